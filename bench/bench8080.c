@@ -0,0 +1,527 @@
+/*
+ * BENCH8080
+ * Fixed workloads for comparing CPU cores and changes to them. Every
+ * workload is run once instruction by instruction to count instructions,
+ * then timed on each core. The best of several runs is reported, one
+ * line per workload and core, as whitespace separated columns. Lines
+ * starting with '#' are comments, so the output of one run can be given
+ * back with -b as a baseline.
+ *
+ * Stefan Wong 2020
+ */
+
+#define _DEFAULT_SOURCE
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <time.h>
+#include "cpu.h"
+#include "input_log.h"
+#include "invaders.h"
+#include "jit.h"
+#include "rom.h"
+
+#define BENCH_RUNS          5
+#define BENCH_FRAMES        600             // ten emulated seconds
+#define BENCH_SLICE         (1L << 20)      // cycles per call into a core
+#define BENCH_MAX_BASELINE  64
+
+// CP/M images are loaded at the start of the TPA and BDOS calls go to an
+// OUT that nothing listens to
+#define CPM_LOAD_ADDR       0x0100
+#define CPM_BDOS_ADDR       0xFF00
+#define CPM_BOOT_ADDR       0xFF10
+#define CPM_PASS_ADDR       0xFF20
+#define CPU_TEST_PASSES     256             // one pass is only ~21000 cycles
+
+typedef enum
+{
+    CORE_COUNT,             // one instruction at a time, counting
+    CORE_INTERP,
+    CORE_DECODED,
+    CORE_JIT,
+    NUM_CORES
+} BenchCore;
+
+static const char* core_names[] = { "count", "interp", "decoded", "jit" };
+
+typedef struct
+{
+    BenchCore       core;
+    CPUState*       state;
+    Invaders*       inv;
+    JIT*            jit;
+    CPUDecodeCache* dc;
+} BenchMachine;
+
+typedef struct
+{
+    const char* name;
+    int         (*init)(BenchMachine* m);
+    long        (*run)(BenchMachine* m);    // returns cycles or -1
+    int         no_decoded;                 // the decoded cache would just fall back
+} BenchWorkload;
+
+typedef struct
+{
+    char   workload[32];
+    char   core[16];
+    double mcycles;
+} BenchBaseline;
+
+static const char*   cpu_test_path = "bench/cpu_test.com";
+static const char*   rom_dir       = "ROM";
+static long          num_frames    = BENCH_FRAMES;
+static unsigned long count_instructions;
+
+// ======== SYNTHETIC PROGRAMS ======== //
+// 65535 passes over the accumulator group, with the result carried
+// from one pass to the next so nothing can be skipped.
+static const uint8_t alu_program[] = {
+    0x31, 0x00, 0xF0,       // 0000  LXI SP, F000
+    0x01, 0xFF, 0xFF,       // 0003  LXI B, FFFF
+    0x21, 0x34, 0x12,       // 0006  LXI H, 1234
+    0x11, 0x78, 0x56,       // 0009  LXI D, 5678
+    0xAF,                   // 000C  XRA A
+    0x82,                   // 000D  ADD D
+    0x93,                   // 000E  SUB E
+    0xAC,                   // 000F  XRA H
+    0xB5,                   // 0010  ORA L
+    0xA2,                   // 0011  ANA D
+    0x8B,                   // 0012  ADC E
+    0x9C,                   // 0013  SBB H
+    0xC6, 0x5A,             // 0014  ADI 5A
+    0xD6, 0x13,             // 0016  SUI 13
+    0xEE, 0x3C,             // 0018  XRI 3C
+    0x07,                   // 001A  RLC
+    0x1F,                   // 001B  RAR
+    0x2C,                   // 001C  INR L
+    0x15,                   // 001D  DCR D
+    0xBB,                   // 001E  CMP E
+    0x19,                   // 001F  DAD D
+    0x27,                   // 0020  DAA
+    0x2F,                   // 0021  CMA
+    0x5F,                   // 0022  MOV E, A
+    0x0B,                   // 0023  DCX B
+    0x78,                   // 0024  MOV A, B
+    0xB1,                   // 0025  ORA C
+    0x7B,                   // 0026  MOV A, E
+    0xC2, 0x0D, 0x00,       // 0027  JNZ 000D
+    0x76                    // 002A  HLT
+};
+
+// 65535 passes of conditional jumps, calls and returns that go a
+// different way depending on the low bits of the loop counter.
+static const uint8_t branch_program[] = {
+    0x31, 0x00, 0xF0,       // 0000  LXI SP, F000
+    0x11, 0xFF, 0xFF,       // 0003  LXI D, FFFF
+    0x21, 0x00, 0x00,       // 0006  LXI H, 0000
+    0x7B,                   // 0009  MOV A, E
+    0xE6, 0x01,             // 000A  ANI 01
+    0xCA, 0x13, 0x00,       // 000C  JZ 0013
+    0x24,                   // 000F  INR H
+    0xC3, 0x14, 0x00,       // 0010  JMP 0014
+    0x25,                   // 0013  DCR H
+    0x7B,                   // 0014  MOV A, E
+    0xE6, 0x06,             // 0015  ANI 06
+    0xCC, 0x32, 0x00,       // 0017  CZ 0032
+    0x7B,                   // 001A  MOV A, E
+    0x0F,                   // 001B  RRC
+    0xDA, 0x22, 0x00,       // 001C  JC 0022
+    0x2C,                   // 001F  INR L
+    0x2C,                   // 0020  INR L
+    0x2C,                   // 0021  INR L
+    0xB7,                   // 0022  ORA A
+    0xF2, 0x27, 0x00,       // 0023  JP 0027
+    0x2D,                   // 0026  DCR L
+    0x7B,                   // 0027  MOV A, E
+    0xCD, 0x34, 0x00,       // 0028  CALL 0034
+    0x1B,                   // 002B  DCX D
+    0x7A,                   // 002C  MOV A, D
+    0xB3,                   // 002D  ORA E
+    0xC2, 0x09, 0x00,       // 002E  JNZ 0009
+    0x76,                   // 0031  HLT
+    0x2C,                   // 0032  INR L
+    0xC9,                   // 0033  RET
+    0xE6, 0x08,             // 0034  ANI 08
+    0xC0,                   // 0036  RNZ
+    0x24,                   // 0037  INR H
+    0xC9                    // 0038  RET
+};
+
+static void usage(const char* prog)
+{
+    fprintf(stderr, "Usage: %s [-r runs] [-f frames] [-w workload] [-c core] [-b baseline] [-C cpu test] [-R rom dir]\n", prog);
+    fprintf(stderr, "  -r   timed runs per workload, the best is reported (default %d)\n", BENCH_RUNS);
+    fprintf(stderr, "  -f   invaders frames to run (default %d)\n", BENCH_FRAMES);
+    fprintf(stderr, "  -w   only run this workload\n");
+    fprintf(stderr, "  -c   only run on this core (interp, decoded, jit)\n");
+    fprintf(stderr, "  -b   compare emulated cycles/s against an earlier run's output\n");
+    fprintf(stderr, "  -C   Microcosm diagnostic image (default %s)\n", cpu_test_path);
+    fprintf(stderr, "  -R   invaders ROM directory (default %s)\n", rom_dir);
+}
+
+static double now_ns(void)
+{
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec * 1e9 + ts.tv_nsec;
+}
+
+// ======== CORES ======== //
+static long count_run(CPUState* state, long budget)
+{
+    long cycles = 0;
+
+    while(cycles < budget)
+    {
+        int status = cpu_exec(state);
+        if(status < 0)
+            return status;
+        cycles += status;
+        count_instructions++;
+    }
+
+    return cycles;
+}
+
+static long core_run(BenchMachine* m, long budget)
+{
+    switch(m->core)
+    {
+        case CORE_COUNT:
+            return count_run(m->state, budget);
+        case CORE_JIT:
+            return jit_run(m->jit, m->state, budget);
+        case CORE_DECODED:
+            return cpu_run_decoded(m->state, m->dc, budget);
+        default:
+            return cpu_run_fast(m->state, budget);
+    }
+}
+
+/*
+ * run_to_halt()
+ * Run a machine on its core until HLT. Returns the cycles run or -1 if
+ * the machine stopped for any other reason.
+ */
+static long run_to_halt(BenchMachine* m)
+{
+    uint64_t start = m->state->cycles;
+    long     status;
+
+    do
+    {
+        status = core_run(m, BENCH_SLICE);
+    } while(status >= 0);
+
+    return (status == -2) ? (long) (m->state->cycles - start) : -1;
+}
+
+// ======== WORKLOADS ======== //
+static int init_program(BenchMachine* m, const uint8_t* prog, size_t len)
+{
+    memcpy(m->state->memory, prog, len);
+    m->state->cc.psw = FLAG_ONE;
+    return 0;
+}
+
+static int init_alu(BenchMachine* m)
+{
+    return init_program(m, alu_program, sizeof(alu_program));
+}
+
+static int init_branch(BenchMachine* m)
+{
+    return init_program(m, branch_program, sizeof(branch_program));
+}
+
+static int init_cpu_test(BenchMachine* m)
+{
+    uint8_t* mem = m->state->memory;
+    static const uint8_t boot[] = {
+        0x3A, CPM_PASS_ADDR & 0xFF, CPM_PASS_ADDR >> 8,     // LDA passes
+        0x3D,                                               // DCR A
+        0x32, CPM_PASS_ADDR & 0xFF, CPM_PASS_ADDR >> 8,     // STA passes
+        0xC2, CPM_LOAD_ADDR & 0xFF, CPM_LOAD_ADDR >> 8,     // JNZ TPA
+        0x76                                                // HLT
+    };
+
+    if(rom_load_file(m->state, cpu_test_path, CPM_LOAD_ADDR) < 0)
+        return -1;
+    // Warm boot runs the diagnostic again until the passes are used up
+    mem[0x0000] = 0xC3;                         // JMP boot
+    mem[0x0001] = CPM_BOOT_ADDR & 0xFF;
+    mem[0x0002] = CPM_BOOT_ADDR >> 8;
+    mem[0x0005] = 0xC3;                         // JMP BDOS
+    mem[0x0006] = CPM_BDOS_ADDR & 0xFF;
+    mem[0x0007] = CPM_BDOS_ADDR >> 8;
+    mem[CPM_BDOS_ADDR]     = 0xD3;              // OUT 0
+    mem[CPM_BDOS_ADDR + 1] = 0x00;
+    mem[CPM_BDOS_ADDR + 2] = 0xC9;              // RET
+    memcpy(&mem[CPM_BOOT_ADDR], boot, sizeof(boot));
+    mem[CPM_PASS_ADDR] = CPU_TEST_PASSES & 0xFF;
+    m->state->pc     = CPM_LOAD_ADDR;
+    m->state->sp     = CPM_BDOS_ADDR;
+    m->state->cc.psw = FLAG_ONE;
+
+    return 0;
+}
+
+static int init_invaders(BenchMachine* m)
+{
+    // The machine brings its own CPU
+    cpu_destroy(m->state);
+    m->state = NULL;
+    m->inv = invaders_create(rom_dir, DISP_BACKEND_OFFSCREEN, 0);
+    if(m->inv == NULL)
+        return -1;
+    m->state = m->inv->cpu;
+    if(m->core == CORE_COUNT)
+        m->inv->run = count_run;
+    if(m->core == CORE_JIT)
+        invaders_set_jit(m->inv, m->jit);
+
+    return 0;
+}
+
+static long run_invaders(BenchMachine* m)
+{
+    long cycles = 0;
+
+    for(long f = 0; f < num_frames; ++f)
+    {
+        long frame_cycles = invaders_run_frame(m->inv);
+        if(frame_cycles < 0)
+            return -1;
+        cycles += frame_cycles;
+    }
+
+    return cycles;
+}
+
+static const BenchWorkload workloads[] = {
+    { "cpu_test", init_cpu_test, run_to_halt,  0 },
+    { "alu",      init_alu,      run_to_halt,  0 },
+    { "branch",   init_branch,   run_to_halt,  0 },
+    // The page map sends the decoded cache to the interpreter
+    { "invaders", init_invaders, run_invaders, 1 },
+};
+
+#define NUM_WORKLOADS ((int) (sizeof(workloads) / sizeof(workloads[0])))
+
+// ======== RUNNING ======== //
+static int machine_init(BenchMachine* m, const BenchWorkload* w, BenchCore core)
+{
+    memset(m, 0, sizeof(*m));
+    m->core  = core;
+    m->state = cpu_create();
+    if(m->state == NULL)
+        return -1;
+    if(core == CORE_JIT && (m->jit = jit_create()) == NULL)
+        return -1;
+    if(core == CORE_DECODED && (m->dc = cpu_dcache_create()) == NULL)
+        return -1;
+
+    return w->init(m);
+}
+
+static void machine_destroy(BenchMachine* m)
+{
+    if(m->inv != NULL)
+        invaders_destroy(m->inv);
+    else if(m->state != NULL)
+        cpu_destroy(m->state);
+    if(m->jit != NULL)
+        jit_destroy(m->jit);
+    if(m->dc != NULL)
+        cpu_dcache_destroy(m->dc);
+}
+
+/*
+ * bench_run()
+ * Run a workload once on a core. Returns the cycles run, or -1 on
+ * failure, and the wall time and final state hash through the pointers.
+ */
+static long bench_run(const BenchWorkload* w, BenchCore core, double* wall_ns, uint64_t* hash)
+{
+    BenchMachine m;
+    long   cycles = -1;
+    double start;
+
+    if(machine_init(&m, w, core) < 0)
+    {
+        fprintf(stderr, "[%s] failed to set up %s on %s\n", __func__, w->name, core_names[core]);
+        goto BENCH_END;
+    }
+    start   = now_ns();
+    cycles  = w->run(&m);
+    *wall_ns = now_ns() - start;
+    *hash   = cpu_state_hash(m.state);
+
+BENCH_END:
+    machine_destroy(&m);
+    return cycles;
+}
+
+static int load_baseline(const char* path, BenchBaseline* base, int max_base)
+{
+    FILE* fp;
+    char  line[256];
+    int   n = 0;
+
+    fp = fopen(path, "r");
+    if(fp == NULL)
+    {
+        fprintf(stderr, "[%s] can't open baseline %s\n", __func__, path);
+        return -1;
+    }
+    while(n < max_base && fgets(line, sizeof(line), fp) != NULL)
+    {
+        if(line[0] == '#')
+            continue;
+        // workload core instructions cycles best_ms minst_s mcycles_s ...
+        if(sscanf(line, "%31s %15s %*s %*s %*s %*s %lf",
+                  base[n].workload, base[n].core, &base[n].mcycles) == 3)
+            n++;
+    }
+    fclose(fp);
+
+    return n;
+}
+
+static double baseline_mcycles(const BenchBaseline* base, int num_base, const char* workload, const char* core)
+{
+    for(int n = 0; n < num_base; ++n)
+    {
+        if(strcmp(base[n].workload, workload) == 0 && strcmp(base[n].core, core) == 0)
+            return base[n].mcycles;
+    }
+
+    return 0.0;
+}
+
+int main(int argc, char* argv[])
+{
+    int opt;
+    int runs = BENCH_RUNS;
+    int num_base = 0;
+    int num_failed = 0;
+    const char* only_workload = NULL;
+    const char* only_core = NULL;
+    const char* base_path = NULL;
+    BenchBaseline base[BENCH_MAX_BASELINE];
+
+    while((opt = getopt(argc, argv, "b:c:f:r:w:C:R:")) != -1)
+    {
+        switch(opt)
+        {
+            case 'b':
+                base_path = optarg;
+                break;
+            case 'c':
+                only_core = optarg;
+                break;
+            case 'f':
+                num_frames = strtol(optarg, NULL, 0);
+                break;
+            case 'r':
+                runs = atoi(optarg);
+                break;
+            case 'w':
+                only_workload = optarg;
+                break;
+            case 'C':
+                cpu_test_path = optarg;
+                break;
+            case 'R':
+                rom_dir = optarg;
+                break;
+            default:
+                usage(argv[0]);
+                exit(1);
+        }
+    }
+    if(runs < 1)
+        runs = 1;
+    if(base_path != NULL && (num_base = load_baseline(base_path, base, BENCH_MAX_BASELINE)) < 0)
+        exit(1);
+
+    fprintf(stdout, "# %-10s %-8s %12s %12s %10s %10s %10s %10s %16s%s\n",
+            "workload", "core", "instructions", "cycles", "best_ms",
+            "minst_s", "mcycles_s", "ns_frame", "hash", base_path ? "  vs_base" : "");
+
+    for(int i = 0; i < NUM_WORKLOADS; ++i)
+    {
+        const BenchWorkload* w = &workloads[i];
+        uint64_t ref_hash;
+        long     ref_cycles;
+        double   wall_ns;
+
+        if(only_workload != NULL && strcmp(only_workload, w->name) != 0)
+            continue;
+
+        // Counting pass, which is also the reference for the other cores
+        count_instructions = 0;
+        ref_cycles = bench_run(w, CORE_COUNT, &wall_ns, &ref_hash);
+        if(ref_cycles < 0)
+        {
+            fprintf(stderr, "[%s] %s didn't run to the end\n", __func__, w->name);
+            num_failed++;
+            continue;
+        }
+
+        for(int core = CORE_INTERP; core < NUM_CORES; ++core)
+        {
+            double   best_ns = 0.0, mcycles, ns_frame;
+            uint64_t hash = 0;
+            long     cycles = 0;
+
+            if(only_core != NULL && strcmp(only_core, core_names[core]) != 0)
+                continue;
+            if(w->no_decoded && core == CORE_DECODED)
+                continue;
+#ifndef JIT_AVAILABLE
+            if(core == CORE_JIT)
+                continue;
+#endif /*JIT_AVAILABLE*/
+
+            for(int r = 0; r < runs; ++r)
+            {
+                cycles = bench_run(w, core, &wall_ns, &hash);
+                if(cycles < 0)
+                    break;
+                if(r == 0 || wall_ns < best_ns)
+                    best_ns = wall_ns;
+            }
+            // Every core must end where the counting pass did
+            if(cycles != ref_cycles || hash != ref_hash)
+            {
+                fprintf(stderr, "[%s] %s on %s doesn't match the reference run\n",
+                        __func__, w->name, core_names[core]);
+                num_failed++;
+                continue;
+            }
+
+            mcycles  = cycles * 1e3 / best_ns;
+            ns_frame = best_ns * INVADERS_CYCLES_PER_FRAME / cycles;
+            fprintf(stdout, "  %-10s %-8s %12lu %12ld %10.3f %10.2f %10.2f %10.0f %016llx",
+                    w->name, core_names[core], count_instructions, cycles, best_ns / 1e6,
+                    count_instructions * 1e3 / best_ns, mcycles, ns_frame,
+                    (unsigned long long) hash);
+            if(base_path != NULL)
+            {
+                double base_mcycles = baseline_mcycles(base, num_base, w->name, core_names[core]);
+                if(base_mcycles > 0.0)
+                    fprintf(stdout, "  %6.3fx", mcycles / base_mcycles);
+                else
+                    fprintf(stdout, "  %7s", "-");
+            }
+            fprintf(stdout, "\n");
+        }
+    }
+
+    return (num_failed > 0) ? 1 : 0;
+}
@@ -0,0 +1,462 @@
+/*
+ * GOLDEN8080
+ * Frame hash regression harness. Boots the invaders ROM set headless,
+ * feeds it a scripted input sequence and hashes video RAM at every
+ * vblank. The hashes are checked against a golden file, and the time
+ * each frame took can be compared against an earlier run, so that one
+ * run catches both a core that has started to go wrong and one that has
+ * got slower.
+ *
+ * Input scripts have one "frame port value" line per change to an IN
+ * port, applied before that frame runs. Golden files have one "frame
+ * hash" line per frame. Runs written with -t add the time in ns as a
+ * third column, which makes them golden files and timing baselines at
+ * the same time. Lines starting with '#' are comments in all of them.
+ *
+ * Stefan Wong 2020
+ */
+
+#define _DEFAULT_SOURCE
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <time.h>
+#include "cpu.h"
+#include "invaders.h"
+
+#define GOLDEN_RUNS        3
+#define GOLDEN_MAX_INPUTS  1024
+
+typedef struct
+{
+    unsigned long frame;
+    int           port;
+    uint8_t       value;
+} GoldenInput;
+
+// One frame of a run, or of a file
+typedef struct
+{
+    uint64_t hash;
+    double   ns;        // 0 if not known
+} GoldenFrame;
+
+static const char* rom_dir     = "ROM";
+static const char* input_path  = "bench/invaders.input";
+static const char* golden_path = "bench/invaders.golden";
+
+static void usage(const char* prog)
+{
+    fprintf(stderr, "Usage: %s [-f frames] [-r runs] [-i input] [-g golden] [-w] [-t times] [-b baseline] [-s slowdown] [-D backend] [-R rom dir]\n", prog);
+    fprintf(stderr, "  -f   frames to run (default is the length of the golden file)\n");
+    fprintf(stderr, "  -r   runs, the fastest time for each frame is kept (default %d)\n", GOLDEN_RUNS);
+    fprintf(stderr, "  -i   input script (default %s)\n", input_path);
+    fprintf(stderr, "  -g   golden file (default %s)\n", golden_path);
+    fprintf(stderr, "  -w   write the golden file from this run instead of checking it\n");
+    fprintf(stderr, "  -t   write this run's hashes and frame times to a file\n");
+    fprintf(stderr, "  -b   compare frame times against a file written with -t\n");
+    fprintf(stderr, "  -s   with -b, fail if the median frame is this many times slower\n");
+    fprintf(stderr, "  -D   display backend (default null)\n");
+    fprintf(stderr, "  -R   invaders ROM directory (default %s)\n", rom_dir);
+}
+
+static double now_ns(void)
+{
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec * 1e9 + ts.tv_nsec;
+}
+
+/*
+ * vram_hash()
+ * 64-bit hash of video RAM, a word at a time
+ */
+static uint64_t vram_hash(const uint8_t* vram)
+{
+    uint64_t hash = 0x9E3779B97F4A7C15ULL;
+
+    for(int i = 0; i < DISP_VRAM_SIZE; i += sizeof(uint64_t))
+    {
+        uint64_t word;
+
+        memcpy(&word, &vram[i], sizeof(word));
+        hash = (hash ^ word) * 0xFF51AFD7ED558CCDULL;
+        hash ^= hash >> 32;
+    }
+    hash ^= hash >> 33;
+    hash *= 0xC4CEB9FE1A85EC53ULL;
+    hash ^= hash >> 33;
+
+    return hash;
+}
+
+static int load_inputs(const char* path, GoldenInput* inputs, int max_inputs)
+{
+    FILE* fp;
+    char  line[256];
+    int   n = 0;
+    unsigned long frame;
+    unsigned int  port, value;
+
+    fp = fopen(path, "r");
+    if(fp == NULL)
+    {
+        fprintf(stderr, "[%s] can't open input script %s\n", __func__, path);
+        return -1;
+    }
+    while(fgets(line, sizeof(line), fp) != NULL)
+    {
+        if(line[0] == '#' || sscanf(line, "%lu %u %i", &frame, &port, &value) != 3)
+            continue;
+        if(n == max_inputs || port > 2 || value > 0xFF || (n > 0 && frame < inputs[n-1].frame))
+        {
+            fprintf(stderr, "[%s] bad input \"%.*s\" in %s\n", __func__, (int) strcspn(line, "\n"), line, path);
+            fclose(fp);
+            return -1;
+        }
+        inputs[n].frame = frame;
+        inputs[n].port  = port;
+        inputs[n].value = value;
+        n++;
+    }
+    fclose(fp);
+
+    return n;
+}
+
+/*
+ * load_frames()
+ * Read a golden or times file. Returns the number of frames, which have
+ * to start at 0 and run in order, or -1.
+ */
+static long load_frames(const char* path, GoldenFrame** frames)
+{
+    FILE*  fp;
+    char   line[256];
+    long   n = 0, cap = 0;
+    unsigned long frame;
+    unsigned long long hash;
+    double ns;
+
+    *frames = NULL;
+    fp = fopen(path, "r");
+    if(fp == NULL)
+    {
+        fprintf(stderr, "[%s] can't open %s\n", __func__, path);
+        return -1;
+    }
+    while(fgets(line, sizeof(line), fp) != NULL)
+    {
+        int fields;
+
+        if(line[0] == '#')
+            continue;
+        ns = 0.0;
+        fields = sscanf(line, "%lu %llx %lf", &frame, &hash, &ns);
+        if(fields < 2)
+            continue;
+        if(frame != (unsigned long) n)
+        {
+            fprintf(stderr, "[%s] %s: expected frame %ld, got %lu\n", __func__, path, n, frame);
+            goto LOAD_FAIL;
+        }
+        if(n == cap)
+        {
+            GoldenFrame* grown;
+
+            cap   = cap ? 2 * cap : 1024;
+            grown = realloc(*frames, cap * sizeof(**frames));
+            if(grown == NULL)
+                goto LOAD_FAIL;
+            *frames = grown;
+        }
+        (*frames)[n].hash = hash;
+        (*frames)[n].ns   = ns;
+        n++;
+    }
+    fclose(fp);
+
+    return n;
+
+LOAD_FAIL:
+    fclose(fp);
+    free(*frames);
+    *frames = NULL;
+    return -1;
+}
+
+/*
+ * run_script()
+ * Run the machine from power on for num_frames, hashing video RAM and
+ * timing each frame. Frame times only ever go down, so that over several
+ * runs each frame keeps its fastest time.
+ */
+static int run_script(DispBackend backend, const GoldenInput* inputs, int num_inputs, GoldenFrame* frames, long num_frames)
+{
+    Invaders* inv;
+    int       next = 0;
+
+    inv = invaders_create(rom_dir, backend, 0);
+    if(inv == NULL)
+        return -1;
+
+    for(long f = 0; f < num_frames; ++f)
+    {
+        double start, ns;
+
+        while(next < num_inputs && inputs[next].frame == (unsigned long) f)
+        {
+            inv->in_port[inputs[next].port] = inputs[next].value;
+            next++;
+        }
+        start = now_ns();
+        if(invaders_run_frame(inv) < 0)
+        {
+            fprintf(stderr, "[%s] CPU stopped in frame %ld at PC %04X\n", __func__, f, inv->cpu->pc);
+            invaders_destroy(inv);
+            return -1;
+        }
+        ns = now_ns() - start;
+
+        // invaders_run_frame() stops right after the vblank
+        frames[f].hash = vram_hash(&inv->cpu->memory[DISP_VRAM_ADDR]);
+        if(frames[f].ns == 0.0 || ns < frames[f].ns)
+            frames[f].ns = ns;
+    }
+    invaders_destroy(inv);
+
+    return 0;
+}
+
+static int write_frames(const char* path, const GoldenFrame* frames, long num_frames, int with_times)
+{
+    FILE* fp;
+
+    fp = fopen(path, "w");
+    if(fp == NULL)
+    {
+        fprintf(stderr, "[%s] can't open %s for writing\n", __func__, path);
+        return -1;
+    }
+    fprintf(fp, "# %s, %ld frames of invaders with input from %s\n",
+            with_times ? "hashes and ns per frame" : "video RAM hash at each vblank",
+            num_frames, input_path);
+    for(long f = 0; f < num_frames; ++f)
+    {
+        fprintf(fp, "%ld %016llx", f, (unsigned long long) frames[f].hash);
+        if(with_times)
+            fprintf(fp, " %.0f", frames[f].ns);
+        fprintf(fp, "\n");
+    }
+
+    return (fclose(fp) == 0) ? 0 : -1;
+}
+
+static int cmp_double(const void* a, const void* b)
+{
+    double x = *(const double*) a;
+    double y = *(const double*) b;
+
+    return (x > y) - (x < y);
+}
+
+/*
+ * frame_percentile()
+ * Frame time at percentile p of the first n frames
+ */
+static double frame_percentile(const GoldenFrame* frames, long n, double p)
+{
+    double* ns;
+    double  val;
+
+    ns = malloc(n * sizeof(*ns));
+    if(ns == NULL || n == 0)
+    {
+        free(ns);
+        return 0.0;
+    }
+    for(long f = 0; f < n; ++f)
+        ns[f] = frames[f].ns;
+    qsort(ns, n, sizeof(*ns), cmp_double);
+    val = ns[(long) (p * (n - 1))];
+    free(ns);
+
+    return val;
+}
+
+int main(int argc, char* argv[])
+{
+    int opt;
+    int runs = GOLDEN_RUNS;
+    int write_golden = 0;
+    int status = 0;
+    int num_inputs;
+    long num_frames = 0;
+    long num_golden = 0;
+    long num_base = 0;
+    double max_slowdown = 0.0;
+    double total_ns = 0.0, median, p99, worst = 0.0;
+    const char* times_path = NULL;
+    const char* base_path = NULL;
+    DispBackend backend = DISP_BACKEND_NULL;
+    GoldenInput inputs[GOLDEN_MAX_INPUTS];
+    GoldenFrame* golden = NULL;
+    GoldenFrame* base = NULL;
+    GoldenFrame* frames = NULL;
+
+    while((opt = getopt(argc, argv, "b:f:g:i:r:s:t:wD:R:")) != -1)
+    {
+        switch(opt)
+        {
+            case 'b':
+                base_path = optarg;
+                break;
+            case 'f':
+                num_frames = strtol(optarg, NULL, 0);
+                break;
+            case 'g':
+                golden_path = optarg;
+                break;
+            case 'i':
+                input_path = optarg;
+                break;
+            case 'r':
+                runs = atoi(optarg);
+                break;
+            case 's':
+                max_slowdown = atof(optarg);
+                break;
+            case 't':
+                times_path = optarg;
+                break;
+            case 'w':
+                write_golden = 1;
+                break;
+            case 'D':
+                if(display_backend_parse(optarg, &backend) < 0)
+                {
+                    fprintf(stderr, "Unknown display backend %s\n", optarg);
+                    exit(1);
+                }
+                break;
+            case 'R':
+                rom_dir = optarg;
+                break;
+            default:
+                usage(argv[0]);
+                exit(1);
+        }
+    }
+    if(runs < 1)
+        runs = 1;
+
+    num_inputs = load_inputs(input_path, inputs, GOLDEN_MAX_INPUTS);
+    if(num_inputs < 0)
+        exit(1);
+    if(!write_golden)
+    {
+        num_golden = load_frames(golden_path, &golden);
+        if(num_golden < 0)
+            exit(1);
+        if(num_frames <= 0 || num_frames > num_golden)
+            num_frames = num_golden;
+    }
+    if(num_frames <= 0)
+    {
+        fprintf(stderr, "Nothing to run, give a frame count with -f\n");
+        exit(1);
+    }
+    if(base_path != NULL && (num_base = load_frames(base_path, &base)) < 0)
+        exit(1);
+
+    frames = calloc(num_frames, sizeof(*frames));
+    if(frames == NULL)
+        exit(1);
+    for(int r = 0; r < runs; ++r)
+    {
+        uint64_t last_hash = frames[num_frames - 1].hash;
+
+        if(run_script(backend, inputs, num_inputs, frames, num_frames) < 0)
+        {
+            status = 1;
+            goto GOLDEN_END;
+        }
+        // The machine is deterministic, so every run must end the same
+        if(r > 0 && frames[num_frames - 1].hash != last_hash)
+        {
+            fprintf(stderr, "Run %d ended on a different frame than run 1\n", r + 1);
+            status = 1;
+        }
+    }
+
+    // ======== CORRECTNESS ======== //
+    if(write_golden)
+    {
+        if(write_frames(golden_path, frames, num_frames, 0) < 0)
+            status = 1;
+        else
+            fprintf(stdout, "Wrote %ld frame hashes to %s\n", num_frames, golden_path);
+    }
+    else
+    {
+        long first = -1, mismatches = 0;
+
+        for(long f = 0; f < num_frames; ++f)
+        {
+            if(frames[f].hash != golden[f].hash)
+            {
+                if(first < 0)
+                    first = f;
+                mismatches++;
+            }
+        }
+        if(first >= 0)
+        {
+            fprintf(stdout, "FAIL: frame %ld diverges from %s (hash %016llx, expected %016llx), %ld of %ld frames differ\n",
+                    first, golden_path, (unsigned long long) frames[first].hash,
+                    (unsigned long long) golden[first].hash, mismatches, num_frames);
+            status = 1;
+        }
+        else
+            fprintf(stdout, "PASS: %ld frames match %s\n", num_frames, golden_path);
+    }
+
+    // ======== PERFORMANCE ======== //
+    for(long f = 0; f < num_frames; ++f)
+    {
+        total_ns += frames[f].ns;
+        if(frames[f].ns > worst)
+            worst = frames[f].ns;
+    }
+    median = frame_percentile(frames, num_frames, 0.5);
+    p99    = frame_percentile(frames, num_frames, 0.99);
+    fprintf(stdout, "Frame time (best of %d): mean %.0f ns, median %.0f ns, p99 %.0f ns, max %.0f ns, %.2f MHz emulated\n",
+            runs, total_ns / num_frames, median, p99, worst,
+            num_frames * (double) INVADERS_CYCLES_PER_FRAME * 1e3 / total_ns);
+    if(base != NULL)
+    {
+        long   n = (num_base < num_frames) ? num_base : num_frames;
+        double base_median = frame_percentile(base, n, 0.5);
+        double base_p99    = frame_percentile(base, n, 0.99);
+        double slowdown    = (base_median > 0.0) ? frame_percentile(frames, n, 0.5) / base_median : 0.0;
+
+        fprintf(stdout, "Against %s over %ld frames: median %.3fx, p99 %.3fx of the baseline time\n",
+                base_path, n, slowdown, (base_p99 > 0.0) ? frame_percentile(frames, n, 0.99) / base_p99 : 0.0);
+        if(max_slowdown > 0.0 && slowdown > max_slowdown)
+        {
+            fprintf(stdout, "FAIL: median frame is %.3fx slower than the baseline (limit %.3fx)\n", slowdown, max_slowdown);
+            status = 1;
+        }
+    }
+    if(times_path != NULL && write_frames(times_path, frames, num_frames, 1) < 0)
+        status = 1;
+
+GOLDEN_END:
+    free(frames);
+    free(golden);
+    free(base);
+
+    return status;
+}
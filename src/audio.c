@@ -0,0 +1,393 @@
+/*
+ * AUDIO
+ * Sound effects for the invaders sound ports
+ *
+ * Stefan Wong 2020
+ */
+
+#include <stdatomic.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#ifdef DISP_SDL
+#include <SDL2/SDL.h>
+#endif /*DISP_SDL*/
+#include "audio.h"
+
+#define AUDIO_CACHE_LINE 64
+#define AUDIO_CHUNK      256        // samples mixed at a time
+#define AUDIO_VOICE_AMP  6000.0     // peak of one effect, leaves room for a few at once
+
+// The original board makes these with analog circuits (and later
+// versions with samples we don't have), so they are synthesized as a
+// swept square wave with some noise mixed in and a linear decay
+typedef struct
+{
+    double secs;
+    double f0, f1;                  // frequency sweeps from f0 to f1
+    double noise;                   // 0 for a pure tone, 1 for pure noise
+    int    loop;                    // plays for as long as the bit is set
+} AudioEffect;
+
+static const AudioEffect audio_effects[AUDIO_NUM_SOUNDS] = {
+    // OUT 3
+    { 0.10,  900.0,  500.0, 0.0, 1 },   // UFO
+    { 0.25, 1600.0,  200.0, 0.3, 0 },   // shot
+    { 1.00,  300.0,   60.0, 0.8, 0 },   // player dies
+    { 0.30,  900.0,  100.0, 0.5, 0 },   // invader dies
+    { 0.60, 1000.0, 1000.0, 0.0, 0 },   // extra life
+    // OUT 5
+    { 0.10,   62.0,   62.0, 0.0, 0 },   // fleet movement 1 - 4
+    { 0.10,   55.0,   55.0, 0.0, 0 },
+    { 0.10,   49.0,   49.0, 0.0, 0 },
+    { 0.10,   44.0,   44.0, 0.0, 0 },
+    { 0.80, 1500.0,  150.0, 0.2, 0 },   // UFO hit
+};
+
+typedef struct
+{
+    const int16_t* data;
+    size_t         len;
+    size_t         pos;
+    int            active;
+} AudioVoice;
+
+struct Audio
+{
+    // Producer side
+    _Alignas(AUDIO_CACHE_LINE) atomic_ulong head;
+    AudioVoice    voices[AUDIO_NUM_SOUNDS];
+    uint8_t       port[2];          // last values written to OUT 3 and OUT 5
+    uint64_t      mixed;            // samples mixed since cycle 0
+    unsigned long triggers;
+    unsigned long dropped;
+    // Consumer side
+    _Alignas(AUDIO_CACHE_LINE) atomic_ulong tail;
+    unsigned long underruns;
+    // Shared, read-only once running
+    _Alignas(AUDIO_CACHE_LINE) int16_t* ring;
+    size_t        ring_mask;
+    size_t        max_queued;       // latency cap, the producer drops past this
+    size_t        target;           // output buffer in samples
+    unsigned long clock_hz;
+    unsigned      rate;
+    int16_t*      samples;          // every effect, back to back
+#ifdef DISP_SDL
+    SDL_AudioDeviceID dev;
+#endif /*DISP_SDL*/
+};
+
+/*
+ * audio_synth()
+ * Render an effect into n samples
+ */
+static void audio_synth(const AudioEffect* fx, int16_t* out, size_t n, unsigned rate)
+{
+    uint32_t lfsr  = 0xACE1u;
+    double   phase = 0.0;
+
+    for(size_t i = 0; i < n; ++i)
+    {
+        double t   = (double) i / n;
+        double f   = fx->f0 + (fx->f1 - fx->f0) * t;
+        double env = fx->loop ? 1.0 : 1.0 - t;
+        double sq  = (phase < 0.5) ? 1.0 : -1.0;
+        double rnd;
+
+        // 16 bit Galois LFSR for the noise
+        lfsr = (lfsr >> 1) ^ (-(lfsr & 1u) & 0xB400u);
+        rnd  = (lfsr & 1) ? 1.0 : -1.0;
+        out[i] = (int16_t) (AUDIO_VOICE_AMP * env * ((1.0 - fx->noise) * sq + fx->noise * rnd));
+        phase += f / rate;
+        if(phase >= 1.0)
+            phase -= 1.0;
+    }
+}
+
+/*
+ * audio_create()
+ * Mix the effects of a machine clocked at clock_hz at rate samples per
+ * second, aiming for target_ms of buffering in the output device
+ */
+Audio* audio_create(unsigned long clock_hz, unsigned rate, unsigned target_ms)
+{
+    Audio* a;
+    size_t total = 0;
+    size_t ring_size = 1;
+    int16_t* s;
+
+    if(clock_hz == 0 || rate == 0 || target_ms == 0)
+    {
+        fprintf(stderr, "[%s] clock, rate and target must be above zero\n", __func__);
+        return NULL;
+    }
+    a = calloc(1, sizeof(*a));
+    if(!a)
+    {
+        fprintf(stderr, "[%s] failed to allocate memory for Audio\n", __func__);
+        return NULL;
+    }
+    atomic_init(&a->head, 0);
+    atomic_init(&a->tail, 0);
+    a->clock_hz   = clock_hz;
+    a->rate       = rate;
+    a->target     = (size_t) rate * target_ms / 1000;
+    if(a->target == 0)
+        a->target = 1;
+    // Never more than twice the target behind, which is where the output
+    // catches up after a stall or when running uncapped
+    a->max_queued = 2 * a->target;
+    while(ring_size < a->max_queued)
+        ring_size <<= 1;
+    a->ring_mask = ring_size - 1;
+    a->ring = calloc(ring_size, sizeof(*a->ring));
+    if(!a->ring)
+        goto AUDIO_FAIL;
+
+    for(int n = 0; n < AUDIO_NUM_SOUNDS; ++n)
+        total += (size_t) (audio_effects[n].secs * rate);
+    a->samples = malloc(total * sizeof(*a->samples));
+    if(!a->samples)
+        goto AUDIO_FAIL;
+    s = a->samples;
+    for(int n = 0; n < AUDIO_NUM_SOUNDS; ++n)
+    {
+        a->voices[n].data = s;
+        a->voices[n].len  = (size_t) (audio_effects[n].secs * rate);
+        audio_synth(&audio_effects[n], s, a->voices[n].len, rate);
+        s += a->voices[n].len;
+    }
+
+    return a;
+
+AUDIO_FAIL:
+    fprintf(stderr, "[%s] failed to allocate memory for samples\n", __func__);
+    audio_destroy(a);
+    return NULL;
+}
+
+/*
+ * audio_destroy()
+ * Closes the output device first, so the callback is done with the ring
+ */
+void audio_destroy(Audio* a)
+{
+    if(!a)
+        return;
+#ifdef DISP_SDL
+    if(a->dev != 0)
+    {
+        SDL_CloseAudioDevice(a->dev);
+        SDL_QuitSubSystem(SDL_INIT_AUDIO);
+    }
+#endif /*DISP_SDL*/
+    free(a->samples);
+    free(a->ring);
+    free(a);
+}
+
+#ifdef DISP_SDL
+static void audio_sdl_callback(void* user_data, Uint8* stream, int len)
+{
+    audio_read((Audio*) user_data, (int16_t*) stream, len / sizeof(int16_t));
+}
+#endif /*DISP_SDL*/
+
+/*
+ * audio_open_device()
+ * Start playing through SDL. Returns 0 on success.
+ */
+int audio_open_device(Audio* a)
+{
+#ifdef DISP_SDL
+    SDL_AudioSpec want, have;
+    Uint16 samples = 1;
+
+    if(SDL_InitSubSystem(SDL_INIT_AUDIO) != 0)
+    {
+        fprintf(stderr, "[%s] %s\n", __func__, SDL_GetError());
+        return -1;
+    }
+    // SDL wants a power of two, take the nearest one to the target
+    while(samples < a->target && samples < 0x8000)
+        samples <<= 1;
+    if(samples > 1 && samples - a->target > a->target - samples / 2)
+        samples >>= 1;
+    memset(&want, 0, sizeof(want));
+    want.freq     = a->rate;
+    want.format   = AUDIO_S16SYS;
+    want.channels = 1;
+    want.samples  = samples;
+    want.callback = audio_sdl_callback;
+    want.userdata = a;
+    // No changes allowed, SDL converts if the device wants something else
+    a->dev = SDL_OpenAudioDevice(NULL, 0, &want, &have, 0);
+    if(a->dev == 0)
+    {
+        fprintf(stderr, "[%s] %s\n", __func__, SDL_GetError());
+        SDL_QuitSubSystem(SDL_INIT_AUDIO);
+        return -1;
+    }
+    SDL_PauseAudioDevice(a->dev, 0);
+
+    return 0;
+#else
+    fprintf(stderr, "[%s] audio output needs a build with SDL=1\n", __func__);
+    return -1;
+#endif /*DISP_SDL*/
+}
+
+/*
+ * audio_start()
+ * Start mixing from cycle, with OUT 3 and OUT 5 already at the values in
+ * port. Nothing plays until the next edge.
+ */
+void audio_start(Audio* a, uint64_t cycle, const uint8_t port[2])
+{
+    for(int v = 0; v < AUDIO_NUM_SOUNDS; ++v)
+        a->voices[v].active = 0;
+    a->port[0] = port[0];
+    a->port[1] = port[1];
+    a->mixed   = cycle * a->rate / a->clock_hz;
+}
+
+/*
+ * audio_push()
+ * Queue samples for the output, dropping what doesn't fit under the cap
+ */
+static void audio_push(Audio* a, const int16_t* buf, size_t n)
+{
+    unsigned long head = atomic_load_explicit(&a->head, memory_order_relaxed);
+    unsigned long tail = atomic_load_explicit(&a->tail, memory_order_acquire);
+    size_t        room = a->max_queued - (head - tail);
+
+    if(n > room)
+    {
+        a->dropped += n - room;
+        n = room;
+    }
+    for(size_t i = 0; i < n; ++i)
+        a->ring[(head + i) & a->ring_mask] = buf[i];
+    atomic_store_explicit(&a->head, head + n, memory_order_release);
+}
+
+/*
+ * audio_mix_until()
+ * Mix the playing effects up to the sample cycle falls on
+ */
+void audio_mix_until(Audio* a, uint64_t cycle)
+{
+    uint64_t end = cycle * a->rate / a->clock_hz;
+    int16_t  buf[AUDIO_CHUNK];
+    int      amp = a->port[0] & AUDIO_AMP_ENABLE;
+
+    while(a->mixed < end)
+    {
+        size_t n = (end - a->mixed < AUDIO_CHUNK) ? (size_t) (end - a->mixed) : AUDIO_CHUNK;
+        int32_t mix[AUDIO_CHUNK];
+
+        memset(mix, 0, n * sizeof(*mix));
+        for(int v = 0; v < AUDIO_NUM_SOUNDS; ++v)
+        {
+            AudioVoice* voice = &a->voices[v];
+
+            for(size_t i = 0; i < n && voice->active; ++i)
+            {
+                mix[i] += voice->data[voice->pos++];
+                if(voice->pos == voice->len)
+                {
+                    voice->pos    = 0;
+                    voice->active = audio_effects[v].loop;
+                }
+            }
+        }
+        // Time goes on with the amplifier off, it just isn't heard
+        for(size_t i = 0; i < n; ++i)
+        {
+            int32_t s = amp ? mix[i] : 0;
+
+            buf[i] = (s > INT16_MAX) ? INT16_MAX : (s < INT16_MIN) ? INT16_MIN : s;
+        }
+        audio_push(a, buf, n);
+        a->mixed += n;
+    }
+}
+
+/*
+ * audio_port_write()
+ * A write of val to OUT 3 (bank 0) or OUT 5 (bank 1) on cycle. Rising
+ * bits start their effect from the top, and a falling bit stops a
+ * looping one.
+ */
+void audio_port_write(Audio* a, int bank, uint8_t val, uint64_t cycle)
+{
+    uint8_t changed = val ^ a->port[bank];
+
+    if(changed == 0)
+        return;
+    audio_mix_until(a, cycle);
+    for(int bit = 0; bit < AUDIO_BANK_BITS; ++bit)
+    {
+        AudioVoice* voice = &a->voices[bank * AUDIO_BANK_BITS + bit];
+
+        if(!(changed & (1 << bit)))
+            continue;
+        if(val & (1 << bit))
+        {
+            voice->pos    = 0;
+            voice->active = 1;
+            a->triggers++;
+        }
+        else if(audio_effects[bank * AUDIO_BANK_BITS + bit].loop)
+            voice->active = 0;
+    }
+    a->port[bank] = val;
+}
+
+/*
+ * audio_read()
+ * Take up to n samples off the ring, filling the rest of out with
+ * silence. Returns the number of samples that were queued.
+ */
+size_t audio_read(Audio* a, int16_t* out, size_t n)
+{
+    unsigned long tail = atomic_load_explicit(&a->tail, memory_order_relaxed);
+    unsigned long head = atomic_load_explicit(&a->head, memory_order_acquire);
+    size_t        got  = (head - tail < n) ? head - tail : n;
+
+    for(size_t i = 0; i < got; ++i)
+        out[i] = a->ring[(tail + i) & a->ring_mask];
+    atomic_store_explicit(&a->tail, tail + got, memory_order_release);
+    if(got < n)
+    {
+        memset(out + got, 0, (n - got) * sizeof(*out));
+        a->underruns++;
+    }
+
+    return got;
+}
+
+/*
+ * audio_queued()
+ * Samples waiting for the output
+ */
+size_t audio_queued(const Audio* a)
+{
+    return atomic_load_explicit(&a->head, memory_order_acquire) -
+           atomic_load_explicit(&a->tail, memory_order_acquire);
+}
+
+unsigned long audio_triggers(const Audio* a)
+{
+    return a->triggers;
+}
+
+unsigned long audio_dropped(const Audio* a)
+{
+    return a->dropped;
+}
+
+unsigned long audio_underruns(const Audio* a)
+{
+    return a->underruns;
+}
@@ -0,0 +1,44 @@
+/*
+ * AUDIO
+ * Sound effects for the invaders sound ports. Each bit of OUT 3 and
+ * OUT 5 starts one of the effects on a rising edge. Port writes carry the
+ * cycle they happened on, and the emulation thread mixes the effects up
+ * to that cycle before acting on the edge, so every sound starts on the
+ * exact sample it should. Mixed samples go out on a lock free single
+ * producer, single consumer ring that the output device drains. The
+ * emulation never waits on the ring: samples that don't fit are dropped,
+ * and the device plays silence when it runs dry.
+ *
+ * Stefan Wong 2020
+ */
+
+#ifndef __AUDIO_H
+#define __AUDIO_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+#define AUDIO_RATE       48000      // samples per second, mono
+#define AUDIO_TARGET_MS  5          // default output buffer
+#define AUDIO_BANK_BITS  5          // effects on each port
+#define AUDIO_NUM_SOUNDS (2 * AUDIO_BANK_BITS)
+#define AUDIO_AMP_ENABLE 0x20       // OUT 3 bit that turns the amplifier on
+
+typedef struct Audio Audio;
+
+Audio*        audio_create(unsigned long clock_hz, unsigned rate, unsigned target_ms);
+void          audio_destroy(Audio* a);
+int           audio_open_device(Audio* a);
+// Emulation thread
+void          audio_start(Audio* a, uint64_t cycle, const uint8_t port[2]);
+void          audio_port_write(Audio* a, int bank, uint8_t val, uint64_t cycle);
+void          audio_mix_until(Audio* a, uint64_t cycle);
+// Output thread
+size_t        audio_read(Audio* a, int16_t* out, size_t n);
+// Stats
+size_t        audio_queued(const Audio* a);
+unsigned long audio_triggers(const Audio* a);
+unsigned long audio_dropped(const Audio* a);
+unsigned long audio_underruns(const Audio* a);
+
+#endif /*__AUDIO_H*/
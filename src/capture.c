@@ -0,0 +1,488 @@
+/*
+ * CAPTURE
+ * Frame capture from the display
+ *
+ * Stefan Wong 2020
+ */
+
+#define _DEFAULT_SOURCE
+#include <errno.h>
+#include <pthread.h>
+#include <sched.h>
+#include <stdatomic.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/stat.h>
+#include <time.h>
+#include <unistd.h>
+#include "capture.h"
+#include "display.h"
+
+#define CAPTURE_IDLE_NS    1000000      // writer sleep when the ring is empty
+#define CAPTURE_CACHE_LINE 64
+#define CAPTURE_PATH_LEN   4096
+
+// PNG rows are a filter byte then RGB. They go out as stored (level 0)
+// deflate blocks, which keeps us off zlib at the cost of file size.
+#define PNG_ROW_BYTES  (1 + 3 * DISP_WIDTH)
+#define PNG_RAW_BYTES  (DISP_HEIGHT * PNG_ROW_BYTES)
+#define PNG_BLOCK_MAX  65535
+#define PNG_NUM_BLOCKS ((PNG_RAW_BYTES + PNG_BLOCK_MAX - 1) / PNG_BLOCK_MAX)
+#define PNG_ZLIB_BYTES (2 + 5 * PNG_NUM_BLOCKS + PNG_RAW_BYTES + 4)
+#define PPM_BYTES      (3 * DISP_NUM_PIXELS)
+#define RAW_BYTES      (4 * DISP_NUM_PIXELS)
+
+struct Capture
+{
+    // Producer side
+    _Alignas(CAPTURE_CACHE_LINE) atomic_ulong head;
+    unsigned long tail_cache;       // last tail the producer saw
+    unsigned long stalls;           // times the producer found the ring full
+    // Consumer side
+    _Alignas(CAPTURE_CACHE_LINE) atomic_ulong tail;
+    atomic_int    stop;
+    uint8_t*      out;              // encoded frame
+    unsigned long written;
+    int           error;
+    // Shared, read-only once running
+    _Alignas(CAPTURE_CACHE_LINE) uint32_t* slots;
+    unsigned long* slot_frame;      // frame number of each slot
+    unsigned      num_slots;
+    unsigned      every;
+    CaptureFormat fmt;
+    char*         path;
+    FILE*         fp;               // CAPTURE_RAW only
+    pthread_t     writer;
+};
+
+static uint32_t       capture_crc_table[256];
+static pthread_once_t capture_crc_once = PTHREAD_ONCE_INIT;
+
+static void capture_crc_init(void)
+{
+    for(uint32_t n = 0; n < 256; ++n)
+    {
+        uint32_t c = n;
+
+        for(int k = 0; k < 8; ++k)
+            c = (c & 1) ? 0xEDB88320u ^ (c >> 1) : c >> 1;
+        capture_crc_table[n] = c;
+    }
+}
+
+static uint32_t capture_crc(uint32_t crc, const uint8_t* buf, size_t len)
+{
+    crc = ~crc;
+    for(size_t i = 0; i < len; ++i)
+        crc = capture_crc_table[(crc ^ buf[i]) & 0xFF] ^ (crc >> 8);
+
+    return ~crc;
+}
+
+static void put_be32(uint8_t* p, uint32_t val)
+{
+    p[0] = val >> 24;
+    p[1] = val >> 16;
+    p[2] = val >> 8;
+    p[3] = val;
+}
+
+// ======== ENCODERS ======== //
+static size_t capture_encode_ppm(const uint32_t* pixels, uint8_t* out)
+{
+    for(int p = 0; p < DISP_NUM_PIXELS; ++p)
+    {
+        out[3 * p + 0] = pixels[p] >> 16;
+        out[3 * p + 1] = pixels[p] >> 8;
+        out[3 * p + 2] = pixels[p];
+    }
+
+    return PPM_BYTES;
+}
+
+static size_t capture_encode_raw(const uint32_t* pixels, uint8_t* out)
+{
+    for(int p = 0; p < DISP_NUM_PIXELS; ++p)
+    {
+        out[4 * p + 0] = pixels[p] >> 16;
+        out[4 * p + 1] = pixels[p] >> 8;
+        out[4 * p + 2] = pixels[p];
+        out[4 * p + 3] = 0xFF;
+    }
+
+    return RAW_BYTES;
+}
+
+// Stored deflate blocks, started as the bytes come in
+typedef struct
+{
+    uint8_t* out;
+    size_t   len;
+    size_t   block_left;    // bytes left in the current block
+    size_t   total_left;    // bytes left in the stream
+    uint32_t s1;            // adler32
+    uint32_t s2;
+} PngStream;
+
+static void png_put(PngStream* z, uint8_t byte)
+{
+    if(z->block_left == 0)
+    {
+        size_t n = (z->total_left > PNG_BLOCK_MAX) ? PNG_BLOCK_MAX : z->total_left;
+
+        z->out[z->len++] = (n == z->total_left) ? 1 : 0;     // last block?
+        z->out[z->len++] = n & 0xFF;
+        z->out[z->len++] = n >> 8;
+        z->out[z->len++] = ~n & 0xFF;
+        z->out[z->len++] = (~n >> 8) & 0xFF;
+        z->block_left = n;
+    }
+    z->out[z->len++] = byte;
+    z->block_left--;
+    z->total_left--;
+    z->s1 = (z->s1 + byte) % 65521;
+    z->s2 = (z->s2 + z->s1) % 65521;
+}
+
+/*
+ * capture_encode_png()
+ * Encode the zlib stream for the IDAT chunk. Returns its length.
+ */
+static size_t capture_encode_png(const uint32_t* pixels, uint8_t* out)
+{
+    PngStream z = { out, 0, 0, PNG_RAW_BYTES, 1, 0 };
+
+    z.out[z.len++] = 0x78;      // deflate, 32K window
+    z.out[z.len++] = 0x01;      // no preset dictionary, fastest
+    for(int row = 0; row < DISP_HEIGHT; ++row)
+    {
+        png_put(&z, 0);         // filter type none
+        for(int col = 0; col < DISP_WIDTH; ++col)
+        {
+            uint32_t p = pixels[row * DISP_WIDTH + col];
+
+            png_put(&z, p >> 16);
+            png_put(&z, p >> 8);
+            png_put(&z, p);
+        }
+    }
+    put_be32(&z.out[z.len], (z.s2 << 16) | z.s1);
+
+    return z.len + 4;
+}
+
+/*
+ * capture_png_chunk()
+ * Write a chunk of len bytes. The data has to be preceded by 8 bytes of
+ * room for the length and type, which this fills in.
+ */
+static int capture_png_chunk(FILE* fp, const char* type, uint8_t* chunk, size_t len)
+{
+    uint8_t crc[4];
+
+    put_be32(chunk, len);
+    memcpy(chunk + 4, type, 4);
+    put_be32(crc, capture_crc(0, chunk + 4, len + 4));
+    if(fwrite(chunk, 1, len + 8, fp) != len + 8 || fwrite(crc, 1, 4, fp) != 4)
+        return -1;
+
+    return 0;
+}
+
+static int capture_write_png(Capture* cap, FILE* fp, const uint32_t* pixels)
+{
+    static const uint8_t sig[8] = { 0x89, 'P', 'N', 'G', '\r', '\n', 0x1A, '\n' };
+    uint8_t ihdr[8 + 13];
+    uint8_t iend[8];
+    size_t  len;
+
+    put_be32(&ihdr[8], DISP_WIDTH);
+    put_be32(&ihdr[12], DISP_HEIGHT);
+    ihdr[16] = 8;           // bits per channel
+    ihdr[17] = 2;           // RGB
+    ihdr[18] = 0;           // deflate
+    ihdr[19] = 0;           // adaptive filtering
+    ihdr[20] = 0;           // not interlaced
+    len = capture_encode_png(pixels, cap->out + 8);
+
+    if(fwrite(sig, 1, sizeof(sig), fp) != sizeof(sig) ||
+       capture_png_chunk(fp, "IHDR", ihdr, 13) < 0 ||
+       capture_png_chunk(fp, "IDAT", cap->out, len) < 0 ||
+       capture_png_chunk(fp, "IEND", iend, 0) < 0)
+        return -1;
+
+    return 0;
+}
+
+/*
+ * capture_write()
+ * Encode and write out one frame
+ */
+static int capture_write(Capture* cap, const uint32_t* pixels, unsigned long frame)
+{
+    char  name[CAPTURE_PATH_LEN];
+    FILE* fp;
+    int   status = 0;
+
+    if(cap->fmt == CAPTURE_RAW)
+    {
+        size_t len = capture_encode_raw(pixels, cap->out);
+        return (fwrite(cap->out, 1, len, cap->fp) == len) ? 0 : -1;
+    }
+
+    snprintf(name, sizeof(name), "%s/frame_%06lu.%s", cap->path, frame,
+            (cap->fmt == CAPTURE_PNG) ? "png" : "ppm");
+    fp = fopen(name, "wb");
+    if(!fp)
+    {
+        fprintf(stderr, "[%s] couldn't open %s for writing\n", __func__, name);
+        return -1;
+    }
+    if(cap->fmt == CAPTURE_PNG)
+        status = capture_write_png(cap, fp, pixels);
+    else
+    {
+        size_t len = capture_encode_ppm(pixels, cap->out);
+
+        if(fprintf(fp, "P6\n%d %d\n255\n", DISP_WIDTH, DISP_HEIGHT) < 0 ||
+           fwrite(cap->out, 1, len, fp) != len)
+            status = -1;
+    }
+    if(fclose(fp) != 0)
+        status = -1;
+
+    return status;
+}
+
+// ======== WRITER THREAD ======== //
+/*
+ * capture_drain()
+ * Write out every frame the producer has committed. Returns the number
+ * of frames written.
+ */
+static unsigned long capture_drain(Capture* cap)
+{
+    unsigned long head = atomic_load_explicit(&cap->head, memory_order_acquire);
+    unsigned long tail = atomic_load_explicit(&cap->tail, memory_order_relaxed);
+    unsigned long total = head - tail;
+
+    for(; tail != head; ++tail)
+    {
+        unsigned slot = tail % cap->num_slots;
+
+        if(!cap->error && capture_write(cap, &cap->slots[slot * DISP_NUM_PIXELS], cap->slot_frame[slot]) < 0)
+            cap->error = 1;
+        atomic_store_explicit(&cap->tail, tail + 1, memory_order_release);
+    }
+    cap->written += total;
+
+    return total;
+}
+
+static void* capture_writer(void* arg)
+{
+    Capture* cap = arg;
+    struct timespec idle = { 0, CAPTURE_IDLE_NS };
+
+    for(;;)
+    {
+        // Check stop first so that a final drain picks up everything
+        // committed before the producer asked us to stop
+        int stop = atomic_load_explicit(&cap->stop, memory_order_acquire);
+
+        if(capture_drain(cap) == 0)
+        {
+            if(stop)
+                break;
+            nanosleep(&idle, NULL);
+        }
+    }
+
+    return NULL;
+}
+
+// ======== CAPTURE ======== //
+/*
+ * capture_create()
+ * Capture every Nth frame to path, which is a directory for the image
+ * formats and a file (or - for stdout) for raw frames. slots is the
+ * number of frames that can be queued, 0 gives the default.
+ */
+Capture* capture_create(CaptureFormat fmt, const char* path, unsigned every, unsigned slots)
+{
+    Capture* cap;
+    size_t   out_size;
+
+    if(every == 0)
+        every = 1;
+    if(slots == 0)
+        slots = CAPTURE_SLOTS;
+    pthread_once(&capture_crc_once, capture_crc_init);
+
+    cap = aligned_alloc(CAPTURE_CACHE_LINE, sizeof(*cap));
+    if(!cap)
+        return NULL;
+    memset(cap, 0, sizeof(*cap));
+    atomic_init(&cap->head, 0);
+    atomic_init(&cap->tail, 0);
+    atomic_init(&cap->stop, 0);
+    cap->fmt       = fmt;
+    cap->every     = every;
+    cap->num_slots = slots;
+
+    out_size = (fmt == CAPTURE_PNG) ? 8 + PNG_ZLIB_BYTES : (fmt == CAPTURE_PPM) ? PPM_BYTES : RAW_BYTES;
+    cap->out        = malloc(out_size);
+    cap->slots      = malloc(slots * sizeof(uint32_t) * DISP_NUM_PIXELS);
+    cap->slot_frame = calloc(slots, sizeof(*cap->slot_frame));
+    cap->path       = strdup(path);
+    if(!cap->out || !cap->slots || !cap->slot_frame || !cap->path)
+        goto CAPTURE_FAIL;
+
+    if(fmt == CAPTURE_RAW)
+    {
+        // Frames go to a copy of stdout, so the caller can move stdout
+        // out of the way of the stream
+        cap->fp = (strcmp(path, "-") == 0) ? fdopen(dup(STDOUT_FILENO), "wb") : fopen(path, "wb");
+        if(!cap->fp)
+        {
+            fprintf(stderr, "[%s] couldn't open %s for writing\n", __func__, path);
+            goto CAPTURE_FAIL;
+        }
+    }
+    else if(mkdir(path, 0777) != 0 && errno != EEXIST)
+    {
+        fprintf(stderr, "[%s] couldn't create directory %s\n", __func__, path);
+        goto CAPTURE_FAIL;
+    }
+
+    if(pthread_create(&cap->writer, NULL, capture_writer, cap) != 0)
+    {
+        fprintf(stderr, "[%s] failed to start writer thread\n", __func__);
+        goto CAPTURE_FAIL;
+    }
+
+    return cap;
+
+CAPTURE_FAIL:
+    if(cap->fp)
+        fclose(cap->fp);
+    free(cap->out);
+    free(cap->slots);
+    free(cap->slot_frame);
+    free(cap->path);
+    free(cap);
+    return NULL;
+}
+
+/*
+ * capture_destroy()
+ * Write out whatever is still queued. Returns 0 if every frame was
+ * written.
+ */
+int capture_destroy(Capture* cap)
+{
+    int status;
+
+    if(!cap)
+        return 0;
+
+    atomic_store_explicit(&cap->stop, 1, memory_order_release);
+    pthread_join(cap->writer, NULL);
+    status = cap->error;
+    if(cap->fp && fclose(cap->fp) != 0)
+        status = 1;
+    free(cap->out);
+    free(cap->slots);
+    free(cap->slot_frame);
+    free(cap->path);
+    free(cap);
+
+    return status ? -1 : 0;
+}
+
+/*
+ * capture_due()
+ * True if frame is one to capture
+ */
+int capture_due(const Capture* cap, unsigned long frame)
+{
+    return frame % cap->every == 0;
+}
+
+/*
+ * capture_begin()
+ * Get a slot to put the pixels of the next frame in. Only one thread
+ * may capture into a Capture. If the writer has fallen a whole ring
+ * behind this waits for it rather than drop frames.
+ */
+uint32_t* capture_begin(Capture* cap)
+{
+    unsigned long head = atomic_load_explicit(&cap->head, memory_order_relaxed);
+
+    if(head - cap->tail_cache >= cap->num_slots)
+    {
+        cap->tail_cache = atomic_load_explicit(&cap->tail, memory_order_acquire);
+        if(head - cap->tail_cache >= cap->num_slots)
+        {
+            cap->stalls++;
+            do
+            {
+                sched_yield();
+                cap->tail_cache = atomic_load_explicit(&cap->tail, memory_order_acquire);
+            } while(head - cap->tail_cache >= cap->num_slots);
+        }
+    }
+
+    return &cap->slots[(head % cap->num_slots) * DISP_NUM_PIXELS];
+}
+
+/*
+ * capture_commit()
+ * Queue the slot from capture_begin() for writing
+ */
+void capture_commit(Capture* cap, unsigned long frame)
+{
+    unsigned long head = atomic_load_explicit(&cap->head, memory_order_relaxed);
+
+    cap->slot_frame[head % cap->num_slots] = frame;
+    atomic_store_explicit(&cap->head, head + 1, memory_order_release);
+}
+
+/*
+ * capture_frames()
+ * Number of frames committed so far
+ */
+unsigned long capture_frames(const Capture* cap)
+{
+    return atomic_load_explicit(&cap->head, memory_order_relaxed);
+}
+
+/*
+ * capture_stalls()
+ * Times the display had to wait for the writer
+ */
+unsigned long capture_stalls(const Capture* cap)
+{
+    return cap->stalls;
+}
+
+/*
+ * capture_format_parse()
+ * Look up a format by name. Returns 0 if the name is known.
+ */
+int capture_format_parse(const char* name, CaptureFormat* fmt)
+{
+    static const char* names[] = { "ppm", "png", "raw" };
+
+    for(int f = 0; f <= CAPTURE_RAW; ++f)
+    {
+        if(strcmp(name, names[f]) == 0)
+        {
+            *fmt = f;
+            return 0;
+        }
+    }
+
+    return -1;
+}
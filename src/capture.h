@@ -0,0 +1,36 @@
+/*
+ * CAPTURE
+ * Frame capture from the display. Every Nth frame the display hands
+ * its pixels to a capture, which queues them on a bounded ring of frame
+ * slots. A worker thread encodes and writes the frames, so the
+ * emulation only pays for a copy unless the ring fills up.
+ *
+ * Stefan Wong 2020
+ */
+
+#ifndef __CAPTURE_H
+#define __CAPTURE_H
+
+#include <stdint.h>
+
+#define CAPTURE_SLOTS 8             // default ring size, in frames
+
+typedef enum
+{
+    CAPTURE_PPM,                    // one PPM image per frame into a directory
+    CAPTURE_PNG,                    // one PNG image per frame into a directory
+    CAPTURE_RAW,                    // RGBA frames back to back into a file or pipe (- for stdout)
+} CaptureFormat;
+
+typedef struct Capture Capture;
+
+Capture*      capture_create(CaptureFormat fmt, const char* path, unsigned every, unsigned slots);
+int           capture_destroy(Capture* cap);
+int           capture_due(const Capture* cap, unsigned long frame);
+uint32_t*     capture_begin(Capture* cap);
+void          capture_commit(Capture* cap, unsigned long frame);
+unsigned long capture_frames(const Capture* cap);
+unsigned long capture_stalls(const Capture* cap);
+int           capture_format_parse(const char* name, CaptureFormat* fmt);
+
+#endif /*__CAPTURE_H*/
@@ -1,15 +1,27 @@
-/* 
- * CPU 
+/*
+ * CPU
  * Trying to clean up the CPU implementation
  *
  * Stefan Wong 2020
  */
 
+#include <stdatomic.h>
 #include <stdio.h>
 #include <stdlib.h>
+#include <string.h>
 #include "cpu.h"
 #include "disassem.h"
 #include "emu_utils.h"
+#include "profile.h"
+#include "trace.h"
+
+// GCC and clang support labels-as-values, so on those compilers each
+// opcode handler jumps directly to the handler for the next opcode
+// (direct threading). Everything else falls back to a plain switch.
+// Define CPU_NO_THREADED to force the switch on GCC as well.
+#if defined(__GNUC__) && !defined(CPU_NO_THREADED)
+#define CPU_THREADED
+#endif
 
 
 // ==== Setup initial state
@@ -22,11 +34,15 @@ CPUState *cpu_create(void)
     if(!state)
         return NULL;
     //state->mem_size = CPU_MEM_SIZE;
-    state->memory       = malloc(CPU_MEM_SIZE);        // 16K
-    state->shift_reg    = 0;
-    state->shift_amount = 0;
+    state->memory       = aligned_alloc(CPU_MEM_ALIGN, CPU_MEM_ALLOC);
+    state->map          = &cpu_map_flat;
     if(!state->memory)
+    {
+        free(state);
         return NULL;
+    }
+    memset(state->memory, 0, CPU_MEM_ALLOC);
+    cpu_mem_changed(state);
 
     return state;
 }
@@ -40,1656 +56,718 @@ void cpu_destroy(CPUState *state)
     free(state);
 }
 
-// Trap unimplemented instructions 
+/*
+ * cpu_mem_changed()
+ * Tell the code caches that memory was changed by something other than
+ * the CPU. Generations come from one counter shared by every machine, so
+ * a cache can't mistake a new machine for one it has seen before, even
+ * if it was given the same memory.
+ */
+void cpu_mem_changed(CPUState* state)
+{
+    static atomic_uint_fast64_t next_gen = 1;
+
+    state->mem_gen = atomic_fetch_add(&next_gen, 1);
+}
+
+// Trap unimplemented instructions
 void UnimplementedInstruction(CPUState *state, unsigned char opcode)
 {
-    // PC will have advanced by one, so undo that 
+    // PC will have advanced by one, so undo that
     state->pc--;
     fprintf(stderr, "Unimplemented instruction 0x%02X\n", opcode);
     fprintf(stderr, "PC   INSTR\n");
     disassemble_8080_op(state->memory, state->pc);
 }
 
+// ======== FLAG TABLES ======== //
+// Built at compile time. 0x6996 is a 16-entry parity table for a nibble,
+// so folding the byte into one nibble gives the parity of all 8 bits.
+#define FLAG_PAR(v)   (((0x6996 >> (((v) ^ ((v) >> 4)) & 0xF)) & 0x1) ? 0 : FLAG_P)
+#define FLAG_SZP(v)   (((v) & FLAG_S) | (((v) & 0xFF) == 0 ? FLAG_Z : 0) | FLAG_PAR((v) & 0xFF))
+#define FLAG_SZPC(v)  (FLAG_SZP((v) & 0xFF) | (((v) >> 8) & FLAG_CY))
+#define FT4(f, b)     f(b), f((b) + 1), f((b) + 2), f((b) + 3)
+#define FT16(f, b)    FT4(f, b), FT4(f, (b) + 4), FT4(f, (b) + 8), FT4(f, (b) + 12)
+#define FT64(f, b)    FT16(f, b), FT16(f, (b) + 16), FT16(f, (b) + 32), FT16(f, (b) + 48)
+#define FT256(f, b)   FT64(f, b), FT64(f, (b) + 64), FT64(f, (b) + 128), FT64(f, (b) + 192)
+
+const uint8_t cpu_flag_szp[256]  = { FT256(FLAG_SZP, 0) };
+const uint8_t cpu_flag_szpc[512] = { FT256(FLAG_SZPC, 0), FT256(FLAG_SZPC, 256) };
+
+// Base cycle counts. Conditional CALL and RET are listed with their
+// not-taken times; a taken CALL costs 6 more and a taken RET 6 more.
+const uint8_t cpu_cycles[256] = {
+//  0   1   2   3   4   5   6   7   8   9   A   B   C   D   E   F
+    4, 10,  7,  5,  5,  5,  7,  4,  4, 10,  7,  5,  5,  5,  7,  4,   // 00
+    4, 10,  7,  5,  5,  5,  7,  4,  4, 10,  7,  5,  5,  5,  7,  4,   // 10
+    4, 10, 16,  5,  5,  5,  7,  4,  4, 10, 16,  5,  5,  5,  7,  4,   // 20
+    4, 10, 13,  5, 10, 10, 10,  4,  4, 10, 13,  5,  5,  5,  7,  4,   // 30
+    5,  5,  5,  5,  5,  5,  7,  5,  5,  5,  5,  5,  5,  5,  7,  5,   // 40
+    5,  5,  5,  5,  5,  5,  7,  5,  5,  5,  5,  5,  5,  5,  7,  5,   // 50
+    5,  5,  5,  5,  5,  5,  7,  5,  5,  5,  5,  5,  5,  5,  7,  5,   // 60
+    7,  7,  7,  7,  7,  7,  7,  7,  5,  5,  5,  5,  5,  5,  7,  5,   // 70
+    4,  4,  4,  4,  4,  4,  7,  4,  4,  4,  4,  4,  4,  4,  7,  4,   // 80
+    4,  4,  4,  4,  4,  4,  7,  4,  4,  4,  4,  4,  4,  4,  7,  4,   // 90
+    4,  4,  4,  4,  4,  4,  7,  4,  4,  4,  4,  4,  4,  4,  7,  4,   // A0
+    4,  4,  4,  4,  4,  4,  7,  4,  4,  4,  4,  4,  4,  4,  7,  4,   // B0
+    5, 10, 10, 10, 11, 11,  7, 11,  5, 10, 10, 10, 11, 17,  7, 11,   // C0
+    5, 10, 10, 10, 11, 11,  7, 11,  5, 10, 10, 10, 11, 17,  7, 11,   // D0
+    5, 10, 10, 18, 11, 11,  7, 11,  5,  5, 10,  4, 11, 17,  7, 11,   // E0
+    5, 10, 10,  4, 11, 11,  7, 11,  5,  5, 10,  4, 11, 17,  7, 11,   // F0
+};
+
+// Instruction length in bytes, including the opcode
+const uint8_t cpu_op_len[256] = {
+//  0   1   2   3   4   5   6   7   8   9   A   B   C   D   E   F
+    1,  3,  1,  1,  1,  1,  2,  1,  1,  1,  1,  1,  1,  1,  2,  1,   // 00
+    1,  3,  1,  1,  1,  1,  2,  1,  1,  1,  1,  1,  1,  1,  2,  1,   // 10
+    1,  3,  3,  1,  1,  1,  2,  1,  1,  1,  3,  1,  1,  1,  2,  1,   // 20
+    1,  3,  3,  1,  1,  1,  2,  1,  1,  1,  3,  1,  1,  1,  2,  1,   // 30
+    1,  1,  1,  1,  1,  1,  1,  1,  1,  1,  1,  1,  1,  1,  1,  1,   // 40
+    1,  1,  1,  1,  1,  1,  1,  1,  1,  1,  1,  1,  1,  1,  1,  1,   // 50
+    1,  1,  1,  1,  1,  1,  1,  1,  1,  1,  1,  1,  1,  1,  1,  1,   // 60
+    1,  1,  1,  1,  1,  1,  1,  1,  1,  1,  1,  1,  1,  1,  1,  1,   // 70
+    1,  1,  1,  1,  1,  1,  1,  1,  1,  1,  1,  1,  1,  1,  1,  1,   // 80
+    1,  1,  1,  1,  1,  1,  1,  1,  1,  1,  1,  1,  1,  1,  1,  1,   // 90
+    1,  1,  1,  1,  1,  1,  1,  1,  1,  1,  1,  1,  1,  1,  1,  1,   // A0
+    1,  1,  1,  1,  1,  1,  1,  1,  1,  1,  1,  1,  1,  1,  1,  1,   // B0
+    1,  1,  3,  3,  3,  1,  2,  1,  1,  1,  3,  3,  3,  3,  2,  1,   // C0
+    1,  1,  3,  2,  3,  1,  2,  1,  1,  1,  3,  2,  3,  3,  2,  1,   // D0
+    1,  1,  3,  1,  3,  1,  2,  1,  1,  1,  3,  1,  3,  3,  2,  1,   // E0
+    1,  1,  3,  1,  3,  1,  2,  1,  1,  1,  3,  1,  3,  3,  2,  1,   // F0
+};
+
+// Page table where every page is backed by the same page of memory,
+// which is what a bare cpu_create() gives you
+#define PAGE_OFF(p)   ((p) << 8)
+
+const CPUMemMap cpu_map_flat = {
+    .read  = { FT256(PAGE_OFF, 0) },
+    .write = { FT256(PAGE_OFF, 0) },
+};
+
+#undef PAGE_OFF
+#undef FLAG_PAR
+#undef FLAG_SZP
+#undef FLAG_SZPC
+#undef FT4
+#undef FT16
+#undef FT64
+#undef FT256
+
+
+// ======== MEMORY MAP ======== //
+/*
+ * cpu_map_init()
+ * Start a map off as flat RAM
+ */
+void cpu_map_init(CPUMemMap* map)
+{
+    *map = cpu_map_flat;
+}
+
+/*
+ * cpu_map_mirror()
+ * Make the pages in [start, end) repeat the pages in [target, target_end)
+ */
+void cpu_map_mirror(CPUMemMap* map, uint16_t start, uint32_t end, uint16_t target, uint32_t target_end)
+{
+    int first = target >> 8;
+    int n     = (target_end - target) >> 8;
+
+    if(n <= 0)
+        return;
+    for(uint32_t addr = start, i = 0; addr < end; addr += CPU_PAGE_SIZE, ++i)
+    {
+        int page = addr >> 8;
+        int src  = first + (i % n);
+
+        map->read[page]          = map->read[src];
+        map->write[page]         = map->write[src];
+        map->read_handler[page]  = map->read_handler[src];
+        map->write_handler[page] = map->write_handler[src];
+    }
+}
+
 /*
- * cpu_shift_register()
+ * cpu_map_protect()
+ * Ignore writes to the pages in [start, end)
  */
-void cpu_shift_register(CPUState* state)
+void cpu_map_protect(CPUMemMap* map, uint16_t start, uint32_t end)
 {
-    uint8_t* opcode;
+    for(uint32_t addr = start; addr < end; addr += CPU_PAGE_SIZE)
+    {
+        map->write[addr >> 8]         = CPU_PAGE_SINK;
+        map->write_handler[addr >> 8] = NULL;
+    }
+}
 
-    opcode = &state->memory[state->pc];
-    if(*opcode == 0xD3)     // OUT instruction
+/*
+ * cpu_map_handler()
+ * Send reads and/or writes to the pages in [start, end) to a handler.
+ * Either handler may be NULL to leave that direction as it is.
+ */
+void cpu_map_handler(CPUMemMap* map, uint16_t start, uint32_t end, CPUMemRead rd, CPUMemWrite wr)
+{
+    for(uint32_t addr = start; addr < end; addr += CPU_PAGE_SIZE)
     {
-        if(state->memory[state->pc] == 0x2)
-            state->shift_amount = state->a;
-        else if(state->memory[state->pc] == 0x4)
-            state->shift_reg = (state->a << 8) | (state->shift_reg >> 8);
+        if(rd)
+        {
+            map->read[addr >> 8]         = CPU_PAGE_HANDLER;
+            map->read_handler[addr >> 8] = rd;
+        }
+        if(wr)
+        {
+            map->write[addr >> 8]         = CPU_PAGE_HANDLER;
+            map->write_handler[addr >> 8] = wr;
+        }
     }
-    else if(opcode == 0xDB)     // IN instruction
+}
+
+// ======== I/O PORTS ======== //
+/*
+ * cpu_ports_init()
+ * Start with every port unconnected
+ */
+void cpu_ports_init(CPUPorts* ports)
+{
+    memset(ports, 0, sizeof(*ports));
+}
+
+/*
+ * cpu_ports_in()
+ * Connect IN from ports [first, last] to fn on dev, or disconnect them if
+ * fn is NULL
+ */
+void cpu_ports_in(CPUPorts* ports, uint8_t first, uint8_t last, CPUPortIn fn, void* dev)
+{
+    for(int port = first; port <= last; ++port)
     {
-        if(state->memory[state->pc] == 0x3)
-            state->a = state->shift_reg >> (8 - state->shift_amount);
+        ports->in[port]     = fn;
+        ports->in_dev[port] = fn ? dev : NULL;
     }
 }
 
+/*
+ * cpu_ports_out()
+ * Connect OUT to ports [first, last] to fn on dev, or disconnect them if
+ * fn is NULL
+ */
+void cpu_ports_out(CPUPorts* ports, uint8_t first, uint8_t last, CPUPortOut fn, void* dev)
+{
+    for(int port = first; port <= last; ++port)
+    {
+        ports->out[port]     = fn;
+        ports->out_dev[port] = fn ? dev : NULL;
+    }
+}
+
+// ======== ALU HELPERS ======== //
+// The interpreter keeps A and the flags in locals, so the helpers work on
+// pointers to those rather than on the CPUState. Once inlined the pointers
+// disappear. Each helper computes the full set of flags with one table
+// lookup, plus a mask for AC, and writes them with a single store.
+
+// ADD, ADC, ADI, ACI
+static inline void alu_add(uint8_t* a, uint8_t* f, uint8_t val, uint8_t carry)
+{
+    uint16_t res = *a + val + carry;
+
+    *f = cpu_flag_szpc[res] | ((*a ^ val ^ res) & FLAG_AC) | FLAG_ONE;
+    *a = res & 0xFF;
+}
+
+// SUB, SBB, SUI, SBI and CMP, CPI. The 8080 subtracts by adding the
+// complement, so AC is the half carry of that addition and CY is the
+// inverted carry out.
+static inline uint8_t alu_sub(uint8_t a, uint8_t* f, uint8_t val, uint8_t borrow)
+{
+    uint8_t  cval = ~val;
+    uint16_t res  = a + cval + (borrow ? 0 : 1);
+
+    *f = (cpu_flag_szpc[res] ^ FLAG_CY) | ((a ^ cval ^ res) & FLAG_AC) | FLAG_ONE;
+
+    return res & 0xFF;
+}
+
+static inline void alu_ana(uint8_t* a, uint8_t* f, uint8_t val)
+{
+    uint8_t res = *a & val;
+
+    // AC is the OR of bit 3 of the operands
+    *f = cpu_flag_szp[res] | (((*a | val) << 1) & FLAG_AC) | FLAG_ONE;
+    *a = res;
+}
+
+static inline void alu_xra(uint8_t* a, uint8_t* f, uint8_t val)
+{
+    *a ^= val;
+    *f = cpu_flag_szp[*a] | FLAG_ONE;
+}
+
+static inline void alu_ora(uint8_t* a, uint8_t* f, uint8_t val)
+{
+    *a |= val;
+    *f = cpu_flag_szp[*a] | FLAG_ONE;
+}
+
+// INR and DCR leave the carry alone
+static inline uint8_t alu_inr(uint8_t* f, uint8_t val)
+{
+    uint8_t res = val + 1;
+
+    *f = (*f & FLAG_CY) | cpu_flag_szp[res] | ((res & 0x0F) == 0 ? FLAG_AC : 0) | FLAG_ONE;
+
+    return res;
+}
+
+static inline uint8_t alu_dcr(uint8_t* f, uint8_t val)
+{
+    uint8_t res = val - 1;
+
+    *f = (*f & FLAG_CY) | cpu_flag_szp[res] | ((res & 0x0F) != 0x0F ? FLAG_AC : 0) | FLAG_ONE;
+
+    return res;
+}
+
+static inline void alu_daa(uint8_t* a, uint8_t* f)
+{
+    uint8_t corr = 0;
+    uint8_t cy   = *f & FLAG_CY;
+    uint8_t lsb  = *a & 0x0F;
+    uint8_t msb  = *a >> 4;
+
+    if((*f & FLAG_AC) || lsb > 9)
+        corr += 0x06;
+    if(cy || msb > 9 || (msb >= 9 && lsb > 9))
+    {
+        corr += 0x60;
+        cy = FLAG_CY;
+    }
+    alu_add(a, f, corr, 0);
+    *f = (*f & ~FLAG_CY) | cy;
+}
+
+static inline void alu_dad(CPUState* state, uint8_t* f, uint16_t val)
+{
+    uint32_t res = ((state->h << 8) | state->l) + val;
+
+    state->h = (res >> 8) & 0xFF;
+    state->l = res & 0xFF;
+    *f       = (*f & ~FLAG_CY) | (res > 0xFFFF);
+}
+
+
+// ======== DECODED INSTRUCTION CACHE ======== //
+// One entry per address. An entry with length 0 hasn't been decoded yet.
+// Memory is split into 256 byte pages, and a write to a page that holds
+// decoded bytes throws away every entry that could have read from it.
+#define DCACHE_PAGES        (CPU_MEM_SIZE >> 8)
+
+struct CPUDecodeCache
+{
+    CPUDecodedOp  ops[CPU_MEM_SIZE];
+    uint8_t       page_cached[DCACHE_PAGES];
+    uint8_t*      memory;               // memory the entries were decoded from
+    uint64_t      mem_gen;              // and its generation at the time
+    uint32_t      int_pushes;           // interrupts seen, see cpu_interrupt()
+    unsigned long invalidations;
+};
+
+static void dcache_fill(CPUDecodeCache* dc, const uint8_t* mem, uint16_t pc)
+{
+    CPUDecodedOp* dec = &dc->ops[pc];
+    uint8_t       op  = cpu_flat_read(mem, pc);
+
+    dec->opcode  = op;
+    dec->length  = cpu_op_len[op];
+    dec->cycles  = cpu_cycles[op];
+    dec->operand = cpu_flat_read(mem, pc + 1) | (cpu_flat_read(mem, pc + 2) << 8);
+    // The operand bytes may be on the next page
+    dc->page_cached[pc >> 8] = 1;
+    dc->page_cached[(uint16_t) (pc + dec->length - 1) >> 8] = 1;
+}
+
+static void dcache_invalidate_page(CPUDecodeCache* dc, uint8_t page)
+{
+    // Instructions in the last two bytes of the previous page have
+    // operands on this one
+    uint16_t prev = (page << 8) - 2;
+
+    memset(&dc->ops[page << 8], 0, 256 * sizeof(dc->ops[0]));
+    memset(&dc->ops[prev], 0, 2 * sizeof(dc->ops[0]));
+    dc->page_cached[page] = 0;
+    dc->invalidations++;
+}
+
+static inline void dcache_write(CPUDecodeCache* dc, uint8_t* mem, uint16_t addr, uint8_t val)
+{
+    cpu_flat_write(mem, addr, val);
+    if(dc->page_cached[addr >> 8])
+        dcache_invalidate_page(dc, addr >> 8);
+}
+
+static void dcache_int_pushes(CPUDecodeCache* dc, const CPUState* state)
+{
+    // One push since the last run leaves two bytes to catch up on. More
+    // than that and some of the addresses are gone.
+    if(state->int_pushes - dc->int_pushes == 1)
+    {
+        for(int i = 0; i < 2; ++i)
+        {
+            uint16_t addr = state->int_sp + i;
+            if(dc->page_cached[addr >> 8])
+                dcache_invalidate_page(dc, addr >> 8);
+        }
+    }
+    else
+        cpu_dcache_flush(dc);
+    dc->int_pushes = state->int_pushes;
+}
+
+
+// ======== INTERPRETER ======== //
+// PC, SP, A and the flags live in locals for the length of a batch. They
+// are written back to the CPUState when the batch ends and around I/O,
+// where a port handler may look at or change the state. The cycle total
+// is brought up to date at the same time.
+#define SYNC_OUT() do { \
+    state->pc     = pc; \
+    state->sp     = sp; \
+    state->a      = acc; \
+    state->cc.psw = flags; \
+    state->cycles = cycle_base + cycles; \
+} while(0)
+
+#define SYNC_IN() do { \
+    pc    = state->pc; \
+    sp    = state->sp; \
+    acc   = state->a; \
+    flags = state->cc.psw; \
+} while(0)
+
+// Memory and register access used by the opcode handlers
+// MEM_RD, WR, IMM8, IMM16, FETCH and DISPATCH depend on the interpreter being built
+// and are defined in cpu_interp.h.
+#define RD(addr)        MEM_RD((uint16_t) (addr))
+#define RD16(addr)      (RD(addr) | (RD((addr) + 1) << 8))
+#define REG_BC          ((state->b << 8) | state->c)
+#define REG_DE          ((state->d << 8) | state->e)
+#define REG_HL          ((state->h << 8) | state->l)
+#define REG(r)          REG_##r
+#define REG_a           acc
+#define REG_b           state->b
+#define REG_c           state->c
+#define REG_d           state->d
+#define REG_e           state->e
+#define REG_h           state->h
+#define REG_l           state->l
+#define FLAG(x)         ((flags & (x)) != 0)
+#define PUSH16(val) do { \
+    uint16_t push_val = (val); \
+    sp -= 2; \
+    WR(sp + 1, push_val >> 8); \
+    WR(sp, push_val & 0xFF); \
+} while(0)
+
+#define POP16(dst) do { \
+    (dst) = RD16(sp); \
+    sp += 2; \
+} while(0)
+
+#ifdef CPU_THREADED
+#define OP(n)       op_##n:
+#define ALIAS(n)
+// Every handler ends by fetching and jumping to the next handler itself.
+// PC has already been advanced past the opcode when a handler runs, so
+// the operand bytes (IMM8, IMM16) start at PC.
+#define NEXT(t) do { \
+    cycles += (t); \
+    if(cycles >= budget) \
+        goto INTERP_END; \
+    FETCH(); \
+    DISPATCH(); \
+} while(0)
+#else
+#define OP(n)       case 0x##n:
+#define ALIAS(n)    case 0x##n:
+#define NEXT(t) do { \
+    cycles += (t); \
+    goto INTERP_FETCH; \
+} while(0)
+#endif /*CPU_THREADED*/
+
+// Regular opcode groups
+#define MOV_RR(n, dst, src) OP(n) { REG(dst) = REG(src); NEXT(5); }
+#define MOV_RM(n, dst)      OP(n) { REG(dst) = RD(REG_HL); NEXT(7); }
+#define MOV_MR(n, src)      OP(n) { WR(REG_HL, REG(src)); NEXT(7); }
+#define MVI_R(n, dst)       OP(n) { REG(dst) = IMM8; pc++; NEXT(7); }
+#define INR_R(n, r)         OP(n) { REG(r) = alu_inr(&flags, REG(r)); NEXT(5); }
+#define DCR_R(n, r)         OP(n) { REG(r) = alu_dcr(&flags, REG(r)); NEXT(5); }
+
+#define ALU_GROUP(n0, n1, n2, n3, n4, n5, n6, n7, stmt) \
+    OP(n0) { uint8_t val = state->b; stmt; NEXT(4); } \
+    OP(n1) { uint8_t val = state->c; stmt; NEXT(4); } \
+    OP(n2) { uint8_t val = state->d; stmt; NEXT(4); } \
+    OP(n3) { uint8_t val = state->e; stmt; NEXT(4); } \
+    OP(n4) { uint8_t val = state->h; stmt; NEXT(4); } \
+    OP(n5) { uint8_t val = state->l; stmt; NEXT(4); } \
+    OP(n6) { uint8_t val = RD(REG_HL); stmt; NEXT(7); } \
+    OP(n7) { uint8_t val = acc;      stmt; NEXT(4); }
+
+#define JMP_COND(n, cond) OP(n) { \
+    if(cond) \
+        pc = IMM16; \
+    else \
+        pc += 2; \
+    NEXT(10); \
+}
+
+#define CALL_COND(n, cond) OP(n) { \
+    if(cond) \
+    { \
+        uint16_t addr = IMM16; \
+        PUSH16(pc + 2); \
+        pc = addr; \
+        NEXT(17); \
+    } \
+    pc += 2; \
+    NEXT(11); \
+}
+
+#define RET_COND(n, cond) OP(n) { \
+    if(cond) \
+    { \
+        POP16(pc); \
+        NEXT(11); \
+    } \
+    NEXT(5); \
+}
+
+#define RST(n, vec) OP(n) { PUSH16(pc); pc = (vec); NEXT(11); }
+
+#define INTERP_NAME cpu_interp
+#include "cpu_interp.h"
+#undef INTERP_NAME
+
+#define INTERP_NAME cpu_interp_paged
+#define INTERP_PAGED
+#include "cpu_interp.h"
+#undef INTERP_PAGED
+#undef INTERP_NAME
+
+#define INTERP_NAME cpu_interp_decoded
+#define INTERP_DECODED
+#include "cpu_interp.h"
+#undef INTERP_DECODED
+#undef INTERP_NAME
+
+// The flat map is also a page table, so the paged copy can instrument
+// any machine
+#define INTERP_NAME cpu_interp_instrumented
+#define INTERP_PAGED
+#define INTERP_INSTRUMENT
+#include "cpu_interp.h"
+#undef INTERP_INSTRUMENT
+#undef INTERP_PAGED
+#undef INTERP_NAME
+
+// Flat machines get the interpreter that indexes memory directly, so a
+// memory map only costs anything on machines that have one. Profiling and
+// tracing are checked once per call rather than once per instruction.
+static inline long interp_run(CPUState* state, long budget)
+{
+    if(__builtin_expect(cpu_instrumented(state), 0))
+        return cpu_interp_instrumented(state, NULL, budget);
+    if(state->map == &cpu_map_flat)
+        return cpu_interp(state, NULL, budget);
+    return cpu_interp_paged(state, NULL, budget);
+}
+
+#undef SYNC_OUT
+#undef SYNC_IN
+#undef RD
+#undef RD16
+#undef REG_BC
+#undef REG_DE
+#undef REG_HL
+#undef REG
+#undef REG_a
+#undef REG_b
+#undef REG_c
+#undef REG_d
+#undef REG_e
+#undef REG_h
+#undef REG_l
+#undef FLAG
+#undef PUSH16
+#undef POP16
+#undef OP
+#undef ALIAS
+#undef NEXT
+#undef MOV_RR
+#undef MOV_RM
+#undef MOV_MR
+#undef MVI_R
+#undef INR_R
+#undef DCR_R
+#undef ALU_GROUP
+#undef JMP_COND
+#undef CALL_COND
+#undef RET_COND
+#undef RST
+
+/*
+ * cpu_run_fast()
+ * Run for at least budget cycles with no tracing or per-instruction hooks.
+ * Returns the number of cycles actually executed (the last instruction may
+ * overshoot the budget) or a negative status if the CPU stopped.
+ */
+long cpu_run_fast(CPUState* state, long budget)
+{
+    return interp_run(state, budget);
+}
+
+/*
+ * cpu_dcache_create()
+ */
+CPUDecodeCache* cpu_dcache_create(void)
+{
+    return calloc(1, sizeof(CPUDecodeCache));
+}
+
+/*
+ * cpu_dcache_destroy()
+ */
+void cpu_dcache_destroy(CPUDecodeCache* dc)
+{
+    free(dc);
+}
+
+/*
+ * cpu_dcache_flush()
+ * Drop every decoded entry. cpu_mem_changed() on the machine does the
+ * same the next time the cache runs.
+ */
+void cpu_dcache_flush(CPUDecodeCache* dc)
+{
+    memset(dc->ops, 0, sizeof(dc->ops));
+    memset(dc->page_cached, 0, sizeof(dc->page_cached));
+}
+
+/*
+ * cpu_dcache_lookup()
+ * Get the decoded entry for an address, or NULL if it hasn't been decoded
+ */
+const CPUDecodedOp* cpu_dcache_lookup(const CPUDecodeCache* dc, uint16_t addr)
+{
+    return dc->ops[addr].length ? &dc->ops[addr] : NULL;
+}
+
+/*
+ * cpu_dcache_invalidations()
+ * Number of pages thrown away because the CPU wrote to them
+ */
+unsigned long cpu_dcache_invalidations(const CPUDecodeCache* dc)
+{
+    return dc->invalidations;
+}
+
+/*
+ * cpu_run_decoded()
+ * As cpu_run_fast(), but instructions are decoded once and then run from
+ * the cache until the CPU writes over them. Only faster than
+ * cpu_run_fast() in an unoptimised build, see cpu.h.
+ */
+long cpu_run_decoded(CPUState* state, CPUDecodeCache* dc, long budget)
+{
+    // The cache is indexed by CPU address, so it only stays coherent
+    // when every address has its own backing. Profiles and traces come
+    // from the interpreter.
+    if(state->map != &cpu_map_flat || cpu_instrumented(state))
+        return interp_run(state, budget);
+    if(dc->memory != state->memory || dc->mem_gen != state->mem_gen)
+    {
+        cpu_dcache_flush(dc);
+        dc->memory     = state->memory;
+        dc->mem_gen    = state->mem_gen;
+        dc->int_pushes = state->int_pushes;
+    }
+    if(dc->int_pushes != state->int_pushes)
+        dcache_int_pushes(dc, state);
+
+    return cpu_interp_decoded(state, dc, budget);
+}
+
 /*
  * cpu_run()
+ * Run for at least the requested number of cycles. Returns the number of
+ * cycles executed or a negative status if the CPU stopped.
  */
 int cpu_run(CPUState* state, long cycles, int print_output)
 {
     int status;
     long exec_cycles = 0;
 
+    if(!print_output)
+        return cpu_run_fast(state, cycles);
+
     while(exec_cycles < cycles)
     {
-        cpu_shift_register(state);
         status = cpu_exec(state);
-        if(print_output)
-        {
-            fprintf(stdout, "[I %04X]  ", state->memory[state->pc]);
-            PrintState(state);
-        }
+        fprintf(stdout, "[I %04X]  ", cpu_mem_read(state, state->pc));
+        PrintState(state);
         if(status < 0)
-            goto RUN_END;
+            return status;
         exec_cycles += status;
     }
 
-RUN_END:
-    return status;
+    return exec_cycles;
 }
 
 /*
  * cpu_exec()
- * TODO : instruction timing
+ * Execute a single instruction. Returns the number of cycles taken
+ * by the instruction.
  */
 int cpu_exec(CPUState *state)
 {
-    int exec_time = 0;
-    uint8_t *opcode;
+    // Every instruction takes at least 4 cycles, so a budget of 1 runs
+    // exactly one instruction.
+    return interp_run(state, 1);
+}
 
-    opcode = &state->memory[state->pc];
-    switch(*opcode)
-    {
-        case 0x00:      // NOP
-            exec_time = 4;
-            break;
-
-        case 0x01:      // LXI B, D16
-            {
-                // TODO : Is this correct?
-                state->b = opcode[3];
-                state->c = opcode[2];
-            }
-            exec_time = 10;
-            break;
-
-        case 0x02:      // STAX B
-            {
-                uint16_t bc;
-                bc = (state->b << 8) | state->c;
-                state->memory[bc] = state->a;
-            }
-            exec_time = 7;
-            break;
-
-        case 0x03:      // INX B
-            {
-                uint32_t bc, res;
-                bc  = (state->b << 8) | state->c;
-                res = bc + 1;
-                state->b = (res >> 8);
-                state->c = (res & 0xFF);
-            }
-            exec_time = 5;
-            break;
-
-        case 0x05:      // DCR B
-            {
-                uint8_t res = state->b - 1;
-                arith_set_flags(state, res);
-                state->b = res;
-            }
-            exec_time = 5;
-            break;
-
-        case 0x06:      // MVI B, d8
-            {
-                state->b = opcode[1];
-                state->pc++;
-            }
-            exec_time = 7;
-            break;
-
-        case 0x07:      // RLC
-            {
-                uint8_t a_prev = state->a;
-                state->a = (a_prev << 1) | (a_prev & 0x80);
-                state->cc.cy = (a_prev >> 7) ? 1 : 0;
-            }
-            exec_time = 4;
-            break;
-
-        case 0x08:      // NOP
-            break;
-
-        case 0x09:      // DAD B
-            {
-                // HL = HL + BC 
-                uint32_t hl, bc, res;
-                hl = (state->h << 8) | state->l;
-                bc = (state->b << 8) | state->c;
-                res = hl + bc;
-                state->h = (res & 0xFF00) >> 8;
-                state->l = res & 0xFF;
-                state->cc.cy = ((res & 0xFFFF0000) > 0);
-            }
-            exec_time = 10;
-            break;
-
-        case 0x0A:      // LDAX B
-            {
-                uint16_t bc;
-                bc       = (state->b << 8) | state->c;
-                state->a = state->memory[bc];
-            }
-            exec_time = 7;
-            break;
-
-        case 0x0C:      // INR C
-            {
-                uint16_t res = state->c + 1;
-                arith_set_flags(state, res);
-                state->c = res;
-            }
-            exec_time = 5;
-            break;
-
-        case 0x0D:      // DCR C
-            {
-                uint16_t res = state->c - 1;
-                arith_set_flags(state, res);
-                state->c = res;
-            }
-            exec_time = 5;
-            break;
-
-        case 0x0E:      // MVI, C, #d8
-            {
-                state->c = opcode[1];
-                state->pc++;
-            }
-            exec_time = 7;
-            break;
-
-        case 0x0F:      // RRC 
-            {
-                uint8_t a_prev = state->a;
-                state->a = a_prev >> 1;
-                state->a = state->a | (a_prev & 0x01);
-                state->cc.cy = (a_prev & 0x01) != 0;
-            }
-            exec_time = 4;
-            break;
-
-        case 0x10:      // NOP
-            exec_time = 4;
-            break;
-
-        case 0x11:      // LXI, D,D16
-            {
-                state->d = opcode[2];
-                state->e = opcode[1];
-                state->pc += 2;
-            }
-            exec_time = 10;
-            break;
-
-        case 0x13:      // INX D
-            {
-                state->e++;
-                if(state->e == 0)
-                    state->d++;
-            }
-            exec_time = 5;
-            break;
-
-        case 0x19:      // DAD D
-            {
-                uint32_t hl, de, res;
-                hl = (state->h << 8) | state->l;
-                de = (state->d << 8) | state->e;
-                res = hl + de;
-                state->h = (res & 0xFF00) >> 8;
-                state->l = res & 0xFF;
-                state->cc.cy = ((res & 0xFFFF0000) != 0);
-            }
-            exec_time = 10;
-            break;
-
-        case 0x1A:      // LDAX D
-            {
-                uint16_t offset = (state->d << 8) | state->e;
-                state->a = state->memory[offset];
-            }
-            exec_time = 7;
-            break;
-
-        case 0x1B:      // DCX D
-            {
-                uint32_t de, res;
-                de = (state->d << 8) | state->e;
-                res = de - 1;
-                state->d = (res & 0xFF00) >> 8;
-                state->e = res & 0xFF;
-                state->cc.cy = ((res & 0xFFFF0000) != 0);
-            }
-            exec_time = 5;
-            break;
-
-        case 0x1D:      // DCR E 1
-            {
-                uint8_t res = state->e - 1;
-                arith_set_flags(state, res);
-                state->e = res;
-            }
-            exec_time = 5;
-            break;
-
-        case 0x20:      // NOP
-            exec_time = 4;
-            break;
-
-        case 0x21:      // LXI H, word
-            {
-                state->l = opcode[1];
-                state->h = opcode[2];
-                state->pc += 2;
-            }
-            exec_time = 10;
-            break;
-
-        case 0x23:      // INX H
-            {
-                state->l++;
-                if(state->l == 0)
-                    state->h++;
-            }
-            exec_time = 5;
-            break;
-
-        case 0x24:      // INR H
-            {
-                uint16_t hl;
-                hl = (state->h << 8) | state->l;
-                hl += 1;
-                arith_set_flags(state, hl);
-                state->h = (hl & 0xFF00) >> 8;
-                state->l = hl & 0xFF;
-            }
-            exec_time = 5;
-            break;
-
-        case 0x25:      // DCR H
-            {
-                uint16_t res = state->h - 1;
-                arith_set_flags(state, res);
-                state->h = res;
-            }
-            exec_time = 5;
-            break;
-
-        case 0x26:      // MVI, H, byte
-            {
-                state->h = opcode[1];
-                state->pc++;
-            }
-            exec_time = 7;
-            break;
-
-        case 0x28:      // NOP
-            exec_time = 4;
-            break;
-
-        case 0x29:      // DAD H
-            {
-                uint32_t hl, res;
-                hl = (state->h << 8) | state->l;
-                res = hl + hl;
-                state->h = (res & 0xFF00) >> 8;
-                state->l = res & 0xFF;
-                state->cc.cy = ((res & 0xFFFF0000) != 0);
-            }
-            exec_time = 10;
-            break;
-
-        case 0x2A:      // LHLD ADR
-            {
-                state->l = state->memory[opcode[1]];
-                state->h = state->memory[opcode[1] + 1];
-                state->pc++;
-            }
-            exec_time = 16;
-            break;
-
-        case 0x2B:      // DCX H
-            {
-                uint16_t hl;
-                hl = (state->h << 8) | state->l;
-                hl = hl + 1;
-                state->h = (hl >> 8) & 0xFF;
-                state->l = hl & 0xFF;
-            }
-            exec_time = 5;
-            break;
-
-        case 0x2C:      // INR L
-            {
-                uint16_t res = state->l + 1;
-                arith_set_flags(state, res);
-                state->l = res;
-            }
-            exec_time = 5;      // TODO : double check the docs for this one
-            break;
-
-        case 0x2D:      // DCR L 
-            {
-                uint16_t res = state->l - 1;
-                arith_set_flags(state, res);
-                state->l = res;
-            }
-            exec_time = 5;
-            break;
-
-        case 0x2E:      // MVI L, D8
-            {
-                state->l = opcode[1];
-                state->pc++;
-            }
-            exec_time = 7;
-            break;
-
-        case 0x2F:      // CMA A
-            {
-                state->a = ~state->a;
-                exec_time = 4;
-            }
-            break;
-
-        case 0x30:      // NOP
-            exec_time = 4;
-            break;
-
-        case 0x31:      // LXI, SP, D16
-            {
-                uint16_t sp;
-                sp = (opcode[3] << 8) | opcode[2];
-                state->sp = sp;
-                state->pc += 3;
-            }
-            exec_time = 10;
-            break;
-
-        case 0x32:      // STA, adr
-            {
-                state->memory[opcode[1]] = state->a;
-                state->pc++;
-            }
-            exec_time = 13;
-            break;
-
-        case 0x33:      // INX SP
-            {
-                state->sp += 1;
-                exec_time = 5;
-            }
-            break;
-
-        case 0x34:      // INR M
-            {
-                // TODO  : the implementation of this may not be correct
-                uint16_t hl; 
-                hl = (state->h << 8) | state->l;
-                hl += 1;
-                arith_set_flags(state, hl);
-                state->h = (hl >> 8) & 0xFF;
-                state->l = 0xFF;
-            }
-            exec_time = 10;
-            break;
-
-        case 0x35:      // DCR M
-            {
-                uint16_t hl;
-
-                hl = (state->h << 8) | state->l;
-                hl -= 1;
-                arith_set_flags(state, hl);
-                state->h = (hl >> 8) & 0xFF;
-                state->l = 0xFF;
-            }
-            exec_time = 10;
-            break;
-
-        case 0x36:      // MVI, M byte
-            {
-                // AC set if lower half-byte was zero before decrement 
-                uint16_t offset;
-                offset = (state->h << 8) | state->l;
-                state->memory[offset] = opcode[1];
-                state->pc++;
-            }
-            exec_time = 10;
-            break;
-
-        case 0x38:      // NOP
-            exec_time = 4;
-            break;
-
-        case 0x3A:      // LDA (word)
-            {
-                uint16_t offset;
-                offset = (opcode[2] << 8) | opcode[1];
-                state->a = state->memory[offset];
-                state->pc += 2;
-            }
-            exec_time = 13;
-            break;
-
-        case 0x3B:      // DCX SP
-            {
-                state->sp -= 1;
-            }
-            exec_time = 5;
-            break;
-
-        case 0x3C:      // INR A
-            {
-                uint16_t res = state->a + 1;
-                arith_set_flags(state, res);
-                state->a = res;
-            }
-            exec_time = 5;
-            break;
-
-        case 0x3D:      // DCR A
-            {
-                uint16_t res = state->a - 1;
-                arith_set_flags(state, res);
-                state->a = res;
-            }
-            exec_time = 5;
-            break;
-
-        case 0x3E:      // MVI A D8
-            {
-                state->a = opcode[1];
-                state->pc++;
-            }
-            exec_time =  7;
-            break;
-
-        // ======== MOV GROUP ======== //
-        case 0x40:      // MOV B, B
-            state->b = state->b;
-            exec_time = 7;
-            break;
-        case 0x41:      // MOV B, C
-            state->b = state->c;
-            exec_time = 7;
-            break;
-        case 0x42:      // MOV B,D
-            state->b = state->c;
-            exec_time = 7;
-            break;
-        case 0x43:      // MOV B,E
-            state->b = state->e;
-            exec_time = 7;
-            break;
-        case 0x44:      // MOV B, H
-            state->b = state->h;
-            exec_time = 7;
-            break;
-        case 0x45:      // MOV B,L
-            state->b = state->l;
-            exec_time = 7;
-            break;
-        case 0x46:      // MOV B,M
-            {
-                uint16_t offset;
-                offset = (state->h << 8) | state->l;
-                state->b = state->memory[offset];
-            }
-            exec_time = 10;
-            break;
-        case 0x47:      // MOV B,A
-            state->b = state->a;
-            exec_time = 7;
-            break;
-        case 0x48:      // MOV C, B
-            state->c = state->b;
-            exec_time = 7;
-            break;
-        case 0x49:      // MOV C, C
-            state->c = state->c;
-            exec_time = 7;
-            break;
-        case 0x4A:      // MOV C, D
-            state->c = state->d;
-            exec_time = 7;
-            break;
-        case 0x4B:      // MOV C, E
-            state->c = state->e;
-            exec_time = 7;
-            break;
-        case 0x4C:      // MOV C, H
-            state->c = state->h;
-            exec_time = 7;
-            break;
-        case 0x4D:      // MOV C, L
-            state->c = state->l;
-            exec_time = 7;
-            break;
-        case 0x4E:      // MOV C, M
-            {
-                uint16_t offset;
-                offset = (state->h << 8) | state->l;
-                state->c = state->memory[offset];
-            }
-            exec_time = 10;
-            break;
-        case 0x4F:      // MOV C, A
-            state->c = state->a;
-            exec_time = 7;
-            break;
-        case 0x50:      // MOV D, B
-            state->d = state->b;
-            exec_time = 7;
-            break;
-        case 0x51:      // MOV, D, C
-            state->d = state->c;
-            exec_time = 7;
-            break;
-        case 0x52:      // MOV D, D
-            state->d = state->d;
-            exec_time = 7;
-            break;
-        case 0x53:      // MOV D,E
-            state->d = state->e;
-            exec_time = 7;
-            break;
-        case 0x54:      // MOV D H
-            state->d = state->h;
-            exec_time = 7;
-            break;
-        case 0x55:      // MOV D, L
-            state->d = state->l;
-            exec_time = 7;
-            break;
-        case 0x56:      // MOV D, M
-            {
-                uint16_t offset;
-                offset = (state->h << 8) | state->l;
-                state->d = state->memory[offset];
-            }
-            exec_time = 10;
-            break;
-        case 0x57:      // MOV D, A
-            state->d = state->a;
-            exec_time = 7;
-            break;
-        case 0x58:      // MOV E, B
-            state->e = state->b;
-            exec_time = 7;
-            break;
-        case 0x59:      // MOV E,C
-            state->e = state->c;
-            exec_time = 7;
-            break;
-        case 0x5A:      // MOV E,D
-            state->e = state->d;
-            exec_time = 7;
-            break;
-        case 0x5B:      // MOV E,E
-            state->e = state->e;
-            exec_time = 7;
-            break;
-        case 0x5C:      // MOV E, H
-            state->e = state->h;
-            exec_time = 7;
-            break;
-        case 0x5D:      // MOV E, L
-            state->e = state->l;
-            exec_time = 7;
-            break;
-        case 0x5E:      // MOV, E, H
-            {
-                uint16_t offset;
-                offset = (state->h << 8) | state->l;
-                state->e = state->memory[offset];
-            }
-            exec_time = 10;
-            break;
-        case 0x5F:      // MOV E,A
-            state->e = state->a;
-            exec_time = 7;
-            break;
-        case 0x60:      // MOV H,B
-            state->h = state->b;
-            exec_time = 7;
-            break;
-        case 0x61:      // MOV H, C
-            state->h = state->c;
-            exec_time = 7;
-            break;
-        case 0x62:      // MOV H, D
-            state->h = state->d;
-            exec_time = 7;
-            break;
-        case 0x63:      // MOV H, E
-            state->h = state->e;
-            exec_time = 7;
-            break;
-        case 0x64:      // MOV H, H
-            state->h = state->h;
-            exec_time = 7;
-            break;
-        case 0x65:      // MOV, H, L
-            state->h = state->l;
-            exec_time = 7;
-            break;
-        case 0x66:      // MOV H, M
-            {
-                uint16_t offset;
-                offset = (state->h << 8) | state->l;
-                state->h = state->memory[offset];
-            }
-            exec_time = 10;
-            break;
-        case 0x67:      // MOV H,A
-            state->h = state->a;
-            exec_time = 10;
-            break;
-        case 0x68:      // MOV L,B
-            state->l = state->b;
-            exec_time = 10;
-            break;
-        case 0x69:      // MOV L, C
-            state->l = state->c;
-            exec_time = 10;
-            break;
-        case 0x6A:      // MOV L, D
-            state->l = state->d;
-            exec_time = 10;
-            break;
-        case 0x6B:      // MOV L,E
-            state->l = state->e;
-            exec_time = 10;
-            break;
-        case 0x6C:      // MOV L, H
-            state->l = state->h;
-            exec_time = 10;
-            break;
-        case 0x6D:      // MOV L,L
-            state->l = state->l;
-            exec_time = 10;
-            break;
-        case 0x6E:      // MOV L, M
-            {
-                uint16_t offset;
-                offset = (state->h << 8) | state->l;
-                state->l = state->memory[offset];
-            }
-            exec_time = 7;
-            break;
-        case 0x6F:      // MOV L,A
-            state->l = state->a;
-            exec_time = 7;
-            break;
-        case 0x70:      // MOV M,B
-            {
-                uint16_t offset;
-                offset = (state->h << 8) | state->l;
-                state->memory[offset] = state->b;
-            }
-            exec_time = 7;
-            break;
-        case 0x71:      // MOV M, C
-            {
-                uint16_t offset;
-                offset = (state->h << 8) | state->l;
-                state->memory[offset] = state->c;
-            }
-            exec_time = 7;
-            break;
-        case 0x72:      // MOV M, D
-            {
-                uint16_t offset;
-                offset = (state->h << 8) | state->l;
-                state->memory[offset] = state->d;
-            }
-            exec_time = 7;
-            break;
-        case 0x73:      // MOV M, E
-            {
-                uint16_t offset;
-                offset = (state->h << 8) | state->l;
-                state->memory[offset] = state->e;
-            }
-            exec_time = 7;
-            break;
-        case 0x74:      // MOV M, H
-            {
-                uint16_t offset = (state->h << 8) | state->l;
-                state->memory[offset] = state->h;
-            }
-            exec_time = 7;
-            break;
-        case 0x75:      // MOV M, L
-            {
-                uint16_t offset = (state->h << 8) | state->l;
-                state->memory[offset] = state->l;
-            }
-            exec_time = 7;
-            break;
-        case 0x76:      //HLT
-            // For now, we just halt the emulation and return a negative code. 
-            // In future this might become  "wait for interrupt" or something
-            return -2;  
-        case 0x77:      // MOV M, A
-            {
-                uint16_t offset = (state->h << 8) | state->l;
-                state->memory[offset] = state->a;
-            }
-            exec_time = 7;
-            break;
-        case 0x78:      // MOV A,B
-            state->a = state->b;
-            exec_time = 7;
-            break;
-        case 0x79:      // MOV A, C
-            state->a = state->c;
-            exec_time = 7;
-            break;
-        case 0x7A:      // MOV A, D
-            state->a = state->d;
-            exec_time = 7;
-            break;
-        case 0x7B:      // MOV A, E
-            state->a = state->e;
-            exec_time = 7;
-            break;
-        case 0x7C:      // MOV A,H
-            state->a = state->h;
-            exec_time = 7;
-            break;
-        case 0x7D:      // MOV A, L
-            state->a = state->l;
-            exec_time = 7;
-            break;
-        case 0x7E:      // MOV A, M
-            {
-                uint16_t offset = (state->h << 8) | state->l;
-                state->a = state->memory[offset];
-            }
-            exec_time = 7;
-            break;
-        case 0x7F:      // MOV A, A
-            state->a = state->a;
-            exec_time = 7;
-            break;
-
-        // ======== ARITHMETIC GROUP ======== //
-        case 0x80:      // ADD B
-            {
-                uint16_t ans = (uint16_t) state->a + (uint16_t) state->b;
-                arith_set_flags(state, ans);
-                state->a = ans & 0xFF;
-            }
-            exec_time = 4;
-            break;
-        case 0x81:  // ADD C 
-            {
-                uint16_t ans = (uint16_t) state->a + (uint16_t) state->c;
-                arith_set_flags(state, ans);
-                state->a = ans & 0xFF;
-            }
-            exec_time = 4;
-            break;
-        case 0x82:  // ADD D
-            {
-                uint16_t ans = (uint16_t) state->a + (uint16_t) state->d;
-                arith_set_flags(state, ans);
-                state->a = ans & 0xFF;
-            }
-            exec_time = 4;
-            break;
-        case 0x83:  // ADD E
-            {
-                uint16_t ans = (uint16_t) state->a + (uint16_t) state->e;
-                arith_set_flags(state, ans);
-                state->a = ans & 0xFF;
-            exec_time = 4;
-            break;
-            }
-        case 0x84:      // ADD H
-            {
-                uint16_t ans = (uint16_t) state->a + (uint16_t) state->h;
-                arith_set_flags(state, ans);
-                state->a = ans & 0xFF;
-            exec_time = 4;
-            }
-            break;
-        case 0x85:      // ADD L
-            {
-                uint16_t ans = (uint16_t) state->a + (uint16_t) state->l;
-                arith_set_flags(state, ans);
-                state->a = ans;
-            }
-            exec_time = 4;
-            break;
-        case 0x86:      // ADD M    (memory form)
-            {
-                uint16_t offset = (state->h << 8) | (state->l);
-                uint16_t ans = (uint16_t) state->a + state->memory[offset];
-                arith_set_flags(state, ans);
-                state->a = ans & 0xFF;
-            }
-            exec_time = 7;
-            break;
-        case 0x87:      // ADD A
-            {
-                uint16_t ans = (uint16_t) state->a + (uint16_t) state->a;
-                arith_set_flags(state, ans);
-                state->a = ans & 0xFF;
-            }
-            exec_time = 4;
-            break;
-        case 0x88:      // ADC B  (A <- A + B + CY)
-            {
-                uint16_t ans = (uint16_t) state->a + (uint16_t) state->b;
-                arith_set_flags(state, ans);
-                state->a = (ans + state->cc.cy) & 0xFF;
-            }
-            exec_time = 4;
-            break;
-        case 0x8A:      // ADC D (A <- A + D + CY
-            {
-                    uint16_t ans = (uint16_t) state->a + (uint16_t) state->d;
-                    arith_set_flags(state, ans);
-                    state->a = (ans + state->cc.cy) & 0xFF;
-            }
-            exec_time = 4;
-            break;
-        case 0x8B:      // ADC E (A <- A + E + CY)
-            {
-                uint16_t ans = (uint16_t) state->a + (uint16_t) state->e;
-                arith_set_flags(state, ans);
-                state->a = (ans + state->cc.cy) & 0xFF;
-            }
-            exec_time = 4;
-            break;
-        case 0x8C:      //ADC H (A <- A + H + CY)
-            {
-                uint16_t ans = (uint16_t) state->a + (uint16_t) state->h;
-                arith_set_flags(state, ans);
-                state->a = (ans + state->cc.cy) & 0xFF;
-            }
-            exec_time = 4;
-            break;
-        case 0x8D:      // ADC L (A <- A + L + CY)
-            {
-                uint16_t ans = (uint16_t) state->a + (uint16_t) state->l;
-                arith_set_flags(state, ans);
-                state->a = (ans + state->cc.cy) & 0xFF;
-            }
-            exec_time = 4;
-            break;
-        case 0x8E:      // ADC M (A <- (HL) + CY)
-            {
-                uint16_t hl;
-                uint32_t ans;
-                hl = (state->h << 8) | state->l;
-                ans = state->a + hl;
-                state->cc.z  = (ans == 0);
-                state->cc.s  = ((ans & 0x80000000) == 1);
-                state->cc.p  = Parity(state->a);
-                state->cc.cy = ((ans & 0xFFFF0000) > 0);
-                state->a = ((ans + state->cc.cy) >> 24) & 0xFF;       // TODO: review this 
-            }
-            exec_time = 7;
-            break;
-        case 0x8F:      // ADC A (A <- A _+ A + CY)
-            {
-                uint16_t ans = (uint16_t) state->a + (uint16_t) state->a;
-                arith_set_flags(state, ans);
-                state->a = (ans + state->cc.cy) & 0xFF;
-            }
-            exec_time = 4;
-            break;
-        case 0x90:      // SUB B 
-            {
-                uint16_t ans = (uint16_t) state->a - (uint16_t) state->b;
-                arith_set_flags(state, ans);
-                state->a = ans;
-            }
-            exec_time = 4;
-            break;
-        case 0x91:      // SUB C
-            {
-                uint16_t ans = (uint16_t) state->a - (uint16_t) state->c;
-                arith_set_flags(state, ans);
-                state->a = ans;
-            }
-            exec_time = 4;
-            break;
-        case 0x92:       // SUB D
-            {
-                uint16_t ans = (uint16_t) state->a - (uint16_t) state->d;
-                arith_set_flags(state, ans);
-                state->a = ans;
-            }
-            exec_time = 4;
-            break;
-        case 0x93:      // SUB E
-            {
-                uint16_t ans = (uint16_t) state->a - (uint16_t) state->e;
-                arith_set_flags(state, ans);
-                state->a = ans;
-            }
-            exec_time = 4;
-            break;
-        case 0x94:      // SUB H
-            {
-                uint16_t ans = (uint16_t) state->a - (uint16_t) state->h;
-                arith_set_flags(state, ans);
-                state->a = ans;
-            }
-            exec_time = 4;
-            break;
-        case 0x95:      // SUB L
-            {
-                uint16_t ans = (uint16_t) state->a - (uint16_t) state->l;
-                arith_set_flags(state, ans);
-                state->a = ans;
-            }
-            exec_time = 4;
-            break;
-        case 0x96:      // SUB M
-            {
-                uint32_t ans;
-                uint16_t hl;
-                hl = (state->h << 8) | state->l;
-                ans = (uint32_t) state->a + hl;
-                state->cc.z  = (ans == 0);
-                state->cc.s  = (ans & 0x80000000) ? 1 : 0;
-                //state->cc.s  = ((ans & 0x80000000) == 1);
-                state->cc.p  = Parity(state->a);
-                state->cc.cy = ((ans & 0xFFFF0000) > 0);
-                state->a = ((ans + state->cc.cy) >> 24) & 0xFF;       // TODO: review this 
-            }
-            exec_time = 7;
-            break;
-        case 0x97:      // SUB A
-            {
-                uint16_t ans = (uint16_t) state->a - (uint16_t) state->a;
-                arith_set_flags(state, ans);
-                state->a = ans;
-            }
-            exec_time = 4;
-            break;
-
-        case 0x98:      // SBB B
-            {
-                uint16_t ans = (uint16_t) state->a - (uint16_t) state->b;
-                arith_set_flags(state, ans);
-                state->a = (ans + state->cc.cy) & 0xFF;
-            }
-            exec_time = 4;
-            break;
-        case 0x99:      // SBB C 
-            {
-                uint16_t ans = (uint16_t) state->a - (uint16_t) state->c;
-                arith_set_flags(state, ans);
-                state->a = (ans + state->cc.cy) & 0xFF;
-            }
-            exec_time = 4;
-            break;
-        case 0x9A:      // SBB D
-            {
-                uint16_t ans = (uint16_t) state->a - (uint16_t) state->d;
-                arith_set_flags(state, ans);
-                state->a = (ans + state->cc.cy) & 0xFF;
-            }
-            exec_time = 4;
-            break;
-        case 0x9B:      // SBB E
-            {
-                uint16_t ans = (uint16_t) state->a - (uint16_t) state->e;
-                arith_set_flags(state, ans);
-                state->a = (ans + state->cc.cy) & 0xFF;
-            }
-            exec_time = 4;
-            break;
-        case 0x9C:      // SBB H
-            {
-                uint16_t ans = (uint16_t) state->a - (uint16_t) state->h;
-                arith_set_flags(state, ans);
-                state->a = ans;
-            }
-            exec_time = 4;
-            break;
-        case 0x9D:      // SBB L
-            {
-                uint16_t ans = (uint16_t) state->a - (uint16_t) state->l;
-                arith_set_flags(state, ans);
-                state->a = ans;
-            }
-            exec_time = 4;
-            break;
-
-        case 0x9E:      // SBB M
-            {
-                uint32_t ans;
-                uint16_t hl;
-                hl = (state->h << 8) | state->l;
-                ans = (uint32_t) state->a - (uint32_t) hl;
-                state->cc.s  = (ans & 0x80000000) ? 1 : 0;
-                state->cc.p  = Parity(state->a);
-                state->cc.cy = ((ans & 0xFFFF0000) > 0);
-                state->a = ((ans + state->cc.cy) >> 24) & 0xFF;       // TODO: review this 
-            }
-            exec_time = 4;
-            break;
-        case 0x9F:      // SBB A
-            {
-                uint16_t ans = (uint16_t) state->a - (uint16_t) state->a;
-                arith_set_flags(state, ans);
-                state->a = ans;
-            }
-            exec_time = 4;
-            break;
-
-        // ======== LOGIC GROUP ======== //
-        case 0xA0:      // ANA B
-            {
-                state->a = state->a & state->b;
-                logic_set_flags(state);
-            }
-            exec_time = 4;
-            break;
-        case 0xA1:      // ANA C 
-            {
-                state->a = state->a & state->c;
-                logic_set_flags(state);
-            }
-            exec_time = 4;
-            break;
-        case 0xA2:      // ANA D
-            {
-                state->a = state->a & state->d;
-                logic_set_flags(state);
-            }
-            exec_time = 4;
-            break;
-        case 0xA3:      // ANA E
-            {
-                state->a = state->a & state->e;
-                logic_set_flags(state);
-            }
-            exec_time = 4;
-            break;
-        case 0xA4:      // ANA H
-            {
-                state->a = state->a & state->h;
-                logic_set_flags(state);
-            }
-            exec_time = 4;
-            break;
-        case 0xA5:      // ANA L 
-            {
-                state->a = state->a & state->l;
-                logic_set_flags(state);
-            }
-            exec_time = 4;
-            break;
-        case 0xA6:      // ANA M
-            {
-                uint16_t hl, ans;
-                hl = (state->h << 8) | state->l;
-                ans = (uint16_t) state->a & hl;
-                state->a = (ans >> 8) & 0xFF;
-                logic_set_flags(state);         // <- TODO : not sure if this is correct
-            }
-            exec_time = 4;
-            break;
-        case 0xA7:      // ANA A
-            {
-                state->a = state->a & state->a;
-                logic_set_flags(state);
-            }
-            exec_time = 4;
-            break;
-        case 0xA8:      // XRA B 
-            {
-                state->a = state->a ^ state->b;
-                logic_set_flags(state);
-            }
-            exec_time = 4;
-            break;
-        case 0xA9:      // XRA C
-            {
-                state->a = state->a ^ state->c;
-                logic_set_flags(state);
-            }
-            exec_time = 4;
-            break;
-        case 0xAA:      // XRA  D
-            {
-                state->a = state->a ^ state->d;
-                logic_set_flags(state);
-            }
-            exec_time = 4;
-            break;
-        case 0xAB:      // XRA E 
-            {
-                state->a = state->a ^ state->e;
-                logic_set_flags(state);
-            }
-            exec_time = 4;
-            break;
-        case 0xAC:      // XRA H
-            {
-                state->a = state->a ^ state->h;
-                logic_set_flags(state);
-            }
-            exec_time = 4;
-            break;
-        case 0xAD:      // XRA L
-            {
-                state->a = state->a ^ state->l;
-                logic_set_flags(state);
-            }
-            exec_time = 4;
-            break;
-
-        case 0xAE:      // XRA M 
-            {
-                uint16_t ans, hl;
-                hl = (state->h << 8) | state->l;
-                ans = (uint16_t) state->a ^ hl;
-                logic_set_flags(state);
-                state->a = (ans >> 8) & 0xFF;
-            }
-            exec_time = 7;
-            break;
-
-        case 0xAF:      // XRA A
-            {
-                state->a = state->a ^ state->a;
-                logic_set_flags(state);
-            }
-            exec_time = 4;
-            break;
-
-        case 0xB0:      // ORA B 
-            {
-                state->a = state->a | state->b;
-                logic_set_flags(state);
-            }
-            exec_time = 4;
-            break;
-        case 0xB1:      // ORA C
-            {
-                state->a = state->a | state->c;
-                logic_set_flags(state);
-            }
-            exec_time = 4;
-            break;
-        case 0xB2:      // ORA D 
-            {
-                state->a = state->a | state->d;
-                logic_set_flags(state);
-            }
-            exec_time = 4;
-            break;
-        case 0xB3:      // ORA E 
-            {
-                state->a = state->a | state->e;
-                logic_set_flags(state);
-            }
-            exec_time = 4;
-            break;
-        case 0xB4:      // ORA H
-            {
-                state->a = state->a | state->h;
-                logic_set_flags(state);
-            }
-            exec_time = 4;
-            break;
-        case 0xB5:      // ORA L 
-            {
-                state->a = state->a | state->l;
-                logic_set_flags(state);
-            }
-            exec_time = 4;
-            break;
-        case 0xB6:      // ORA M 
-            {
-                uint16_t ans, hl;
-                hl = (state->h << 8) | state->l;
-                ans = (uint16_t) state->a ^ hl;
-                logic_set_flags(state);
-                state->a = (ans >> 8) & 0xFF;
-            }
-            exec_time = 7;
-            break;
-        case 0xB7:      // ORA A 
-            {
-                state->a = state->a ^ state->a;
-                logic_set_flags(state);
-            }
-            exec_time = 4;
-            break;
-                    
-        case 0xB8:      // CMP B
-            {
-                state->a = ~state->b;
-                logic_set_flags(state);
-            }
-            exec_time = 4;
-            break;
-        case 0xB9:      // CMP C
-            {
-                state->a = ~state->c;
-                logic_set_flags(state);
-            }
-            exec_time = 4;
-            break;
-        case 0xBA:      // CMP D
-            {
-                state->a = ~state->d;
-                logic_set_flags(state);
-            exec_time = 4;
-            }
-            break;
-        case 0xBB:      // CMP E
-            {
-                state->a = ~state->e;
-                logic_set_flags(state);
-            }
-            exec_time = 4;
-            break;
-        case 0xBC:      // CMP H 
-            {
-                state->a = ~state->h;
-                logic_set_flags(state);
-            }
-            exec_time = 4;
-            break;
-        case 0xBD:      // CMP L
-            {
-                state->a = ~state->l;
-                logic_set_flags(state);
-            }
-            exec_time = 4;
-            break;
-        case 0xBE:      // CMP M
-            {
-                uint16_t ans, hl;
-                hl = (state->h << 8) | state->l;
-                ans = ~hl;
-                logic_set_flags(state);
-                state->a = (ans >> 8) & 0xFF;
-            }
-            exec_time = 7;
-            break;
-        case 0xBF:      // CMP A
-            {
-                state->a = ~state->a;
-                logic_set_flags(state);
-            }
-            exec_time = 4;
-            break;
-
-
-        case 0xC1:      // POP B
-            {
-                state->c = state->memory[state->sp];
-                state->b = state->memory[state->sp+1];
-                state->sp += 2;
-            }
-            exec_time = 10;
-            break;
-
-        case 0xC2:      // JNZ ADR
-            {
-                if(state->cc.z == 0)
-                    state->pc = (opcode[2] << 8) | opcode[1];
-                else
-                    state->pc += 2;
-            }
-            exec_time = 10;
-            break;
-
-        case 0xC3:      // JMP ADR
-            state->pc = (opcode[2] << 8) | opcode[1];
-            exec_time = 10;
-            break;
-
-        case 0xC4:      // CNZ ADR
-            {
-                if(state->cc.z == 0)
-                {
-                    // TODO : I've implemented the call instruciton here, 
-                    // but I'm not sure if that is completely correct.
-                    uint16_t ret = state->pc + 2;
-                    state->memory[state->sp-1] = (ret >> 8) & 0xFF;
-                    state->memory[state->sp-2] = ret & 0xFF;
-                    state->sp -= 2;
-                    state->pc = (opcode[2] << 8) | opcode[1];
-                }
-                else
-                    state->pc += 2;
-            }
-            exec_time = (state->cc.z == 0) ? 17 : 11;
-            break;
-        case 0xC5:     // PUSH B
-            {
-                state->memory[state->sp-1] = state->b;
-                state->memory[state->sp]   = state->c;
-                state->sp -= 2;
-            }
-            exec_time = 11;
-            break;
-
-        case 0xC6:      // ADD ADI (immediate form)
-            {
-                uint16_t ans = (uint16_t) state->a + (uint16_t) opcode[1];
-                arith_set_flags(state, ans);
-                state->a = (ans >> 8) & 0xFF;
-                state->pc++;
-            }
-            exec_time = 4;
-            break;
-
-        case 0xC7:      // RST 0
-            state->pc = 0;          // TODO : possibly not correct...
-            break;
-
-        case 0xC8:      // RZ  (if Z, RET)
-            {
-                if(state->cc.z == 1)
-                {
-                    state->pc = state->memory[state->sp] | (state->memory[state->sp+1] << 8);
-                    state->sp += 2;
-                }
-            }
-            exec_time = (state->cc.z) ? 11 : 5;
-            break;
-
-        case 0xC9:      // RET
-            {
-                state->pc = state->memory[state->sp] | (state->memory[state->sp+1] << 8);
-                state->sp += 2;
-            }
-            exec_time = 10;
-            break;
-            
-        case 0xCA:      // JZ adr
-            {
-                if(state->cc.z == 1)
-                {
-                    uint16_t ret = state->pc + 2;
-                    state->memory[state->sp-1] = (ret >> 8) & 0xFF;
-                    state->memory[state->sp-2] = ret & 0xFF;
-                    state->sp -= 2;
-                    state->pc = (opcode[2] << 8) | opcode[1];
-                }
-            }
-            exec_time = 10;
-            break;
-
-        case 0xCC:      // CZ ADR
-            {
-                if(state->cc.z)
-                {
-                    uint16_t ret = state->pc + 2;
-
-                    state->memory[state->sp-1] = (ret >> 8) & 0xFF;
-                    state->memory[state->sp-2] = ret & 0xFF;
-                    state->sp -= 2;
-                    state->pc = (opcode[2] << 8) | opcode[1];
-                }
-            }
-            exec_time = (state->cc.z) ? 17 : 11;
-            break;
-
-        case 0xCD:      // CALL ADR
-            {
-#ifdef CPU_DIAG     // use the CPM style printing routine
-                fprintf(stdout, "[%s] debug message follows : \n", __func__);
-                // Emulate the printing in CPM/OS
-                if(((opcode[2] << 8) | (opcode[1])) == 5)
-                {
-                    uint16_t offset = (state->d << 8) | (state->e);
-                    char* str       = &state->memory[offset+3];  // skips prefix byte
-                    while(*str != '$')
-                    {
-                        fprintf(stdout, "%c", *str);
-                        str++;
-                    }
-                    fprintf(stdout, "\n");
-                }
-                else if(state->c == 2)
-                {
-                    fprintf(stdout, "putchar() routine here\n");
-                }
-                else if(((opcode[2] << 8) | opcode[1]) == 0)
-                {
-                    return -2;      // halt the machine and exit
-                }
-#else
-                // save reutrn address
-                uint16_t ret = state->pc + 2;
-                state->memory[state->sp-1] = (ret >> 8) & 0xFF;
-                state->memory[state->sp-2] = ret & 0xFF;
-                state->sp -= 2;
-                state->pc = (opcode[2] << 8) | opcode[1];
-#endif /*CPU_DIAG*/
-            }
-            exec_time = 17;
-            break;
-
-        case 0xCE:      // ACI, d8
-            {
-                uint16_t res;
-                res = state->a + opcode[1];
-                arith_set_flags(state, res);
-                state->a = res + state->cc.cy;
-                state->pc++;
-            }
-            exec_time = 7;
-            break;
-
-        case 0xCF:      // RST 1
-            {
-                // CALL d8
-                state->sp = state->pc;
-                state->pc = 0x0008;
-            }
-            exec_time = 11;
-            break;
-
-        case 0xD1:      // POP D
-            {
-                state->e = state->memory[state->sp];
-                state->d = state->memory[state->sp-1];
-                state->sp += 2;
-            }
-            exec_time = 10;
-            break;
-        case 0xD2:      // JNC adr
-            {
-                if(!state->cc.cy)
-                    state->pc = (opcode[2] << 8) | opcode[1];
-            }
-            exec_time = 10;
-            break;
-
-        case 0xD3:      // OUT 
-            state->pc++;            // TODO implement actual logic 
-            exec_time = 10;
-            break;
-
-        case 0xD4:      // CNC (if NCY, CALL adr)
-            {
-                UnimplementedInstruction(state, opcode[0]);
-                return -1;
-            }
-            exec_time = 0;      // TODO
-            break;
-
-        case 0xD5:      // PUSH D
-            {
-                state->memory[state->sp-1] = state->d;
-                state->memory[state->sp-2] = state->e;
-                state->sp -= 2;
-            }
-            exec_time = 11;
-            break;
-
-        case 0xDB:      // IN 
-            state->pc += 2;         // TODO : implement actual logic 
-            exec_time = 10;
-            break;
-
-        case 0xDE:      // SBI D8
-            exec_time = 7;
-            break;
-
-        case 0xE3:      // XTHL  L <-> SP, H <-> SP+1
-            {
-                uint8_t l   = state->l;
-                uint8_t h   = state->h;
-                uint8_t sp1 = state->memory[state->sp];
-                uint8_t sp2 = state->memory[state->sp+1];
-                // swap 
-                state->l = sp1;
-                state->h = sp2;
-                state->memory[sp1] = l;
-                state->memory[sp2] = h;
-            }
-            exec_time = 14;
-            break;
-
-        case 0xE5:      // PUSH H 
-            {
-                state->memory[state->sp-1] = state->h;
-                state->memory[state->sp-2] = state->l;
-                state->sp -= 2;
-            }
-            exec_time = 11;
-            break;
-
-        case 0xE6:      // ANI D8
-            {
-                uint8_t ans = state->a & opcode[1];
-                logic_set_flags(state);
-                state->a = ans;
-                state->pc++;
-            }
-            exec_time = 7;
-            break;
-
-        case 0xF1:      // POP PSW
-            {
-                uint8_t psw;
-                state->a = state->memory[state->sp+1];
-                psw = state->memory[state->sp];
-                state->cc.z  = ((psw & 0x01) == 0x01);
-                state->cc.s  = ((psw & 0x02) == 0x02);
-                state->cc.p  = ((psw & 0x04) == 0x04);
-                state->cc.cy = ((psw & 0x05) == 0x05);
-                state->cc.ac = ((psw & 0x10) == 0x10);
-                state->pc += 2;
-            }
-            exec_time = 10;
-            break;
-
-        case 0xF2:      // JP ADR
-            {
-                if(state->cc.p)
-                    state->pc = (opcode[1] << 8) | opcode[2];
-            }
-            exec_time = 10;
-            break;
-
-        case 0xF3:      // DI (disable interrupts)
-            state->int_enable = 0;
-            exec_time = 4;
-            break;
-
-        case 0xF4:      // CP ADR
-            {
-                if(state->cc.p)
-                    state->pc = (opcode[1] << 8) | opcode[2];
-            }
-            exec_time = (state->cc.p) ? 17 : 11;
-            break;
-
-        case 0xF5:      // PUSH PSW
-            {
-                uint8_t psw;
-                state->memory[state->sp-1] = state->a;
-                psw = (state->cc.z       |
-                       state->cc.s  << 1 | 
-                       state->cc.p  << 2 | 
-                       state->cc.cy << 3 | 
-                       state->cc.ac << 4);
-                state->memory[state->sp-2] = psw;
-                state->sp = state->sp - 2;
-            }
-            exec_time = 11;
-            break;
-
-        case 0xF6:      // ORI D8
-            {
-                uint16_t ans = state->a | opcode[1];
-                logic_set_flags(state);
-                state->a = ans;
-                state->pc++;
-            }
-            exec_time = 7;
-            break;
-
-        case 0xFB:      // EI (enable interrupt)
-            state->int_enable = 1;
-            exec_time = 4;
-            break;
-
-        case 0xF9:      // SPHL     sp <- hl
-            {
-                uint16_t hl;
-                hl = (state->h << 8) | state->l;
-                state->sp = hl;
-            }
-            exec_time = 5;
-            break;
-
-        case 0xFE:      // CPI D8
-            {
-                UnimplementedInstruction(state, opcode[0]);
-                // TODO : This instruction
-                //uint16_t ans = (uint16_t) state->a + (uint16_t) opcode[1];
-            }
-            exec_time = 7;
-            break;
-
-        default:
-            UnimplementedInstruction(state, opcode[0]);
-            return -1;
-    }
-    state->pc += 1;     
+/*
+ * cpu_interrupt()
+ * Raise an interrupt that puts RST n on the bus. Returns 1 if the CPU
+ * took it and 0 if interrupts are disabled. Like the real part, taking
+ * an interrupt disables further interrupts until the next EI.
+ */
+int cpu_interrupt(CPUState* state, int rst)
+{
+    if(!state->int_enable)
+        return 0;
+
+    state->sp -= 2;
+    cpu_mem_write(state, state->sp + 1, state->pc >> 8);
+    cpu_mem_write(state, state->sp, state->pc & 0xFF);
+    // The code caches don't see this write. They look at int_sp when
+    // int_pushes has moved on.
+    state->int_sp = state->sp;
+    state->int_pushes++;
+    state->pc = (rst & 0x7) << 3;
+    state->int_enable = 0;
+    state->cycles += 11;
+
+    return 1;
+}
 
-    return exec_time;       // TODO : what is the correct thing to return here?
+/*
+ * cpu_daa()
+ * DAA on an accumulator and flags, for cores that don't run it through
+ * the interpreter
+ */
+void cpu_daa(uint8_t* a, uint8_t* f)
+{
+    alu_daa(a, f);
 }
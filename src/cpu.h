@@ -9,20 +9,87 @@
 
 //#define CPU_DIAG
 #define CPU_MEM_SIZE 0x10000
-
+#define CPU_MEM_ALIGN 4096           // so that host pages of memory can be protected
+
+// Memory is mapped in 256 byte pages. Backing memory from cpu_create()
+// has one spare page after the address space that writes to protected
+// pages are sent to.
+#define CPU_PAGE_SIZE    256
+#define CPU_NUM_PAGES    (CPU_MEM_SIZE / CPU_PAGE_SIZE)
+#define CPU_PAGE_SINK    CPU_MEM_SIZE
+#define CPU_PAGE_HANDLER 0x80000000u  // page is served by a handler
+#define CPU_MEM_ALLOC    (CPU_MEM_SIZE + CPU_MEM_ALIGN)
+#define CPU_NUM_PORTS    256
+
+#include <stddef.h>
 #include <stdint.h>
 
-// Condition code
-typedef struct 
+// Condition codes. The bits are laid out the same way the 8080 stores
+// them in the PSW (S Z 0 AC 0 P 1 CY) so that the ALU can set every flag
+// with a single store from the flag tables, and PUSH/POP PSW are plain
+// byte copies. This relies on the compiler allocating bitfields from the
+// least significant bit, which GCC and clang do on little-endian targets.
+typedef union
 {
-    uint8_t z   :1;         //zero
-    uint8_t s   :1;         //sign
-    uint8_t p   :1;         //parity
-    uint8_t cy  :1;         //carry 
-    uint8_t ac  :1;
-    uint8_t pad :3;
+    struct
+    {
+        uint8_t cy   :1;        //carry
+        uint8_t one  :1;        //always 1 in the PSW
+        uint8_t p    :1;        //parity
+        uint8_t pad3 :1;
+        uint8_t ac   :1;        //auxillary carry
+        uint8_t pad5 :1;
+        uint8_t z    :1;        //zero
+        uint8_t s    :1;        //sign
+    };
+    uint8_t psw;
 } ConditionCodes;
 
+#define FLAG_CY   0x01
+#define FLAG_ONE  0x02
+#define FLAG_P    0x04
+#define FLAG_AC   0x10
+#define FLAG_Z    0x40
+#define FLAG_S    0x80
+#define FLAG_MASK (FLAG_S | FLAG_Z | FLAG_AC | FLAG_P | FLAG_ONE | FLAG_CY)
+
+struct CPUState;
+
+typedef uint8_t (*CPUMemRead)(struct CPUState* state, uint16_t addr);
+typedef void    (*CPUMemWrite)(struct CPUState* state, uint16_t addr, uint8_t val);
+
+// Page table. Each entry is the offset into state->memory of the backing
+// for that page, so the same map works for any machine it is attached
+// to. Pages tagged with CPU_PAGE_HANDLER go to the handler instead.
+// Registers in the CPUState may be out of date while a handler runs.
+// A machine that changes its map while running must call
+// cpu_mem_changed() afterwards. Sending a page's writes to a handler, or
+// a write handler pointing its own page back at its backing, doesn't
+// count: every core looks the write side up on each store.
+typedef struct CPUMemMap
+{
+    uint32_t    read[CPU_NUM_PAGES];
+    uint32_t    write[CPU_NUM_PAGES];
+    CPUMemRead  read_handler[CPU_NUM_PAGES];
+    CPUMemWrite write_handler[CPU_NUM_PAGES];
+} CPUMemMap;
+
+// I/O port handlers, called with the device they were attached with
+typedef uint8_t (*CPUPortIn)(struct CPUState* state, void* dev, uint8_t port);
+typedef void    (*CPUPortOut)(struct CPUState* state, void* dev, uint8_t port, uint8_t val);
+
+// Port tables. IN and OUT look their port up here and nothing else pays
+// for I/O. A port with no handler is unconnected: OUT to it is ignored
+// and IN from it leaves A as it is. Registers in the CPUState are up to
+// date while a handler runs.
+typedef struct CPUPorts
+{
+    CPUPortIn  in[CPU_NUM_PORTS];
+    CPUPortOut out[CPU_NUM_PORTS];
+    void*      in_dev[CPU_NUM_PORTS];
+    void*      out_dev[CPU_NUM_PORTS];
+} CPUPorts;
+
 // State structure 
 typedef struct CPUState
 {
@@ -36,72 +103,144 @@ typedef struct CPUState
     uint16_t       sp;
     uint16_t       pc;
     uint8_t        *memory;
+    uint64_t       mem_gen;         // see cpu_mem_changed()
+    const CPUMemMap *map;           // &cpu_map_flat unless a machine sets one
     ConditionCodes cc;
     uint8_t        int_enable;
-    uint16_t       shift_reg;
-    uint16_t       shift_amount;
+    uint16_t       int_sp;          // where cpu_interrupt() last pushed the PC
+    uint32_t       int_pushes;      // and how many times it has pushed one
+    uint64_t       cycles;          // total cycles executed
+    const CPUPorts *ports;          // NULL if no port is connected
+    void           *userdata;       // for the memory handlers
+    struct CPUProfile *profile;     // NULL unless profiling
+    struct Tracer     *tracer;      // NULL unless tracing
+    struct CPUSnapTracker *snap;    // NULL unless writes are tracked, see snapshot.h
     //int            mem_size;
 } CPUState;
 
+// An instruction from the decoded instruction cache
+typedef struct
+{
+    const void* handler;    // opcode handler (threaded interpreter only)
+    uint16_t    operand;    // the two bytes after the opcode
+    uint8_t     opcode;
+    uint8_t     length;     // in bytes, 0 if the entry isn't valid
+    uint8_t     cycles;     // base cycles, as in cpu_cycles[]
+} CPUDecodedOp;
+
+typedef struct CPUDecodeCache CPUDecodeCache;
+
 // Get a new emulator state
 CPUState *cpu_create(void);
 void cpu_destroy(CPUState *state);
 
+void cpu_mem_changed(CPUState* state);
+
 // Operation
-void cpu_shift_register(CPUState* state);
 int  cpu_run(CPUState* state, long cycles, int verbose);
+long cpu_run_fast(CPUState* state, long budget);
 int  cpu_exec(CPUState *state);
+int  cpu_interrupt(CPUState* state, int rst);
+void cpu_daa(uint8_t* a, uint8_t* f);
 void UnimplementedInstruction(CPUState *state, unsigned char opcode);
 
-// ======== INLINE METHODS ======== //
-// Simple parity loop. Probably can replace this with a faster routine later 
-static inline uint8_t Parity(uint8_t inp)
+// Memory map
+extern const CPUMemMap cpu_map_flat;
+void cpu_map_init(CPUMemMap* map);
+void cpu_map_mirror(CPUMemMap* map, uint16_t start, uint32_t end, uint16_t target, uint32_t target_end);
+void cpu_map_protect(CPUMemMap* map, uint16_t start, uint32_t end);
+void cpu_map_handler(CPUMemMap* map, uint16_t start, uint32_t end, CPUMemRead rd, CPUMemWrite wr);
+
+// I/O ports
+void cpu_ports_init(CPUPorts* ports);
+void cpu_ports_in(CPUPorts* ports, uint8_t first, uint8_t last, CPUPortIn fn, void* dev);
+void cpu_ports_out(CPUPorts* ports, uint8_t first, uint8_t last, CPUPortOut fn, void* dev);
+
+/*
+ * cpu_map_read()
+ * cpu_map_write()
+ * Access memory through a page table. RAM and ROM pages are one table
+ * lookup and an indexed load or store. Only handler pages branch away.
+ */
+static inline uint8_t cpu_map_read(struct CPUState* state, const CPUMemMap* map, const uint8_t* mem, uint16_t addr)
 {
-    uint8_t n = 0;
-    uint8_t x;
+    uint32_t off = map->read[addr >> 8];
 
-    x = inp;
-    while(x)
-    {
-        ++n;
-        x &= x - 1;
-    }
+    if(__builtin_expect(off & CPU_PAGE_HANDLER, 0))
+        return map->read_handler[addr >> 8](state, addr);
+    return mem[off | (addr & 0xFF)];
+}
+
+static inline void cpu_map_write(struct CPUState* state, const CPUMemMap* map, uint8_t* mem, uint16_t addr, uint8_t val)
+{
+    uint32_t off = map->write[addr >> 8];
 
-    return n;
+    if(__builtin_expect(off & CPU_PAGE_HANDLER, 0))
+        map->write_handler[addr >> 8](state, addr, val);
+    else
+        mem[off | (addr & 0xFF)] = val;
 }
 
-static inline int Parity2(int x, int size)
+// Memory known to be mapped flat (cpu_map_flat)
+static inline uint8_t cpu_flat_read(const uint8_t* mem, uint16_t addr)
 {
-    int i, p = 0;
+    return mem[addr];
+}
 
-    x = (x && ((1 << size)-1));
-    for(i = 0; i < size; i++)
-    {
-        if(x & 0x01)
-            p++;
-        x = x >> 1;
-    }
+static inline void cpu_flat_write(uint8_t* mem, uint16_t addr, uint8_t val)
+{
+    mem[addr] = val;
+}
 
-    return (0 == (p & 0x1));
+static inline uint8_t cpu_mem_read(CPUState* state, uint16_t addr)
+{
+    return cpu_map_read(state, state->map, state->memory, addr);
 }
 
-// Common instructions in arithmetic group
-static inline void arith_set_flags(CPUState *state, uint16_t ans)
+static inline void cpu_mem_write(CPUState* state, uint16_t addr, uint8_t val)
 {
-    state->cc.z  = ((ans & 0xFF) == 0);  // zero flag. 
-    state->cc.s  = ((ans & 0x80) != 0);  // sign flag. Set if bit 7 is set 
-    state->cc.cy = ((ans > 0xff) != 0);  // carry flag
-    state->cc.p = Parity2(ans & 0xFF, 16);    // parity flag
-} 
+    cpu_map_write(state, state->map, state->memory, addr, val);
+}
 
-static inline void logic_set_flags(CPUState *state)
+/*
+ * cpu_instrumented()
+ * True if a profile or trace is attached. These machines only run on
+ * the interpreter.
+ */
+static inline int cpu_instrumented(const CPUState* state)
 {
-    state->cc.cy = 0;
-    state->cc.ac = 0;
-    state->cc.s = (0x80 == (state->a & 0x80));
-    state->cc.p = Parity(state->a);
+    return state->profile != NULL || state->tracer != NULL;
 }
 
+// Decoded instruction cache. A cache follows the CPU's own writes, and
+// starts over when it is run on a different machine. The PC pushed by
+// cpu_interrupt() is caught up with through int_sp and int_pushes the
+// next time the cache runs. Anything else that changes memory (a loader,
+// a snapshot restore, a port handler doing DMA) must call
+// cpu_mem_changed() on the machine once it is done, or the cache will
+// keep running the old code.
+//
+// The cache only pays off in an unoptimised build, such as the -O0 one
+// the Makefile makes by default. With -O2 the interpreter's own fetch
+// from flat memory is as cheap as a cache lookup, and with the check on
+// every store the cache is at best even with it, whichever dispatch is
+// built. Use the JIT for speed there.
+CPUDecodeCache* cpu_dcache_create(void);
+void cpu_dcache_destroy(CPUDecodeCache* dc);
+void cpu_dcache_flush(CPUDecodeCache* dc);
+const CPUDecodedOp* cpu_dcache_lookup(const CPUDecodeCache* dc, uint16_t addr);
+unsigned long cpu_dcache_invalidations(const CPUDecodeCache* dc);
+long cpu_run_decoded(CPUState* state, CPUDecodeCache* dc, long budget);
+
+// ======== FLAG TABLES ======== //
+// S, Z and P for every 8-bit result, already in PSW bit positions
+extern const uint8_t cpu_flag_szp[256];
+// As above, indexed by a 9-bit result so that bit 8 also gives CY
+extern const uint8_t cpu_flag_szpc[512];
+// Base cycles for each opcode (not-taken time for conditional CALL/RET)
+extern const uint8_t cpu_cycles[256];
+// Instruction length in bytes
+extern const uint8_t cpu_op_len[256];
 
 
 #endif /*__CPU_H*/
@@ -0,0 +1,548 @@
+/*
+ * CPU_BANK
+ * Structure-of-arrays bank of 8080 machines
+ *
+ * Stefan Wong 2020
+ */
+
+#include <stddef.h>
+#include <stdlib.h>
+#include <string.h>
+#include "cpu_bank.h"
+
+#if (defined(__x86_64__) || defined(__i386__)) && defined(__GNUC__)
+#define BANK_AVX2
+#include <immintrin.h>
+#define AVX2_FUNC __attribute__((target("avx2")))
+#endif
+
+// What the vector path knows how to do with an opcode. Anything that
+// touches memory, the stack or the ports is left to the interpreter.
+typedef enum
+{
+    BK_NONE = 0,
+    BK_NOP,
+    BK_MOV,
+    BK_MVI,
+    BK_ALU,
+    BK_ALUI,
+    BK_INR,
+    BK_DCR,
+    BK_RLC,
+    BK_RRC,
+    BK_RAL,
+    BK_RAR,
+    BK_CMA,
+    BK_STC,
+    BK_CMC,
+    BK_JMP,
+    BK_JCC
+} BankClass;
+
+static uint8_t bank_class(uint8_t op)
+{
+    int dst = (op >> 3) & 0x7;
+    int src = op & 0x7;
+
+    if(op >= 0x40 && op < 0x80)
+        return (dst == 6 || src == 6) ? BK_NONE : BK_MOV;
+    if(op >= 0x80 && op < 0xC0)
+        return (src == 6) ? BK_NONE : BK_ALU;
+    if(op < 0x40)
+    {
+        switch(src)
+        {
+            case 4: return (dst == 6) ? BK_NONE : BK_INR;
+            case 5: return (dst == 6) ? BK_NONE : BK_DCR;
+            case 6: return (dst == 6) ? BK_NONE : BK_MVI;
+        }
+    }
+    switch(op)
+    {
+        case 0x00: return BK_NOP;
+        case 0x07: return BK_RLC;
+        case 0x0F: return BK_RRC;
+        case 0x17: return BK_RAL;
+        case 0x1F: return BK_RAR;
+        case 0x2F: return BK_CMA;
+        case 0x37: return BK_STC;
+        case 0x3F: return BK_CMC;
+        case 0xC3: return BK_JMP;
+        case 0xC2: case 0xCA: case 0xD2: case 0xDA:
+        case 0xE2: case 0xEA: case 0xF2: case 0xFA:
+            return BK_JCC;
+        case 0xC6: case 0xCE: case 0xD6: case 0xDE:
+        case 0xE6: case 0xEE: case 0xF6: case 0xFE:
+            return BK_ALUI;
+    }
+    return BK_NONE;
+}
+
+// Flag for each condition pair of Jcc (NZ/Z, NC/C, PO/PE, P/M)
+static const uint8_t cond_flag[4] = { FLAG_Z, FLAG_CY, FLAG_P, FLAG_S };
+
+// Ports of peeled lanes go to the bank's handlers
+static uint8_t bank_port_in(CPUState* state, void* dev, uint8_t port)
+{
+    CPUBank* bank = dev;
+
+    if(bank->port_in)
+        return bank->port_in(bank, bank->scratch_lane, port);
+    return state->a;
+}
+
+static void bank_port_out(CPUState* state, void* dev, uint8_t port, uint8_t val)
+{
+    CPUBank* bank = dev;
+
+    if(bank->port_out)
+        bank->port_out(bank, bank->scratch_lane, port, val);
+}
+
+/*
+ * cpu_bank_create()
+ */
+CPUBank* cpu_bank_create(int num_lanes)
+{
+    CPUBank* bank;
+    int      n;
+
+    if(num_lanes <= 0)
+        return NULL;
+    bank = calloc(1, sizeof(*bank));
+    if(!bank)
+        return NULL;
+
+    n = (num_lanes + CPU_BANK_VEC_LANES - 1) & ~(CPU_BANK_VEC_LANES - 1);
+    bank->num_lanes   = num_lanes;
+    bank->alloc_lanes = n;
+    for(int r = 0; r < 8; ++r)
+    {
+        if(r == 6)
+            continue;
+        bank->reg[r] = calloc(n, 1);
+        if(!bank->reg[r])
+            goto BANK_CREATE_FAIL;
+    }
+    bank->flags      = calloc(n, 1);
+    bank->int_enable = calloc(n, 1);
+    bank->halted     = calloc(n, 1);
+    bank->op         = calloc(n, 1);
+    bank->imm        = calloc(n, 1);
+    bank->mask       = calloc(n, 1);
+    bank->sp         = calloc(n, sizeof(*bank->sp));
+    bank->pc         = calloc(n, sizeof(*bank->pc));
+    bank->cycles     = calloc(n, sizeof(*bank->cycles));
+    bank->memory     = calloc(n, CPU_MEM_SIZE);
+    if(!bank->flags || !bank->int_enable || !bank->halted || !bank->op ||
+       !bank->imm || !bank->mask || !bank->sp || !bank->pc ||
+       !bank->cycles || !bank->memory)
+        goto BANK_CREATE_FAIL;
+    // Every port of a peeled lane goes to the bank's handlers
+    cpu_ports_init(&bank->scratch_ports);
+    cpu_ports_in(&bank->scratch_ports, 0, CPU_NUM_PORTS - 1, bank_port_in, bank);
+    cpu_ports_out(&bank->scratch_ports, 0, CPU_NUM_PORTS - 1, bank_port_out, bank);
+
+    // Padding lanes never run
+    for(int lane = 0; lane < n; ++lane)
+    {
+        bank->flags[lane] = FLAG_ONE;
+        if(lane >= num_lanes)
+            bank->halted[lane] = 1;
+    }
+#ifdef BANK_AVX2
+    __builtin_cpu_init();
+    bank->use_avx2 = __builtin_cpu_supports("avx2") != 0;
+#endif /*BANK_AVX2*/
+
+    return bank;
+
+BANK_CREATE_FAIL:
+    cpu_bank_destroy(bank);
+    return NULL;
+}
+
+/*
+ * cpu_bank_destroy()
+ */
+void cpu_bank_destroy(CPUBank* bank)
+{
+    if(!bank)
+        return;
+    for(int r = 0; r < 8; ++r)
+        free(bank->reg[r]);
+    free(bank->flags);
+    free(bank->int_enable);
+    free(bank->halted);
+    free(bank->op);
+    free(bank->imm);
+    free(bank->mask);
+    free(bank->sp);
+    free(bank->pc);
+    free(bank->cycles);
+    free(bank->memory);
+    free(bank);
+}
+
+/*
+ * cpu_bank_lane_memory()
+ */
+uint8_t* cpu_bank_lane_memory(CPUBank* bank, int lane)
+{
+    return &bank->memory[(size_t) lane * CPU_MEM_SIZE];
+}
+
+/*
+ * cpu_bank_set_lane()
+ * Copy the registers of state into a lane. Memory is not copied.
+ */
+void cpu_bank_set_lane(CPUBank* bank, int lane, const CPUState* state)
+{
+    bank->reg[0][lane]     = state->b;
+    bank->reg[1][lane]     = state->c;
+    bank->reg[2][lane]     = state->d;
+    bank->reg[3][lane]     = state->e;
+    bank->reg[4][lane]     = state->h;
+    bank->reg[5][lane]     = state->l;
+    bank->reg[7][lane]     = state->a;
+    bank->flags[lane]      = state->cc.psw;
+    bank->int_enable[lane] = state->int_enable;
+    bank->sp[lane]         = state->sp;
+    bank->pc[lane]         = state->pc;
+    bank->cycles[lane]     = state->cycles;
+    bank->halted[lane]     = 0;
+}
+
+/*
+ * cpu_bank_get_lane()
+ * Copy a lane out into state. state->memory is pointed at the lane's memory,
+ * which is always mapped flat.
+ */
+void cpu_bank_get_lane(CPUBank* bank, int lane, CPUState* state)
+{
+    state->b          = bank->reg[0][lane];
+    state->c          = bank->reg[1][lane];
+    state->d          = bank->reg[2][lane];
+    state->e          = bank->reg[3][lane];
+    state->h          = bank->reg[4][lane];
+    state->l          = bank->reg[5][lane];
+    state->a          = bank->reg[7][lane];
+    state->cc.psw     = bank->flags[lane];
+    state->int_enable = bank->int_enable[lane];
+    state->sp         = bank->sp[lane];
+    state->pc         = bank->pc[lane];
+    state->cycles     = bank->cycles[lane];
+    state->memory     = cpu_bank_lane_memory(bank, lane);
+    state->map        = &cpu_map_flat;
+}
+
+/*
+ * cpu_bank_active()
+ * Number of lanes that haven't halted
+ */
+int cpu_bank_active(const CPUBank* bank)
+{
+    int n = 0;
+
+    for(int lane = 0; lane < bank->num_lanes; ++lane)
+        n += !bank->halted[lane];
+
+    return n;
+}
+
+// ======== PEELED LANES ======== //
+// Run one instruction on one lane with the interpreter
+static void bank_step_lane(CPUBank* bank, int lane)
+{
+    CPUState* s = &bank->scratch;
+    int       status;
+
+    cpu_bank_get_lane(bank, lane, s);
+    s->ports = &bank->scratch_ports;
+    bank->scratch_lane = lane;
+    status = cpu_exec(s);
+    cpu_bank_set_lane(bank, lane, s);
+    if(status < 0)
+        bank->halted[lane] = 1;
+}
+
+
+// ======== VECTOR PATH ======== //
+#ifdef BANK_AVX2
+// x < y, unsigned, as a byte mask
+AVX2_FUNC static inline __m256i v_ltu(__m256i x, __m256i y)
+{
+    return _mm256_xor_si256(_mm256_cmpeq_epi8(_mm256_max_epu8(x, y), x), _mm256_set1_epi8(-1));
+}
+
+// S, Z, P and the fixed bit for each byte of res. P uses the same nibble
+// trick as the flag tables in cpu.c, with a shuffle as the nibble table.
+AVX2_FUNC static inline __m256i v_szp(__m256i res)
+{
+    const __m256i odd = _mm256_setr_epi8(
+        0, FLAG_P, FLAG_P, 0, FLAG_P, 0, 0, FLAG_P, FLAG_P, 0, 0, FLAG_P, 0, FLAG_P, FLAG_P, 0,
+        0, FLAG_P, FLAG_P, 0, FLAG_P, 0, 0, FLAG_P, FLAG_P, 0, 0, FLAG_P, 0, FLAG_P, FLAG_P, 0);
+    const __m256i nib = _mm256_set1_epi8(0x0F);
+    __m256i lo = _mm256_and_si256(res, nib);
+    __m256i hi = _mm256_and_si256(_mm256_srli_epi16(res, 4), nib);
+    __m256i p  = _mm256_xor_si256(_mm256_shuffle_epi8(odd, lo), _mm256_shuffle_epi8(odd, hi));
+    __m256i s  = _mm256_and_si256(res, _mm256_set1_epi8((char) FLAG_S));
+    __m256i z  = _mm256_and_si256(_mm256_cmpeq_epi8(res, _mm256_setzero_si256()), _mm256_set1_epi8(FLAG_Z));
+
+    p = _mm256_xor_si256(p, _mm256_set1_epi8(FLAG_P));
+    return _mm256_or_si256(_mm256_or_si256(s, z), _mm256_or_si256(p, _mm256_set1_epi8(FLAG_ONE)));
+}
+
+// ADD ADC SUB SBB ANA XRA ORA CMP on 32 lanes, as alu_*() in cpu.c
+AVX2_FUNC static inline void v_alu(int kind, __m256i* a, __m256i* f, __m256i v)
+{
+    const __m256i one = _mm256_set1_epi8(1);
+    const __m256i ac  = _mm256_set1_epi8(FLAG_AC);
+    __m256i cy = _mm256_and_si256(*f, one);
+    __m256i res, flags;
+
+    if(kind < 4 || kind == 7)
+    {
+        __m256i cin = _mm256_setzero_si256();
+        __m256i sum, carry;
+
+        // Subtraction adds the complement and inverts the carry
+        if(kind >= 2)
+        {
+            v   = _mm256_xor_si256(v, _mm256_set1_epi8(-1));
+            cin = (kind == 3) ? _mm256_xor_si256(cy, one) : one;
+        }
+        else if(kind == 1)
+            cin = cy;
+        sum   = _mm256_add_epi8(*a, v);
+        res   = _mm256_add_epi8(sum, cin);
+        carry = _mm256_and_si256(_mm256_or_si256(v_ltu(sum, *a), v_ltu(res, sum)), one);
+        if(kind >= 2)
+            carry = _mm256_xor_si256(carry, one);
+        flags = _mm256_or_si256(v_szp(res), carry);
+        flags = _mm256_or_si256(flags, _mm256_and_si256(_mm256_xor_si256(_mm256_xor_si256(*a, v), res), ac));
+        *f = flags;
+        if(kind != 7)
+            *a = res;
+        return;
+    }
+
+    if(kind == 4)
+    {
+        // AC is the OR of bit 3 of the operands
+        __m256i bit3 = _mm256_and_si256(_mm256_or_si256(*a, v), _mm256_set1_epi8(0x08));
+        res = _mm256_and_si256(*a, v);
+        *f  = _mm256_or_si256(v_szp(res), _mm256_add_epi8(bit3, bit3));
+    }
+    else
+    {
+        res = (kind == 5) ? _mm256_xor_si256(*a, v) : _mm256_or_si256(*a, v);
+        *f  = v_szp(res);
+    }
+    *a = res;
+}
+
+AVX2_FUNC static inline __m256i v_blend_store(uint8_t* dst, __m256i val, __m256i m)
+{
+    __m256i old = _mm256_loadu_si256((const __m256i*) dst);
+    __m256i out = _mm256_blendv_epi8(old, val, m);
+    _mm256_storeu_si256((__m256i*) dst, out);
+    return out;
+}
+
+/*
+ * bank_vec_step()
+ * Apply the register and flag effects of op to every lane in the mask
+ */
+AVX2_FUNC static void bank_vec_step(CPUBank* bank, uint8_t op, int cls)
+{
+    const __m256i one  = _mm256_set1_epi8(1);
+    const __m256i low4 = _mm256_set1_epi8(0x0F);
+    int dst = (op >> 3) & 0x7;
+    int src = op & 0x7;
+
+    for(int i = 0; i < bank->alloc_lanes; i += CPU_BANK_VEC_LANES)
+    {
+        __m256i m = _mm256_loadu_si256((const __m256i*) &bank->mask[i]);
+        __m256i a, f, r, res, ac;
+
+        if(_mm256_testz_si256(m, m))
+            continue;
+        a = _mm256_loadu_si256((const __m256i*) &bank->reg[7][i]);
+        f = _mm256_loadu_si256((const __m256i*) &bank->flags[i]);
+
+        switch(cls)
+        {
+            case BK_MOV:
+                r = _mm256_loadu_si256((const __m256i*) &bank->reg[src][i]);
+                v_blend_store(&bank->reg[dst][i], r, m);
+                continue;
+            case BK_MVI:
+                r = _mm256_loadu_si256((const __m256i*) &bank->imm[i]);
+                v_blend_store(&bank->reg[dst][i], r, m);
+                continue;
+            case BK_ALU:
+                r = _mm256_loadu_si256((const __m256i*) &bank->reg[src][i]);
+                v_alu(dst, &a, &f, r);
+                break;
+            case BK_ALUI:
+                r = _mm256_loadu_si256((const __m256i*) &bank->imm[i]);
+                v_alu(dst, &a, &f, r);
+                break;
+            case BK_INR:
+            case BK_DCR:
+                r = _mm256_loadu_si256((const __m256i*) &bank->reg[dst][i]);
+                if(cls == BK_INR)
+                {
+                    res = _mm256_add_epi8(r, one);
+                    ac  = _mm256_cmpeq_epi8(_mm256_and_si256(res, low4), _mm256_setzero_si256());
+                }
+                else
+                {
+                    res = _mm256_sub_epi8(r, one);
+                    ac  = _mm256_xor_si256(_mm256_cmpeq_epi8(_mm256_and_si256(res, low4), low4),
+                                           _mm256_set1_epi8(-1));
+                }
+                ac = _mm256_and_si256(ac, _mm256_set1_epi8(FLAG_AC));
+                f  = _mm256_or_si256(_mm256_or_si256(v_szp(res), ac), _mm256_and_si256(f, one));
+                // A may be the destination, so reload it after the store
+                v_blend_store(&bank->reg[dst][i], res, m);
+                a  = _mm256_loadu_si256((const __m256i*) &bank->reg[7][i]);
+                break;
+            case BK_RLC:
+            case BK_RRC:
+            case BK_RAL:
+            case BK_RAR:
+            {
+                __m256i msb = _mm256_and_si256(_mm256_srli_epi16(a, 7), one);
+                __m256i lsb = _mm256_and_si256(a, one);
+                __m256i shl = _mm256_add_epi8(a, a);
+                __m256i shr = _mm256_and_si256(_mm256_srli_epi16(a, 1), _mm256_set1_epi8(0x7F));
+                __m256i in, cy;
+
+                if(cls == BK_RLC || cls == BK_RAL)
+                {
+                    in = (cls == BK_RLC) ? msb : _mm256_and_si256(f, one);
+                    a  = _mm256_or_si256(shl, in);
+                    cy = msb;
+                }
+                else
+                {
+                    in = (cls == BK_RRC) ? lsb : _mm256_and_si256(f, one);
+                    in = _mm256_and_si256(_mm256_cmpeq_epi8(in, one), _mm256_set1_epi8((char) 0x80));
+                    a  = _mm256_or_si256(shr, in);
+                    cy = lsb;
+                }
+                f = _mm256_or_si256(_mm256_andnot_si256(one, f), cy);
+                break;
+            }
+            case BK_CMA:
+                a = _mm256_xor_si256(a, _mm256_set1_epi8(-1));
+                break;
+            case BK_STC:
+                f = _mm256_or_si256(f, one);
+                break;
+            case BK_CMC:
+                f = _mm256_xor_si256(f, one);
+                break;
+            default:        // NOP and jumps only move the PC
+                continue;
+        }
+        v_blend_store(&bank->reg[7][i], a, m);
+        v_blend_store(&bank->flags[i], f, m);
+    }
+}
+#endif /*BANK_AVX2*/
+
+// Move the PC and cycle count on for every lane that ran op on the vector path
+static void bank_vec_advance(CPUBank* bank, uint8_t op, int cls)
+{
+    int     cond = (op >> 3) & 0x7;
+    uint8_t flag = cond_flag[cond >> 1];
+
+    for(int lane = 0; lane < bank->num_lanes; ++lane)
+    {
+        const uint8_t* mem;
+        uint16_t       pc;
+
+        if(!bank->mask[lane])
+            continue;
+        mem = cpu_bank_lane_memory(bank, lane);
+        pc  = bank->pc[lane];
+        if(cls == BK_JMP || cls == BK_JCC)
+        {
+            uint16_t target = mem[(uint16_t) (pc + 1)] | (mem[(uint16_t) (pc + 2)] << 8);
+            int      taken  = 1;
+
+            if(cls == BK_JCC)
+                taken = ((bank->flags[lane] & flag) != 0) == (cond & 1);
+            bank->pc[lane] = taken ? target : (uint16_t) (pc + 3);
+        }
+        else
+            bank->pc[lane] = pc + cpu_op_len[op];
+        bank->cycles[lane] += cpu_cycles[op];
+        bank->vector_ops++;
+    }
+}
+
+/*
+ * cpu_bank_step()
+ * Run one instruction on every lane that hasn't halted, steps times over.
+ * The opcode of the first live lane leads each step. Every lane at the
+ * same opcode runs it on the vector unit when it can, and the others are
+ * peeled off and run through the interpreter. Returns the number of
+ * lane-instructions executed.
+ */
+long cpu_bank_step(CPUBank* bank, long steps)
+{
+    long executed = 0;
+
+    for(long s = 0; s < steps; ++s)
+    {
+        int     leader = -1;
+        uint8_t lead_op;
+        int     cls;
+
+        for(int lane = 0; lane < bank->num_lanes; ++lane)
+        {
+            if(bank->halted[lane])
+                continue;
+            bank->op[lane] = cpu_bank_lane_memory(bank, lane)[bank->pc[lane]];
+            if(leader < 0)
+                leader = lane;
+        }
+        if(leader < 0)
+            break;
+
+        lead_op = bank->op[leader];
+        cls     = bank_class(lead_op);
+        memset(bank->mask, 0, bank->alloc_lanes);
+#ifdef BANK_AVX2
+        if(bank->use_avx2 && cls != BK_NONE)
+        {
+            for(int lane = 0; lane < bank->num_lanes; ++lane)
+            {
+                if(bank->halted[lane] || bank->op[lane] != lead_op)
+                    continue;
+                bank->mask[lane] = 0xFF;
+                bank->imm[lane]  = cpu_bank_lane_memory(bank, lane)[(uint16_t) (bank->pc[lane] + 1)];
+            }
+            bank_vec_step(bank, lead_op, cls);
+            bank_vec_advance(bank, lead_op, cls);
+        }
+#endif /*BANK_AVX2*/
+
+        for(int lane = 0; lane < bank->num_lanes; ++lane)
+        {
+            if(bank->halted[lane])
+                continue;
+            executed++;
+            if(bank->mask[lane])
+                continue;
+            bank_step_lane(bank, lane);
+            bank->scalar_ops++;
+        }
+    }
+
+    return executed;
+}
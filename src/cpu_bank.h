@@ -0,0 +1,59 @@
+/*
+ * CPU_BANK
+ * A bank of 8080 machines stored as structure-of-arrays. Every step runs
+ * one instruction on every lane. Lanes that share an opcode run together
+ * on the vector unit and the rest are peeled off and run one at a time
+ * through cpu_exec().
+ *
+ * Stefan Wong 2020
+ */
+
+#ifndef __CPU_BANK_H
+#define __CPU_BANK_H
+
+#include <stdint.h>
+#include "cpu.h"
+
+#define CPU_BANK_VEC_LANES 32       // lanes per 256-bit vector
+
+typedef struct CPUBank
+{
+    int       num_lanes;            // as requested
+    int       alloc_lanes;          // rounded up to a whole vector
+    // Registers, indexed by the 8080 register field (B C D E H L M A).
+    // reg[6] is NULL since M is memory.
+    uint8_t*  reg[8];
+    uint8_t*  flags;
+    uint8_t*  int_enable;
+    uint8_t*  halted;
+    uint16_t* sp;
+    uint16_t* pc;
+    uint64_t* cycles;
+    uint8_t*  memory;               // CPU_MEM_SIZE bytes per lane
+    // Per step scratch
+    uint8_t*  op;
+    uint8_t*  imm;
+    uint8_t*  mask;
+    // Port handlers for lanes that run IN or OUT
+    uint8_t   (*port_in)(struct CPUBank* bank, int lane, uint8_t port);
+    void      (*port_out)(struct CPUBank* bank, int lane, uint8_t port, uint8_t val);
+    void*     userdata;
+    // Lane-instructions run on the vector unit and one at a time
+    unsigned long vector_ops;
+    unsigned long scalar_ops;
+    int       use_avx2;
+    // Used to run peeled lanes through the interpreter
+    CPUState  scratch;
+    CPUPorts  scratch_ports;
+    int       scratch_lane;
+} CPUBank;
+
+CPUBank* cpu_bank_create(int num_lanes);
+void     cpu_bank_destroy(CPUBank* bank);
+uint8_t* cpu_bank_lane_memory(CPUBank* bank, int lane);
+void     cpu_bank_set_lane(CPUBank* bank, int lane, const CPUState* state);
+void     cpu_bank_get_lane(CPUBank* bank, int lane, CPUState* state);
+long     cpu_bank_step(CPUBank* bank, long steps);
+int      cpu_bank_active(const CPUBank* bank);
+
+#endif /*__CPU_BANK_H*/
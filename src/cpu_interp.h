@@ -0,0 +1,511 @@
+/*
+ * CPU_INTERP
+ * Body of the 8080 interpreter. cpu.c includes this once for each
+ * interpreter it builds, with INTERP_NAME set to the name of the function.
+ * Defining INTERP_DECODED builds the copy that fetches from the decoded
+ * instruction cache instead of from memory. Defining INTERP_PAGED builds
+ * the copy that goes through the state's memory map rather than
+ * assuming flat memory. Defining INTERP_INSTRUMENT as well builds the
+ * copy that fills in the state's profile and trace, so the others never
+ * pay for them.
+ *
+ * Stefan Wong 2020
+ */
+
+// No include guard, this is meant to be included more than once
+
+#if defined(INTERP_INSTRUMENT) && defined(INTERP_DECODED)
+#error "the instrumented interpreter fetches from memory, not the decoded cache"
+#endif
+
+#ifdef INTERP_PAGED
+#define MEM_RD(addr)        cpu_map_read(state, map, mem, (addr))
+#define MEM_WR(addr, val)   cpu_map_write(state, map, mem, (addr), (val))
+#else
+#define MEM_RD(addr)        cpu_flat_read(mem, (addr))
+#define MEM_WR(addr, val)   cpu_flat_write(mem, (addr), (val))
+#endif /*INTERP_PAGED*/
+
+#ifdef INTERP_DECODED
+// Operands come from the cache entry, and every write checks whether it
+// landed on a page that has been decoded.
+#define WR(addr, val)   dcache_write(dc, mem, (addr), (val))
+#define IMM8            (dec->operand & 0xFF)
+#define IMM16           (dec->operand)
+// A port handler that changed memory has said so with cpu_mem_changed()
+#define PORT_DONE() do { \
+    if(state->mem_gen != dc->mem_gen) \
+    { \
+        cpu_dcache_flush(dc); \
+        dc->mem_gen = state->mem_gen; \
+    } \
+} while(0)
+#ifdef CPU_THREADED
+#define FETCH() do { \
+    dec = &dc->ops[pc]; \
+    if(!dec->length) \
+    { \
+        dcache_fill(dc, mem, pc); \
+        dec->handler = dispatch_table[dec->opcode]; \
+    } \
+    pc++; \
+} while(0)
+#define DISPATCH()      goto *dec->handler
+#else
+#define FETCH() do { \
+    dec = &dc->ops[pc]; \
+    if(!dec->length) \
+        dcache_fill(dc, mem, pc); \
+    opcode = dec->opcode; \
+    pc++; \
+} while(0)
+#endif /*CPU_THREADED*/
+#else
+#define WR(addr, val)   MEM_WR((uint16_t) (addr), (val))
+#define IMM8            RD(pc)
+#define IMM16           RD16(pc)
+#define PORT_DONE()     ((void) 0)
+#ifdef INTERP_INSTRUMENT
+// Each fetch closes out the instruction before it in the profile. The
+// last one is closed out on the way out of the interpreter.
+#define PROFILE_DONE() do { \
+    if(prof && prof_pc >= 0) \
+        cpu_profile_add(prof, prof_pc, prof_op, cycles - prof_start); \
+} while(0)
+// The trace gets the state before the instruction runs. Operands are
+// only read if the instruction has them, as it would read them anyway.
+#define TRACE_STEP() do { \
+    if(tracer) \
+    { \
+        TraceRecord rec; \
+        rec.cycles     = cycle_base + cycles; \
+        rec.pc         = pc; \
+        rec.sp         = sp; \
+        rec.opcode     = opcode; \
+        rec.operand[0] = (cpu_op_len[opcode] > 1) ? RD(pc + 1) : 0; \
+        rec.operand[1] = (cpu_op_len[opcode] > 2) ? RD(pc + 2) : 0; \
+        rec.a          = acc; \
+        rec.b          = state->b; \
+        rec.c          = state->c; \
+        rec.d          = state->d; \
+        rec.e          = state->e; \
+        rec.h          = state->h; \
+        rec.l          = state->l; \
+        rec.flags      = flags; \
+        rec.pad        = 0; \
+        tracer_push(tracer, &rec); \
+    } \
+} while(0)
+#define FETCH() do { \
+    PROFILE_DONE(); \
+    opcode     = RD(pc); \
+    TRACE_STEP(); \
+    prof_pc    = pc++; \
+    prof_start = cycles; \
+    prof_op    = opcode; \
+} while(0)
+#else
+#define FETCH()         (opcode = RD(pc++))
+#endif /*INTERP_INSTRUMENT*/
+#define DISPATCH()      goto *dispatch_table[opcode]
+#endif /*INTERP_DECODED*/
+
+/*
+ * INTERP_NAME()
+ * Execute instructions until at least budget cycles have elapsed. Returns
+ * the number of cycles executed, or a negative status if the CPU halted.
+ */
+static long INTERP_NAME(CPUState* state, CPUDecodeCache* dc, long budget)
+{
+    long     cycles = 0;
+    long     status = 0;
+#if !defined(INTERP_DECODED) || !defined(CPU_THREADED)
+    uint8_t  opcode;
+#endif
+    uint8_t* mem    = state->memory;
+#ifdef INTERP_PAGED
+    const CPUMemMap* map = state->map;
+#endif /*INTERP_PAGED*/
+    uint16_t pc     = state->pc;
+    uint16_t sp     = state->sp;
+    uint8_t  acc    = state->a;
+    uint8_t  flags  = state->cc.psw;
+    uint64_t cycle_base = state->cycles;
+#ifdef INTERP_DECODED
+    CPUDecodedOp* dec;
+#endif /*INTERP_DECODED*/
+#ifdef INTERP_INSTRUMENT
+    CPUProfile* prof   = state->profile;
+    Tracer*  tracer     = state->tracer;
+    int32_t  prof_pc    = -1;
+    uint8_t  prof_op    = 0;
+    long     prof_start = 0;
+#endif /*INTERP_INSTRUMENT*/
+
+#ifdef CPU_THREADED
+#define L(n) &&op_##n
+    // Undocumented opcodes point at the handler for the instruction they
+    // alias on real hardware.
+    static const void* const dispatch_table[256] = {
+        L(00), L(01), L(02), L(03), L(04), L(05), L(06), L(07), L(00), L(09), L(0A), L(0B), L(0C), L(0D), L(0E), L(0F),
+        L(00), L(11), L(12), L(13), L(14), L(15), L(16), L(17), L(00), L(19), L(1A), L(1B), L(1C), L(1D), L(1E), L(1F),
+        L(00), L(21), L(22), L(23), L(24), L(25), L(26), L(27), L(00), L(29), L(2A), L(2B), L(2C), L(2D), L(2E), L(2F),
+        L(00), L(31), L(32), L(33), L(34), L(35), L(36), L(37), L(00), L(39), L(3A), L(3B), L(3C), L(3D), L(3E), L(3F),
+        L(40), L(41), L(42), L(43), L(44), L(45), L(46), L(47), L(48), L(49), L(4A), L(4B), L(4C), L(4D), L(4E), L(4F),
+        L(50), L(51), L(52), L(53), L(54), L(55), L(56), L(57), L(58), L(59), L(5A), L(5B), L(5C), L(5D), L(5E), L(5F),
+        L(60), L(61), L(62), L(63), L(64), L(65), L(66), L(67), L(68), L(69), L(6A), L(6B), L(6C), L(6D), L(6E), L(6F),
+        L(70), L(71), L(72), L(73), L(74), L(75), L(76), L(77), L(78), L(79), L(7A), L(7B), L(7C), L(7D), L(7E), L(7F),
+        L(80), L(81), L(82), L(83), L(84), L(85), L(86), L(87), L(88), L(89), L(8A), L(8B), L(8C), L(8D), L(8E), L(8F),
+        L(90), L(91), L(92), L(93), L(94), L(95), L(96), L(97), L(98), L(99), L(9A), L(9B), L(9C), L(9D), L(9E), L(9F),
+        L(A0), L(A1), L(A2), L(A3), L(A4), L(A5), L(A6), L(A7), L(A8), L(A9), L(AA), L(AB), L(AC), L(AD), L(AE), L(AF),
+        L(B0), L(B1), L(B2), L(B3), L(B4), L(B5), L(B6), L(B7), L(B8), L(B9), L(BA), L(BB), L(BC), L(BD), L(BE), L(BF),
+        L(C0), L(C1), L(C2), L(C3), L(C4), L(C5), L(C6), L(C7), L(C8), L(C9), L(CA), L(C3), L(CC), L(CD), L(CE), L(CF),
+        L(D0), L(D1), L(D2), L(D3), L(D4), L(D5), L(D6), L(D7), L(D8), L(C9), L(DA), L(DB), L(DC), L(CD), L(DE), L(DF),
+        L(E0), L(E1), L(E2), L(E3), L(E4), L(E5), L(E6), L(E7), L(E8), L(E9), L(EA), L(EB), L(EC), L(CD), L(EE), L(EF),
+        L(F0), L(F1), L(F2), L(F3), L(F4), L(F5), L(F6), L(F7), L(F8), L(F9), L(FA), L(FB), L(FC), L(CD), L(FE), L(FF),
+    };
+#undef L
+#endif /*CPU_THREADED*/
+
+#ifndef CPU_THREADED
+INTERP_FETCH:
+#endif
+    if(cycles >= budget)
+        goto INTERP_END;
+    FETCH();
+
+#ifdef CPU_THREADED
+    DISPATCH();
+#else
+    switch(opcode)
+    {
+#endif
+        // ======== MISC / 16-BIT GROUP ======== //
+        OP(00) ALIAS(08) ALIAS(10) ALIAS(18) ALIAS(20) ALIAS(28) ALIAS(30) ALIAS(38)
+        {
+            NEXT(4);        // NOP
+        }
+
+        OP(01) { state->c = IMM16 & 0xFF; state->b = IMM16 >> 8; pc += 2; NEXT(10); }     // LXI B
+        OP(11) { state->e = IMM16 & 0xFF; state->d = IMM16 >> 8; pc += 2; NEXT(10); }     // LXI D
+        OP(21) { state->l = IMM16 & 0xFF; state->h = IMM16 >> 8; pc += 2; NEXT(10); }     // LXI H
+        OP(31) { sp = IMM16; pc += 2; NEXT(10); }                                          // LXI SP
+
+        OP(02) { WR(REG_BC, acc); NEXT(7); }        // STAX B
+        OP(12) { WR(REG_DE, acc); NEXT(7); }        // STAX D
+        OP(0A) { acc = RD(REG_BC); NEXT(7); }       // LDAX B
+        OP(1A) { acc = RD(REG_DE); NEXT(7); }       // LDAX D
+
+        OP(22)      // SHLD adr
+        {
+            uint16_t addr = IMM16;
+            WR(addr, state->l);
+            WR(addr + 1, state->h);
+            pc += 2;
+            NEXT(16);
+        }
+        OP(2A)      // LHLD adr
+        {
+            uint16_t addr = IMM16;
+            state->l = RD(addr);
+            state->h = RD(addr + 1);
+            pc += 2;
+            NEXT(16);
+        }
+        OP(32) { WR(IMM16, acc); pc += 2; NEXT(13); }      // STA adr
+        OP(3A) { acc = RD(IMM16); pc += 2; NEXT(13); }     // LDA adr
+
+        OP(03) { uint16_t bc = REG_BC + 1; state->b = bc >> 8; state->c = bc & 0xFF; NEXT(5); }   // INX B
+        OP(13) { uint16_t de = REG_DE + 1; state->d = de >> 8; state->e = de & 0xFF; NEXT(5); }   // INX D
+        OP(23) { uint16_t hl = REG_HL + 1; state->h = hl >> 8; state->l = hl & 0xFF; NEXT(5); }   // INX H
+        OP(33) { sp++; NEXT(5); }                                                                 // INX SP
+        OP(0B) { uint16_t bc = REG_BC - 1; state->b = bc >> 8; state->c = bc & 0xFF; NEXT(5); }   // DCX B
+        OP(1B) { uint16_t de = REG_DE - 1; state->d = de >> 8; state->e = de & 0xFF; NEXT(5); }   // DCX D
+        OP(2B) { uint16_t hl = REG_HL - 1; state->h = hl >> 8; state->l = hl & 0xFF; NEXT(5); }   // DCX H
+        OP(3B) { sp--; NEXT(5); }                                                                 // DCX SP
+
+        OP(09) { alu_dad(state, &flags, REG_BC); NEXT(10); }    // DAD B
+        OP(19) { alu_dad(state, &flags, REG_DE); NEXT(10); }    // DAD D
+        OP(29) { alu_dad(state, &flags, REG_HL); NEXT(10); }    // DAD H
+        OP(39) { alu_dad(state, &flags, sp); NEXT(10); }        // DAD SP
+
+        INR_R(04, b)
+        INR_R(0C, c)
+        INR_R(14, d)
+        INR_R(1C, e)
+        INR_R(24, h)
+        INR_R(2C, l)
+        INR_R(3C, a)
+        OP(34) { uint16_t hl = REG_HL; WR(hl, alu_inr(&flags, RD(hl))); NEXT(10); }    // INR M
+
+        DCR_R(05, b)
+        DCR_R(0D, c)
+        DCR_R(15, d)
+        DCR_R(1D, e)
+        DCR_R(25, h)
+        DCR_R(2D, l)
+        DCR_R(3D, a)
+        OP(35) { uint16_t hl = REG_HL; WR(hl, alu_dcr(&flags, RD(hl))); NEXT(10); }    // DCR M
+
+        MVI_R(06, b)
+        MVI_R(0E, c)
+        MVI_R(16, d)
+        MVI_R(1E, e)
+        MVI_R(26, h)
+        MVI_R(2E, l)
+        MVI_R(3E, a)
+        OP(36) { WR(REG_HL, IMM8); pc++; NEXT(10); }        // MVI M
+
+        OP(07)      // RLC
+        {
+            flags = (flags & ~FLAG_CY) | (acc >> 7);
+            acc   = (acc << 1) | (acc >> 7);
+            NEXT(4);
+        }
+        OP(0F)      // RRC
+        {
+            flags = (flags & ~FLAG_CY) | (acc & 0x1);
+            acc   = (acc >> 1) | (acc << 7);
+            NEXT(4);
+        }
+        OP(17)      // RAL
+        {
+            uint8_t cy = flags & FLAG_CY;
+            flags = (flags & ~FLAG_CY) | (acc >> 7);
+            acc   = (acc << 1) | cy;
+            NEXT(4);
+        }
+        OP(1F)      // RAR
+        {
+            uint8_t cy = flags & FLAG_CY;
+            flags = (flags & ~FLAG_CY) | (acc & 0x1);
+            acc   = (acc >> 1) | (cy << 7);
+            NEXT(4);
+        }
+
+        OP(27) { alu_daa(&acc, &flags); NEXT(4); }      // DAA
+        OP(2F) { acc = ~acc; NEXT(4); }                 // CMA
+        OP(37) { flags |= FLAG_CY; NEXT(4); }           // STC
+        OP(3F) { flags ^= FLAG_CY; NEXT(4); }           // CMC
+
+        // ======== MOV GROUP ======== //
+        MOV_RR(40, b, b) MOV_RR(41, b, c) MOV_RR(42, b, d) MOV_RR(43, b, e)
+        MOV_RR(44, b, h) MOV_RR(45, b, l) MOV_RM(46, b)    MOV_RR(47, b, a)
+        MOV_RR(48, c, b) MOV_RR(49, c, c) MOV_RR(4A, c, d) MOV_RR(4B, c, e)
+        MOV_RR(4C, c, h) MOV_RR(4D, c, l) MOV_RM(4E, c)    MOV_RR(4F, c, a)
+        MOV_RR(50, d, b) MOV_RR(51, d, c) MOV_RR(52, d, d) MOV_RR(53, d, e)
+        MOV_RR(54, d, h) MOV_RR(55, d, l) MOV_RM(56, d)    MOV_RR(57, d, a)
+        MOV_RR(58, e, b) MOV_RR(59, e, c) MOV_RR(5A, e, d) MOV_RR(5B, e, e)
+        MOV_RR(5C, e, h) MOV_RR(5D, e, l) MOV_RM(5E, e)    MOV_RR(5F, e, a)
+        MOV_RR(60, h, b) MOV_RR(61, h, c) MOV_RR(62, h, d) MOV_RR(63, h, e)
+        MOV_RR(64, h, h) MOV_RR(65, h, l) MOV_RM(66, h)    MOV_RR(67, h, a)
+        MOV_RR(68, l, b) MOV_RR(69, l, c) MOV_RR(6A, l, d) MOV_RR(6B, l, e)
+        MOV_RR(6C, l, h) MOV_RR(6D, l, l) MOV_RM(6E, l)    MOV_RR(6F, l, a)
+        MOV_MR(70, b)    MOV_MR(71, c)    MOV_MR(72, d)    MOV_MR(73, e)
+        MOV_MR(74, h)    MOV_MR(75, l)                     MOV_MR(77, a)
+        MOV_RR(78, a, b) MOV_RR(79, a, c) MOV_RR(7A, a, d) MOV_RR(7B, a, e)
+        MOV_RR(7C, a, h) MOV_RR(7D, a, l) MOV_RM(7E, a)    MOV_RR(7F, a, a)
+
+        OP(76)      // HLT
+        {
+            // For now, we just halt the emulation and return a negative code.
+            // In future this might become  "wait for interrupt" or something
+            cycles += 7;
+            status = -2;
+            goto INTERP_END;
+        }
+
+        // ======== ARITHMETIC GROUP ======== //
+        ALU_GROUP(80, 81, 82, 83, 84, 85, 86, 87, alu_add(&acc, &flags, val, 0))                        // ADD
+        ALU_GROUP(88, 89, 8A, 8B, 8C, 8D, 8E, 8F, alu_add(&acc, &flags, val, flags & FLAG_CY))          // ADC
+        ALU_GROUP(90, 91, 92, 93, 94, 95, 96, 97, acc = alu_sub(acc, &flags, val, 0))                   // SUB
+        ALU_GROUP(98, 99, 9A, 9B, 9C, 9D, 9E, 9F, acc = alu_sub(acc, &flags, val, flags & FLAG_CY))     // SBB
+
+        // ======== LOGIC GROUP ======== //
+        ALU_GROUP(A0, A1, A2, A3, A4, A5, A6, A7, alu_ana(&acc, &flags, val))       // ANA
+        ALU_GROUP(A8, A9, AA, AB, AC, AD, AE, AF, alu_xra(&acc, &flags, val))       // XRA
+        ALU_GROUP(B0, B1, B2, B3, B4, B5, B6, B7, alu_ora(&acc, &flags, val))       // ORA
+        ALU_GROUP(B8, B9, BA, BB, BC, BD, BE, BF, alu_sub(acc, &flags, val, 0))     // CMP
+
+        // Immediate forms
+        OP(C6) { alu_add(&acc, &flags, IMM8, 0); pc++; NEXT(7); }                         // ADI
+        OP(CE) { alu_add(&acc, &flags, IMM8, flags & FLAG_CY); pc++; NEXT(7); }           // ACI
+        OP(D6) { acc = alu_sub(acc, &flags, IMM8, 0); pc++; NEXT(7); }                    // SUI
+        OP(DE) { acc = alu_sub(acc, &flags, IMM8, flags & FLAG_CY); pc++; NEXT(7); }      // SBI
+        OP(E6) { alu_ana(&acc, &flags, IMM8); pc++; NEXT(7); }                            // ANI
+        OP(EE) { alu_xra(&acc, &flags, IMM8); pc++; NEXT(7); }                            // XRI
+        OP(F6) { alu_ora(&acc, &flags, IMM8); pc++; NEXT(7); }                            // ORI
+        OP(FE) { alu_sub(acc, &flags, IMM8, 0); pc++; NEXT(7); }                          // CPI
+
+        // ======== BRANCH GROUP ======== //
+        OP(C3) ALIAS(CB)        // JMP adr
+        {
+            pc = IMM16;
+            NEXT(10);
+        }
+        JMP_COND(C2, !FLAG(FLAG_Z))     // JNZ
+        JMP_COND(CA, FLAG(FLAG_Z))      // JZ
+        JMP_COND(D2, !FLAG(FLAG_CY))    // JNC
+        JMP_COND(DA, FLAG(FLAG_CY))     // JC
+        JMP_COND(E2, !FLAG(FLAG_P))     // JPO
+        JMP_COND(EA, FLAG(FLAG_P))      // JPE
+        JMP_COND(F2, !FLAG(FLAG_S))     // JP
+        JMP_COND(FA, FLAG(FLAG_S))      // JM
+
+        OP(CD) ALIAS(DD) ALIAS(ED) ALIAS(FD)    // CALL adr
+        {
+            uint16_t addr = IMM16;
+#ifdef CPU_DIAG     // use the CPM style printing routine
+            // Emulate the BDOS print routines and warm boot in CPM/OS
+            if(addr == 0x0005)
+            {
+                if(state->c == 9)
+                {
+                    for(uint16_t offset = REG_DE; RD(offset) != '$'; ++offset)
+                        fprintf(stdout, "%c", RD(offset));
+                }
+                else if(state->c == 2)
+                    fprintf(stdout, "%c", state->e);
+                pc += 2;
+                NEXT(17);
+            }
+            else if(addr == 0x0000)
+            {
+                cycles += 17;
+                status = -2;      // halt the machine and exit
+                goto INTERP_END;
+            }
+#endif /*CPU_DIAG*/
+            PUSH16(pc + 2);
+            pc = addr;
+            NEXT(17);
+        }
+        CALL_COND(C4, !FLAG(FLAG_Z))    // CNZ
+        CALL_COND(CC, FLAG(FLAG_Z))     // CZ
+        CALL_COND(D4, !FLAG(FLAG_CY))   // CNC
+        CALL_COND(DC, FLAG(FLAG_CY))    // CC
+        CALL_COND(E4, !FLAG(FLAG_P))    // CPO
+        CALL_COND(EC, FLAG(FLAG_P))     // CPE
+        CALL_COND(F4, !FLAG(FLAG_S))    // CP
+        CALL_COND(FC, FLAG(FLAG_S))     // CM
+
+        OP(C9) ALIAS(D9)        // RET
+        {
+            POP16(pc);
+            NEXT(10);
+        }
+        RET_COND(C0, !FLAG(FLAG_Z))     // RNZ
+        RET_COND(C8, FLAG(FLAG_Z))      // RZ
+        RET_COND(D0, !FLAG(FLAG_CY))    // RNC
+        RET_COND(D8, FLAG(FLAG_CY))     // RC
+        RET_COND(E0, !FLAG(FLAG_P))     // RPO
+        RET_COND(E8, FLAG(FLAG_P))      // RPE
+        RET_COND(F0, !FLAG(FLAG_S))     // RP
+        RET_COND(F8, FLAG(FLAG_S))      // RM
+
+        RST(C7, 0x00)
+        RST(CF, 0x08)
+        RST(D7, 0x10)
+        RST(DF, 0x18)
+        RST(E7, 0x20)
+        RST(EF, 0x28)
+        RST(F7, 0x30)
+        RST(FF, 0x38)
+
+        OP(E9) { pc = REG_HL; NEXT(5); }        // PCHL
+
+        // ======== STACK GROUP ======== //
+        OP(C5) { PUSH16(REG_BC); NEXT(11); }                    // PUSH B
+        OP(D5) { PUSH16(REG_DE); NEXT(11); }                    // PUSH D
+        OP(E5) { PUSH16(REG_HL); NEXT(11); }                    // PUSH H
+        OP(F5)                                                  // PUSH PSW
+        {
+            // The flags are stored in PSW order, so only the fixed bits need fixing up
+            PUSH16((acc << 8) | (flags & FLAG_MASK) | FLAG_ONE);
+            NEXT(11);
+        }
+        OP(C1) { state->c = RD(sp); state->b = RD(sp + 1); sp += 2; NEXT(10); }    // POP B
+        OP(D1) { state->e = RD(sp); state->d = RD(sp + 1); sp += 2; NEXT(10); }    // POP D
+        OP(E1) { state->l = RD(sp); state->h = RD(sp + 1); sp += 2; NEXT(10); }    // POP H
+        OP(F1)                                                  // POP PSW
+        {
+            flags = (RD(sp) & FLAG_MASK) | FLAG_ONE;
+            acc   = RD(sp + 1);
+            sp += 2;
+            NEXT(10);
+        }
+
+        OP(E3)      // XTHL  L <-> (SP), H <-> (SP+1)
+        {
+            uint8_t l = state->l;
+            uint8_t h = state->h;
+            state->l = RD(sp);
+            state->h = RD(sp + 1);
+            WR(sp, l);
+            WR(sp + 1, h);
+            NEXT(18);
+        }
+        OP(EB)      // XCHG  HL <-> DE
+        {
+            uint8_t d = state->d;
+            uint8_t e = state->e;
+            state->d = state->h;
+            state->e = state->l;
+            state->h = d;
+            state->l = e;
+            NEXT(4);
+        }
+        OP(F9) { sp = REG_HL; NEXT(5); }        // SPHL
+
+        // ======== IO / INTERRUPT GROUP ======== //
+        OP(D3)      // OUT d8
+        {
+            uint8_t port = IMM8;
+            pc++;
+            if(state->ports && state->ports->out[port])
+            {
+                SYNC_OUT();
+                state->ports->out[port](state, state->ports->out_dev[port], port, acc);
+                SYNC_IN();
+                PORT_DONE();
+            }
+            NEXT(10);
+        }
+        OP(DB)      // IN d8
+        {
+            uint8_t port = IMM8;
+            pc++;
+            if(state->ports && state->ports->in[port])
+            {
+                SYNC_OUT();
+                state->a = state->ports->in[port](state, state->ports->in_dev[port], port);
+                SYNC_IN();
+                PORT_DONE();
+            }
+            NEXT(10);
+        }
+        OP(F3) { state->int_enable = 0; NEXT(4); }      // DI
+        OP(FB) { state->int_enable = 1; NEXT(4); }      // EI
+
+#ifndef CPU_THREADED
+    }
+#endif
+
+INTERP_END:
+#ifdef INTERP_INSTRUMENT
+    PROFILE_DONE();
+#endif /*INTERP_INSTRUMENT*/
+    SYNC_OUT();
+    return (status < 0) ? status : cycles;
+}
+
+#undef MEM_RD
+#undef MEM_WR
+#undef WR
+#undef IMM8
+#undef IMM16
+#undef PORT_DONE
+#undef FETCH
+#undef DISPATCH
+#undef PROFILE_DONE
+#undef TRACE_STEP
@@ -1,3 +1,4 @@
+#define _DEFAULT_SOURCE
 #include <stdio.h>
 
 
@@ -12,856 +13,881 @@
 // create some binary intermediate representation that
 // we can reuse (and create strings out of later)
 
-int disassemble_8080_op(unsigned char *codebuffer, int pc)
+/*
+ * disassemble_8080_op_file()
+ * Write the mnemonic and operands of the op at pc to fp, with no address
+ * or newline. Returns the number of bytes of the op.
+ */
+int disassemble_8080_op_file(FILE* fp, const unsigned char *codebuffer, int pc)
 {
-    unsigned char *code = &codebuffer[pc];
+    const unsigned char *code = &codebuffer[pc];
     int opbytes = 1;
 
-    fprintf(stdout, "%04X ", pc);
     switch(*code)
     {
         case 0x00:
-            fprintf(stdout, "NOP");
+            fprintf(fp, "NOP");
             break;
         case 0x01:
-            fprintf(stdout, "LXI   B,#$%02X%02X", code[2], code[1]);
+            fprintf(fp, "LXI   B,#$%02X%02X", code[2], code[1]);
             opbytes = 3;
             break;
         case 0x02:
-            fprintf(stdout, "STAX  B");
+            fprintf(fp, "STAX  B");
             break;
         case 0x03:
-            fprintf(stdout, "INX   B");
+            fprintf(fp, "INX   B");
             break;
         case 0x04:
-            fprintf(stdout, "INR   B");
+            fprintf(fp, "INR   B");
             break;
         case 0x05:
-            fprintf(stdout, "DCR   B");
+            fprintf(fp, "DCR   B");
             break;
         case 0x06:
-            fprintf(stdout, "MVI   B,#0x%02X", code[1]);
+            fprintf(fp, "MVI   B,#0x%02X", code[1]);
             opbytes = 2;
             break;
         case 0x07:
-            fprintf(stdout, "RLC");
+            fprintf(fp, "RLC");
             break;
         case 0x08:
-            fprintf(stdout, "NOP");
+            fprintf(fp, "NOP");
             break;
         case 0x09:
-            fprintf(stdout, "DAD   B");
+            fprintf(fp, "DAD   B");
             break;
         case 0x0A:
-            fprintf(stdout, "LDAX  B");
+            fprintf(fp, "LDAX  B");
             break;
         case 0x0B:
-            fprintf(stdout, "DCX   B");
+            fprintf(fp, "DCX   B");
             break;
         case 0x0C:
-            fprintf(stdout, "INR   C");
+            fprintf(fp, "INR   C");
             break;
         case 0x0D:
-            fprintf(stdout, "DCR   C");
+            fprintf(fp, "DCR   C");
             break;
         case 0x0E:
-            fprintf(stdout, "MVI   C,#$%02X", code[1]);
+            fprintf(fp, "MVI   C,#$%02X", code[1]);
             opbytes = 2;
             break;
         case 0x0F:
-            fprintf(stdout, "RRC");
+            fprintf(fp, "RRC");
             break;
         case 0x10:
-            fprintf(stdout, "*NOP");
+            fprintf(fp, "*NOP");
             break;
         case 0x11:
-            fprintf(stdout, "LXI   D,#$%02X%02X", code[2], code[1]);
+            fprintf(fp, "LXI   D,#$%02X%02X", code[2], code[1]);
+            opbytes = 3;
             break;
         case 0x12:
-            fprintf(stdout, "STAX  D");
+            fprintf(fp, "STAX  D");
             break;
         case 0x13:
-            fprintf(stdout, "INX   D");
+            fprintf(fp, "INX   D");
             break;
         case 0x14:
-            fprintf(stdout, "INR   D");
+            fprintf(fp, "INR   D");
             break;
         case 0x15:
-            fprintf(stdout, "DCR   D");
+            fprintf(fp, "DCR   D");
             break;
         case 0x16:
-            fprintf(stdout, "MVI   D,#$%02X", code[1]);
+            fprintf(fp, "MVI   D,#$%02X", code[1]);
             opbytes = 2;
             break;
         case 0x17:
-            fprintf(stdout, "DAA");
+            fprintf(fp, "RAL");
             break;
         case 0x18:
-            fprintf(stdout, "*NOP");
+            fprintf(fp, "*NOP");
             break;
         case 0x19:
-            fprintf(stdout, "DAD   H");
+            fprintf(fp, "DAD   D");
             break;
         case 0x1A:
-            fprintf(stdout, "LDAX  D");
-            opbytes = 3;
+            fprintf(fp, "LDAX  D");
             break;
         case 0x1B:
-            fprintf(stdout, "DCX   H");
+            fprintf(fp, "DCX   D");
             break;
         case 0x1C:
-            fprintf(stdout, "INR,  E");
+            fprintf(fp, "INR   E");
             break;
         case 0x1D:
-            fprintf(stdout, "DCR   E");
+            fprintf(fp, "DCR   E");
             break;
         case 0x1E:
-            fprintf(stdout, "MVI   E,#$%02X", code[1]);
+            fprintf(fp, "MVI   E,#$%02X", code[1]);
             opbytes = 2;
             break;
         case 0x1F:
-            fprintf(stdout, "RAR");
+            fprintf(fp, "RAR");
             break;
         case 0x20:
-            fprintf(stdout, "*NOP");
+            fprintf(fp, "*NOP");
             break;
         case 0x21:
-            fprintf(stdout, "LXI   H,#$%02X%02X", code[2], code[1]);
+            fprintf(fp, "LXI   H,#$%02X%02X", code[2], code[1]);
             opbytes = 3;
             break;
         case 0x22:
-            fprintf(stdout, "SHLD    #$%02X%02X", code[2], code[1]);
+            fprintf(fp, "SHLD    #$%02X%02X", code[2], code[1]);
             opbytes = 3;
             break;
         case 0x23:
-            fprintf(stdout, "INX   H");
+            fprintf(fp, "INX   H");
             break;
         case 0x24:
-            fprintf(stdout, "INR   H");
+            fprintf(fp, "INR   H");
             break;
         case 0x25:
-            fprintf(stdout, "DCR   H");
+            fprintf(fp, "DCR   H");
             break;
         case 0x26:
-            fprintf(stdout, "MVI   H,#$%02X", code[1]);
+            fprintf(fp, "MVI   H,#$%02X", code[1]);
             opbytes = 2;
             break;
         case 0x27:
-            fprintf(stdout, "DAA");
+            fprintf(fp, "DAA");
             break;
         case 0x28:
-            fprintf(stdout, "*NOP");
+            fprintf(fp, "*NOP");
             break;
         case 0x29:
-            fprintf(stdout, "DAD   H");
+            fprintf(fp, "DAD   H");
             break;
         case 0x2A:
-            fprintf(stdout, "LHLD  #$%02X%02X", code[2], code[1]);
+            fprintf(fp, "LHLD  #$%02X%02X", code[2], code[1]);
             opbytes = 3;
             break;
         case 0x2B:
-            fprintf(stdout, "DCX   H");
+            fprintf(fp, "DCX   H");
             break;
         case 0x2C:
-            fprintf(stdout, "INR   L");
+            fprintf(fp, "INR   L");
             break;
         case 0x2D:
-            fprintf(stdout, "DCR   L");
+            fprintf(fp, "DCR   L");
             break;
         case 0x2E:
-            fprintf(stdout, "MVI   L,#$%02X", code[1]);
+            fprintf(fp, "MVI   L,#$%02X", code[1]);
             opbytes = 2;
             break;
         case 0x2F:
-            fprintf(stdout, "CMA");
+            fprintf(fp, "CMA");
             break;
         case 0x30:
-            fprintf(stdout, "*NOP");
+            fprintf(fp, "*NOP");
             break;
         case 0x31:
-            fprintf(stdout, "LXI  SP,#$%02X%02X", code[2], code[1]);
+            fprintf(fp, "LXI  SP,#$%02X%02X", code[2], code[1]);
             opbytes = 3;
             break;
         case 0x32:
-            fprintf(stdout, "SHLD,   #$%02X%02X", code[2], code[1]);
+            fprintf(fp, "STA     #$%02X%02X", code[2], code[1]);
             opbytes = 3;
             break;
         case 0x33:
-            fprintf(stdout, "INX   H");
+            fprintf(fp, "INX   SP");
             break;
         case 0x34:
-            fprintf(stdout, "INR   H");
+            fprintf(fp, "INR   M");
             break;
         case 0x35:
-            fprintf(stdout, "DCR   H");
+            fprintf(fp, "DCR   M");
             break;
         case 0x36:
-            fprintf(stdout, "MVI   H,#$%02X", code[1]);
+            fprintf(fp, "MVI   M,#$%02X", code[1]);
             opbytes = 2;
             break;
         case 0x37:
-            fprintf(stdout, "STC");
+            fprintf(fp, "STC");
             break;
         case 0x38:
-            fprintf(stdout, "*NOP");
+            fprintf(fp, "*NOP");
             break;
         case 0x39:
-            fprintf(stdout, "DAD   SP");
+            fprintf(fp, "DAD   SP");
             break;
         case 0x3A:
-            fprintf(stdout, "LDA     #$%02X%02X", code[2], code[1]);
+            fprintf(fp, "LDA     #$%02X%02X", code[2], code[1]);
             opbytes = 3;
             break;
         case 0x3B:
-            fprintf(stdout, "DCX   SP");
+            fprintf(fp, "DCX   SP");
             break;
         case 0x3C:
-            fprintf(stdout, "INR   A");
+            fprintf(fp, "INR   A");
             break;
         case 0x3D:
-            fprintf(stdout, "DCR   A");
+            fprintf(fp, "DCR   A");
             break;
         case 0x3E:
-            fprintf(stdout, "MVI   A,#$%02X", code[1]);
+            fprintf(fp, "MVI   A,#$%02X", code[1]);
             opbytes = 2;
             break;
         case 0x3F:
-            fprintf(stdout, "CMC");
+            fprintf(fp, "CMC");
             break;
         /* ======== 0x40 ======== */
         case 0x40:
-            fprintf(stdout, "MOV   B,B");
+            fprintf(fp, "MOV   B,B");
             break;
         case 0x41:
-            fprintf(stdout, "MOV   B,C");
+            fprintf(fp, "MOV   B,C");
             break;
         case 0x42:
-            fprintf(stdout, "MOV   B,D");
+            fprintf(fp, "MOV   B,D");
             break;
         case 0x43:
-            fprintf(stdout, "MOV   B,E");
+            fprintf(fp, "MOV   B,E");
             break;
         case 0x44:
-            fprintf(stdout, "MOV   B,H");
+            fprintf(fp, "MOV   B,H");
             break;
         case 0x45:
-            fprintf(stdout, "MOV   B,L");
+            fprintf(fp, "MOV   B,L");
             break;
         case 0x46:
-            fprintf(stdout, "MOV   B,M");
+            fprintf(fp, "MOV   B,M");
             break;
         case 0x47:
-            fprintf(stdout, "MOV   B,A");
+            fprintf(fp, "MOV   B,A");
             break;
         case 0x48:
-            fprintf(stdout, "MOV   C,B");
+            fprintf(fp, "MOV   C,B");
             break;
         case 0x49:
-            fprintf(stdout, "MOV   C,C");
+            fprintf(fp, "MOV   C,C");
             break;
         case 0x4A:
-            fprintf(stdout, "MOV   C,D");
+            fprintf(fp, "MOV   C,D");
             break;
         case 0x4B:
-            fprintf(stdout, "MOV   C,E");
+            fprintf(fp, "MOV   C,E");
             break;
         case 0x4C:
-            fprintf(stdout, "MOV   C,H");
+            fprintf(fp, "MOV   C,H");
             break;
         case 0x4D:
-            fprintf(stdout, "MOV   C,L");
+            fprintf(fp, "MOV   C,L");
             break;
         case 0x4E:
-            fprintf(stdout, "MOV   C,M");
+            fprintf(fp, "MOV   C,M");
             break;
         case 0x4F:
-            fprintf(stdout, "MOV   C,A");
+            fprintf(fp, "MOV   C,A");
             break;
 
         /* ======== 0x50 ======== */
         case 0x50:
-            fprintf(stdout, "MOV   D,B");
+            fprintf(fp, "MOV   D,B");
             break;
         case 0x51:
-            fprintf(stdout, "MOV   D,C");
+            fprintf(fp, "MOV   D,C");
             break;
         case 0x52:
-            fprintf(stdout, "MOV   D,D");
+            fprintf(fp, "MOV   D,D");
             break;
         case 0x53:
-            fprintf(stdout, "MOV   D,E");
+            fprintf(fp, "MOV   D,E");
             break;
         case 0x54:
-            fprintf(stdout, "MOV   D,H");
+            fprintf(fp, "MOV   D,H");
             break;
         case 0x55:
-            fprintf(stdout, "MOV   D,L");
+            fprintf(fp, "MOV   D,L");
             break;
         case 0x56:
-            fprintf(stdout, "MOV   D,M");
+            fprintf(fp, "MOV   D,M");
             break;
         case 0x57:
-            fprintf(stdout, "MOV   D,A");
+            fprintf(fp, "MOV   D,A");
             break;
         case 0x58:
-            fprintf(stdout, "MOV   E,B");
+            fprintf(fp, "MOV   E,B");
             break;
         case 0x59:
-            fprintf(stdout, "MOV   E,C");
+            fprintf(fp, "MOV   E,C");
             break;
         case 0x5A:
-            fprintf(stdout, "MOV   E,D");
+            fprintf(fp, "MOV   E,D");
             break;
         case 0x5B:
-            fprintf(stdout, "MOV   E,E");
+            fprintf(fp, "MOV   E,E");
             break;
         case 0x5C:
-            fprintf(stdout, "MOV   E,H");
+            fprintf(fp, "MOV   E,H");
             break;
         case 0x5D:
-            fprintf(stdout, "MOV   E,L");
+            fprintf(fp, "MOV   E,L");
             break;
         case 0x5E:
-            fprintf(stdout, "MOV   E,M");
+            fprintf(fp, "MOV   E,M");
             break;
         case 0x5F:
-            fprintf(stdout, "MOV,  E,A");
+            fprintf(fp, "MOV   E,A");
             break;
         //case 0x5F:
-        //    fprintf(stdout, "MOV   C, A");
+        //    fprintf(fp, "MOV   C, A");
         //    break;
 
 
         case 0x60:
-            fprintf(stdout, "MOV   H,B");
+            fprintf(fp, "MOV   H,B");
             break;
         case 0x61:
-            fprintf(stdout, "MOV   H,C");
+            fprintf(fp, "MOV   H,C");
             break;
         case 0x62:
-            fprintf(stdout, "MOV   H,D");
+            fprintf(fp, "MOV   H,D");
             break;
         case 0x63:
-            fprintf(stdout, "MOV   H,E");
+            fprintf(fp, "MOV   H,E");
             break;
         case 0x64:
-            fprintf(stdout, "MOV   H,H");
+            fprintf(fp, "MOV   H,H");
             break;
         case 0x65:
-            fprintf(stdout, "MOV   H,L");
+            fprintf(fp, "MOV   H,L");
             break;
         case 0x66:
-            fprintf(stdout, "MOV   H,M");
+            fprintf(fp, "MOV   H,M");
             break;
         case 0x67:
-            fprintf(stdout, "MOV   H,A");
+            fprintf(fp, "MOV   H,A");
             break;
         case 0x68:
-            fprintf(stdout, "MOV   L,B");
+            fprintf(fp, "MOV   L,B");
             break;
         case 0x69:
-            fprintf(stdout, "MOV   L,C");
+            fprintf(fp, "MOV   L,C");
             break;
         case 0x6A:
-            fprintf(stdout, "MOV   L,D");
+            fprintf(fp, "MOV   L,D");
             break;
         case 0x6B:
-            fprintf(stdout, "MOV   L,E");
+            fprintf(fp, "MOV   L,E");
             break;
         case 0x6C:
-            fprintf(stdout, "MOV   L,H");
+            fprintf(fp, "MOV   L,H");
             break;
         case 0x6D:
-            fprintf(stdout, "MOV   L,L");
+            fprintf(fp, "MOV   L,L");
             break;
         case 0x6E:
-            fprintf(stdout, "MOV   L,M");
+            fprintf(fp, "MOV   L,M");
             break;
         case 0x6F:
-            fprintf(stdout, "MOV   L,A");
+            fprintf(fp, "MOV   L,A");
             break;
         case 0x70:
-            fprintf(stdout, "MOV   M,B");
+            fprintf(fp, "MOV   M,B");
             break;
         case 0x71:
-            fprintf(stdout, "MOV   M,C");
+            fprintf(fp, "MOV   M,C");
             break;
         case 0x72:
-            fprintf(stdout, "MOV   M,D");
+            fprintf(fp, "MOV   M,D");
             break;
         case 0x73:
-            fprintf(stdout, "MOV   M,E");
+            fprintf(fp, "MOV   M,E");
             break;
         case 0x74:
-            fprintf(stdout, "MOV   M,H");
+            fprintf(fp, "MOV   M,H");
             break;
         case 0x75:
-            fprintf(stdout, "MOV   M,L");
+            fprintf(fp, "MOV   M,L");
             break;
         case 0x76:
-            fprintf(stdout, "HLT");
+            fprintf(fp, "HLT");
             break;
         case 0x77:
-            fprintf(stdout, "MOV   M,A");
+            fprintf(fp, "MOV   M,A");
             break;
         case 0x78:
-            fprintf(stdout, "MOV   A,B");
+            fprintf(fp, "MOV   A,B");
             break;
         case 0x79:
-            fprintf(stdout, "MOV   A,C");
+            fprintf(fp, "MOV   A,C");
             break;
         case 0x7A:
-            fprintf(stdout, "MOV   A,D");
+            fprintf(fp, "MOV   A,D");
             break;
         case 0x7B:
-            fprintf(stdout, "MOV   A,E");
+            fprintf(fp, "MOV   A,E");
             break;
         case 0x7C:
-            fprintf(stdout, "MOV   A,H");
+            fprintf(fp, "MOV   A,H");
             break;
         case 0x7D:
-            fprintf(stdout, "MOV   A,L");
+            fprintf(fp, "MOV   A,L");
             break;
         case 0x7E:
-            fprintf(stdout, "MOV   A,M");
+            fprintf(fp, "MOV   A,M");
             break;
         case 0x7F:
-            fprintf(stdout, "MOV   A,A");
+            fprintf(fp, "MOV   A,A");
             break;
         case 0x80:
-            fprintf(stdout, "ADD   B");
+            fprintf(fp, "ADD   B");
             break;
         case 0x81:
-            fprintf(stdout, "ADD   C");
+            fprintf(fp, "ADD   C");
             break;
         case 0x82:
-            fprintf(stdout, "ADD   D");
+            fprintf(fp, "ADD   D");
             break;
         case 0x83:
-            fprintf(stdout, "ADD   E");
+            fprintf(fp, "ADD   E");
             break;
         case 0x84:
-            fprintf(stdout, "ADD   H");
+            fprintf(fp, "ADD   H");
             break;
         case 0x85:
-            fprintf(stdout, "ADD   L");
+            fprintf(fp, "ADD   L");
             break;
         case 0x86:
-            fprintf(stdout, "ADD   M");
+            fprintf(fp, "ADD   M");
             break;
         case 0x87:
-            fprintf(stdout, "ADD   A");
+            fprintf(fp, "ADD   A");
             break;
         case 0x88:
-            fprintf(stdout, "ADC   B");
+            fprintf(fp, "ADC   B");
             break;
         case 0x89:
-            fprintf(stdout, "ADC   C");
+            fprintf(fp, "ADC   C");
             break;
         case 0x8A:
-            fprintf(stdout, "ADC   D");
+            fprintf(fp, "ADC   D");
             break;
         case 0x8B:
-            fprintf(stdout, "ADC   E");
+            fprintf(fp, "ADC   E");
             break;
         case 0x8C:
-            fprintf(stdout, "ADC   H");
+            fprintf(fp, "ADC   H");
             break;
         case 0x8D:
-            fprintf(stdout, "ADC   L");
+            fprintf(fp, "ADC   L");
             break;
         case 0x8E:
-            fprintf(stdout, "ADC   M");
+            fprintf(fp, "ADC   M");
             break;
         case 0x8F:
-            fprintf(stdout, "ADC   A");
+            fprintf(fp, "ADC   A");
             break;
         case 0x90:
-            fprintf(stdout, "SUB   B");
+            fprintf(fp, "SUB   B");
             break;
         case 0x91:
-            fprintf(stdout, "SUB   C");
+            fprintf(fp, "SUB   C");
             break;
         case 0x92:
-            fprintf(stdout, "SUB   D");
+            fprintf(fp, "SUB   D");
             break;
         case 0x93:
-            fprintf(stdout, "SUB   E");
+            fprintf(fp, "SUB   E");
             break;
         case 0x94:
-            fprintf(stdout, "SUB   H");
+            fprintf(fp, "SUB   H");
             break;
         case 0x95:
-            fprintf(stdout, "SUB   L");
+            fprintf(fp, "SUB   L");
             break;
         case 0x96:
-            fprintf(stdout, "SUB   M");
+            fprintf(fp, "SUB   M");
             break;
         case 0x97:
-            fprintf(stdout, "SUB   A");
+            fprintf(fp, "SUB   A");
             break;
         case 0x98:
-            fprintf(stdout, "SBB   B");
+            fprintf(fp, "SBB   B");
             break;
         case 0x99:
-            fprintf(stdout, "SBB   C");
+            fprintf(fp, "SBB   C");
             break;
         case 0x9A:
-            fprintf(stdout, "SBB   D");
+            fprintf(fp, "SBB   D");
             break;
         case 0x9B:
-            fprintf(stdout, "SBB   E");
+            fprintf(fp, "SBB   E");
             break;
         case 0x9C:
-            fprintf(stdout, "SBB   H");
+            fprintf(fp, "SBB   H");
             break;
         case 0x9D:
-            fprintf(stdout, "SBB   L");
+            fprintf(fp, "SBB   L");
             break;
         case 0x9E:
-            fprintf(stdout, "SBB   M");
+            fprintf(fp, "SBB   M");
             break;
         case 0x9F:
-            fprintf(stdout, "SBB   A");
+            fprintf(fp, "SBB   A");
             break;
         case 0xA0:
-            fprintf(stdout, "ANA   B");
+            fprintf(fp, "ANA   B");
             break;
         case 0xA1:
-            fprintf(stdout, "ANA   C");
+            fprintf(fp, "ANA   C");
             break;
         case 0xA2:
-            fprintf(stdout, "ANA   D");
+            fprintf(fp, "ANA   D");
             break;
         case 0xA3:
-            fprintf(stdout, "ANA   E");
+            fprintf(fp, "ANA   E");
             break;
         case 0xA4:
-            fprintf(stdout, "ANA   H");
+            fprintf(fp, "ANA   H");
             break;
         case 0xA5:
-            fprintf(stdout, "ANA   L");
+            fprintf(fp, "ANA   L");
             break;
         case 0xA6:
-            fprintf(stdout, "ANA   M");
+            fprintf(fp, "ANA   M");
             break;
         case 0xA7:
-            fprintf(stdout, "ANA   A");
+            fprintf(fp, "ANA   A");
             break;
         case 0xA8:
-            fprintf(stdout, "XRA   B");
+            fprintf(fp, "XRA   B");
             break;
         case 0xA9:
-            fprintf(stdout, "XRA   C");
+            fprintf(fp, "XRA   C");
             break;
         case 0xAA:
-            fprintf(stdout, "XRA   D");
+            fprintf(fp, "XRA   D");
             break;
         case 0xAB:
-            fprintf(stdout, "XRA   E");
+            fprintf(fp, "XRA   E");
             break;
         case 0xAC:
-            fprintf(stdout, "XRA   H");
+            fprintf(fp, "XRA   H");
             break;
         case 0xAD:
-            fprintf(stdout, "XRA   L");
+            fprintf(fp, "XRA   L");
             break;
         case 0xAE:
-            fprintf(stdout, "XRA   M");
+            fprintf(fp, "XRA   M");
             break;
         case 0xAF:
-            fprintf(stdout, "XRA   A");
+            fprintf(fp, "XRA   A");
             break;
         case 0xB0:
-            fprintf(stdout, "ORA   B");
+            fprintf(fp, "ORA   B");
             break;
         case 0xB1:
-            fprintf(stdout, "ORA   C");
+            fprintf(fp, "ORA   C");
             break;
         case 0xB2:
-            fprintf(stdout, "ORA   D");
+            fprintf(fp, "ORA   D");
             break;
         case 0xB3:
-            fprintf(stdout, "ORA   E");
+            fprintf(fp, "ORA   E");
             break;
         case 0xB4:
-            fprintf(stdout, "ORA   H");
+            fprintf(fp, "ORA   H");
             break;
         case 0xB5:
-            fprintf(stdout, "ORA   L");
+            fprintf(fp, "ORA   L");
             break;
         case 0xB6:
-            fprintf(stdout, "ORA   M");
+            fprintf(fp, "ORA   M");
             break;
         case 0xB7:
-            fprintf(stdout, "ORA   A");
+            fprintf(fp, "ORA   A");
             break;
         case 0xB8:
-            fprintf(stdout, "CMP   B");
+            fprintf(fp, "CMP   B");
             break;
         case 0xB9:
-            fprintf(stdout, "CMP   C");
+            fprintf(fp, "CMP   C");
             break;
         case 0xBA:
-            fprintf(stdout, "CMP   D");
+            fprintf(fp, "CMP   D");
             break;
         case 0xBB:
-            fprintf(stdout, "CMP   E");
+            fprintf(fp, "CMP   E");
             break;
         case 0xBC:
-            fprintf(stdout, "CMP   H");
+            fprintf(fp, "CMP   H");
             break;
         case 0xBD:
-            fprintf(stdout, "CMP   L");
+            fprintf(fp, "CMP   L");
             break;
         case 0xBE:
-            fprintf(stdout, "CMP   M");
+            fprintf(fp, "CMP   M");
             break;
         case 0xBF:
-            fprintf(stdout, "CMP   A");
+            fprintf(fp, "CMP   A");
             break;
         /* ======== 0xc0 ======== */
         case 0xC0:
-            fprintf(stdout, "RNZ    ");
+            fprintf(fp, "RNZ    ");
             break;
         case 0xC1:
-            fprintf(stdout, "POP   B");
+            fprintf(fp, "POP   B");
             break;
         case 0xC2:
-            fprintf(stdout, "JNZ   #0x%02X%02X", code[2], code[1]);
+            fprintf(fp, "JNZ   #0x%02X%02X", code[2], code[1]);
             opbytes = 3;
             break;
         case 0xC3:
-            fprintf(stdout, "JMP   #0x%02X%02X", code[2], code[1]);
+            fprintf(fp, "JMP   #0x%02X%02X", code[2], code[1]);
             opbytes = 3;
             break;
         case 0xC4:
-            fprintf(stdout, "CNZ   #0x%02X%02X", code[2], code[1]);
+            fprintf(fp, "CNZ   #0x%02X%02X", code[2], code[1]);
             opbytes = 3;
             break;
         case 0xC5:
-            fprintf(stdout, "PUSH  B");
+            fprintf(fp, "PUSH  B");
             break;
         case 0xC6:
-            fprintf(stdout, "ADI   #0x%02X", code[1]);
+            fprintf(fp, "ADI   #0x%02X", code[1]);
             opbytes = 2;
             break;
         case 0xC7:
-            fprintf(stdout, "RST   0");
+            fprintf(fp, "RST   0");
             break;
         case 0xC8:
-            fprintf(stdout, "RZ    ");
+            fprintf(fp, "RZ    ");
             break;
         case 0xC9:
-            fprintf(stdout, "RET   ");
+            fprintf(fp, "RET   ");
             break;
         case 0xCA:
-            fprintf(stdout, "JZ    #0x%02X%02X", code[2], code[1]);
+            fprintf(fp, "JZ    #0x%02X%02X", code[2], code[1]);
             opbytes = 3;
             break;
         case 0xCB:
-            fprintf(stdout, "*JMP  #0x%02X%02X", code[2], code[1]);
+            fprintf(fp, "*JMP  #0x%02X%02X", code[2], code[1]);
             opbytes = 3;
             break;
         case 0xCC:
-            fprintf(stdout, "CZ    #0x%02X%02X", code[2], code[1]);
+            fprintf(fp, "CZ    #0x%02X%02X", code[2], code[1]);
             opbytes = 3;
             break;
         case 0xCD:
-            fprintf(stdout, "CALL  #0x%02X%02X", code[2], code[1]);
+            fprintf(fp, "CALL  #0x%02X%02X", code[2], code[1]);
             opbytes = 3;
             break;
         case 0xCE:
-            fprintf(stdout, "ACI   #0x%02X", code[1]);
+            fprintf(fp, "ACI   #0x%02X", code[1]);
             opbytes = 2;
             break;
         case 0xCF:
-            fprintf(stdout, "RST   1");
+            fprintf(fp, "RST   1");
             break;
 
 
         /* ======== 0xD0 ======== */
         case 0xD0:
-            fprintf(stdout, "RNZ   ");
+            fprintf(fp, "RNC   ");
             break;
         case 0xD1:
-            fprintf(stdout, "POP   D");
+            fprintf(fp, "POP   D");
             break;
         case 0xD2:
-            fprintf(stdout, "JNC   #0x%02X%02X", code[2], code[1]);
+            fprintf(fp, "JNC   #0x%02X%02X", code[2], code[1]);
             opbytes = 3;
             break;
         case 0xD3:
-            fprintf(stdout, "OUT   #0x%02X", code[1]);
+            fprintf(fp, "OUT   #0x%02X", code[1]);
             opbytes = 2;
             break;
         case 0xD4:
-            fprintf(stdout, "CNC   #0x%02X%02X", code[2], code[1]);
+            fprintf(fp, "CNC   #0x%02X%02X", code[2], code[1]);
             opbytes = 3;
             break;
         case 0xD5:
-            fprintf(stdout, "PUSH  D");
+            fprintf(fp, "PUSH  D");
             break;
         case 0xD6:
-            fprintf(stdout, "SUI   #0x%02X", code[1]);
+            fprintf(fp, "SUI   #0x%02X", code[1]);
             opbytes = 2;
             break;
         case 0xD7:
-            fprintf(stdout, "RST   2");
+            fprintf(fp, "RST   2");
             break;
         case 0xD8:
-            fprintf(stdout, "RC    ");
+            fprintf(fp, "RC    ");
             break;
         case 0xD9:
-            fprintf(stdout, "*RET  ");
+            fprintf(fp, "*RET  ");
             break;
         case 0xDA:
-            fprintf(stdout, "JC    #0x%02X%02X", code[2], code[1]);
+            fprintf(fp, "JC    #0x%02X%02X", code[2], code[1]);
             opbytes = 3;
             break;
         case 0xDB:
-            fprintf(stdout, "IN    #0x%02x", code[1]);
+            fprintf(fp, "IN    #0x%02x", code[1]);
             opbytes = 2;
             break;
         case 0xDC:
-            fprintf(stdout, "CC    #0x%02X%02X", code[2], code[1]);
+            fprintf(fp, "CC    #0x%02X%02X", code[2], code[1]);
             opbytes = 3;
             break;
         case 0xDD:
-            fprintf(stdout, "*CALL #0x%02X%02X", code[2], code[1]);
+            fprintf(fp, "*CALL #0x%02X%02X", code[2], code[1]);
             opbytes = 3;
             break;
         case 0xDE:
-            fprintf(stdout, "XRI   #0x%02X", code[1]);
+            fprintf(fp, "SBI   #0x%02X", code[1]);
             opbytes = 2;
             break;
         case 0xDF:
-            fprintf(stdout, "RST   5");
+            fprintf(fp, "RST   3");
             break;
 
         /* ======== 0xE0 ======== */
         case 0xE0:
-            fprintf(stdout, "RPO   ");
+            fprintf(fp, "RPO   ");
             break;
         case 0xE1:
-            fprintf(stdout, "POP   H");
+            fprintf(fp, "POP   H");
             break;
         case 0xE2:
-            fprintf(stdout, "JNC   #0x%02X%02X", code[2], code[1]);
+            fprintf(fp, "JPO   #0x%02X%02X", code[2], code[1]);
             opbytes = 3;
             break;
         case 0xE3:
-            fprintf(stdout, "XTHL  ");
+            fprintf(fp, "XTHL  ");
             break;
         case 0xE4:
-            fprintf(stdout, "CPO   #0x%02X%02X", code[2], code[1]);
+            fprintf(fp, "CPO   #0x%02X%02X", code[2], code[1]);
             opbytes = 3;
             break;
         case 0xE5:
-            fprintf(stdout, "PUSH  H");
+            fprintf(fp, "PUSH  H");
             break;
         case 0xE6:
-            fprintf(stdout, "ANI   #0x%02X", code[1]);
+            fprintf(fp, "ANI   #0x%02X", code[1]);
             opbytes = 2;
             break;
         case 0xE7:
-            fprintf(stdout, "RST   4");
+            fprintf(fp, "RST   4");
             break;
         case 0xE8:
-            fprintf(stdout, "RPE   ");
+            fprintf(fp, "RPE   ");
             break;
         case 0xE9:
-            fprintf(stdout, "PCHL  ");
+            fprintf(fp, "PCHL  ");
             break;
         case 0xEA:
-            fprintf(stdout, "JPE   #0x%02X%02X", code[2], code[1]);
+            fprintf(fp, "JPE   #0x%02X%02X", code[2], code[1]);
             opbytes = 3;
             break;
         case 0xEB:
-            fprintf(stdout, "XCHG  ");
+            fprintf(fp, "XCHG  ");
             break;
         case 0xEC:
-            fprintf(stdout, "CPE   #0x%02X%02X", code[2], code[1]);
+            fprintf(fp, "CPE   #0x%02X%02X", code[2], code[1]);
             opbytes = 3;
             break;
         case 0xED:
-            fprintf(stdout, "*CALL #0x%02X%02X", code[2], code[1]);
+            fprintf(fp, "*CALL #0x%02X%02X", code[2], code[1]);
             opbytes = 3;
             break;
         case 0xEE:
-            fprintf(stdout, "XRI   #0x%02X", code[1]);
+            fprintf(fp, "XRI   #0x%02X", code[1]);
             opbytes = 2;
             break;
         case 0xEF:
-            fprintf(stdout, "RST   5");
+            fprintf(fp, "RST   5");
             break;
 
         /* ======== 0xF0 ======== */
         case 0xF0:
-            fprintf(stdout, "RP    ");
+            fprintf(fp, "RP    ");
             break;
         case 0xF1:
-            fprintf(stdout, "POP   PSW");
+            fprintf(fp, "POP   PSW");
             break;
         case 0xF2:
-            fprintf(stdout, "JP    #0x%02X%02X", code[2], code[1]);
+            fprintf(fp, "JP    #0x%02X%02X", code[2], code[1]);
             opbytes = 3;
             break;
         case 0xF3:
-            fprintf(stdout, "DI    ");
+            fprintf(fp, "DI    ");
             break;
         case 0xF4:
-            fprintf(stdout, "CP    #0x%02X%02X", code[2], code[1]);
+            fprintf(fp, "CP    #0x%02X%02X", code[2], code[1]);
             opbytes = 3;
             break;
         case 0xF5:
-            fprintf(stdout, "PUSH  PSW");
+            fprintf(fp, "PUSH  PSW");
             break;
         case 0xF6:
-            fprintf(stdout, "ORI   #0x%02X", code[1]);
+            fprintf(fp, "ORI   #0x%02X", code[1]);
             opbytes = 2;
             break;
         case 0xF7:
-            fprintf(stdout, "RST   6");
+            fprintf(fp, "RST   6");
             break;
         case 0xF8:
-            fprintf(stdout, "RM    ");
+            fprintf(fp, "RM    ");
             break;
         case 0xF9:
-            fprintf(stdout, "SPHL  ");
+            fprintf(fp, "SPHL  ");
             break;
         case 0xFA:
-            fprintf(stdout, "JM    #0x%02X%02X", code[2], code[1]);
+            fprintf(fp, "JM    #0x%02X%02X", code[2], code[1]);
             opbytes = 3;
             break;
         case 0xFB:
-            fprintf(stdout, "EI    ");
+            fprintf(fp, "EI    ");
             break;
         case 0xFC:
-            fprintf(stdout, "CM    #0x%02X%02X", code[2], code[1]);
+            fprintf(fp, "CM    #0x%02X%02X", code[2], code[1]);
             opbytes = 3;
             break;
         case 0xFD:
-            fprintf(stdout, "*CALL #0x%02X%02X", code[2], code[1]);
+            fprintf(fp, "*CALL #0x%02X%02X", code[2], code[1]);
             opbytes = 3;
             break;
         case 0xFE:
-            fprintf(stdout, "CPI   #0x%02X", code[1]);
+            fprintf(fp, "CPI   #0x%02X", code[1]);
             opbytes = 2;
             break;
         case 0xFF:
-            fprintf(stdout, "RST   7");
+            fprintf(fp, "RST   7");
             break;
     }
 
-    fprintf(stdout, "\n");
-
     return opbytes;
 }
 
- 
+int disassemble_8080_op(unsigned char *codebuffer, int pc)
+{
+    int opbytes;
 
+    fprintf(stdout, "%04X ", pc);
+    opbytes = disassemble_8080_op_file(stdout, codebuffer, pc);
+    fprintf(stdout, "\n");
 
+    return opbytes;
+}
 
+/*
+ * disassemble_8080_op_str()
+ * As disassemble_8080_op_file(), but into a string
+ */
+int disassemble_8080_op_str(char* buf, size_t len, const unsigned char *codebuffer, int pc)
+{
+    int   opbytes = 1;
+    FILE* fp = fmemopen(buf, len, "w");
 
+    buf[0] = '\0';
+    if(fp)
+    {
+        opbytes = disassemble_8080_op_file(fp, codebuffer, pc);
+        fclose(fp);
+    }
 
+    return opbytes;
+}
@@ -7,6 +7,10 @@
 #ifndef __DISASSEM_H
 #define __DISASSEM_H
 
+#include <stdio.h>
+
 int disassemble_8080_op(unsigned char *codebuffer, int pc);
+int disassemble_8080_op_file(FILE* fp, const unsigned char *codebuffer, int pc);
+int disassemble_8080_op_str(char* buf, size_t len, const unsigned char *codebuffer, int pc);
 
 #endif /*__DISASSEM_H*/
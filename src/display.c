@@ -6,92 +6,89 @@
  */
 
 
+#include <stdio.h>
 #include <stdlib.h>
-#include "display.h"
+#include <string.h>
+#include "capture.h"
+#include "display_backend.h"
 
-// Display structure internals
-struct Display
+// ======== NULL BACKEND ======== //
+static int disp_null_init(Display* disp)
 {
-    SDL_Window*  win;
-    SDL_Surface* surf;
-    SDL_Surface* winsurf;
-    int resize;
-    //void (*resize_func)(void*, SDL_Event*);
+    disp->pixels = NULL;
+    return 0;
+}
+
+static void disp_null_present(Display* disp)
+{
+}
+
+static void disp_null_destroy(Display* disp)
+{
+}
+
+static const DisplayBackendOps disp_null_ops = {
+    .name    = "null",
+    .init    = disp_null_init,
+    .present = disp_null_present,
+    .destroy = disp_null_destroy,
 };
 
-int disp_resize_func(void* user_data, SDL_Event* ev)
+// ======== OFFSCREEN BACKEND ======== //
+static int disp_offscreen_init(Display* disp)
 {
-    Display* disp = (Display*) user_data;
-    if(ev->type == SDL_WINDOWEVENT)
-    {
-        if(ev->window.event == SDL_WINDOWEVENT_RESIZED)
-            disp->resize = 1;
-    }
+    disp->pixels = calloc(DISP_NUM_PIXELS, sizeof(*disp->pixels));
+    return disp->pixels ? 0 : -1;
+}
 
-    return 0;
+static void disp_offscreen_destroy(Display* disp)
+{
+    free(disp->pixels);
+    disp->pixels = NULL;
 }
 
+static const DisplayBackendOps disp_offscreen_ops = {
+    .name    = "offscreen",
+    .init    = disp_offscreen_init,
+    .present = disp_null_present,       // the pixels are the output
+    .destroy = disp_offscreen_destroy,
+};
+
+static const DisplayBackendOps* disp_backends[] = {
+    [DISP_BACKEND_NULL]      = &disp_null_ops,
+    [DISP_BACKEND_OFFSCREEN] = &disp_offscreen_ops,
+#ifdef DISP_SDL
+    [DISP_BACKEND_SDL]       = &disp_sdl_ops,
+#else
+    [DISP_BACKEND_SDL]       = NULL,
+#endif /*DISP_SDL*/
+};
+
 // ======== DISPLAY ======== //
-Display* display_create(void)
+/*
+ * display_create()
+ * Backends ignore flags they have no use for
+ */
+Display* display_create(DispBackend backend, unsigned flags)
 {
-    int status = 0;
     Display* disp;
 
-    disp = malloc(sizeof(*disp));
-    if(!disp)
-        goto DISP_END;
-
-    disp->resize = 0;
-
-    // We also take care of all the SDL stuff here
-    status = SDL_Init(SDL_INIT_VIDEO);
-    if(status)
+    if(backend < 0 || backend > DISP_BACKEND_SDL || !disp_backends[backend])
     {
-        fprintf(stderr, "[%s] %s\n", __func__, SDL_GetError());
-        goto DISP_END;
-    }
-    status = 1;
-
-    disp->win = SDL_CreateWindow(
-            DISP_TITLE,
-            SDL_WINDOWPOS_UNDEFINED, 
-            SDL_WINDOWPOS_UNDEFINED,
-            2 * DISP_WIDTH,
-            2 * DISP_HEIGHT,
-            SDL_WINDOW_RESIZABLE
-    );
-
-    if(!disp->win)
-    {
-        fprintf(stderr, "[%s] failed to create SDL_Window handle\n", __func__);
-        goto DISP_END;
+        fprintf(stderr, "[%s] display backend %d not available in this build\n", __func__, backend);
+        return NULL;
     }
 
-    // Create surface
-    disp->winsurf = SDL_GetWindowSurface(disp->win);
-    if(!disp->winsurf)
-    {
-        fprintf(stderr, "[%s] failed to get Window surface\n", __func__);
-        goto DISP_END;
-    }
-    // watch for resize
-    SDL_AddEventWatch(disp_resize_func, NULL);
-    // Create backbuffer surface
-    disp->surf = SDL_CreateRGBSurface(
-            0, 
-            DISP_WIDTH, 
-            DISP_HEIGHT, 
-            32,
-            0,
-            0,
-            0,
-            0
-    );
-
-DISP_END:
-    if(!disp || !disp->win || !disp->winsurf || !status)
+    disp = calloc(1, sizeof(*disp));
+    if(!disp)
+        return NULL;
+    disp->ops   = disp_backends[backend];
+    disp->flags = flags;
+    atomic_init(&disp->keys, 0);
+    if(disp->ops->init(disp) != 0)
     {
-        fprintf(stderr, "[%s] failed to create display\n", __func__);
+        fprintf(stderr, "[%s] failed to create %s display\n", __func__, disp->ops->name);
+        free(disp);
         return NULL;
     }
 
@@ -105,35 +102,96 @@ void display_draw(Display* disp, uint8_t* mem)
 {
     // TODO : Size of video RAM is hardcoded here. Need to check if 
     // that the case for all 8080 software or just invaders
-    int vram = 0x2400;
-    uint32_t* pixels = disp->surf->pixels;
+    display_draw_vram(disp, &mem[DISP_VRAM_ADDR]);
+}
+
+/*
+ * disp_capture()
+ * Hand the frame to the capture if it wants it. Backends that keep
+ * pixels have already converted it, for the others it is converted
+ * straight into the capture slot.
+ */
+static void disp_capture(Display* disp, const uint8_t* vram)
+{
+    unsigned long frame = disp->frames - 1;
+    uint32_t*     slot;
+
+    if(!disp->capture || !capture_due(disp->capture, frame))
+        return;
+    slot = capture_begin(disp->capture);
+    if(disp->pixels)
+        memcpy(slot, disp->pixels, DISP_NUM_PIXELS * sizeof(*slot));
+    else
+        display_convert(vram, slot);
+    capture_commit(disp->capture, frame);
+}
+
+/*
+ * display_draw_vram()
+ * Draw from a copy of video RAM (DISP_VRAM_SIZE bytes)
+ */
+void display_draw_vram(Display* disp, const uint8_t* vram)
+{
+    display_draw_dirty(disp, vram, NULL);
+}
+
+/*
+ * display_draw_dirty()
+ * Draw only the columns marked in dirty (DISP_DIRTY_WORDS words, see
+ * display_mark_dirty()). Everything else is left as it was last frame.
+ * A NULL dirty redraws the whole screen, as does the first frame.
+ */
+void display_draw_dirty(Display* disp, const uint8_t* vram, const uint32_t* dirty)
+{
+    uint8_t   groups[DISP_WIDTH / 8];
+    uint32_t* pixels;
+    int       stride = DISP_WIDTH;
+    int       lo = -1, hi = -1;
+
+    disp->frames++;
+    if(!disp->pixels && !disp->ops->lock)
+    {
+        disp_capture(disp, vram);
+        return;
+    }
 
-    for(int col = 0; col < DISP_WIDTH; ++col)
+    // Columns are converted 8 at a time
+    for(int g = 0; g < DISP_WIDTH / 8; ++g)
     {
-        for(int row = DISP_HEIGHT; row > 0; row = row-8)
+        groups[g] = !dirty || disp->frames == 1 || ((dirty[g / 4] >> (8 * (g % 4))) & 0xFF);
+        if(groups[g])
         {
-            for(int k = 0; k < 8; ++k)
-            {
-                int idx = (row - k) * DISP_WIDTH + col;
-                if(mem[vram] & 1 << k)
-                    pixels[idx] = 0xFFFFFF;
-                else
-                    pixels[idx]= 0x000000;
-            }
-            vram++;
+            if(lo < 0)
+                lo = g;
+            hi = g;
         }
     }
+    // Locked pixels are write only, so everything between the first and
+    // last dirty group has to be drawn
+    if(disp->ops->lock && lo >= 0)
+        memset(&groups[lo], 1, hi - lo + 1);
 
-    //if(disp->resize)
-    //{
-    //    disp->winsurf = SDL_GetWindowSurface(disp->win);
-    //}
-    SDL_BlitScaled(disp->surf, NULL, disp->winsurf, NULL);
-
-    if(SDL_UpdateWindowSurface(disp->win))
+    for(int g = 0; g < DISP_WIDTH / 8; ++g)
     {
-        fprintf(stderr, "[%s] %s\n", __func__, SDL_GetError());
+        int n = 0;
+
+        while(g + n < DISP_WIDTH / 8 && groups[g + n])
+            n++;
+        if(n == 0)
+            continue;
+        if(disp->ops->lock)
+            pixels = disp->ops->lock(disp, 8 * g, 8 * n, &stride);
+        else
+            pixels = &disp->pixels[8 * g];
+        if(!pixels)
+            return;
+        display_convert_cols(vram, pixels, stride, 8 * g, 8 * n);
+        disp->cols_drawn += 8 * n;
+        g += n;
     }
+
+    disp_capture(disp, vram);
+    disp->ops->present(disp);
 }
 
 /*
@@ -141,5 +199,84 @@ void display_draw(Display* disp, uint8_t* mem)
  */
 void display_destroy(Display* disp)
 {
+    if(!disp)
+        return;
+    disp->ops->destroy(disp);
     free(disp);
 }
+
+/*
+ * display_pixels()
+ * The last frame drawn, DISP_WIDTH x DISP_HEIGHT, or NULL if the backend
+ * doesn't keep pixels
+ */
+const uint32_t* display_pixels(const Display* disp)
+{
+    return disp->pixels;
+}
+
+/*
+ * display_frames()
+ */
+unsigned long display_frames(const Display* disp)
+{
+    return disp->frames;
+}
+
+/*
+ * display_cols_drawn()
+ * Columns converted over all frames. Over display_frames() * DISP_WIDTH
+ * this is the fraction of video RAM redrawn each frame.
+ */
+unsigned long display_cols_drawn(const Display* disp)
+{
+    return disp->cols_drawn;
+}
+
+/*
+ * display_keys()
+ * DISP_KEY_* bits for the keys held down in the window. Backends without
+ * a window never set any.
+ */
+unsigned display_keys(const Display* disp)
+{
+    return atomic_load_explicit(&disp->keys, memory_order_relaxed);
+}
+
+/*
+ * display_set_capture()
+ * Capture frames from here on, or stop if cap is NULL. The display
+ * doesn't own the capture.
+ */
+void display_set_capture(Display* disp, struct Capture* cap)
+{
+    disp->capture = cap;
+}
+
+/*
+ * display_backend_name()
+ */
+const char* display_backend_name(const Display* disp)
+{
+    return disp->ops->name;
+}
+
+/*
+ * display_backend_parse()
+ * Look up a backend by name. Returns 0 if the name is known.
+ */
+int display_backend_parse(const char* name, DispBackend* backend)
+{
+    static const char* names[] = { "null", "offscreen", "sdl" };
+
+    for(int b = 0; b <= DISP_BACKEND_SDL; ++b)
+    {
+        if(strcmp(name, names[b]) == 0)
+        {
+            *backend = b;
+            return 0;
+        }
+    }
+
+    return -1;
+}
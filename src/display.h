@@ -1,6 +1,9 @@
 /*
  * DISPLAY
- * Some SDL stuff to display the ROM contents (ie: for games)
+ * Display for the ROM contents (ie: for games). The display converts
+ * video RAM into pixels and hands them to a backend, which can be an SDL
+ * window, an offscreen pixel buffer, or nothing at all when running
+ * headless.
  *
  * Stefan Wong 2020
  */
@@ -8,7 +11,6 @@
 #ifndef __DISPLAY_H
 #define __DISPLAY_H
 
-#include <SDL2/SDL.h>
 #include <stdint.h>
 
 
@@ -16,20 +18,62 @@
 #define DISP_TITLE "Space Invaders"
 #define DISP_HEIGHT 256
 #define DISP_WIDTH 224
+#define DISP_NUM_PIXELS (DISP_WIDTH * DISP_HEIGHT)
+#define DISP_VRAM_ADDR 0x2400
+#define DISP_VRAM_SIZE (DISP_NUM_PIXELS / 8)
+#define DISP_COL_BYTES (DISP_HEIGHT / 8)   // video RAM bytes per screen column
+#define DISP_DIRTY_WORDS (DISP_WIDTH / 32)  // bitmap with a bit per column
+#define DISP_PIXEL_ON  0xFFFFFF
+#define DISP_PIXEL_OFF 0x000000
 #define DISP_TIC (1000.0 / 60.0)       // ms per tic
 #define DISP_CYCLES_PER_MS 2000         // 8080 clock @2Mhz
 #define DISP_CYCLES_PER_TIC (DISP_CYCLES_PER_MS * DISP_TIC)
 
+typedef enum
+{
+    DISP_BACKEND_NULL,          // draws nothing
+    DISP_BACKEND_OFFSCREEN,     // draws into a pixel buffer
+    DISP_BACKEND_SDL,           // draws into a window (needs SDL=1)
+} DispBackend;
+
+// Flags for display_create()
+#define DISP_VSYNC 0x1          // present in step with the monitor refresh
+
+// Keys held down in the window, from display_keys()
+#define DISP_KEY_TURBO 0x1      // run uncapped (Tab)
+#define DISP_KEY_QUIT  0x2      // window closed or Escape
+
 // Display forward declaration
 typedef struct Display Display;
+struct Capture;
+
+Display*        display_create(DispBackend backend, unsigned flags);
+void            display_destroy(Display* disp);
+void            display_draw(Display* disp, uint8_t* mem);
+void            display_draw_vram(Display* disp, const uint8_t* vram);
+void            display_draw_dirty(Display* disp, const uint8_t* vram, const uint32_t* dirty);
+const uint32_t* display_pixels(const Display* disp);
+unsigned long   display_frames(const Display* disp);
+unsigned long   display_cols_drawn(const Display* disp);
+unsigned        display_keys(const Display* disp);
+void            display_set_capture(Display* disp, struct Capture* cap);
+const char*     display_backend_name(const Display* disp);
+int             display_backend_parse(const char* name, DispBackend* backend);
 
-int disp_resize_func(void* user_data, SDL_Event* ev);
-// NOTE: Maybe refactor this file to be something like IO.h (since
-// display and input aren't really related)
-//int disp_handle_input(void);
+// Video RAM to pixels
+void display_convert(const uint8_t* vram, uint32_t* pixels);
+void display_convert_ref(const uint8_t* vram, uint32_t* pixels);
+void display_convert_cols(const uint8_t* vram, uint32_t* pixels, int stride, int col, int ncols);
+
+/*
+ * display_mark_dirty()
+ * Mark the screen column holding byte off of video RAM for redrawing
+ */
+static inline void display_mark_dirty(uint32_t* dirty, unsigned off)
+{
+    unsigned col = off / DISP_COL_BYTES;
 
-Display* display_create(void);
-void     display_destroy(Display* disp);
-void     display_draw(Display* disp, uint8_t* mem);
+    dirty[col / 32] |= 1u << (col % 32);
+}
 
 #endif /*__DISPLAY_H*/
@@ -0,0 +1,49 @@
+/*
+ * DISPLAY_BACKEND
+ * Interface between the display and the things it can draw on
+ *
+ * Stefan Wong 2020
+ */
+
+#ifndef __DISPLAY_BACKEND_H
+#define __DISPLAY_BACKEND_H
+
+#include <stdatomic.h>
+#include "display.h"
+
+typedef struct
+{
+    const char* name;
+    // Set up the backend. Backends that want pixels point disp->pixels
+    // at a DISP_WIDTH x DISP_HEIGHT buffer. Returns 0 on success.
+    int  (*init)(Display* disp);
+    // Optional. Get the buffer to draw columns [col, col + ncols) of the
+    // next frame into, as a pointer to the top pixel of col and a stride
+    // in pixels. The whole range has to be drawn. Without this the frame
+    // is drawn into disp->pixels. Returns NULL to skip the frame.
+    uint32_t* (*lock)(Display* disp, int col, int ncols, int* stride);
+    // Show the pixels of a new frame
+    void (*present)(Display* disp);
+    void (*destroy)(Display* disp);
+} DisplayBackendOps;
+
+// Display structure internals
+struct Display
+{
+    const DisplayBackendOps* ops;
+    uint32_t*     pixels;       // NULL if the backend doesn't want them
+    unsigned long frames;
+    unsigned long cols_drawn;   // columns converted over all frames
+    unsigned      flags;        // DISP_VSYNC, ...
+    // DISP_KEY_* set by the backend while presenting. Read from the
+    // emulation thread when drawing happens on another one.
+    atomic_uint   keys;
+    struct Capture* capture;    // NULL unless capturing frames
+    void*         backend;      // backend private data
+};
+
+#ifdef DISP_SDL
+extern const DisplayBackendOps disp_sdl_ops;
+#endif /*DISP_SDL*/
+
+#endif /*__DISPLAY_BACKEND_H*/
@@ -0,0 +1,129 @@
+/*
+ * DISPLAY_CONVERT
+ * Video RAM to pixel conversion
+ *
+ * Stefan Wong 2020
+ */
+
+#include <pthread.h>
+#include <string.h>
+#include "display.h"
+
+
+// Video RAM is DISP_WIDTH columns of DISP_COL_BYTES bytes each, starting
+// from the bottom of the column. Bit 0 of a byte is the lowest pixel.
+
+/*
+ * display_convert_ref()
+ * Reference conversion, one pixel at a time in video RAM order
+ */
+void display_convert_ref(const uint8_t* vram, uint32_t* pixels)
+{
+    // The screen is rotated, so each byte is 8 pixels of a column
+    // going up from the bottom of the screen
+    for(int col = 0; col < DISP_WIDTH; ++col)
+    {
+        for(int row = DISP_HEIGHT - 1; row > 0; row = row-8)
+        {
+            for(int k = 0; k < 8; ++k)
+            {
+                int idx = (row - k) * DISP_WIDTH + col;
+                if(*vram & 1 << k)
+                    pixels[idx] = DISP_PIXEL_ON;
+                else
+                    pixels[idx] = DISP_PIXEL_OFF;
+            }
+            vram++;
+        }
+    }
+}
+
+// ======== TILED CONVERSION ======== //
+//
+// The fast path works on tiles of 8x8 pixels, which are 8 bytes of video
+// RAM from 8 neighbouring columns. Transposing the tile as a bit matrix
+// turns it into 8 bytes that each hold 8 neighbouring pixels of one row,
+// and each of those expands to 8 pixels with one copy from a table.
+// Tiles are walked across the screen a band of 8 rows at a time so the
+// stores run along rows instead of down columns.
+
+// Pixels for each byte, bit 0 first
+static uint32_t       disp_expand_lut[256][8];
+static pthread_once_t disp_convert_once = PTHREAD_ONCE_INIT;
+
+/*
+ * disp_tile_load()
+ * Gather the tile at (col, byte) into a bit matrix with one column per byte
+ */
+static inline uint64_t disp_tile_load(const uint8_t* vram, int col, int byte)
+{
+    const uint8_t* p = &vram[col * DISP_COL_BYTES + byte];
+    uint64_t x = 0;
+
+    for(int j = 0; j < 8; ++j)
+        x |= (uint64_t) p[j * DISP_COL_BYTES] << (8 * j);
+
+    return x;
+}
+
+/*
+ * disp_transpose8()
+ * Transpose an 8x8 bit matrix, so bit k of byte j moves to bit j of byte k
+ */
+static inline uint64_t disp_transpose8(uint64_t x)
+{
+    uint64_t t;
+
+    t = (x ^ (x >> 7))  & 0x00AA00AA00AA00AAULL;
+    x = x ^ t ^ (t << 7);
+    t = (x ^ (x >> 14)) & 0x0000CCCC0000CCCCULL;
+    x = x ^ t ^ (t << 14);
+    t = (x ^ (x >> 28)) & 0x00000000F0F0F0F0ULL;
+    x = x ^ t ^ (t << 28);
+
+    return x;
+}
+
+static void disp_convert_init(void)
+{
+    for(int b = 0; b < 256; ++b)
+    {
+        for(int k = 0; k < 8; ++k)
+            disp_expand_lut[b][k] = (b & 1 << k) ? DISP_PIXEL_ON : DISP_PIXEL_OFF;
+    }
+}
+
+/*
+ * display_convert_cols()
+ * Convert columns [col, col + ncols) of video RAM, where col and ncols are
+ * multiples of 8. pixels points at the top pixel of col and rows are
+ * stride pixels apart.
+ */
+void display_convert_cols(const uint8_t* vram, uint32_t* pixels, int stride, int col, int ncols)
+{
+    pthread_once(&disp_convert_once, disp_convert_init);
+
+    for(int byte = 0; byte < DISP_COL_BYTES; ++byte)
+    {
+        // Bit k of this byte is row (DISP_HEIGHT - 1 - 8 * byte - k)
+        uint32_t* band = &pixels[(DISP_HEIGHT - 1 - 8 * byte) * stride];
+
+        for(int c = 0; c < ncols; c += 8)
+        {
+            uint64_t tile = disp_transpose8(disp_tile_load(vram, col + c, byte));
+
+            for(int k = 0; k < 8; ++k)
+                memcpy(&band[c - k * stride], disp_expand_lut[(tile >> (8 * k)) & 0xFF], 8 * sizeof(uint32_t));
+        }
+    }
+}
+
+/*
+ * display_convert()
+ * Convert DISP_VRAM_SIZE bytes of video RAM into DISP_WIDTH x DISP_HEIGHT
+ * pixels. Gives the same result as display_convert_ref().
+ */
+void display_convert(const uint8_t* vram, uint32_t* pixels)
+{
+    display_convert_cols(vram, pixels, DISP_WIDTH, 0, DISP_WIDTH);
+}
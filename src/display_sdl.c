@@ -0,0 +1,244 @@
+/*
+ * DISPLAY_SDL
+ * SDL window backend for the display
+ *
+ * Stefan Wong 2020
+ */
+
+#ifdef DISP_SDL
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <SDL2/SDL.h>
+#include "display_backend.h"
+
+// Frames are converted straight into a streaming texture and the
+// renderer scales them to the window, so the CPU only ever touches
+// DISP_WIDTH x DISP_HEIGHT pixels no matter how big the window is. Only
+// the columns that changed are locked and redrawn.
+typedef struct
+{
+    SDL_Window*   win;
+    SDL_Renderer* ren;
+    SDL_Texture*  tex;
+    SDL_Rect      dst;          // where the frame goes in the window
+    void*         locked;       // texture pixels while the texture is locked
+    int           resize;       // set by the event watch
+} DisplaySDL;
+
+/*
+ * disp_key_bit()
+ * DISP_KEY_* bit for an SDL key, or 0
+ */
+static unsigned disp_key_bit(SDL_Keycode sym)
+{
+    switch(sym)
+    {
+        case SDLK_TAB:
+            return DISP_KEY_TURBO;
+        case SDLK_ESCAPE:
+            return DISP_KEY_QUIT;
+        default:
+            return 0;
+    }
+}
+
+static int disp_event_func(void* user_data, SDL_Event* ev)
+{
+    Display*    disp = (Display*) user_data;
+    DisplaySDL* sdl  = disp->backend;
+
+    switch(ev->type)
+    {
+        case SDL_WINDOWEVENT:
+            if(ev->window.windowID == SDL_GetWindowID(sdl->win) &&
+               ev->window.event == SDL_WINDOWEVENT_SIZE_CHANGED)
+                sdl->resize = 1;
+            break;
+        case SDL_KEYDOWN:
+            atomic_fetch_or(&disp->keys, disp_key_bit(ev->key.keysym.sym));
+            break;
+        case SDL_KEYUP:
+            // Quit stays set once asked for
+            atomic_fetch_and(&disp->keys, ~(disp_key_bit(ev->key.keysym.sym) & DISP_KEY_TURBO));
+            break;
+        case SDL_QUIT:
+            atomic_fetch_or(&disp->keys, DISP_KEY_QUIT);
+            break;
+    }
+
+    return 0;
+}
+
+/*
+ * disp_sdl_fit()
+ * Centre the largest frame that keeps the aspect ratio in the window
+ */
+static void disp_sdl_fit(DisplaySDL* sdl)
+{
+    int w, h;
+
+    if(SDL_GetRendererOutputSize(sdl->ren, &w, &h) != 0)
+        SDL_GetWindowSize(sdl->win, &w, &h);
+    if(w * DISP_HEIGHT > h * DISP_WIDTH)
+    {
+        sdl->dst.h = h;
+        sdl->dst.w = h * DISP_WIDTH / DISP_HEIGHT;
+    }
+    else
+    {
+        sdl->dst.w = w;
+        sdl->dst.h = w * DISP_HEIGHT / DISP_WIDTH;
+    }
+    sdl->dst.x  = (w - sdl->dst.w) / 2;
+    sdl->dst.y  = (h - sdl->dst.h) / 2;
+    sdl->resize = 0;
+}
+
+static void disp_sdl_destroy(Display* disp)
+{
+    DisplaySDL* sdl = disp->backend;
+
+    if(!sdl)
+        return;
+    SDL_DelEventWatch(disp_event_func, disp);
+    if(sdl->tex)
+        SDL_DestroyTexture(sdl->tex);
+    if(sdl->ren)
+        SDL_DestroyRenderer(sdl->ren);
+    if(sdl->win)
+        SDL_DestroyWindow(sdl->win);
+    SDL_Quit();
+    free(sdl);
+    disp->backend = NULL;
+}
+
+static int disp_sdl_init(Display* disp)
+{
+    int status = 0;
+    uint32_t ren_flags = 0;
+    DisplaySDL* sdl;
+
+    sdl = calloc(1, sizeof(*sdl));
+    if(!sdl)
+        return -1;
+    disp->backend = sdl;
+    disp->pixels  = NULL;       // frames go straight to the texture
+
+    // We also take care of all the SDL stuff here
+    status = SDL_Init(SDL_INIT_VIDEO);
+    if(status)
+    {
+        fprintf(stderr, "[%s] %s\n", __func__, SDL_GetError());
+        free(sdl);
+        disp->backend = NULL;
+        return -1;
+    }
+
+    sdl->win = SDL_CreateWindow(
+            DISP_TITLE,
+            SDL_WINDOWPOS_UNDEFINED,
+            SDL_WINDOWPOS_UNDEFINED,
+            2 * DISP_WIDTH,
+            2 * DISP_HEIGHT,
+            SDL_WINDOW_RESIZABLE
+    );
+
+    if(!sdl->win)
+    {
+        fprintf(stderr, "[%s] failed to create SDL_Window handle\n", __func__);
+        goto DISP_FAIL;
+    }
+
+    if(disp->flags & DISP_VSYNC)
+        ren_flags |= SDL_RENDERER_PRESENTVSYNC;
+    sdl->ren = SDL_CreateRenderer(sdl->win, -1, ren_flags | SDL_RENDERER_ACCELERATED);
+    if(!sdl->ren)
+    {
+        fprintf(stderr, "[%s] no accelerated renderer (%s), falling back to software\n", __func__, SDL_GetError());
+        sdl->ren = SDL_CreateRenderer(sdl->win, -1, ren_flags | SDL_RENDERER_SOFTWARE);
+    }
+    if(!sdl->ren)
+    {
+        fprintf(stderr, "[%s] %s\n", __func__, SDL_GetError());
+        goto DISP_FAIL;
+    }
+
+    // Keep the pixels square when scaling up
+    SDL_SetHint(SDL_HINT_RENDER_SCALE_QUALITY, "nearest");
+    // Display pixels are 0x00RRGGBB
+    sdl->tex = SDL_CreateTexture(
+            sdl->ren,
+            SDL_PIXELFORMAT_RGB888,
+            SDL_TEXTUREACCESS_STREAMING,
+            DISP_WIDTH,
+            DISP_HEIGHT
+    );
+    if(!sdl->tex)
+    {
+        fprintf(stderr, "[%s] %s\n", __func__, SDL_GetError());
+        goto DISP_FAIL;
+    }
+    disp_sdl_fit(sdl);
+    // watch for resize and the keys in display_keys()
+    SDL_AddEventWatch(disp_event_func, disp);
+
+    return 0;
+
+DISP_FAIL:
+    disp_sdl_destroy(disp);
+    return -1;
+}
+
+/*
+ * disp_sdl_lock()
+ * Lock the columns of the texture that are about to change, so that they
+ * are converted straight into it
+ */
+static uint32_t* disp_sdl_lock(Display* disp, int col, int ncols, int* stride)
+{
+    DisplaySDL* sdl = disp->backend;
+    SDL_Rect    rect = { col, 0, ncols, DISP_HEIGHT };
+    int         pitch;
+
+    if(SDL_LockTexture(sdl->tex, &rect, &sdl->locked, &pitch) != 0)
+    {
+        fprintf(stderr, "[%s] %s\n", __func__, SDL_GetError());
+        sdl->locked = NULL;
+        return NULL;
+    }
+    *stride = pitch / sizeof(uint32_t);
+
+    return sdl->locked;
+}
+
+static void disp_sdl_present(Display* disp)
+{
+    DisplaySDL* sdl = disp->backend;
+
+    if(sdl->locked)
+    {
+        SDL_UnlockTexture(sdl->tex);
+        sdl->locked = NULL;
+    }
+
+    // Nothing else runs an event loop, so pump here to keep the window
+    // responsive. This is also what calls the event watch.
+    SDL_PumpEvents();
+    if(sdl->resize)
+        disp_sdl_fit(sdl);
+
+    SDL_RenderClear(sdl->ren);
+    SDL_RenderCopy(sdl->ren, sdl->tex, NULL, &sdl->dst);
+    SDL_RenderPresent(sdl->ren);
+}
+
+const DisplayBackendOps disp_sdl_ops = {
+    .name    = "sdl",
+    .init    = disp_sdl_init,
+    .lock    = disp_sdl_lock,
+    .present = disp_sdl_present,
+    .destroy = disp_sdl_destroy,
+};
+
+#endif /*DISP_SDL*/
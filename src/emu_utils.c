@@ -6,6 +6,7 @@
 #include <stdio.h>
 #include <stdlib.h>
 #include "cpu.h"
+#include "rom.h"
 
 
 void PrintState(CPUState *state)
@@ -29,25 +30,18 @@ void PrintState(CPUState *state)
          state->sp);
 }
 
-void ReadFileToMemory(CPUState *state, const char *filename, int offset)
+/*
+ * ReadFileToMemory()
+ * Load a file into memory at offset. Returns the number of bytes read,
+ * or -1 if the file can't be read or doesn't fit in the address space.
+ */
+long ReadFileToMemory(CPUState *state, const char *filename, int offset)
 {
-    FILE *fp;
-    int num_bytes;
-    uint8_t *buffer;
-
-    fp = fopen(filename, "rb");
-    if(!fp)
+    if(offset < 0 || offset >= CPU_MEM_SIZE)
     {
-        fprintf(stderr, "Failed to read file %s, exiting\n", filename);
-        exit(-1);
+        fprintf(stderr, "[%s] offset 0x%X is outside memory\n", __func__, offset);
+        return -1;
     }
 
-    fseek(fp, 0, SEEK_END);
-    num_bytes = ftell(fp);
-    fseek(fp, 0, SEEK_SET);
-    
-    // Load file into memory 
-    buffer = &state->memory[offset];
-    fread(buffer, num_bytes, 1, fp);
-    fclose(fp);
+    return rom_load_file(state, filename, (uint16_t) offset);
 }
@@ -9,6 +9,6 @@
 #include "cpu.h"
 
 void PrintState(CPUState *state);
-void ReadFileToMemory(CPUState *state, const char *filename, int offset);
+long ReadFileToMemory(CPUState *state, const char *filename, int offset);
 
 #endif /*__EMU_UTILS*/
@@ -0,0 +1,335 @@
+/*
+ * INPUT_LOG
+ * Record and replay of CPU inputs
+ *
+ * Stefan Wong 2020
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "input_log.h"
+
+#define INPUT_KIND_BITS   2
+#define INPUT_KIND_MASK   ((1 << INPUT_KIND_BITS) - 1)
+#define INPUT_HEADER_SIZE 5
+#define INPUT_LOG_CHUNK   4096
+
+/*
+ * input_log_create()
+ */
+InputLog* input_log_create(void)
+{
+    InputLog* log;
+
+    log = calloc(1, sizeof(*log));
+    if(!log)
+        return NULL;
+    log->data = byte_vector_create(INPUT_LOG_CHUNK);
+    if(!log->data)
+    {
+        free(log);
+        return NULL;
+    }
+
+    return log;
+}
+
+/*
+ * input_log_destroy()
+ */
+void input_log_destroy(InputLog* log)
+{
+    if(!log)
+        return;
+    byte_vector_destroy(log->data);
+    free(log);
+}
+
+// ======== ENCODING ======== //
+static void put_varint(ByteVector* v, uint64_t val)
+{
+    uint8_t buf[10];
+    int     n = 0;
+
+    do
+    {
+        buf[n] = val & 0x7F;
+        val >>= 7;
+        if(val)
+            buf[n] |= 0x80;
+        n++;
+    } while(val);
+    byte_vector_push_back(v, buf, n);
+}
+
+static int get_varint(const ByteVector* v, int* pos, uint64_t* val)
+{
+    uint64_t out   = 0;
+    int      shift = 0;
+
+    while(*pos < v->size && shift < 64)
+    {
+        uint8_t b = v->data[(*pos)++];
+
+        out |= (uint64_t) (b & 0x7F) << shift;
+        if(!(b & 0x80))
+        {
+            *val = out;
+            return 1;
+        }
+        shift += 7;
+    }
+
+    return 0;
+}
+
+static void put_event(InputLog* log, uint64_t cycles, InputEventKind kind)
+{
+    // Events come from a single machine, so time only goes forward
+    uint64_t delta = (cycles > log->last_cycles) ? cycles - log->last_cycles : 0;
+
+    put_varint(log->data, (delta << INPUT_KIND_BITS) | kind);
+    log->last_cycles += delta;
+    log->num_events++;
+}
+
+/*
+ * input_log_port()
+ * Log the value read from a port. Nothing is written unless it differs
+ * from the last value logged for the same port.
+ */
+void input_log_port(InputLog* log, uint64_t cycles, uint8_t port, uint8_t val)
+{
+    uint8_t payload[2] = { port, val };
+
+    if(log->port_seen[port] && log->port_val[port] == val)
+        return;
+    log->port_seen[port] = 1;
+    log->port_val[port]  = val;
+    put_event(log, cycles, INPUT_EV_PORT);
+    byte_vector_push_back(log->data, payload, 2);
+}
+
+/*
+ * input_log_interrupt()
+ */
+void input_log_interrupt(InputLog* log, uint64_t cycles, uint8_t vector)
+{
+    put_event(log, cycles, INPUT_EV_INTERRUPT);
+    byte_vector_push_back(log->data, &vector, 1);
+}
+
+/*
+ * input_log_hash()
+ */
+void input_log_hash(InputLog* log, uint64_t cycles, uint64_t hash)
+{
+    put_event(log, cycles, INPUT_EV_HASH);
+    put_varint(log->data, hash);
+}
+
+// ======== DECODING ======== //
+/*
+ * input_cursor_init()
+ */
+void input_cursor_init(InputCursor* cursor)
+{
+    cursor->pos    = 0;
+    cursor->cycles = 0;
+}
+
+/*
+ * input_log_read()
+ * Read the event at the cursor and move past it. Returns 0 at the end of
+ * the log or if the log is truncated.
+ */
+int input_log_read(const InputLog* log, InputCursor* cursor, InputEvent* ev)
+{
+    const ByteVector* v = log->data;
+    uint64_t          tag;
+    int               pos = cursor->pos;
+
+    if(!get_varint(v, &pos, &tag))
+        return 0;
+    memset(ev, 0, sizeof(*ev));
+    ev->kind   = tag & INPUT_KIND_MASK;
+    ev->cycles = cursor->cycles + (tag >> INPUT_KIND_BITS);
+
+    switch(ev->kind)
+    {
+        case INPUT_EV_PORT:
+            if(pos + 2 > v->size)
+                return 0;
+            ev->port  = v->data[pos];
+            ev->value = v->data[pos + 1];
+            pos += 2;
+            break;
+        case INPUT_EV_INTERRUPT:
+            if(pos + 1 > v->size)
+                return 0;
+            ev->port = v->data[pos++];
+            break;
+        case INPUT_EV_HASH:
+            if(!get_varint(v, &pos, &ev->hash))
+                return 0;
+            break;
+        default:
+            return 0;
+    }
+    cursor->pos    = pos;
+    cursor->cycles = ev->cycles;
+
+    return 1;
+}
+
+/*
+ * input_log_next_of()
+ * Read up to and including the next event whose kind is set in kinds
+ * (a mask of 1 << InputEventKind). Returns 0 if there isn't one.
+ */
+int input_log_next_of(const InputLog* log, InputCursor* cursor, unsigned kinds, InputEvent* ev)
+{
+    while(input_log_read(log, cursor, ev))
+    {
+        if(kinds & (1u << ev->kind))
+            return 1;
+    }
+
+    return 0;
+}
+
+/*
+ * input_replay_init()
+ */
+void input_replay_init(InputReplay* rp, const InputLog* log)
+{
+    memset(rp, 0, sizeof(*rp));
+    rp->log = log;
+    input_cursor_init(&rp->cursor);
+    rp->have_next = input_log_next_of(log, &rp->cursor, 1u << INPUT_EV_PORT, &rp->next);
+}
+
+/*
+ * input_replay_port()
+ * Value of a port at the given cycle. Port values change only when the
+ * recording says they did, so reading a port at the same cycle as it was
+ * read while recording gives the same value.
+ */
+uint8_t input_replay_port(InputReplay* rp, uint64_t cycles, uint8_t port)
+{
+    while(rp->have_next && rp->next.cycles <= cycles)
+    {
+        rp->port_val[rp->next.port] = rp->next.value;
+        rp->have_next = input_log_next_of(rp->log, &rp->cursor, 1u << INPUT_EV_PORT, &rp->next);
+    }
+
+    return rp->port_val[port];
+}
+
+// ======== FILES ======== //
+/*
+ * input_log_save()
+ */
+int input_log_save(const InputLog* log, const char* filename)
+{
+    FILE*   fp;
+    uint8_t header[INPUT_HEADER_SIZE] = { 'S', '8', 'I', 'N', INPUT_LOG_VERSION };
+    int     status = -1;
+
+    fp = fopen(filename, "wb");
+    if(!fp)
+    {
+        fprintf(stderr, "[%s] failed to open %s\n", __func__, filename);
+        return -1;
+    }
+    if(fwrite(header, 1, INPUT_HEADER_SIZE, fp) != INPUT_HEADER_SIZE)
+        goto SAVE_END;
+    if(fwrite(log->data->data, 1, log->data->size, fp) != (size_t) log->data->size)
+        goto SAVE_END;
+    status = 0;
+
+SAVE_END:
+    if(fclose(fp) != 0)
+        status = -1;
+    if(status < 0)
+        fprintf(stderr, "[%s] failed to write %s\n", __func__, filename);
+
+    return status;
+}
+
+/*
+ * input_log_load()
+ * Load a log for replay. Returns NULL if the file can't be read or isn't
+ * an input log.
+ */
+InputLog* input_log_load(const char* filename)
+{
+    FILE*      fp;
+    InputLog*  log = NULL;
+    uint8_t    buf[INPUT_LOG_CHUNK];
+    size_t     n;
+    InputEvent ev;
+    InputCursor cursor;
+
+    fp = fopen(filename, "rb");
+    if(!fp)
+    {
+        fprintf(stderr, "[%s] failed to open %s\n", __func__, filename);
+        return NULL;
+    }
+    if(fread(buf, 1, INPUT_HEADER_SIZE, fp) != INPUT_HEADER_SIZE ||
+       memcmp(buf, INPUT_LOG_MAGIC, 4) != 0 || buf[4] != INPUT_LOG_VERSION)
+    {
+        fprintf(stderr, "[%s] %s is not an input log\n", __func__, filename);
+        goto LOAD_END;
+    }
+
+    log = input_log_create();
+    if(!log)
+        goto LOAD_END;
+    while((n = fread(buf, 1, sizeof(buf), fp)) > 0)
+        byte_vector_push_back(log->data, buf, n);
+    if(ferror(fp))
+    {
+        fprintf(stderr, "[%s] failed to read %s\n", __func__, filename);
+        input_log_destroy(log);
+        log = NULL;
+        goto LOAD_END;
+    }
+
+    // Count the events and leave the log ready to be appended to
+    input_cursor_init(&cursor);
+    while(input_log_read(log, &cursor, &ev))
+        log->num_events++;
+    log->last_cycles = cursor.cycles;
+
+LOAD_END:
+    fclose(fp);
+    return log;
+}
+
+/*
+ * cpu_state_hash()
+ * FNV-1a over the registers, the cycle count and the address space
+ */
+uint64_t cpu_state_hash(const CPUState* state)
+{
+    uint64_t hash = 0xCBF29CE484222325ULL;
+    uint8_t  regs[] = {
+        state->a, state->b, state->c, state->d, state->e, state->h, state->l,
+        state->cc.psw, state->int_enable,
+        state->sp & 0xFF, state->sp >> 8, state->pc & 0xFF, state->pc >> 8,
+    };
+
+#define FNV(byte) hash = (hash ^ (byte)) * 0x100000001B3ULL
+    for(size_t i = 0; i < sizeof(regs); ++i)
+        FNV(regs[i]);
+    for(int i = 0; i < 8; ++i)
+        FNV((state->cycles >> (8 * i)) & 0xFF);
+    for(int i = 0; i < CPU_MEM_SIZE; ++i)
+        FNV(state->memory[i]);
+#undef FNV
+
+    return hash;
+}
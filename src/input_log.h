@@ -0,0 +1,86 @@
+/*
+ * INPUT_LOG
+ * Record and replay of everything that reaches the CPU from outside:
+ * values read from IN ports, interrupts, and state hashes to check a
+ * replay against. Each event is stored as a LEB128 varint of the cycles
+ * since the previous event, with the event kind in the low bits, followed
+ * by a short payload. Port values are only logged when they change.
+ *
+ * Stefan Wong 2020
+ */
+
+#ifndef __INPUT_LOG_H
+#define __INPUT_LOG_H
+
+#include <stddef.h>
+#include <stdint.h>
+#include "cpu.h"
+#include "vector.h"
+
+#define INPUT_LOG_MAGIC   "S8IN"
+#define INPUT_LOG_VERSION 1
+
+typedef enum
+{
+    INPUT_EV_PORT      = 0,     // port, value
+    INPUT_EV_INTERRUPT = 1,     // vector
+    INPUT_EV_HASH      = 2,     // 64-bit state hash
+} InputEventKind;
+
+typedef struct
+{
+    InputEventKind kind;
+    uint64_t       cycles;
+    uint8_t        port;        // or interrupt vector
+    uint8_t        value;
+    uint64_t       hash;
+} InputEvent;
+
+typedef struct
+{
+    ByteVector* data;
+    uint64_t    last_cycles;    // of the last event written
+    uint8_t     port_val[256];  // last value logged for each port
+    uint8_t     port_seen[256];
+    int         num_events;
+} InputLog;
+
+// Position of a reader in a log
+typedef struct
+{
+    int      pos;
+    uint64_t cycles;
+} InputCursor;
+
+// Port values as of a point in a replay
+typedef struct
+{
+    const InputLog* log;
+    InputCursor     cursor;
+    InputEvent      next;
+    int             have_next;
+    uint8_t         port_val[256];
+} InputReplay;
+
+InputLog* input_log_create(void);
+void      input_log_destroy(InputLog* log);
+int       input_log_save(const InputLog* log, const char* filename);
+InputLog* input_log_load(const char* filename);
+
+// Recording
+void input_log_port(InputLog* log, uint64_t cycles, uint8_t port, uint8_t val);
+void input_log_interrupt(InputLog* log, uint64_t cycles, uint8_t vector);
+void input_log_hash(InputLog* log, uint64_t cycles, uint64_t hash);
+
+// Reading back
+void input_cursor_init(InputCursor* cursor);
+int  input_log_read(const InputLog* log, InputCursor* cursor, InputEvent* ev);
+int  input_log_next_of(const InputLog* log, InputCursor* cursor, unsigned kinds, InputEvent* ev);
+
+void    input_replay_init(InputReplay* rp, const InputLog* log);
+uint8_t input_replay_port(InputReplay* rp, uint64_t cycles, uint8_t port);
+
+// Hash of the registers, cycle count and memory of a machine
+uint64_t cpu_state_hash(const CPUState* state);
+
+#endif /*__INPUT_LOG_H*/
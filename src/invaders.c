@@ -0,0 +1,344 @@
+/*
+ * INVADERS
+ * The Space Invaders machine
+ *
+ * Stefan Wong 2020
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "invaders.h"
+#include "rom.h"
+
+
+// ======== PORTS ======== //
+// Each device is attached to its ports in invaders_create(). Anything
+// else is unconnected.
+static uint8_t invaders_inputs_in(CPUState* state, void* dev, uint8_t port)
+{
+    const uint8_t* in_port = dev;
+
+    return in_port[port];
+}
+
+static uint8_t invaders_shift_in(CPUState* state, void* dev, uint8_t port)
+{
+    const InvadersShifter* sh = dev;
+
+    return (sh->value >> (8 - sh->offset)) & 0xFF;
+}
+
+static void invaders_shift_offset_out(CPUState* state, void* dev, uint8_t port, uint8_t val)
+{
+    InvadersShifter* sh = dev;
+
+    sh->offset = val & 0x7;
+}
+
+static void invaders_shift_data_out(CPUState* state, void* dev, uint8_t port, uint8_t val)
+{
+    InvadersShifter* sh = dev;
+
+    sh->value = (val << 8) | (sh->value >> 8);
+}
+
+// OUT 3 and OUT 5
+static void invaders_sound_out(CPUState* state, void* dev, uint8_t port, uint8_t val)
+{
+    Invaders* inv  = dev;
+    int       bank = (port == 5);
+
+    if(inv->audio)
+        audio_port_write(inv->audio, bank, val, state->cycles);
+    inv->sound[bank] = val;
+}
+
+static void invaders_watchdog_out(CPUState* state, void* dev, uint8_t port, uint8_t val)
+{
+    uint8_t* watchdog = dev;
+
+    *watchdog = val;
+}
+
+// ======== VIDEO RAM ======== //
+// Writes to video RAM, and to its mirrors, come through here so the
+// display only has to redraw the columns that changed
+static void invaders_vram_write(CPUState* state, uint16_t addr, uint8_t val)
+{
+    Invaders* inv = state->userdata;
+    uint16_t  ram = rom_set_invaders.ram_start +
+        (addr - rom_set_invaders.ram_start) % (rom_set_invaders.ram_end - rom_set_invaders.ram_start);
+
+    if(state->memory[ram] != val)
+    {
+        state->memory[ram] = val;
+        display_mark_dirty(inv->vram_dirty, ram - DISP_VRAM_ADDR);
+    }
+}
+
+// ======== RECORD / REPLAY ======== //
+// Only the inputs are wrapped. The shift register follows from the
+// OUTs, so it runs as it is in a replay.
+static uint8_t invaders_record_in(CPUState* state, void* dev, uint8_t port)
+{
+    Invaders* inv = dev;
+    uint8_t   val = inv->ports.in[port](state, inv->ports.in_dev[port], port);
+
+    input_log_port(inv->rec_log, state->cycles, port, val);
+    return val;
+}
+
+static uint8_t invaders_replay_in(CPUState* state, void* dev, uint8_t port)
+{
+    Invaders* inv = dev;
+
+    return input_replay_port(inv->replay, state->cycles, port);
+}
+
+// Point the CPU at the inputs wrapped in handler, or back at the devices
+// if it is NULL
+static void invaders_wrap_inputs(Invaders* inv, CPUPortIn handler)
+{
+    if(!handler)
+    {
+        inv->cpu->ports = &inv->ports;
+        return;
+    }
+    inv->session_ports = inv->ports;
+    cpu_ports_in(&inv->session_ports, 0, INVADERS_NUM_INPUTS - 1, handler, inv);
+    inv->cpu->ports = &inv->session_ports;
+}
+
+// Raise a display interrupt, unless a replay raises them from its log
+static void invaders_interrupt(Invaders* inv, int rst)
+{
+    if(inv->replay)
+        return;
+    if(inv->rec_log)
+        input_log_interrupt(inv->rec_log, inv->cpu->cycles, rst);
+    cpu_interrupt(inv->cpu, rst);
+}
+
+// Raises the next interrupt in a replay, on the cycle it was raised on
+// in the recording, and waits for the one after it
+static void invaders_replay_interrupt(Scheduler* s, void* ctx, uint64_t when)
+{
+    Invaders* inv = ctx;
+
+    cpu_interrupt(inv->cpu, inv->irq_next.port);
+    if(input_log_next_of(inv->replay->log, &inv->irq_cursor, 1u << INPUT_EV_INTERRUPT, &inv->irq_next))
+        sched_add(s, inv->irq_next.cycles, invaders_replay_interrupt, inv);
+}
+
+// ======== DISPLAY EVENTS ======== //
+static void invaders_mid_screen(Scheduler* s, void* ctx, uint64_t when)
+{
+    Invaders* inv = ctx;
+
+    invaders_interrupt(inv, INVADERS_RST_MID);
+    sched_add(s, when + INVADERS_CYCLES_PER_FRAME, invaders_mid_screen, inv);
+}
+
+static void invaders_vblank(Scheduler* s, void* ctx, uint64_t when)
+{
+    Invaders* inv = ctx;
+
+    invaders_interrupt(inv, INVADERS_RST_VBLANK);
+    if(inv->frames_out)
+    {
+        uint8_t* frame = triple_buffer_back(inv->frames_out);
+
+        memcpy(frame, &inv->cpu->memory[DISP_VRAM_ADDR], DISP_VRAM_SIZE);
+        memcpy(frame + DISP_VRAM_SIZE, inv->vram_dirty, sizeof(inv->vram_dirty));
+        triple_buffer_publish(inv->frames_out, inv->frames);
+    }
+    else
+        display_draw_dirty(inv->disp, &inv->cpu->memory[DISP_VRAM_ADDR], inv->vram_dirty);
+    memset(inv->vram_dirty, 0, sizeof(inv->vram_dirty));
+    inv->frames++;
+    sched_add(s, when + INVADERS_CYCLES_PER_FRAME, invaders_vblank, inv);
+}
+
+// Mixes the sound up to now every INVADERS_AUDIO_CYCLES, so the output
+// never waits longer than that for samples
+static void invaders_audio_tick(Scheduler* s, void* ctx, uint64_t when)
+{
+    Invaders* inv = ctx;
+
+    audio_mix_until(inv->audio, when);
+    sched_add(s, when + INVADERS_AUDIO_CYCLES, invaders_audio_tick, inv);
+}
+
+/*
+ * invaders_create()
+ * Load and check the ROM set from rom_dir and attach a display
+ */
+Invaders* invaders_create(const char* rom_dir, DispBackend backend, unsigned disp_flags)
+{
+    Invaders* inv;
+
+    inv = calloc(1, sizeof(*inv));
+    if(!inv)
+        return NULL;
+
+    inv->cpu = cpu_create();
+    if(!inv->cpu)
+        goto INVADERS_FAIL;
+    if(rom_load_set(inv->cpu, &rom_set_invaders, rom_dir) < 0)
+    {
+        fprintf(stderr, "[%s] couldn't load ROM set %s from %s\n", __func__, rom_set_invaders.name, rom_dir);
+        goto INVADERS_FAIL;
+    }
+    if(rom_protect(inv->cpu, &rom_set_invaders) < 0)
+        goto INVADERS_FAIL;
+    rom_map_init(&rom_set_invaders, &inv->map);
+    // Track writes to video RAM, then mirror RAM again to pick them up
+    cpu_map_handler(&inv->map, DISP_VRAM_ADDR, rom_set_invaders.ram_end, NULL, invaders_vram_write);
+    cpu_map_mirror(&inv->map, rom_set_invaders.ram_end, CPU_MEM_SIZE, rom_set_invaders.ram_start, rom_set_invaders.ram_end);
+    cpu_ports_init(&inv->ports);
+    cpu_ports_in(&inv->ports, 0, 2, invaders_inputs_in, inv->in_port);
+    cpu_ports_in(&inv->ports, 3, 3, invaders_shift_in, &inv->shifter);
+    cpu_ports_out(&inv->ports, 2, 2, invaders_shift_offset_out, &inv->shifter);
+    cpu_ports_out(&inv->ports, 4, 4, invaders_shift_data_out, &inv->shifter);
+    cpu_ports_out(&inv->ports, 3, 3, invaders_sound_out, inv);
+    cpu_ports_out(&inv->ports, 5, 5, invaders_sound_out, inv);
+    cpu_ports_out(&inv->ports, 6, 6, invaders_watchdog_out, &inv->watchdog);
+    inv->cpu->map      = &inv->map;
+    inv->cpu->ports    = &inv->ports;
+    inv->cpu->userdata = inv;
+    inv->run           = cpu_run_fast;
+
+    // Bits 1-3 of port 0 and bit 3 of port 1 are always set
+    inv->in_port[0] = 0x0E;
+    inv->in_port[1] = 0x08;
+    inv->in_port[2] = 0x00;
+
+    inv->disp = display_create(backend, disp_flags);
+    if(!inv->disp)
+        goto INVADERS_FAIL;
+
+    inv->sched = sched_create();
+    if(!inv->sched)
+        goto INVADERS_FAIL;
+    if(sched_add(inv->sched, INVADERS_CYCLES_PER_FRAME / 2, invaders_mid_screen, inv) < 0 ||
+       sched_add(inv->sched, INVADERS_CYCLES_PER_FRAME, invaders_vblank, inv) < 0)
+        goto INVADERS_FAIL;
+
+    return inv;
+
+INVADERS_FAIL:
+    invaders_destroy(inv);
+    return NULL;
+}
+
+/*
+ * invaders_destroy()
+ */
+void invaders_destroy(Invaders* inv)
+{
+    if(!inv)
+        return;
+    sched_destroy(inv->sched);
+    if(inv->disp)
+        display_destroy(inv->disp);
+    if(inv->cpu)
+    {
+        rom_unprotect(inv->cpu, &rom_set_invaders);
+        cpu_destroy(inv->cpu);
+    }
+    free(inv);
+}
+
+/*
+ * invaders_run_frame()
+ * Run up to the end of the next 60 Hz frame. The mid screen and vblank
+ * interrupts and the redraw happen in scheduler events on the way.
+ * Frames are laid out on the cycle count, so an instruction that runs
+ * past the end of a frame is taken out of the next one. Returns the
+ * cycles run or -1 if the CPU stopped.
+ */
+long invaders_run_frame(Invaders* inv)
+{
+    return invaders_run_until(inv, (inv->frames + 1) * (uint64_t) INVADERS_CYCLES_PER_FRAME);
+}
+
+/*
+ * invaders_run_until()
+ * Run up to cycle target, which can fall in the middle of a frame.
+ * Returns the cycles run or -1 if the CPU stopped.
+ */
+long invaders_run_until(Invaders* inv, uint64_t target)
+{
+    long cycles = sched_run_until(inv->sched, inv->cpu, target, inv->run);
+
+    return (cycles < 0) ? -1 : cycles;
+}
+
+/*
+ * invaders_set_audio()
+ * Play the sound ports through audio from the current cycle on, or stop
+ * if audio is NULL. The machine doesn't own the audio. Returns 0 on
+ * success.
+ */
+int invaders_set_audio(Invaders* inv, Audio* audio)
+{
+    sched_cancel(inv->sched, invaders_audio_tick, inv);
+    inv->audio = audio;
+    if(!audio)
+        return 0;
+    audio_start(audio, inv->cpu->cycles, inv->sound);
+
+    return sched_add(inv->sched, inv->cpu->cycles + INVADERS_AUDIO_CYCLES, invaders_audio_tick, inv);
+}
+
+static long invaders_run_jit(CPUState* state, long budget)
+{
+    Invaders* inv = state->userdata;
+
+    return jit_run(inv->jit, state, budget);
+}
+
+/*
+ * invaders_set_jit()
+ * Run the CPU on jit from now on, or on the interpreter if jit is NULL.
+ * The machine doesn't own the JIT.
+ */
+void invaders_set_jit(Invaders* inv, JIT* jit)
+{
+    inv->jit = jit;
+    inv->run = jit ? invaders_run_jit : cpu_run_fast;
+}
+
+/*
+ * invaders_record()
+ * Log every value read from the inputs and every display interrupt to
+ * log from now on, or stop if log is NULL. The machine doesn't own the
+ * log.
+ */
+void invaders_record(Invaders* inv, InputLog* log)
+{
+    inv->rec_log = log;
+    invaders_wrap_inputs(inv, log ? invaders_record_in : NULL);
+}
+
+/*
+ * invaders_replay()
+ * Play a recording back from rp: the inputs read what the log says they
+ * read, and the display interrupts are raised on the cycles the log says
+ * they were raised on. The machine has to start in the state the
+ * recording started in. Stops if rp is NULL. Returns 0 on success.
+ */
+int invaders_replay(Invaders* inv, InputReplay* rp)
+{
+    sched_cancel(inv->sched, invaders_replay_interrupt, inv);
+    inv->replay = rp;
+    invaders_wrap_inputs(inv, rp ? invaders_replay_in : NULL);
+    if(!rp)
+        return 0;
+    input_cursor_init(&inv->irq_cursor);
+    if(!input_log_next_of(rp->log, &inv->irq_cursor, 1u << INPUT_EV_INTERRUPT, &inv->irq_next))
+        return 0;
+
+    return sched_add(inv->sched, inv->irq_next.cycles, invaders_replay_interrupt, inv);
+}
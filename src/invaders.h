@@ -0,0 +1,86 @@
+/*
+ * INVADERS
+ * The Space Invaders machine. An 8080 with the invaders ROM set, a
+ * hardware shift register on the ports, and a display that raises
+ * RST 1 halfway down the screen and RST 2 at the start of vblank.
+ *
+ * Stefan Wong 2020
+ */
+
+#ifndef __INVADERS_H
+#define __INVADERS_H
+
+#include <stdint.h>
+#include "audio.h"
+#include "cpu.h"
+#include "display.h"
+#include "input_log.h"
+#include "jit.h"
+#include "scheduler.h"
+#include "triple_buffer.h"
+
+#define INVADERS_CLOCK_HZ        2000000
+#define INVADERS_FPS             60
+#define INVADERS_CYCLES_PER_FRAME (INVADERS_CLOCK_HZ / INVADERS_FPS)
+#define INVADERS_AUDIO_CYCLES    (INVADERS_CLOCK_HZ / 1000)   // mix sound every ms
+#define INVADERS_RST_MID         1      // display reached the middle line
+#define INVADERS_RST_VBLANK      2      // display reached the last line
+#define INVADERS_NUM_INPUTS      3      // IN 0 - 2 come from outside the machine
+// A frame in frames_out is video RAM followed by its dirty bitmap
+#define INVADERS_FRAME_SIZE      (DISP_VRAM_SIZE + DISP_DIRTY_WORDS * sizeof(uint32_t))
+
+// Bits in IN port 1
+#define INVADERS_IN1_COIN        0x01
+#define INVADERS_IN1_P2_START    0x02
+#define INVADERS_IN1_P1_START    0x04
+#define INVADERS_IN1_P1_SHOT     0x10
+#define INVADERS_IN1_P1_LEFT     0x20
+#define INVADERS_IN1_P1_RIGHT    0x40
+
+// The shift register. OUT 4 shifts a byte in from the top, OUT 2 sets
+// an offset and IN 3 reads the 8 bits that far below the top.
+typedef struct
+{
+    uint16_t      value;
+    uint8_t       offset;
+} InvadersShifter;
+
+typedef struct
+{
+    CPUState*     cpu;
+    CPUMemMap     map;
+    CPUPorts      ports;            // the devices below
+    Display*      disp;
+    Scheduler*    sched;            // display interrupts and sound mixing
+    Audio*        audio;            // NULL unless sound is on
+    JIT*          jit;              // NULL unless running on the recompiler
+    // If set, vblank publishes a copy of video RAM here for another
+    // thread to draw instead of drawing it (INVADERS_FRAME_SIZE bytes)
+    TripleBuffer* frames_out;
+    // Columns of video RAM written since the last vblank
+    uint32_t      vram_dirty[DISP_DIRTY_WORDS];
+    uint8_t       in_port[3];       // IN 0 - 2, IN 3 is the shift register
+    InvadersShifter shifter;
+    uint8_t       sound[2];         // last values written to OUT 3 and OUT 5
+    uint8_t       watchdog;
+    unsigned long frames;
+    // Runs the CPU for at least budget cycles, cpu_run_fast() by default
+    long          (*run)(CPUState* state, long budget);
+    // Record and replay, see invaders_record() and invaders_replay()
+    CPUPorts      session_ports;    // ports with the inputs wrapped
+    InputLog*     rec_log;          // NULL unless recording
+    InputReplay*  replay;           // NULL unless replaying
+    InputCursor   irq_cursor;       // interrupts still to come in the replay
+    InputEvent    irq_next;
+} Invaders;
+
+Invaders* invaders_create(const char* rom_dir, DispBackend backend, unsigned disp_flags);
+void      invaders_destroy(Invaders* inv);
+long      invaders_run_frame(Invaders* inv);
+long      invaders_run_until(Invaders* inv, uint64_t target);
+int       invaders_set_audio(Invaders* inv, Audio* audio);
+void      invaders_set_jit(Invaders* inv, JIT* jit);
+void      invaders_record(Invaders* inv, InputLog* log);
+int       invaders_replay(Invaders* inv, InputReplay* rp);
+
+#endif /*__INVADERS_H*/
@@ -0,0 +1,1944 @@
+/*
+ * JIT
+ * Basic block recompiler for the 8080 core
+ *
+ * Stefan Wong 2020
+ */
+
+#define _GNU_SOURCE
+#include <stddef.h>
+#include <stdlib.h>
+#include <string.h>
+#include "jit.h"
+
+#ifdef JIT_AVAILABLE
+#include <fcntl.h>
+#include <stdio.h>
+#include <unistd.h>
+#include <sys/mman.h>
+
+/*
+ * Register usage in generated code
+ *
+ *  rbx  CPUState*. The 8080 registers other than A and the flags stay in
+ *       the CPUState.
+ *  r8d  A, zero extended. The entry stub loads it and the exit stub
+ *       stores it back, so blocks chained to each other keep it here.
+ *  r9d  the flags, as A
+ *  r12  state->memory
+ *  r13  cycles left in the budget (signed)
+ *  r14  JITTables*, for the flag table and the translated code map
+ *  r15  exit reason handed back to jit_run()
+ *
+ * eax, ecx, edx, esi and edi are scratch. Byte stores only ever come from
+ * al, cl or dl so that no REX prefix is needed to reach them. Loads and
+ * stores through a memory map only use esi and edi, and save the others
+ * (r8 and r9 included) around calls to a page handler. A handler sees
+ * the A and flags from before the block, as it does under the
+ * interpreter.
+ */
+enum { RAX = 0, RCX = 1, RDX = 2, RSI = 6, RDI = 7 };
+
+// Exit reasons. Anything larger is the address of the jmp rel32 at the
+// end of a direct exit, which jit_run() patches to point at the block
+// for the new PC.
+#define EXIT_DONE    0      // indirect branch miss or budget used up
+#define EXIT_BUDGET  1      // not enough budget left to run the whole block
+#define EXIT_SMC     2      // the block wrote over translated code
+
+// Longest block in 8080 bytes. A block is in at most two pieces of
+// memory, the part on its first page and the part on the next.
+#define JIT_MAX_BLOCK_BYTES (JIT_MAX_BLOCK_OPS * 3)
+#if JIT_MAX_BLOCK_BYTES > CPU_PAGE_SIZE
+#error "block_pieces() only splits a block in two"
+#endif
+
+// Bit set in tables->smc when a write handler changed the memory
+// generation
+#define JIT_SMC_GEN  0x04
+
+// Worst case host code for one block, checked before translating
+#define JIT_BLOCK_RESERVE  (JIT_MAX_BLOCK_OPS * 512 + 256)
+
+typedef struct
+{
+    uint8_t  flags[512];            // copy of cpu_flag_szpc
+    // A and flags after DAA (low and high byte), indexed by A, CY << 8
+    // and AC << 9, from cpu_daa()
+    uint16_t daa[1024];
+    // Nonzero for bytes that have been translated, by offset into memory
+    // so that every address a page is mapped at sees the same byte
+    uint8_t  code[CPU_MEM_SIZE + CPU_PAGE_SIZE];
+    // When an instruction writes to one of those, bit n of smc is set
+    // and smc_addr[n] is the offset its nth store went to
+    uint8_t  smc;
+    uint32_t smc_addr[2];
+    uint64_t mem_gen;               // memory generation the blocks belong to
+    uint32_t int_pushes;            // interrupts seen, see cpu_interrupt()
+    uint64_t cycle_end;             // state->cycles once the budget is used up
+} JITTables;
+
+// Blocks with code on a page of memory, so that a write only has to look
+// at the blocks near it
+typedef struct
+{
+    uint16_t* starts;
+    int       num;
+    int       cap;
+} JITPageBlocks;
+
+// A block exit that was patched to jump straight to another block
+typedef struct
+{
+    uint8_t* site;
+    int32_t  next;                  // next link into the same block, or -1
+} JITLink;
+
+typedef struct
+{
+    long      remaining;
+    uintptr_t reason;
+} JITExit;
+
+typedef JITExit (*JITEnterFunc)(CPUState* state, long budget, void* block, JITTables* tables);
+
+struct JIT
+{
+    uint8_t*      code;             // mapped RX, this is what runs
+    uint8_t*      wcode;            // the same pages mapped RW, this is what is written
+    size_t        size;
+    size_t        pos;
+    size_t        code_start;       // first byte after the entry and exit stubs
+    size_t        exit_stub;
+    JITEnterFunc  enter;
+    void**        blocks;           // entry point for each 8080 address
+    void**        guarded;          // budget checked copies, see translate_block()
+    uint8_t*      block_len;        // bytes of 8080 code in the block at each address
+    JITPageBlocks page_blocks[CPU_NUM_PAGES + 1];   // by page of memory, sink included
+    int32_t*      link_head;        // first link into the block at each address
+    JITLink*      links;
+    int32_t       num_links;
+    int32_t       cap_links;
+    JITTables*    tables;
+    uint8_t*      memory;           // memory the blocks were translated from
+    const CPUMemMap* map;           // and the map they were translated through
+    int           paged;            // map isn't cpu_map_flat
+    int           stores;           // stores made by the current instruction
+    JITStats      stats;
+};
+
+#define OFF_A   offsetof(CPUState, a)
+#define OFF_B   offsetof(CPUState, b)
+#define OFF_C   offsetof(CPUState, c)
+#define OFF_D   offsetof(CPUState, d)
+#define OFF_E   offsetof(CPUState, e)
+#define OFF_H   offsetof(CPUState, h)
+#define OFF_L   offsetof(CPUState, l)
+#define OFF_SP  offsetof(CPUState, sp)
+#define OFF_PC  offsetof(CPUState, pc)
+#define OFF_MEM offsetof(CPUState, memory)
+#define OFF_GEN offsetof(CPUState, mem_gen)
+#define OFF_MAP offsetof(CPUState, map)
+#define OFF_F   offsetof(CPUState, cc)
+#define OFF_INTE    offsetof(CPUState, int_enable)
+#define OFF_PUSHES  offsetof(CPUState, int_pushes)
+#define OFF_CYCLES  offsetof(CPUState, cycles)
+#define OFF_PORTS   offsetof(CPUState, ports)
+#define TBL_DAA  offsetof(JITTables, daa)
+#define TBL_CODE offsetof(JITTables, code)
+#define TBL_SMC  offsetof(JITTables, smc)
+#define TBL_SMC_ADDR offsetof(JITTables, smc_addr)
+#define TBL_GEN  offsetof(JITTables, mem_gen)
+#define TBL_PUSHES    offsetof(JITTables, int_pushes)
+#define TBL_CYCLE_END offsetof(JITTables, cycle_end)
+#define MAP_READ  offsetof(CPUMemMap, read)
+#define MAP_WRITE offsetof(CPUMemMap, write)
+#define MAP_READ_HANDLER  offsetof(CPUMemMap, read_handler)
+#define MAP_WRITE_HANDLER offsetof(CPUMemMap, write_handler)
+
+// 8080 register field r (B C D E H L M A) to CPUState offset
+static const uint8_t reg_off[8] = {
+    OFF_B, OFF_C, OFF_D, OFF_E, OFF_H, OFF_L, 0, OFF_A
+};
+// Register pair field rp (BC DE HL SP), high and low halves
+static const uint8_t pair_hi[3] = { OFF_B, OFF_D, OFF_H };
+static const uint8_t pair_lo[3] = { OFF_C, OFF_E, OFF_L };
+
+
+// ======== EMITTER ======== //
+static inline void emit8(JIT* j, uint8_t v)
+{
+    j->wcode[j->pos++] = v;
+}
+
+static inline void emit16(JIT* j, uint16_t v)
+{
+    memcpy(j->wcode + j->pos, &v, 2);
+    j->pos += 2;
+}
+
+static inline void emit32(JIT* j, uint32_t v)
+{
+    memcpy(j->wcode + j->pos, &v, 4);
+    j->pos += 4;
+}
+
+static inline void emit64(JIT* j, uint64_t v)
+{
+    memcpy(j->wcode + j->pos, &v, 8);
+    j->pos += 8;
+}
+
+static void emit_bytes(JIT* j, const uint8_t* b, int n)
+{
+    memcpy(j->wcode + j->pos, b, n);
+    j->pos += n;
+}
+
+// movzx r32, byte [rbx+off]
+static void emit_ld8(JIT* j, int r, int off)
+{
+    emit8(j, 0x0F); emit8(j, 0xB6); emit8(j, 0x43 | (r << 3)); emit8(j, off);
+}
+
+// mov byte [rbx+off], r8
+static void emit_st8(JIT* j, int r, int off)
+{
+    emit8(j, 0x88); emit8(j, 0x43 | (r << 3)); emit8(j, off);
+}
+
+// mov byte [rbx+off], imm8
+static void emit_st8i(JIT* j, int off, uint8_t imm)
+{
+    emit8(j, 0xC6); emit8(j, 0x43); emit8(j, off); emit8(j, imm);
+}
+
+// movzx r32, word [rbx+off]
+static void emit_ld16(JIT* j, int r, int off)
+{
+    emit8(j, 0x0F); emit8(j, 0xB7); emit8(j, 0x43 | (r << 3)); emit8(j, off);
+}
+
+// mov word [rbx+off], r16
+static void emit_st16(JIT* j, int r, int off)
+{
+    emit8(j, 0x66); emit8(j, 0x89); emit8(j, 0x43 | (r << 3)); emit8(j, off);
+}
+
+// mov word [rbx+off], imm16
+static void emit_st16i(JIT* j, int off, uint16_t imm)
+{
+    emit8(j, 0x66); emit8(j, 0xC7); emit8(j, 0x43); emit8(j, off); emit16(j, imm);
+}
+
+// Two operand ALU ops, reg to reg (32 bit)
+enum { X_ADD = 0x01, X_OR = 0x09, X_AND = 0x21, X_SUB = 0x29, X_XOR = 0x31, X_MOV = 0x89 };
+
+static void emit_rr(JIT* j, int op, int dst, int src)
+{
+    emit8(j, op); emit8(j, 0xC0 | (src << 3) | dst);
+}
+
+// ALU op with a 32 bit immediate, ext is the /digit of opcode 0x81
+enum { I_ADD = 0, I_OR = 1, I_AND = 4, I_SUB = 5, I_XOR = 6 };
+
+static void emit_ri(JIT* j, int ext, int r, uint32_t imm)
+{
+    emit8(j, 0x81); emit8(j, 0xC0 | (ext << 3) | r); emit32(j, imm);
+}
+
+static void emit_movi(JIT* j, int r, uint32_t imm)
+{
+    emit8(j, 0xB8 + r); emit32(j, imm);
+}
+
+static void emit_shl(JIT* j, int r, int n)
+{
+    emit8(j, 0xC1); emit8(j, 0xE0 | r); emit8(j, n);
+}
+
+static void emit_shr(JIT* j, int r, int n)
+{
+    emit8(j, 0xC1); emit8(j, 0xE8 | r); emit8(j, n);
+}
+
+static void emit_not(JIT* j, int r)
+{
+    emit8(j, 0xF7); emit8(j, 0xD0 | r);
+}
+
+// movzx r32, byte [r14+idx+disp32]
+static void emit_ld_table(JIT* j, int r, int idx, uint32_t disp)
+{
+    emit8(j, 0x41); emit8(j, 0x0F); emit8(j, 0xB6);
+    emit8(j, 0x84 | (r << 3)); emit8(j, (idx << 3) | 6); emit32(j, disp);
+}
+
+// A and the flags, see the register usage above. The setters truncate
+// to a byte so that r8d and r9d stay zero extended.
+// mov r32, r8d
+static void emit_get_a(JIT* j, int r)
+{
+    emit8(j, 0x44); emit8(j, 0x89); emit8(j, 0xC0 | r);
+}
+
+// movzx r8d, r8 (al, cl or dl)
+static void emit_set_a(JIT* j, int r)
+{
+    emit8(j, 0x44); emit8(j, 0x0F); emit8(j, 0xB6); emit8(j, 0xC0 | r);
+}
+
+// mov r32, r9d
+static void emit_get_f(JIT* j, int r)
+{
+    emit8(j, 0x44); emit8(j, 0x89); emit8(j, 0xC8 | r);
+}
+
+// movzx r9d, r8 (al, cl or dl)
+static void emit_set_f(JIT* j, int r)
+{
+    emit8(j, 0x44); emit8(j, 0x0F); emit8(j, 0xB6); emit8(j, 0xC8 | r);
+}
+
+// 8080 register (B C D E H L - A) to and from r
+static void emit_ld_reg(JIT* j, int r, int reg)
+{
+    if(reg == 7)
+        emit_get_a(j, r);
+    else
+        emit_ld8(j, r, reg_off[reg]);
+}
+
+static void emit_st_reg(JIT* j, int r, int reg)
+{
+    if(reg == 7)
+        emit_set_a(j, r);
+    else
+        emit_st8(j, r, reg_off[reg]);
+}
+
+static void emit_st_regi(JIT* j, int reg, uint8_t imm)
+{
+    if(reg == 7)
+    {
+        emit8(j, 0x41); emit8(j, 0xB8); emit32(j, imm);     // mov r8d, imm32
+    }
+    else
+        emit_st8i(j, reg_off[reg], imm);
+}
+
+// Forward branches. The rel8/rel32 field is filled in by patch_here().
+enum { CC_E = 0x4, CC_NE = 0x5, CC_S = 0x8, CC_LE = 0xE, CC_G = 0xF };
+
+static size_t emit_jcc8(JIT* j, int cc)
+{
+    emit8(j, 0x70 | cc); emit8(j, 0);
+    return j->pos - 1;
+}
+
+static size_t emit_jmp8(JIT* j)
+{
+    emit8(j, 0xEB); emit8(j, 0);
+    return j->pos - 1;
+}
+
+static size_t emit_jcc32(JIT* j, int cc)
+{
+    emit8(j, 0x0F); emit8(j, 0x80 | cc); emit32(j, 0);
+    return j->pos - 4;
+}
+
+static void patch8_here(JIT* j, size_t at)
+{
+    j->wcode[at] = (uint8_t) (j->pos - (at + 1));
+}
+
+static void patch32(JIT* j, size_t at, size_t target)
+{
+    int32_t rel = (int32_t) (target - (at + 4));
+    memcpy(j->wcode + at, &rel, 4);
+}
+
+static void patch32_here(JIT* j, size_t at)
+{
+    patch32(j, at, j->pos);
+}
+
+// movzx r32, byte [r12+idx]
+static void emit_ld_flat(JIT* j, int r, int idx)
+{
+    emit8(j, 0x41); emit8(j, 0x0F); emit8(j, 0xB6);
+    emit8(j, 0x04 | (r << 3)); emit8(j, (idx << 3) | 4);
+}
+
+// mov byte [r12+idx], r8 followed by a check of the translated code map.
+// A hit records the address in tables->smc_addr and sets the bit for
+// this store in tables->smc, which the instruction tests once it is done.
+static void emit_st_flat(JIT* j, int r, int idx, int slot)
+{
+    size_t skip;
+
+    emit8(j, 0x41); emit8(j, 0x88); emit8(j, 0x04 | (r << 3)); emit8(j, (idx << 3) | 4);
+    // cmp byte [r14+idx+code], 0
+    emit8(j, 0x41); emit8(j, 0x80); emit8(j, 0xBC); emit8(j, (idx << 3) | 6);
+    emit32(j, TBL_CODE); emit8(j, 0x00);
+    skip = emit_jcc8(j, CC_E);
+    // or byte [r14+smc], 1 << slot ; mov dword [r14+smc_addr+4*slot], idx
+    emit8(j, 0x41); emit8(j, 0x80); emit8(j, 0x8E); emit32(j, TBL_SMC); emit8(j, 1 << slot);
+    emit8(j, 0x41); emit8(j, 0x89); emit8(j, 0x86 | (idx << 3));
+    emit32(j, TBL_SMC_ADDR + 4 * slot);
+    patch8_here(j, skip);
+}
+
+/*
+ * emit_map_lookup()
+ * esi = the map entry for the page of idx, from the table at disp in the
+ * CPUMemMap. Returns the js taken for a handler page. Otherwise esi ends
+ * up as the offset into memory of the byte.
+ */
+static size_t emit_map_lookup(JIT* j, int idx, uint32_t disp)
+{
+    size_t handler;
+
+    emit_rr(j, X_MOV, RSI, idx);
+    emit_shr(j, RSI, 8);
+    emit8(j, 0x48); emit8(j, 0x8B); emit8(j, 0x7B); emit8(j, OFF_MAP);     // mov rdi, [rbx+map]
+    emit8(j, 0x8B); emit8(j, 0xB4); emit8(j, 0xB7); emit32(j, disp);        // mov esi, [rdi+rsi*4+disp]
+    emit8(j, 0x85); emit8(j, 0xF6);                                         // test esi, esi
+    handler = emit_jcc8(j, CC_S);
+    emit8(j, 0x0F); emit8(j, 0xB6); emit8(j, 0xF8 | idx);                  // movzx edi, idx8
+    emit_rr(j, X_OR, RSI, RDI);
+
+    return handler;
+}
+
+/*
+ * emit_handler_call()
+ * Call the page handler for idx from the table at disp, with val as the
+ * byte to write (or -1 for a read). r8, r9, eax, ecx, edx and esi are
+ * saved around the call, and a read leaves the byte in the saved copy of r.
+ */
+static void emit_handler_call(JIT* j, int r, int idx, int val, uint32_t disp)
+{
+    // push r8, r9, rax, rcx, rdx, rsi and pop them again
+    static const uint8_t save[]    = { 0x41, 0x50, 0x41, 0x51, 0x50, 0x51, 0x52, 0x56 };
+    static const uint8_t restore[] = { 0x5E, 0x5A, 0x59, 0x58, 0x41, 0x59, 0x41, 0x58 };
+
+    emit_bytes(j, save, sizeof(save));
+    emit_rr(j, X_MOV, RSI, idx);
+    if(val >= 0)
+    {
+        emit8(j, 0x0F); emit8(j, 0xB6); emit8(j, 0xD0 | val);              // movzx edx, val8
+    }
+    emit_rr(j, X_MOV, RAX, RSI);
+    emit_shr(j, RAX, 8);
+    emit8(j, 0x48); emit8(j, 0x8B); emit8(j, 0x7B); emit8(j, OFF_MAP);     // mov rdi, [rbx+map]
+    emit8(j, 0x48); emit8(j, 0x8B); emit8(j, 0x84); emit8(j, 0xC7);        // mov rax, [rdi+rax*8+disp]
+    emit32(j, disp);
+    emit8(j, 0x48); emit8(j, 0x89); emit8(j, 0xDF);                        // mov rdi, rbx
+    emit8(j, 0xFF); emit8(j, 0xD0);                                         // call rax
+    if(val < 0)
+    {
+        // movzx eax, al ; mov [rsp+saved r], rax
+        emit8(j, 0x0F); emit8(j, 0xB6); emit8(j, 0xC0);
+        emit8(j, 0x48); emit8(j, 0x89); emit8(j, 0x44); emit8(j, 0x24); emit8(j, 8 * (3 - r));
+    }
+    else
+    {
+        // A handler that changed the generation changed memory as well.
+        // mov rax, [rbx+mem_gen] ; cmp rax, [r14+mem_gen] ; je skip
+        size_t skip;
+
+        emit8(j, 0x48); emit8(j, 0x8B); emit8(j, 0x43); emit8(j, OFF_GEN);
+        emit8(j, 0x49); emit8(j, 0x3B); emit8(j, 0x86); emit32(j, TBL_GEN);
+        skip = emit_jcc8(j, CC_E);
+        emit8(j, 0x41); emit8(j, 0x80); emit8(j, 0x8E); emit32(j, TBL_SMC); emit8(j, JIT_SMC_GEN);
+        patch8_here(j, skip);
+    }
+    emit_bytes(j, restore, sizeof(restore));
+}
+
+// movzx r32, byte at the 8080 address in idx
+static void emit_ld_mem(JIT* j, int r, int idx)
+{
+    size_t handler, done;
+
+    if(!j->paged)
+    {
+        emit_ld_flat(j, r, idx);
+        return;
+    }
+    handler = emit_map_lookup(j, idx, MAP_READ);
+    // movzx r32, byte [r12+rsi]
+    emit8(j, 0x41); emit8(j, 0x0F); emit8(j, 0xB6); emit8(j, 0x04 | (r << 3)); emit8(j, 0x34);
+    done = emit_jmp8(j);
+    patch8_here(j, handler);
+    emit_handler_call(j, r, idx, -1, MAP_READ_HANDLER);
+    patch8_here(j, done);
+}
+
+// Store r8 to the 8080 address in idx, see emit_st_flat()
+static void emit_st_mem(JIT* j, int r, int idx)
+{
+    int    slot = j->stores++;
+    size_t handler, skip, done, check;
+
+    if(!j->paged)
+    {
+        emit_st_flat(j, r, idx, slot);
+        return;
+    }
+    handler = emit_map_lookup(j, idx, MAP_WRITE);
+    // mov byte [r12+rsi], r8 ; cmp byte [r14+rsi+code], 0
+    emit8(j, 0x41); emit8(j, 0x88); emit8(j, 0x04 | (r << 3)); emit8(j, 0x34);
+    check = j->pos;
+    emit8(j, 0x41); emit8(j, 0x80); emit8(j, 0xBC); emit8(j, 0x36); emit32(j, TBL_CODE); emit8(j, 0x00);
+    skip = emit_jcc8(j, CC_E);
+    // or byte [r14+smc], 1 << slot ; mov dword [r14+smc_addr+4*slot], esi
+    emit8(j, 0x41); emit8(j, 0x80); emit8(j, 0x8E); emit32(j, TBL_SMC); emit8(j, 1 << slot);
+    emit8(j, 0x41); emit8(j, 0x89); emit8(j, 0xB6); emit32(j, TBL_SMC_ADDR + 4 * slot);
+    patch8_here(j, skip);
+    done = emit_jmp8(j);
+    patch8_here(j, handler);
+    emit_handler_call(j, r, idx, r, MAP_WRITE_HANDLER);
+    // A handler that took the protection off its own page stored the byte
+    // there, which has to be checked like any other store
+    handler = emit_map_lookup(j, idx, MAP_WRITE);
+    emit8(j, 0xE9); emit32(j, 0);
+    patch32(j, j->pos - 4, check);
+    patch8_here(j, handler);
+    patch8_here(j, done);
+}
+
+// Jumps to the shared exit stub
+static void emit_jmp_exit(JIT* j)
+{
+    emit8(j, 0xE9); emit32(j, 0);
+    patch32(j, j->pos - 4, j->exit_stub);
+}
+
+static void emit_jcc_exit(JIT* j, int cc)
+{
+    patch32(j, emit_jcc32(j, cc), j->exit_stub);
+}
+
+// sub r13, imm32
+static void emit_sub_budget(JIT* j, long cycles)
+{
+    emit8(j, 0x49); emit8(j, 0x81); emit8(j, 0xED); emit32(j, cycles);
+}
+
+// cmp r13, imm32
+static void emit_cmp_budget(JIT* j, long cycles)
+{
+    emit8(j, 0x49); emit8(j, 0x81); emit8(j, 0xFD); emit32(j, cycles);
+}
+
+// mov r15d, imm32
+static void emit_reason(JIT* j, uint32_t reason)
+{
+    if(reason == EXIT_DONE)
+    {
+        emit8(j, 0x45); emit8(j, 0x31); emit8(j, 0xFF);
+    }
+    else
+    {
+        emit8(j, 0x41); emit8(j, 0xBF); emit32(j, reason);
+    }
+}
+
+// test r9b, mask
+static void emit_test_flag(JIT* j, uint8_t mask)
+{
+    emit8(j, 0x41); emit8(j, 0xF6); emit8(j, 0xC1); emit8(j, mask);
+}
+
+
+// ======== BLOCK EXITS ======== //
+/*
+ * emit_exit_direct()
+ * Leave the block for a known target. If there is budget left the exit
+ * ends in a jmp that jit_run() later patches to go straight to the block
+ * for target.
+ */
+static void emit_exit_direct(JIT* j, uint16_t target, long cycles)
+{
+    emit_reason(j, EXIT_DONE);
+    emit_st16i(j, OFF_PC, target);
+    emit_sub_budget(j, cycles);
+    emit_jcc_exit(j, CC_LE);
+    // mov r15, imm64 (address of the jmp below) ; jmp exit
+    emit8(j, 0x49); emit8(j, 0xBF);
+    emit64(j, (uint64_t) (uintptr_t) (j->code + j->pos + 8));
+    emit_jmp_exit(j);
+}
+
+/*
+ * emit_exit_indirect()
+ * Leave the block for the address in eax. The block map is looked up
+ * inline, and only a miss goes back through jit_run().
+ */
+static void emit_exit_indirect(JIT* j, long cycles)
+{
+    static const uint8_t lookup[] = {
+        0x48, 0x8B, 0x14, 0xC2,     // mov rdx, [rdx+rax*8]
+        0x48, 0x85, 0xD2,           // test rdx, rdx
+    };
+
+    emit_st16(j, RAX, OFF_PC);
+    emit_reason(j, EXIT_DONE);
+    emit_sub_budget(j, cycles);
+    emit_jcc_exit(j, CC_LE);
+    emit8(j, 0x48); emit8(j, 0xBA); emit64(j, (uint64_t) (uintptr_t) j->blocks);
+    emit_bytes(j, lookup, sizeof(lookup));
+    emit_jcc_exit(j, CC_E);
+    emit8(j, 0xFF); emit8(j, 0xE2);     // jmp rdx
+}
+
+/*
+ * emit_exit_smc()
+ * If the instruction just translated wrote over translated code, or a
+ * write handler it called changed memory, leave the block with the PC it
+ * would have continued at so that jit_run() can throw away the blocks
+ * that were written to.
+ */
+static void emit_exit_smc(JIT* j, uint16_t next_pc, long cycles)
+{
+    size_t skip;
+
+    if(!j->stores)
+        return;
+    // cmp byte [r14+smc], 0
+    emit8(j, 0x41); emit8(j, 0x80); emit8(j, 0xBE); emit32(j, TBL_SMC); emit8(j, 0x00);
+    skip = emit_jcc8(j, CC_E);
+    emit_reason(j, EXIT_SMC);
+    emit_st16i(j, OFF_PC, next_pc);
+    emit_sub_budget(j, cycles);
+    emit_jmp_exit(j);
+    patch8_here(j, skip);
+    j->stores = 0;
+}
+
+/*
+ * emit_guard()
+ * Stop before an instruction if the budget has run out. Only used in the
+ * guarded copy of a block.
+ */
+static void emit_guard(JIT* j, uint16_t pc, long cycles)
+{
+    size_t skip;
+
+    emit_cmp_budget(j, cycles);
+    skip = emit_jcc8(j, CC_G);
+    emit_reason(j, EXIT_DONE);
+    emit_st16i(j, OFF_PC, pc);
+    emit_sub_budget(j, cycles);
+    emit_jmp_exit(j);
+    patch8_here(j, skip);
+}
+
+
+/*
+ * emit_port()
+ * IN or OUT to a port. If the port is connected, the handler is called
+ * with the CPUState brought up to date as the interpreter does, and the
+ * block ends there since the handler may change anything. A handler that
+ * changed memory or raised an interrupt sends the block back to
+ * jit_run(). An unconnected port falls through to the next instruction.
+ */
+static void emit_port(JIT* j, int in, uint8_t port, uint16_t next, long cycles, long t)
+{
+    uint32_t fn  = in ? offsetof(CPUPorts, in) : offsetof(CPUPorts, out);
+    uint32_t dev = in ? offsetof(CPUPorts, in_dev) : offsetof(CPUPorts, out_dev);
+    size_t   none, no_fn, changed, pushed;
+
+    // rax = state->ports ; rcx = its handler for the port
+    emit8(j, 0x48); emit8(j, 0x8B); emit8(j, 0x43); emit8(j, OFF_PORTS);
+    emit8(j, 0x48); emit8(j, 0x85); emit8(j, 0xC0);                        // test rax, rax
+    none = emit_jcc32(j, CC_E);
+    emit8(j, 0x48); emit8(j, 0x8B); emit8(j, 0x88); emit32(j, fn + 8 * port);
+    emit8(j, 0x48); emit8(j, 0x85); emit8(j, 0xC9);                        // test rcx, rcx
+    no_fn = emit_jcc32(j, CC_E);
+
+    // The handler sees A, the flags, the PC after the instruction and the
+    // cycles before it
+    emit8(j, 0x44); emit8(j, 0x88); emit8(j, 0x43); emit8(j, OFF_A);       // mov [rbx+a], r8b
+    emit8(j, 0x44); emit8(j, 0x88); emit8(j, 0x4B); emit8(j, OFF_F);       // mov [rbx+cc], r9b
+    emit_st16i(j, OFF_PC, next);
+    emit8(j, 0x49); emit8(j, 0x8B); emit8(j, 0x96); emit32(j, TBL_CYCLE_END);  // mov rdx, [r14+cycle_end]
+    emit8(j, 0x4C); emit8(j, 0x29); emit8(j, 0xEA);                        // sub rdx, r13
+    emit8(j, 0x48); emit8(j, 0x81); emit8(j, 0xC2); emit32(j, cycles);     // add rdx, cycles
+    emit8(j, 0x48); emit8(j, 0x89); emit8(j, 0x53); emit8(j, OFF_CYCLES);  // mov [rbx+cycles], rdx
+
+    // handler(state, dev, port[, A])
+    emit8(j, 0x48); emit8(j, 0x8B); emit8(j, 0xB0); emit32(j, dev + 8 * port);  // mov rsi, [rax+dev]
+    emit8(j, 0x48); emit8(j, 0x89); emit8(j, 0xC8);                        // mov rax, rcx
+    emit8(j, 0x48); emit8(j, 0x89); emit8(j, 0xDF);                        // mov rdi, rbx
+    emit_movi(j, RDX, port);
+    if(!in)
+        emit_get_a(j, RCX);
+    emit8(j, 0xFF); emit8(j, 0xD0);                                         // call rax
+    if(in)
+        emit_st8(j, RAX, OFF_A);
+    emit8(j, 0x44); emit8(j, 0x0F); emit8(j, 0xB6); emit8(j, 0x43); emit8(j, OFF_A);   // movzx r8d, [rbx+a]
+    emit8(j, 0x44); emit8(j, 0x0F); emit8(j, 0xB6); emit8(j, 0x4B); emit8(j, OFF_F);   // movzx r9d, [rbx+cc]
+
+    // mov rax, [rbx+mem_gen] ; cmp rax, [r14+mem_gen] ; jne changed
+    emit8(j, 0x48); emit8(j, 0x8B); emit8(j, 0x43); emit8(j, OFF_GEN);
+    emit8(j, 0x49); emit8(j, 0x3B); emit8(j, 0x86); emit32(j, TBL_GEN);
+    changed = emit_jcc8(j, CC_NE);
+    // mov eax, [rbx+int_pushes] ; cmp eax, [r14+int_pushes] ; jne changed
+    emit8(j, 0x8B); emit8(j, 0x43); emit8(j, OFF_PUSHES);
+    emit8(j, 0x41); emit8(j, 0x3B); emit8(j, 0x86); emit32(j, TBL_PUSHES);
+    pushed = emit_jcc8(j, CC_NE);
+    emit_ld16(j, RAX, OFF_PC);
+    emit_exit_indirect(j, t);
+
+    patch8_here(j, changed);
+    patch8_here(j, pushed);
+    emit8(j, 0x41); emit8(j, 0x80); emit8(j, 0x8E); emit32(j, TBL_SMC); emit8(j, JIT_SMC_GEN);
+    emit_reason(j, EXIT_SMC);
+    emit_sub_budget(j, t);
+    emit_jmp_exit(j);
+
+    patch32_here(j, none);
+    patch32_here(j, no_fn);
+}
+
+
+// ======== INSTRUCTION HELPERS ======== //
+// Load a register pair into r (tmp is clobbered)
+static void emit_ld_pair(JIT* j, int r, int rp, int tmp)
+{
+    if(rp == 3)
+    {
+        emit_ld16(j, r, OFF_SP);
+        return;
+    }
+    emit_ld8(j, r, pair_hi[rp]);
+    emit_shl(j, r, 8);
+    emit_ld8(j, tmp, pair_lo[rp]);
+    emit_rr(j, X_OR, r, tmp);
+}
+
+// Store the low 16 bits of r to a register pair (r is clobbered)
+static void emit_st_pair(JIT* j, int r, int rp)
+{
+    if(rp == 3)
+    {
+        emit_st16(j, r, OFF_SP);
+        return;
+    }
+    emit_st8(j, r, pair_lo[rp]);
+    emit_shr(j, r, 8);
+    emit_st8(j, r, pair_hi[rp]);
+}
+
+// ecx = HL
+static void emit_hl(JIT* j)
+{
+    emit_ld_pair(j, RCX, 2, RDX);
+}
+
+// Push the 16 bit value in eax. Clobbers ecx.
+static void emit_push(JIT* j)
+{
+    emit_ld16(j, RCX, OFF_SP);
+    emit_ri(j, I_SUB, RCX, 2);
+    emit_ri(j, I_AND, RCX, 0xFFFF);
+    emit_st16(j, RCX, OFF_SP);
+    emit_st_mem(j, RAX, RCX);
+    emit_shr(j, RAX, 8);
+    emit_ri(j, I_ADD, RCX, 1);
+    emit_ri(j, I_AND, RCX, 0xFFFF);
+    emit_st_mem(j, RAX, RCX);
+}
+
+// Pop a 16 bit value into eax. Clobbers ecx and edx.
+static void emit_pop(JIT* j)
+{
+    emit_ld16(j, RCX, OFF_SP);
+    emit_ld_mem(j, RAX, RCX);
+    emit_ri(j, I_ADD, RCX, 1);
+    emit_ri(j, I_AND, RCX, 0xFFFF);
+    emit_ld_mem(j, RDX, RCX);
+    emit_shl(j, RDX, 8);
+    emit_rr(j, X_OR, RAX, RDX);
+    emit_ri(j, I_ADD, RCX, 1);
+    emit_st16(j, RCX, OFF_SP);
+}
+
+// Operand of an ALU or MOV source field into r (M reads (HL))
+static void emit_ld_src(JIT* j, int r, int src)
+{
+    if(src == 6)
+    {
+        emit_hl(j);
+        if(r != RCX)
+            emit_ld_mem(j, r, RCX);
+        else
+        {
+            emit_ld_mem(j, RDX, RCX);
+            emit_rr(j, X_MOV, RCX, RDX);
+        }
+    }
+    else
+        emit_ld_reg(j, r, src);
+}
+
+/*
+ * emit_alu()
+ * ADD ADC SUB SBB ANA XRA ORA CMP (kind 0-7) with the operand in ecx.
+ * Follows the ALU helpers in cpu.c exactly.
+ */
+static void emit_alu(JIT* j, int kind)
+{
+    emit_get_a(j, RAX);
+    switch(kind)
+    {
+        case 0:     // ADD
+        case 1:     // ADC
+        case 2:     // SUB
+        case 3:     // SBB
+        case 7:     // CMP
+            if(kind >= 2)
+            {
+                emit_not(j, RCX);
+                emit_ri(j, I_AND, RCX, 0xFF);
+            }
+            emit_rr(j, X_MOV, RSI, RAX);
+            if(kind == 1 || kind == 3)
+            {
+                emit_get_f(j, RDX);
+                emit_ri(j, I_AND, RDX, FLAG_CY);
+                if(kind == 3)
+                    emit_ri(j, I_XOR, RDX, FLAG_CY);
+                emit_rr(j, X_ADD, RAX, RDX);
+            }
+            else if(kind >= 2)
+                emit_ri(j, I_ADD, RAX, 1);
+            emit_rr(j, X_ADD, RAX, RCX);
+            emit_rr(j, X_MOV, RDI, RSI);
+            emit_rr(j, X_XOR, RDI, RCX);
+            emit_rr(j, X_XOR, RDI, RAX);
+            emit_ri(j, I_AND, RDI, FLAG_AC);
+            emit_ld_table(j, RDX, RAX, 0);
+            if(kind >= 2)
+                emit_ri(j, I_XOR, RDX, FLAG_CY);
+            emit_rr(j, X_OR, RDX, RDI);
+            break;
+
+        case 4:     // ANA
+            emit_rr(j, X_MOV, RDI, RAX);
+            emit_rr(j, X_OR, RDI, RCX);
+            emit_shl(j, RDI, 1);
+            emit_ri(j, I_AND, RDI, FLAG_AC);
+            emit_rr(j, X_AND, RAX, RCX);
+            emit_ld_table(j, RDX, RAX, 0);
+            emit_rr(j, X_OR, RDX, RDI);
+            break;
+
+        case 5:     // XRA
+        case 6:     // ORA
+            emit_rr(j, (kind == 5) ? X_XOR : X_OR, RAX, RCX);
+            emit_ld_table(j, RDX, RAX, 0);
+            break;
+    }
+    emit_ri(j, I_OR, RDX, FLAG_ONE);
+    emit_set_f(j, RDX);
+    if(kind != 7)
+        emit_set_a(j, RAX);
+}
+
+/*
+ * emit_inr_dcr()
+ * Value in eax, result left in eax. CY is preserved.
+ */
+static void emit_inr_dcr(JIT* j, int dec)
+{
+    emit_ri(j, dec ? I_SUB : I_ADD, RAX, 1);
+    emit_ri(j, I_AND, RAX, 0xFF);
+    emit_rr(j, X_MOV, RDX, RAX);
+    emit_ri(j, I_AND, RDX, 0x0F);
+    if(dec)
+        emit_ri(j, I_XOR, RDX, 0x0F);
+    // setz/setnz dl ; movzx edx, dl ; shl edx, 4
+    emit8(j, 0x0F); emit8(j, dec ? 0x95 : 0x94); emit8(j, 0xC2);
+    emit8(j, 0x0F); emit8(j, 0xB6); emit8(j, 0xD2);
+    emit_shl(j, RDX, 4);
+    emit_ld_table(j, RSI, RAX, 0);
+    emit_rr(j, X_OR, RDX, RSI);
+    emit_get_f(j, RSI);
+    emit_ri(j, I_AND, RSI, FLAG_CY);
+    emit_rr(j, X_OR, RDX, RSI);
+    emit_ri(j, I_OR, RDX, FLAG_ONE);
+    emit_set_f(j, RDX);
+}
+
+// Flag mask and polarity for the condition field of Jcc, Ccc and Rcc
+static const uint8_t cond_mask[4] = { FLAG_Z, FLAG_CY, FLAG_P, FLAG_S };
+
+// Branch over the taken path when the condition is false
+static size_t emit_cond_skip(JIT* j, uint8_t op)
+{
+    int cond = (op >> 3) & 0x7;
+
+    emit_test_flag(j, cond_mask[cond >> 1]);
+    // odd conditions test for the flag set, even ones for clear
+    return emit_jcc32(j, (cond & 1) ? CC_E : CC_NE);
+}
+
+// Opcodes that always go through the interpreter
+static int jit_interp_only(const uint8_t* ins)
+{
+    switch(ins[0])
+    {
+        case 0x76:      // HLT
+            return 1;
+#ifdef CPU_DIAG
+        // The CPM BDOS emulation lives in the interpreter
+        case 0xCD:
+        case 0xDD:
+        case 0xED:
+        case 0xFD:
+        {
+            uint16_t addr = ins[1] | (ins[2] << 8);
+            return (addr == 0x0000 || addr == 0x0005);
+        }
+#endif /*CPU_DIAG*/
+    }
+    return 0;
+}
+
+// Undocumented opcodes behave like these
+static uint8_t canonical_op(uint8_t op)
+{
+    switch(op)
+    {
+        case 0x08: case 0x10: case 0x18: case 0x20:
+        case 0x28: case 0x30: case 0x38:
+            return 0x00;
+        case 0xCB:
+            return 0xC3;
+        case 0xD9:
+            return 0xC9;
+        case 0xDD: case 0xED: case 0xFD:
+            return 0xCD;
+    }
+    return op;
+}
+
+
+// Offset into memory of the byte the CPU reads at addr, or -1 if a
+// handler serves it
+static int32_t code_offset(const JIT* j, uint16_t addr)
+{
+    uint32_t off = j->map->read[addr >> 8];
+
+    if(off & CPU_PAGE_HANDLER)
+        return -1;
+    return off | (addr & 0xFF);
+}
+
+/*
+ * fetch_op()
+ * Read the instruction at pc through the map into ins. Returns -1 if any
+ * of its bytes is on a handler page, since those can't be translated.
+ */
+static int fetch_op(const JIT* j, uint16_t pc, uint8_t* ins)
+{
+    int32_t off = code_offset(j, pc);
+    int     len;
+
+    if(off < 0)
+        return -1;
+    ins[0] = j->memory[off];
+    len    = cpu_op_len[canonical_op(ins[0])];
+    for(int i = 1; i < 3; ++i)
+    {
+        off    = code_offset(j, (uint16_t) (pc + i));
+        ins[i] = 0;
+        if(off >= 0)
+            ins[i] = j->memory[off];
+        else if(i < len)
+            return -1;
+    }
+
+    return 0;
+}
+
+/*
+ * translate_op()
+ * Emit host code for the instruction ins at pc. cycles is the block's
+ * cycle count before this instruction. Returns 1 if the instruction ends
+ * the block (and has emitted its own exits), 0 otherwise.
+ */
+static int translate_op(JIT* j, const uint8_t* ins, uint16_t pc, long cycles)
+{
+    uint8_t  op   = canonical_op(ins[0]);
+    uint8_t  b1   = ins[1];
+    uint16_t imm  = b1 | (ins[2] << 8);
+    uint16_t next = pc + cpu_op_len[op];
+    long     t    = cycles + cpu_cycles[ins[0]];
+    int      dst  = (op >> 3) & 0x7;
+    int      src  = op & 0x7;
+    int      rp   = (op >> 4) & 0x3;
+    size_t   skip;
+
+    j->stores = 0;
+    // MOV group
+    if(op >= 0x40 && op < 0x80)
+    {
+        if(dst == 6)
+        {
+            emit_ld_reg(j, RAX, src);
+            emit_hl(j);
+            emit_st_mem(j, RAX, RCX);
+        }
+        else
+        {
+            emit_ld_src(j, RAX, src);
+            emit_st_reg(j, RAX, dst);
+        }
+        emit_exit_smc(j, next, t);
+        return 0;
+    }
+    // ALU group
+    if(op >= 0x80 && op < 0xC0)
+    {
+        emit_ld_src(j, RCX, src);
+        emit_alu(j, dst);
+        return 0;
+    }
+
+    switch(op)
+    {
+        case 0x00:      // NOP
+            return 0;
+
+        case 0x01: case 0x11: case 0x21:    // LXI
+            emit_st8i(j, pair_lo[rp], imm & 0xFF);
+            emit_st8i(j, pair_hi[rp], imm >> 8);
+            return 0;
+        case 0x31:                          // LXI SP
+            emit_st16i(j, OFF_SP, imm);
+            return 0;
+
+        case 0x02: case 0x12:               // STAX
+            emit_ld_pair(j, RCX, rp, RDX);
+            emit_get_a(j, RAX);
+            emit_st_mem(j, RAX, RCX);
+            emit_exit_smc(j, next, t);
+            return 0;
+        case 0x0A: case 0x1A:               // LDAX
+            emit_ld_pair(j, RCX, rp, RDX);
+            emit_ld_mem(j, RAX, RCX);
+            emit_set_a(j, RAX);
+            return 0;
+
+        case 0x03: case 0x13: case 0x23: case 0x33:     // INX
+        case 0x0B: case 0x1B: case 0x2B: case 0x3B:     // DCX
+            emit_ld_pair(j, RAX, rp, RDX);
+            emit_ri(j, (op & 0x08) ? I_SUB : I_ADD, RAX, 1);
+            emit_ri(j, I_AND, RAX, 0xFFFF);
+            emit_st_pair(j, RAX, rp);
+            return 0;
+
+        case 0x09: case 0x19: case 0x29: case 0x39:     // DAD
+            emit_ld_pair(j, RAX, 2, RDX);
+            emit_ld_pair(j, RCX, rp, RDX);
+            emit_rr(j, X_ADD, RAX, RCX);
+            emit_rr(j, X_MOV, RCX, RAX);
+            emit_shr(j, RCX, 16);
+            emit_st_pair(j, RAX, 2);
+            emit_get_f(j, RDX);
+            emit_ri(j, I_AND, RDX, (uint8_t) ~FLAG_CY);
+            emit_rr(j, X_OR, RDX, RCX);
+            emit_set_f(j, RDX);
+            return 0;
+
+        case 0x04: case 0x0C: case 0x14: case 0x1C:     // INR
+        case 0x24: case 0x2C: case 0x3C:
+        case 0x05: case 0x0D: case 0x15: case 0x1D:     // DCR
+        case 0x25: case 0x2D: case 0x3D:
+            emit_ld_reg(j, RAX, dst);
+            emit_inr_dcr(j, op & 0x1);
+            emit_st_reg(j, RAX, dst);
+            return 0;
+        case 0x34: case 0x35:                           // INR M, DCR M
+            emit_hl(j);
+            emit_ld_mem(j, RAX, RCX);
+            emit_inr_dcr(j, op & 0x1);
+            emit_st_mem(j, RAX, RCX);
+            emit_exit_smc(j, next, t);
+            return 0;
+
+        case 0x06: case 0x0E: case 0x16: case 0x1E:     // MVI
+        case 0x26: case 0x2E: case 0x3E:
+            emit_st_regi(j, dst, b1);
+            return 0;
+        case 0x36:                                      // MVI M
+            emit_hl(j);
+            emit_movi(j, RAX, b1);
+            emit_st_mem(j, RAX, RCX);
+            emit_exit_smc(j, next, t);
+            return 0;
+
+        case 0x07:      // RLC
+        case 0x0F:      // RRC
+        case 0x17:      // RAL
+        case 0x1F:      // RAR
+            emit_get_a(j, RAX);
+            emit_get_f(j, RDX);
+            // ecx = bit shifted in, esi = new CY
+            emit_rr(j, X_MOV, RSI, RAX);
+            if(op == 0x07 || op == 0x17)
+                emit_shr(j, RSI, 7);
+            else
+                emit_ri(j, I_AND, RSI, 0x1);
+            if(op == 0x07 || op == 0x0F)
+                emit_rr(j, X_MOV, RCX, RSI);
+            else
+            {
+                emit_rr(j, X_MOV, RCX, RDX);
+                emit_ri(j, I_AND, RCX, FLAG_CY);
+            }
+            if(op == 0x07 || op == 0x17)
+                emit_shl(j, RAX, 1);
+            else
+            {
+                emit_shr(j, RAX, 1);
+                emit_shl(j, RCX, 7);
+            }
+            emit_rr(j, X_OR, RAX, RCX);
+            emit_ri(j, I_AND, RDX, (uint8_t) ~FLAG_CY);
+            emit_rr(j, X_OR, RDX, RSI);
+            emit_set_a(j, RAX);
+            emit_set_f(j, RDX);
+            return 0;
+
+        case 0x22:      // SHLD
+        case 0x2A:      // LHLD
+            emit_movi(j, RCX, imm);
+            if(op == 0x22)
+            {
+                emit_ld8(j, RAX, OFF_L);
+                emit_st_mem(j, RAX, RCX);
+            }
+            else
+            {
+                emit_ld_mem(j, RAX, RCX);
+                emit_st8(j, RAX, OFF_L);
+            }
+            emit_movi(j, RCX, (uint16_t) (imm + 1));
+            if(op == 0x22)
+            {
+                emit_ld8(j, RAX, OFF_H);
+                emit_st_mem(j, RAX, RCX);
+                emit_exit_smc(j, next, t);
+            }
+            else
+            {
+                emit_ld_mem(j, RAX, RCX);
+                emit_st8(j, RAX, OFF_H);
+            }
+            return 0;
+
+        case 0x32:      // STA
+            emit_movi(j, RCX, imm);
+            emit_get_a(j, RAX);
+            emit_st_mem(j, RAX, RCX);
+            emit_exit_smc(j, next, t);
+            return 0;
+        case 0x3A:      // LDA
+            emit_movi(j, RCX, imm);
+            emit_ld_mem(j, RAX, RCX);
+            emit_set_a(j, RAX);
+            return 0;
+
+        case 0x2F:      // CMA
+            emit_get_a(j, RAX);
+            emit_not(j, RAX);
+            emit_set_a(j, RAX);
+            return 0;
+        case 0x37:      // STC  (or r9d, 1)
+            emit8(j, 0x41); emit8(j, 0x83); emit8(j, 0xC9); emit8(j, FLAG_CY);
+            return 0;
+        case 0x3F:      // CMC  (xor r9d, 1)
+            emit8(j, 0x41); emit8(j, 0x83); emit8(j, 0xF1); emit8(j, FLAG_CY);
+            return 0;
+
+        case 0x27:      // DAA
+            // eax = A | CY << 8 | AC << 9
+            emit_get_f(j, RAX);
+            emit_ri(j, I_AND, RAX, FLAG_CY);
+            emit_shl(j, RAX, 8);
+            emit_get_f(j, RDX);
+            emit_ri(j, I_AND, RDX, FLAG_AC);
+            emit_shl(j, RDX, 5);
+            emit_rr(j, X_OR, RAX, RDX);
+            emit8(j, 0x44); emit8(j, 0x09); emit8(j, 0xC0);            // or eax, r8d
+            // movzx eax, word [r14+rax*2+daa]
+            emit8(j, 0x41); emit8(j, 0x0F); emit8(j, 0xB7); emit8(j, 0x84); emit8(j, 0x46);
+            emit32(j, TBL_DAA);
+            emit_set_a(j, RAX);
+            emit_shr(j, RAX, 8);
+            emit_set_f(j, RAX);
+            return 0;
+
+        case 0xC6: case 0xCE: case 0xD6: case 0xDE:     // ALU immediate
+        case 0xE6: case 0xEE: case 0xF6: case 0xFE:
+            emit_movi(j, RCX, b1);
+            emit_alu(j, dst);
+            return 0;
+
+        case 0xC5: case 0xD5: case 0xE5:                // PUSH
+            emit_ld_pair(j, RAX, rp, RDX);
+            emit_push(j);
+            emit_exit_smc(j, next, t);
+            return 0;
+        case 0xF5:                                      // PUSH PSW
+            emit_get_a(j, RAX);
+            emit_shl(j, RAX, 8);
+            emit_get_f(j, RDX);
+            emit_ri(j, I_AND, RDX, FLAG_MASK);
+            emit_ri(j, I_OR, RDX, FLAG_ONE);
+            emit_rr(j, X_OR, RAX, RDX);
+            emit_push(j);
+            emit_exit_smc(j, next, t);
+            return 0;
+        case 0xC1: case 0xD1: case 0xE1:                // POP
+            emit_pop(j);
+            emit_st_pair(j, RAX, rp);
+            return 0;
+        case 0xF1:                                      // POP PSW
+            emit_pop(j);
+            emit_rr(j, X_MOV, RDX, RAX);
+            emit_ri(j, I_AND, RDX, FLAG_MASK);
+            emit_ri(j, I_OR, RDX, FLAG_ONE);
+            emit_set_f(j, RDX);
+            emit_shr(j, RAX, 8);
+            emit_set_a(j, RAX);
+            return 0;
+
+        case 0xD3:      // OUT
+        case 0xDB:      // IN
+            emit_port(j, op == 0xDB, b1, next, cycles, t);
+            return 0;
+        case 0xF3:      // DI
+        case 0xFB:      // EI
+            emit_st8i(j, OFF_INTE, op == 0xFB);
+            return 0;
+
+        case 0xE3:      // XTHL
+            emit_ld16(j, RCX, OFF_SP);
+            emit_ld_mem(j, RAX, RCX);
+            emit_ld8(j, RDX, OFF_L);
+            emit_st8(j, RAX, OFF_L);
+            emit_st_mem(j, RDX, RCX);
+            emit_ri(j, I_ADD, RCX, 1);
+            emit_ri(j, I_AND, RCX, 0xFFFF);
+            emit_ld_mem(j, RAX, RCX);
+            emit_ld8(j, RDX, OFF_H);
+            emit_st8(j, RAX, OFF_H);
+            emit_st_mem(j, RDX, RCX);
+            emit_exit_smc(j, next, t);
+            return 0;
+        case 0xEB:      // XCHG
+            emit_ld8(j, RAX, OFF_H);
+            emit_ld8(j, RCX, OFF_D);
+            emit_st8(j, RCX, OFF_H);
+            emit_st8(j, RAX, OFF_D);
+            emit_ld8(j, RAX, OFF_L);
+            emit_ld8(j, RCX, OFF_E);
+            emit_st8(j, RCX, OFF_L);
+            emit_st8(j, RAX, OFF_E);
+            return 0;
+        case 0xF9:      // SPHL
+            emit_hl(j);
+            emit_st16(j, RCX, OFF_SP);
+            return 0;
+
+        // ======== BLOCK ENDS ======== //
+        case 0xE9:      // PCHL
+            emit_ld_pair(j, RAX, 2, RDX);
+            emit_exit_indirect(j, t);
+            return 1;
+
+        case 0xC3:      // JMP
+            emit_exit_direct(j, imm, t);
+            return 1;
+        case 0xC2: case 0xCA: case 0xD2: case 0xDA:     // Jcc
+        case 0xE2: case 0xEA: case 0xF2: case 0xFA:
+            skip = emit_cond_skip(j, op);
+            emit_exit_direct(j, imm, t);
+            patch32_here(j, skip);
+            emit_exit_direct(j, next, t);
+            return 1;
+
+        case 0xCD:      // CALL
+            emit_movi(j, RAX, next);
+            emit_push(j);
+            emit_exit_smc(j, imm, t);
+            emit_exit_direct(j, imm, t);
+            return 1;
+        case 0xC4: case 0xCC: case 0xD4: case 0xDC:     // Ccc
+        case 0xE4: case 0xEC: case 0xF4: case 0xFC:
+            skip = emit_cond_skip(j, op);
+            emit_movi(j, RAX, next);
+            emit_push(j);
+            emit_exit_smc(j, imm, t + 6);
+            emit_exit_direct(j, imm, t + 6);
+            patch32_here(j, skip);
+            emit_exit_direct(j, next, t);
+            return 1;
+
+        case 0xC9:      // RET
+            emit_pop(j);
+            emit_exit_indirect(j, t);
+            return 1;
+        case 0xC0: case 0xC8: case 0xD0: case 0xD8:     // Rcc
+        case 0xE0: case 0xE8: case 0xF0: case 0xF8:
+            skip = emit_cond_skip(j, op);
+            emit_pop(j);
+            emit_exit_indirect(j, t + 6);
+            patch32_here(j, skip);
+            emit_exit_direct(j, next, t);
+            return 1;
+
+        case 0xC7: case 0xCF: case 0xD7: case 0xDF:     // RST
+        case 0xE7: case 0xEF: case 0xF7: case 0xFF:
+            emit_movi(j, RAX, next);
+            emit_push(j);
+            emit_exit_smc(j, op & 0x38, t);
+            emit_exit_direct(j, op & 0x38, t);
+            return 1;
+    }
+
+    return 0;
+}
+
+
+// ======== INVALIDATION ======== //
+/*
+ * block_pieces()
+ * Where the bytes of the block at start live in memory: a piece on its
+ * first page and, if it runs over the end of that page, a piece on the
+ * next one. Returns the number of pieces.
+ */
+static int block_pieces(const JIT* j, uint16_t start, uint32_t off[2], int len[2])
+{
+    int total = j->block_len[start];
+
+    len[0] = CPU_PAGE_SIZE - (start & 0xFF);
+    off[0] = code_offset(j, start);
+    if(len[0] >= total)
+    {
+        len[0] = total;
+        return 1;
+    }
+    len[1] = total - len[0];
+    off[1] = code_offset(j, (uint16_t) (start + len[0]));
+
+    return 2;
+}
+
+static int page_add_block(JIT* j, uint32_t page, uint16_t start)
+{
+    JITPageBlocks* pb = &j->page_blocks[page];
+
+    if(pb->num == pb->cap)
+    {
+        int       cap    = pb->cap ? 2 * pb->cap : 16;
+        uint16_t* starts = realloc(pb->starts, cap * sizeof(*starts));
+
+        if(!starts)
+            return -1;
+        pb->starts = starts;
+        pb->cap    = cap;
+    }
+    pb->starts[pb->num++] = start;
+
+    return 0;
+}
+
+static void page_remove_block(JIT* j, uint32_t page, uint16_t start)
+{
+    JITPageBlocks* pb = &j->page_blocks[page];
+
+    for(int i = 0; i < pb->num; ++i)
+    {
+        if(pb->starts[i] == start)
+        {
+            pb->starts[i] = pb->starts[--pb->num];
+            return;
+        }
+    }
+}
+
+// Add the block at start to the list of each page of memory it is on
+static int add_block(JIT* j, uint16_t start)
+{
+    uint32_t off[2];
+    int      len[2];
+    int      n = block_pieces(j, start, off, len);
+
+    if(page_add_block(j, off[0] >> 8, start) < 0)
+        return -1;
+    if(n == 2 && (off[1] >> 8) != (off[0] >> 8) && page_add_block(j, off[1] >> 8, start) < 0)
+    {
+        page_remove_block(j, off[0] >> 8, start);
+        return -1;
+    }
+
+    return 0;
+}
+
+// Remember that site now jumps straight to the block at target
+static void add_link(JIT* j, uint8_t* site, uint16_t target)
+{
+    if(j->num_links == j->cap_links)
+    {
+        int32_t  cap   = j->cap_links ? 2 * j->cap_links : 1024;
+        JITLink* links = realloc(j->links, cap * sizeof(*links));
+
+        if(!links)
+            return;
+        j->links     = links;
+        j->cap_links = cap;
+    }
+    j->links[j->num_links].site = site;
+    j->links[j->num_links].next = j->link_head[target];
+    j->link_head[target] = j->num_links++;
+}
+
+// Point a patched exit back at the exit stub, so that it goes through
+// jit_run() again
+static void unpatch_exit(JIT* j, uint8_t* site)
+{
+    int32_t rel = (int32_t) ((j->code + j->exit_stub) - (site + 5));
+
+    memcpy(j->wcode + (site - j->code) + 1, &rel, 4);
+}
+
+/*
+ * kill_block()
+ * Throw away the block at start and every exit chained to it. Its host
+ * code stays where it is until the next flush, but nothing can reach it.
+ * The pages of memory it was on are set in touched.
+ */
+static void kill_block(JIT* j, uint16_t start, uint8_t* touched)
+{
+    uint32_t off[2];
+    int      len[2];
+    int      n = block_pieces(j, start, off, len);
+
+    for(int p = 0; p < n; ++p)
+    {
+        memset(&j->tables->code[off[p]], 0, len[p]);
+        page_remove_block(j, off[p] >> 8, start);
+        touched[off[p] >> 8] = 1;
+    }
+    for(int32_t l = j->link_head[start]; l >= 0; l = j->links[l].next)
+        unpatch_exit(j, j->links[l].site);
+    j->link_head[start] = -1;
+    j->blocks[start]    = NULL;
+    j->guarded[start]   = NULL;
+    j->block_len[start] = 0;
+    j->stats.invalidations++;
+}
+
+// Mark the bytes of every block on a page of memory as translated
+static void mark_code(JIT* j, uint32_t page)
+{
+    const JITPageBlocks* pb = &j->page_blocks[page];
+
+    for(int i = 0; i < pb->num; ++i)
+    {
+        uint32_t off[2];
+        int      len[2];
+        int      n = block_pieces(j, pb->starts[i], off, len);
+
+        for(int p = 0; p < n; ++p)
+            memset(&j->tables->code[off[p]], 1, len[p]);
+    }
+}
+
+static int block_covers(const JIT* j, uint16_t start, uint32_t off)
+{
+    uint32_t pieces[2];
+    int      len[2];
+    int      n = block_pieces(j, start, pieces, len);
+
+    for(int p = 0; p < n; ++p)
+    {
+        if(off - pieces[p] < (uint32_t) len[p])
+            return 1;
+    }
+    return 0;
+}
+
+/*
+ * invalidate()
+ * Throw away the blocks that cover off after a store to it, and nothing
+ * else, so that code writing to data next to itself keeps running
+ * translated. off is the offset into memory, so a store through any
+ * address the page is mapped at finds the same blocks.
+ */
+static void invalidate(JIT* j, uint32_t off)
+{
+    JITPageBlocks* pb = &j->page_blocks[off >> 8];
+    uint8_t touched[CPU_NUM_PAGES + 1] = {0};
+    int     killed = 0;
+
+    // kill_block() moves the last entry into the one it removes
+    for(int i = pb->num - 1; i >= 0; --i)
+    {
+        if(block_covers(j, pb->starts[i], off))
+        {
+            kill_block(j, pb->starts[i], touched);
+            killed = 1;
+        }
+    }
+    // The bytes cleared above may also be covered by blocks that are
+    // still live
+    if(killed)
+    {
+        for(int p = 0; p <= CPU_NUM_PAGES; ++p)
+        {
+            if(touched[p])
+                mark_code(j, p);
+        }
+    }
+}
+
+
+// ======== CODE CACHE ======== //
+/*
+ * emit_stubs()
+ * The entry trampoline and the shared exit go at the start of the buffer.
+ *
+ *   JITExit enter(CPUState* state, long budget, void* block, JITTables* t)
+ */
+static void emit_stubs(JIT* j)
+{
+    static const uint8_t entry[] = {
+        0x53,                       // push rbx
+        0x41, 0x54,                 // push r12
+        0x41, 0x55,                 // push r13
+        0x41, 0x56,                 // push r14
+        0x41, 0x57,                 // push r15
+        0x48, 0x89, 0xFB,           // mov rbx, rdi
+        0x49, 0x89, 0xF5,           // mov r13, rsi
+        0x49, 0x89, 0xCE,           // mov r14, rcx
+        0x4C, 0x8B, 0x63, OFF_MEM,  // mov r12, [rbx+memory]
+        0x44, 0x0F, 0xB6, 0x43, OFF_A,  // movzx r8d, byte [rbx+a]
+        0x44, 0x0F, 0xB6, 0x4B, OFF_F,  // movzx r9d, byte [rbx+cc]
+        0x45, 0x31, 0xFF,           // xor r15d, r15d
+        0xFF, 0xE2,                 // jmp rdx
+    };
+    static const uint8_t leave[] = {
+        0x44, 0x88, 0x43, OFF_A,    // mov [rbx+a], r8b
+        0x44, 0x88, 0x4B, OFF_F,    // mov [rbx+cc], r9b
+        0x4C, 0x89, 0xE8,           // mov rax, r13
+        0x4C, 0x89, 0xFA,           // mov rdx, r15
+        0x41, 0x5F,                 // pop r15
+        0x41, 0x5E,                 // pop r14
+        0x41, 0x5D,                 // pop r13
+        0x41, 0x5C,                 // pop r12
+        0x5B,                       // pop rbx
+        0xC3,                       // ret
+    };
+
+    j->pos   = 0;
+    j->enter = (JITEnterFunc) (void*) j->code;
+    emit_bytes(j, entry, sizeof(entry));
+    j->exit_stub = j->pos;
+    emit_bytes(j, leave, sizeof(leave));
+    j->pos = (j->pos + 15) & ~(size_t) 15;
+    j->code_start = j->pos;
+}
+
+/*
+ * translate_block()
+ * Translate the block starting at pc. The normal copy checks on entry
+ * that the budget covers every instruction but the last, so that it
+ * stops at exactly the same place the interpreter would. When it doesn't,
+ * jit_run() falls back to the guarded copy, which checks the budget
+ * before each instruction instead.
+ */
+static void* translate_block(JIT* j, uint16_t start, int guarded)
+{
+    uint8_t  ins[3];
+    uint16_t pc     = start;
+    long     cycles = 0;
+    long     last   = 0;
+    size_t   entry, check = 0, skip;
+    int      n, done = 0;
+
+    if(fetch_op(j, start, ins) < 0 || jit_interp_only(ins))
+        return NULL;
+    if(j->size - j->pos < JIT_BLOCK_RESERVE)
+        jit_flush(j);
+
+    entry = j->pos;
+    if(!guarded)
+    {
+        emit_cmp_budget(j, 0);
+        check = j->pos - 4;
+        skip  = emit_jcc8(j, CC_G);
+        emit_reason(j, EXIT_BUDGET);
+        emit_st16i(j, OFF_PC, start);
+        emit_jmp_exit(j);
+        patch8_here(j, skip);
+    }
+
+    for(n = 0; n < JIT_MAX_BLOCK_OPS && !done; ++n)
+    {
+        if(n > 0 && (fetch_op(j, pc, ins) < 0 || jit_interp_only(ins)))
+            break;
+        if(guarded && n > 0)
+            emit_guard(j, pc, cycles);
+
+        last = cycles;
+        done = translate_op(j, ins, pc, cycles);
+        cycles += cpu_cycles[ins[0]];
+        pc += cpu_op_len[canonical_op(ins[0])];
+    }
+    if(!done)
+        emit_exit_direct(j, pc, cycles);
+
+    // The guarded copy covers the same bytes as the normal one
+    if(!j->block_len[start])
+    {
+        uint32_t off[2];
+        int      len[2];
+
+        j->block_len[start] = (uint8_t) (pc - start);
+        if(add_block(j, start) < 0)
+        {
+            j->block_len[start] = 0;
+            return NULL;
+        }
+        for(int p = 0, np = block_pieces(j, start, off, len); p < np; ++p)
+            memset(&j->tables->code[off[p]], 1, len[p]);
+    }
+
+    if(!guarded)
+    {
+        int32_t v = (int32_t) last;
+        memcpy(j->wcode + check, &v, 4);
+        j->blocks[start] = j->code + entry;
+    }
+    else
+        j->guarded[start] = j->code + entry;
+    j->stats.blocks++;
+
+    return j->code + entry;
+}
+
+static void* lookup_block(JIT* j, uint16_t pc)
+{
+    if(j->blocks[pc])
+        return j->blocks[pc];
+    return translate_block(j, pc, 0);
+}
+
+/*
+ * map_code()
+ * Map the code buffer twice, executable at code and writable at wcode,
+ * so that no page is ever writable and executable at once. Translating
+ * and chaining write through wcode and never have to change the mapping.
+ */
+static int map_code(JIT* j)
+{
+    int fd;
+
+#ifdef __linux__
+    fd = memfd_create("jit8080", MFD_CLOEXEC);
+#else
+    char name[32];
+
+    snprintf(name, sizeof(name), "/jit8080.%ld", (long) getpid());
+    fd = shm_open(name, O_RDWR | O_CREAT | O_EXCL, 0600);
+    if(fd >= 0)
+        shm_unlink(name);
+#endif
+    if(fd < 0)
+        return -1;
+    if(ftruncate(fd, j->size) < 0)
+        goto MAP_CODE_FAIL;
+
+    j->wcode = mmap(NULL, j->size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+    if(j->wcode == MAP_FAILED)
+    {
+        j->wcode = NULL;
+        goto MAP_CODE_FAIL;
+    }
+    j->code = mmap(NULL, j->size, PROT_READ | PROT_EXEC, MAP_SHARED, fd, 0);
+    if(j->code == MAP_FAILED)
+    {
+        j->code = NULL;
+        goto MAP_CODE_FAIL;
+    }
+    close(fd);
+
+    return 0;
+
+MAP_CODE_FAIL:
+    close(fd);
+    return -1;
+}
+
+/*
+ * jit_create()
+ */
+JIT* jit_create(void)
+{
+    JIT* jit;
+
+    jit = calloc(1, sizeof(*jit));
+    if(!jit)
+        return NULL;
+
+    jit->size = JIT_CODE_SIZE;
+    if(map_code(jit) < 0)
+        goto JIT_CREATE_FAIL;
+    jit->blocks    = calloc(CPU_MEM_SIZE, sizeof(*jit->blocks));
+    jit->guarded   = calloc(CPU_MEM_SIZE, sizeof(*jit->guarded));
+    jit->block_len = calloc(CPU_MEM_SIZE, sizeof(*jit->block_len));
+    jit->link_head = malloc(CPU_MEM_SIZE * sizeof(*jit->link_head));
+    jit->tables    = calloc(1, sizeof(*jit->tables));
+    if(!jit->blocks || !jit->guarded || !jit->block_len || !jit->link_head || !jit->tables)
+        goto JIT_CREATE_FAIL;
+    memset(jit->link_head, 0xFF, CPU_MEM_SIZE * sizeof(*jit->link_head));
+    memcpy(jit->tables->flags, cpu_flag_szpc, sizeof(jit->tables->flags));
+    for(int i = 0; i < 1024; ++i)
+    {
+        uint8_t a = i & 0xFF;
+        uint8_t f = ((i & 0x100) ? FLAG_CY : 0) | ((i & 0x200) ? FLAG_AC : 0) | FLAG_ONE;
+
+        cpu_daa(&a, &f);
+        jit->tables->daa[i] = a | (f << 8);
+    }
+
+    emit_stubs(jit);
+
+    return jit;
+
+JIT_CREATE_FAIL:
+    jit_destroy(jit);
+    return NULL;
+}
+
+/*
+ * jit_destroy()
+ */
+void jit_destroy(JIT* jit)
+{
+    if(!jit)
+        return;
+    if(jit->code)
+        munmap(jit->code, jit->size);
+    if(jit->wcode)
+        munmap(jit->wcode, jit->size);
+    free(jit->blocks);
+    free(jit->guarded);
+    free(jit->block_len);
+    free(jit->link_head);
+    free(jit->links);
+    for(int p = 0; p <= CPU_NUM_PAGES; ++p)
+        free(jit->page_blocks[p].starts);
+    free(jit->tables);
+    free(jit);
+}
+
+/*
+ * jit_flush()
+ * Throw away every translated block. Changing memory from outside of
+ * the CPU and calling cpu_mem_changed() on the machine does the same the
+ * next time it runs.
+ */
+void jit_flush(JIT* jit)
+{
+    jit->pos = jit->code_start;
+    memset(jit->blocks, 0, CPU_MEM_SIZE * sizeof(*jit->blocks));
+    memset(jit->guarded, 0, CPU_MEM_SIZE * sizeof(*jit->guarded));
+    memset(jit->block_len, 0, CPU_MEM_SIZE * sizeof(*jit->block_len));
+    memset(jit->link_head, 0xFF, CPU_MEM_SIZE * sizeof(*jit->link_head));
+    for(int p = 0; p <= CPU_NUM_PAGES; ++p)
+        jit->page_blocks[p].num = 0;
+    jit->num_links = 0;
+    memset(jit->tables->code, 0, sizeof(jit->tables->code));
+    jit->tables->smc = 0;
+    jit->stats.flushes++;
+}
+
+// Start over if state isn't the memory and map the blocks came from, or
+// if its memory was changed by anything other than translated code
+static void check_memory(JIT* jit, const CPUState* state)
+{
+    if(jit->memory != state->memory || jit->map != state->map ||
+       jit->tables->mem_gen != state->mem_gen)
+    {
+        jit_flush(jit);
+        jit->memory  = state->memory;
+        jit->map     = state->map;
+        jit->paged   = (state->map != &cpu_map_flat);
+        jit->tables->int_pushes = state->int_pushes;
+        jit->tables->mem_gen = state->mem_gen;
+    }
+    // cpu_interrupt() pushes the PC without the translated code seeing it
+    if(jit->tables->int_pushes != state->int_pushes)
+    {
+        if(state->int_pushes - jit->tables->int_pushes == 1)
+        {
+            for(int i = 0; i < 2; ++i)
+            {
+                uint16_t addr = state->int_sp + i;
+                uint32_t off  = jit->map->write[addr >> 8];
+                if(!(off & CPU_PAGE_HANDLER))
+                    invalidate(jit, off | (addr & 0xFF));
+            }
+        }
+        else
+            jit_flush(jit);
+        jit->tables->int_pushes = state->int_pushes;
+    }
+}
+
+/*
+ * jit_run()
+ * Run for at least budget cycles. Same contract as cpu_run_fast(): the
+ * return value is the number of cycles executed, or a negative status if
+ * the CPU stopped, and the run ends on the same instruction the
+ * interpreter would have ended on.
+ */
+long jit_run(JIT* jit, CPUState* state, long budget)
+{
+    long    remaining = budget;
+    JITExit ex;
+    void*   block;
+    int     status;
+
+    // Machines being profiled or traced run on the interpreter
+    if(cpu_instrumented(state))
+        return cpu_run_fast(state, budget);
+    check_memory(jit, state);
+
+    while(remaining > 0)
+    {
+        block = lookup_block(jit, state->pc);
+        if(!block)
+        {
+            uint8_t ins[3];
+            // An instruction on a handler page can store anywhere without
+            // the translated code map seeing it
+            int unseen = fetch_op(jit, state->pc, ins) < 0;
+
+            status = cpu_exec(state);
+            jit->stats.interp_ops++;
+            if(status < 0)
+                return status;
+            remaining -= status;
+            if(unseen && jit->pos != jit->code_start)
+                jit_flush(jit);
+            // A port handler may have written to memory
+            check_memory(jit, state);
+            continue;
+        }
+
+        // A port handler in the block sets state->cycles itself, so the
+        // total comes from where the budget runs out rather than from
+        // what it was on entry
+        jit->tables->cycle_end = state->cycles + remaining;
+        ex = jit->enter(state, remaining, block, jit->tables);
+        state->cycles = jit->tables->cycle_end - ex.remaining;
+        remaining = ex.remaining;
+
+        if(ex.reason == EXIT_BUDGET)
+        {
+            block = jit->guarded[state->pc];
+            if(!block)
+                block = translate_block(jit, state->pc, 1);
+            jit->tables->cycle_end = state->cycles + remaining;
+            ex = jit->enter(state, remaining, block, jit->tables);
+            state->cycles = jit->tables->cycle_end - ex.remaining;
+            remaining = ex.remaining;
+        }
+
+        if(ex.reason == EXIT_SMC)
+        {
+            uint8_t smc = jit->tables->smc;
+
+            jit->tables->smc = 0;
+            if(smc & JIT_SMC_GEN)
+                check_memory(jit, state);
+            else
+            {
+                for(int n = 0; n < 2; ++n)
+                {
+                    if(smc & (1 << n))
+                        invalidate(jit, jit->tables->smc_addr[n]);
+                }
+            }
+        }
+        else if(ex.reason > EXIT_SMC && remaining > 0)
+        {
+            // Chain the exit straight to the next block
+            uint8_t*      site    = (uint8_t*) ex.reason;
+            unsigned long flushes = jit->stats.flushes;
+
+            block = lookup_block(jit, state->pc);
+            // A flush during translation throws the exit away as well
+            if(block && jit->stats.flushes == flushes)
+            {
+                int32_t rel = (int32_t) ((uint8_t*) block - (site + 5));
+                memcpy(jit->wcode + (site - jit->code) + 1, &rel, 4);
+                add_link(jit, site, state->pc);
+                jit->stats.chains++;
+            }
+        }
+    }
+
+    return budget - remaining;
+}
+
+#else /*JIT_AVAILABLE*/
+
+struct JIT
+{
+    JITStats stats;
+};
+
+JIT* jit_create(void)
+{
+    return NULL;
+}
+
+void jit_destroy(JIT* jit)
+{
+    free(jit);
+}
+
+void jit_flush(JIT* jit)
+{
+}
+
+long jit_run(JIT* jit, CPUState* state, long budget)
+{
+    return cpu_run_fast(state, budget);
+}
+
+#endif /*JIT_AVAILABLE*/
+
+/*
+ * jit_get_stats()
+ */
+void jit_get_stats(const JIT* jit, JITStats* stats)
+{
+    if(jit)
+        *stats = jit->stats;
+    else
+        memset(stats, 0, sizeof(*stats));
+}
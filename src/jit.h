@@ -0,0 +1,51 @@
+/*
+ * JIT
+ * Basic block recompiler for the 8080 core. Translates straight line
+ * runs of 8080 code into x86-64 code and chains the blocks together.
+ * HLT is run by the interpreter. IN and OUT call the port handler from
+ * the block with the CPUState brought up to date, as the interpreter
+ * does, so both cores produce the same state and the same cycle counts. Machines with a memory map run translated
+ * as well: loads and stores look their page up in the map and call out
+ * to the handler for handler pages, and writes to code are tracked by
+ * offset into memory so that mirrors see them. Code on a handler page
+ * is run by the interpreter. As with the decoded instruction cache, the
+ * blocks belong to the memory, map and memory generation of the machine
+ * they were translated from, so anything other than the CPU that writes
+ * to memory must call cpu_mem_changed().
+ *
+ * Stefan Wong 2020
+ */
+
+#ifndef __JIT_H
+#define __JIT_H
+
+#include <stdint.h>
+#include "cpu.h"
+
+// The recompiler is only available on x86-64 POSIX hosts. Elsewhere
+// jit_create() returns NULL and callers should use the interpreter.
+#if defined(__x86_64__) && (defined(__unix__) || defined(__APPLE__))
+#define JIT_AVAILABLE
+#endif
+
+#define JIT_CODE_SIZE      (4 << 20)     // bytes of host code before a flush
+#define JIT_MAX_BLOCK_OPS  64            // 8080 instructions per block
+
+typedef struct JIT JIT;
+
+typedef struct
+{
+    unsigned long blocks;           // blocks translated
+    unsigned long chains;           // block exits patched to jump directly
+    unsigned long flushes;          // times the code cache was thrown away
+    unsigned long invalidations;    // blocks thrown away because they were written over
+    unsigned long interp_ops;       // instructions run by the interpreter
+} JITStats;
+
+JIT* jit_create(void);
+void jit_destroy(JIT* jit);
+void jit_flush(JIT* jit);
+long jit_run(JIT* jit, CPUState* state, long budget);
+void jit_get_stats(const JIT* jit, JITStats* stats);
+
+#endif /*__JIT_H*/
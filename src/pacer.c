@@ -0,0 +1,186 @@
+/*
+ * PACER
+ * Keeps the emulation in step with wall time
+ *
+ * Stefan Wong 2020
+ */
+
+#define _POSIX_C_SOURCE 200809L
+#include <errno.h>
+#include <math.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <time.h>
+#include "pacer.h"
+
+#define PACER_LATE_NS 1000000       // a wait this late counts as a late frame
+
+static uint64_t pacer_now_ns(void)
+{
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t) ts.tv_sec * 1000000000u + ts.tv_nsec;
+}
+
+/*
+ * pacer_rebase()
+ * Restart the clock from now with cycles emulated so far
+ */
+static void pacer_rebase(Pacer* p, uint64_t now, uint64_t cycles)
+{
+    p->origin_ns     = now;
+    p->origin_cycles = cycles;
+    p->last_ns       = now;
+    p->last_cycles   = cycles;
+    p->rebase        = 0;
+}
+
+/*
+ * pacer_create()
+ */
+Pacer* pacer_create(double clock_hz, double multiplier)
+{
+    Pacer* p;
+
+    if(clock_hz <= 0.0 || multiplier <= 0.0)
+    {
+        fprintf(stderr, "[%s] clock (%g Hz) and multiplier (%g) must be positive\n",
+                __func__, clock_hz, multiplier);
+        return NULL;
+    }
+    p = calloc(1, sizeof(*p));
+    if(!p)
+    {
+        fprintf(stderr, "[%s] failed to allocate memory for Pacer\n", __func__);
+        return NULL;
+    }
+    p->clock_hz   = clock_hz;
+    p->multiplier = multiplier;
+    pacer_start(p, 0);
+
+    return p;
+}
+
+/*
+ * pacer_destroy()
+ */
+void pacer_destroy(Pacer* p)
+{
+    free(p);
+}
+
+/*
+ * pacer_start()
+ * Start the clock from now, with cycles already emulated
+ */
+void pacer_start(Pacer* p, uint64_t cycles)
+{
+    pacer_rebase(p, pacer_now_ns(), cycles);
+}
+
+/*
+ * pacer_wait()
+ * Sleep until the wall time at which cycles (counted from the same base
+ * as pacer_start()) should have been emulated. Returns 1 if the clock
+ * was restarted instead, because of turbo or falling too far behind,
+ * and 0 otherwise.
+ */
+int pacer_wait(Pacer* p, uint64_t cycles)
+{
+    uint64_t now = pacer_now_ns();
+    uint64_t deadline;
+    double   ns_per_cycle;
+    double   late, jitter;
+
+    if(p->turbo || p->rebase)
+    {
+        pacer_rebase(p, now, cycles);
+        return 1;
+    }
+
+    ns_per_cycle = 1e9 / (p->clock_hz * p->multiplier);
+    deadline = p->origin_ns + (uint64_t) ((cycles - p->origin_cycles) * ns_per_cycle);
+    if(now > deadline + PACER_RESYNC_NS)
+    {
+        p->resyncs++;
+        pacer_rebase(p, now, cycles);
+        return 1;
+    }
+    if(now < deadline)
+    {
+        struct timespec ts = {
+            .tv_sec  = deadline / 1000000000u,
+            .tv_nsec = deadline % 1000000000u
+        };
+
+        // Absolute sleeps can be restarted after a signal as they are
+        while(clock_nanosleep(CLOCK_MONOTONIC, TIMER_ABSTIME, &ts, NULL) == EINTR)
+            ;
+        p->sleeps++;
+        now = pacer_now_ns();
+    }
+
+    p->waits++;
+    late = (double) (now - deadline);
+    p->late_sum_ns += late;
+    if(late > p->late_max_ns)
+        p->late_max_ns = late;
+    if(late > PACER_LATE_NS)
+        p->late++;
+
+    // Time since the last wait against the time its cycles should take
+    jitter = (double) (now - p->last_ns) - (cycles - p->last_cycles) * ns_per_cycle;
+    p->intervals++;
+    p->jitter_sum_ns += fabs(jitter);
+    p->jitter_sq_sum += jitter * jitter;
+    if(fabs(jitter) > p->jitter_max_ns)
+        p->jitter_max_ns = fabs(jitter);
+    p->last_ns     = now;
+    p->last_cycles = cycles;
+
+    return 0;
+}
+
+/*
+ * pacer_set_multiplier()
+ * Change the speed. The clock restarts at the next wait so that the
+ * frames already run don't count against the new speed.
+ */
+void pacer_set_multiplier(Pacer* p, double multiplier)
+{
+    if(multiplier <= 0.0)
+        return;
+    p->multiplier = multiplier;
+    p->rebase     = 1;
+}
+
+/*
+ * pacer_set_turbo()
+ * Run uncapped while turbo is set. Turning it off picks up the authentic
+ * speed from wherever the emulation has got to.
+ */
+void pacer_set_turbo(Pacer* p, int turbo)
+{
+    if(p->turbo && !turbo)
+        p->rebase = 1;
+    p->turbo = turbo;
+}
+
+/*
+ * pacer_jitter_mean_ns()
+ * Mean absolute jitter
+ */
+double pacer_jitter_mean_ns(const Pacer* p)
+{
+    return (p->intervals > 0) ? p->jitter_sum_ns / p->intervals : 0.0;
+}
+
+/*
+ * pacer_jitter_rms_ns()
+ * Root mean square jitter
+ */
+double pacer_jitter_rms_ns(const Pacer* p)
+{
+    return (p->intervals > 0) ? sqrt(p->jitter_sq_sum / p->intervals) : 0.0;
+}
@@ -0,0 +1,55 @@
+/*
+ * PACER
+ * Keeps the emulation in step with wall time. The deadline for a frame
+ * is worked out from the number of cycles emulated since the pacer was
+ * started, not from the previous deadline, so rounding and oversleeping
+ * never add up to drift. Between frames the thread sleeps on
+ * clock_nanosleep() until the absolute deadline instead of spinning.
+ *
+ * Stefan Wong 2020
+ */
+
+#ifndef __PACER_H
+#define __PACER_H
+
+#include <stdint.h>
+
+// Falling this far behind (a stall, a debugger, a suspended laptop)
+// starts the clock again instead of running flat out to catch up
+#define PACER_RESYNC_NS 100000000
+
+typedef struct
+{
+    double        clock_hz;         // emulated clock at 1x
+    double        multiplier;       // 2.0 runs at twice the authentic speed
+    int           turbo;            // set to run uncapped
+    int           rebase;           // restart the clock at the next wait
+    uint64_t      origin_ns;        // wall time the clock was started at
+    uint64_t      origin_cycles;    // cycles emulated by then
+    uint64_t      last_ns;          // wall time the last wait returned
+    uint64_t      last_cycles;
+    // Stats. Lateness is how far past its deadline a wait returned, and
+    // jitter is how far the time between two waits was off the time the
+    // cycles between them should take.
+    unsigned long waits;
+    unsigned long sleeps;           // waits that had to sleep
+    unsigned long resyncs;
+    unsigned long late;             // waits that returned over a ms late
+    double        late_sum_ns;
+    double        late_max_ns;
+    unsigned long intervals;
+    double        jitter_sum_ns;
+    double        jitter_sq_sum;
+    double        jitter_max_ns;
+} Pacer;
+
+Pacer* pacer_create(double clock_hz, double multiplier);
+void   pacer_destroy(Pacer* p);
+void   pacer_start(Pacer* p, uint64_t cycles);
+int    pacer_wait(Pacer* p, uint64_t cycles);
+void   pacer_set_multiplier(Pacer* p, double multiplier);
+void   pacer_set_turbo(Pacer* p, int turbo);
+double pacer_jitter_mean_ns(const Pacer* p);
+double pacer_jitter_rms_ns(const Pacer* p);
+
+#endif /*__PACER_H*/
@@ -0,0 +1,151 @@
+/*
+ * PROFILE
+ * Execution profile of an emulated program
+ *
+ * Stefan Wong 2020
+ */
+
+#include <stdlib.h>
+#include <string.h>
+#include "disassem.h"
+#include "profile.h"
+
+/*
+ * cpu_profile_create()
+ */
+CPUProfile* cpu_profile_create(void)
+{
+    return calloc(1, sizeof(CPUProfile));
+}
+
+/*
+ * cpu_profile_destroy()
+ */
+void cpu_profile_destroy(CPUProfile* prof)
+{
+    free(prof);
+}
+
+/*
+ * cpu_profile_clear()
+ */
+void cpu_profile_clear(CPUProfile* prof)
+{
+    memset(prof, 0, sizeof(*prof));
+}
+
+/*
+ * cpu_profile_total_cycles()
+ */
+uint64_t cpu_profile_total_cycles(const CPUProfile* prof)
+{
+    uint64_t total = 0;
+
+    for(int op = 0; op < PROFILE_NUM_OPS; ++op)
+        total += prof->op_cycles[op];
+
+    return total;
+}
+
+// qsort has no context argument, so the sort keys are set here first
+static const uint64_t* sort_cycles;
+static const uint64_t* sort_count;
+
+static int cmp_by_cycles(const void* a, const void* b)
+{
+    uint32_t ia = *(const uint32_t*) a;
+    uint32_t ib = *(const uint32_t*) b;
+
+    if(sort_cycles[ia] != sort_cycles[ib])
+        return (sort_cycles[ia] < sort_cycles[ib]) ? 1 : -1;
+    if(sort_count[ia] != sort_count[ib])
+        return (sort_count[ia] < sort_count[ib]) ? 1 : -1;
+    return (ia < ib) ? -1 : 1;
+}
+
+/*
+ * sort_entries()
+ * Fill idx with the entries that ran at least once, most cycles first.
+ * Returns the number of entries.
+ */
+static int sort_entries(const uint64_t* count, const uint64_t* cycles, int num, uint32_t* idx)
+{
+    int n = 0;
+
+    for(int i = 0; i < num; ++i)
+    {
+        if(count[i] > 0)
+            idx[n++] = i;
+    }
+    sort_cycles = cycles;
+    sort_count  = count;
+    qsort(idx, n, sizeof(*idx), cmp_by_cycles);
+
+    return n;
+}
+
+/*
+ * cpu_profile_report()
+ * Write the opcodes and the addresses that took the most cycles to fp,
+ * at most max_lines of each (0 for all of them). Addresses are
+ * disassembled from mem, which should hold the program that was run and
+ * have room for an operand past the top of memory (as CPUState memory
+ * does).
+ */
+void cpu_profile_report(const CPUProfile* prof, const uint8_t* mem, FILE* fp, int max_lines)
+{
+    uint32_t*      idx;
+    uint64_t       total = cpu_profile_total_cycles(prof);
+    double         scale = (total > 0) ? 100.0 / total : 0.0;
+    uint8_t        code[3] = {0, 0, 0};
+    char           instr[32];
+    int            n;
+
+    idx = malloc(PROFILE_NUM_PCS * sizeof(*idx));
+    if(!idx)
+    {
+        fprintf(stderr, "[%s] failed to allocate sort buffer\n", __func__);
+        return;
+    }
+
+    n = sort_entries(prof->op_count, prof->op_cycles, PROFILE_NUM_OPS, idx);
+    if(max_lines > 0 && n > max_lines)
+        n = max_lines;
+    fprintf(fp, "Opcodes by cycles (%lu cycles total)\n", (unsigned long) total);
+    fprintf(fp, "  OP  %-16s %14s %14s %7s\n", "INSTR", "COUNT", "CYCLES", "%");
+    for(int i = 0; i < n; ++i)
+    {
+        uint32_t op = idx[i];
+
+        code[0] = op;
+        disassemble_8080_op_str(instr, sizeof(instr), code, 0);
+        // Only the opcode is known here, so drop the immediate operand
+        char* imm = strchr(instr, '#');
+        if(imm)
+        {
+            while(imm > instr && (imm[-1] == ' ' || imm[-1] == ','))
+                imm--;
+            *imm = '\0';
+        }
+        fprintf(fp, "  %02X  %-16s %14lu %14lu %6.2f%%\n", op, instr,
+                (unsigned long) prof->op_count[op], (unsigned long) prof->op_cycles[op],
+                prof->op_cycles[op] * scale);
+    }
+
+    n = sort_entries(prof->pc_count, prof->pc_cycles, PROFILE_NUM_PCS, idx);
+    if(max_lines > 0 && n > max_lines)
+        n = max_lines;
+    fprintf(fp, "\nAddresses by cycles\n");
+    fprintf(fp, "  PC    %-24s %14s %14s %7s\n", "INSTR", "COUNT", "CYCLES", "%");
+    for(int i = 0; i < n; ++i)
+    {
+        uint32_t pc = idx[i];
+
+        disassemble_8080_op_str(instr, sizeof(instr), mem, pc);
+        fprintf(fp, "  %04X  %-24s %14lu %14lu %6.2f%%\n", pc, instr,
+                (unsigned long) prof->pc_count[pc], (unsigned long) prof->pc_cycles[pc],
+                prof->pc_cycles[pc] * scale);
+    }
+
+    free(idx);
+}
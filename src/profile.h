@@ -0,0 +1,46 @@
+/*
+ * PROFILE
+ * Execution profile of an emulated program. Counts executions and cycles
+ * for each opcode and for each address an instruction started at. A
+ * profile is only filled in while it is attached to a CPUState, and the
+ * interpreter only does the extra work when one is attached.
+ *
+ * Stefan Wong 2020
+ */
+
+#ifndef __PROFILE_H
+#define __PROFILE_H
+
+#include <stdint.h>
+#include <stdio.h>
+
+#define PROFILE_NUM_OPS 256
+#define PROFILE_NUM_PCS 0x10000
+
+typedef struct CPUProfile
+{
+    uint64_t op_count[PROFILE_NUM_OPS];
+    uint64_t op_cycles[PROFILE_NUM_OPS];
+    uint64_t pc_count[PROFILE_NUM_PCS];
+    uint64_t pc_cycles[PROFILE_NUM_PCS];
+} CPUProfile;
+
+CPUProfile* cpu_profile_create(void);
+void        cpu_profile_destroy(CPUProfile* prof);
+void        cpu_profile_clear(CPUProfile* prof);
+uint64_t    cpu_profile_total_cycles(const CPUProfile* prof);
+void        cpu_profile_report(const CPUProfile* prof, const uint8_t* mem, FILE* fp, int max_lines);
+
+/*
+ * cpu_profile_add()
+ * Count one execution of the op at pc that took the given cycles
+ */
+static inline void cpu_profile_add(CPUProfile* prof, uint16_t pc, uint8_t op, uint32_t cycles)
+{
+    prof->op_count[op]++;
+    prof->op_cycles[op] += cycles;
+    prof->pc_count[pc]++;
+    prof->pc_cycles[pc] += cycles;
+}
+
+#endif /*__PROFILE_H*/
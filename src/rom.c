@@ -0,0 +1,225 @@
+/*
+ * ROM
+ * Checked loading of ROM images
+ *
+ * Stefan Wong 2020
+ */
+
+#define _DEFAULT_SOURCE
+#include <errno.h>
+#include <fcntl.h>
+#include <stdio.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#include "rom.h"
+
+// Space Invaders (Midway, 1978)
+static const RomFile invaders_files[] = {
+    { "invaders.h", 0x0000, 0x0800, 0x734F5AD8 },
+    { "invaders.g", 0x0800, 0x0800, 0x6BFACA4A },
+    { "invaders.f", 0x1000, 0x0800, 0x0CCEAD96 },
+    { "invaders.e", 0x1800, 0x0800, 0x14E538B0 },
+};
+
+const RomSet rom_set_invaders = {
+    .name      = "invaders",
+    .files     = invaders_files,
+    .num_files = sizeof(invaders_files) / sizeof(invaders_files[0]),
+    .rom_start = 0x0000,
+    .rom_end   = 0x2000,
+    .ram_start = 0x2000,
+    .ram_end   = 0x4000,
+};
+
+/*
+ * rom_crc32()
+ * CRC-32 (IEEE 802.3), as used by MAME and zip to identify ROM dumps
+ */
+uint32_t rom_crc32(const uint8_t* data, size_t len)
+{
+    uint32_t crc = 0xFFFFFFFF;
+
+    for(size_t i = 0; i < len; ++i)
+    {
+        crc ^= data[i];
+        for(int k = 0; k < 8; ++k)
+            crc = (crc >> 1) ^ (0xEDB88320 & -(crc & 1));
+    }
+
+    return ~crc;
+}
+
+/*
+ * rom_map()
+ * Map a whole file read-only. Returns NULL if the file can't be opened
+ * or is empty, and sets *size to the size of the file.
+ */
+static const uint8_t* rom_map(const char* path, size_t* size)
+{
+    struct stat st;
+    void*       map = NULL;
+    int         fd;
+
+    fd = open(path, O_RDONLY);
+    if(fd < 0)
+    {
+        fprintf(stderr, "[%s] failed to open %s (%s)\n", __func__, path, strerror(errno));
+        return NULL;
+    }
+    if(fstat(fd, &st) < 0 || !S_ISREG(st.st_mode) || st.st_size <= 0)
+    {
+        fprintf(stderr, "[%s] %s is not a readable file\n", __func__, path);
+        goto MAP_END;
+    }
+    if(st.st_size > CPU_MEM_SIZE)
+    {
+        fprintf(stderr, "[%s] %s is %lld bytes, more than the %d byte address space\n",
+                __func__, path, (long long) st.st_size, CPU_MEM_SIZE);
+        goto MAP_END;
+    }
+    map = mmap(NULL, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+    if(map == MAP_FAILED)
+    {
+        fprintf(stderr, "[%s] failed to map %s (%s)\n", __func__, path, strerror(errno));
+        map = NULL;
+        goto MAP_END;
+    }
+    *size = st.st_size;
+
+MAP_END:
+    close(fd);
+    return map;
+}
+
+/*
+ * rom_load_file()
+ * Load a file into memory at offset. Returns the number of bytes loaded,
+ * or -1 if the file can't be read or doesn't fit above offset.
+ */
+long rom_load_file(CPUState* state, const char* path, uint16_t offset)
+{
+    const uint8_t* map;
+    size_t         size = 0;
+
+    map = rom_map(path, &size);
+    if(map == NULL)
+        return -1;
+    if(size > (size_t) (CPU_MEM_SIZE - offset))
+    {
+        fprintf(stderr, "[%s] %s (%zu bytes) doesn't fit at 0x%04X\n", __func__, path, size, offset);
+        munmap((void*) map, size);
+        return -1;
+    }
+    memcpy(&state->memory[offset], map, size);
+    munmap((void*) map, size);
+    cpu_mem_changed(state);
+
+    return (long) size;
+}
+
+/*
+ * rom_load_set()
+ * Load every file of a ROM set from dir, checking the size and CRC32 of
+ * each. Returns 0 if the whole set loaded.
+ */
+int rom_load_set(CPUState* state, const RomSet* set, const char* dir)
+{
+    for(int i = 0; i < set->num_files; ++i)
+    {
+        const RomFile* rf = &set->files[i];
+        const uint8_t* map;
+        size_t         size = 0;
+        uint32_t       crc;
+        char           path[4096];
+
+        snprintf(path, sizeof(path), "%s/%s", dir, rf->name);
+        map = rom_map(path, &size);
+        if(map == NULL)
+            return -1;
+        if(size != rf->size)
+        {
+            fprintf(stderr, "[%s] %s is %zu bytes, expected %u\n", __func__, path, size, rf->size);
+            munmap((void*) map, size);
+            return -1;
+        }
+        crc = rom_crc32(map, size);
+        if(crc != rf->crc32)
+        {
+            fprintf(stderr, "[%s] %s has CRC32 %08X, expected %08X\n", __func__, path, crc, rf->crc32);
+            munmap((void*) map, size);
+            return -1;
+        }
+        memcpy(&state->memory[rf->offset], map, size);
+        munmap((void*) map, size);
+    }
+    cpu_mem_changed(state);
+
+    return 0;
+}
+
+/*
+ * rom_map_init()
+ * Memory map for the machine a ROM set runs on. Writes to the ROM are
+ * ignored and the RAM repeats through the rest of the address space.
+ */
+void rom_map_init(const RomSet* set, CPUMemMap* map)
+{
+    cpu_map_init(map);
+    cpu_map_protect(map, set->rom_start, set->rom_end);
+    if(set->ram_end > set->ram_start)
+        cpu_map_mirror(map, set->ram_end, CPU_MEM_SIZE, set->ram_start, set->ram_end);
+}
+
+// Host pages wholly inside the ROM range of set
+static int rom_pages(CPUState* state, const RomSet* set, uint8_t** start, size_t* len)
+{
+    uintptr_t page = (uintptr_t) sysconf(_SC_PAGESIZE);
+    uintptr_t lo   = (uintptr_t) &state->memory[set->rom_start];
+    uintptr_t hi   = (uintptr_t) state->memory + set->rom_end;
+
+    lo = (lo + page - 1) & ~(page - 1);
+    hi = hi & ~(page - 1);
+    if(hi <= lo)
+        return -1;
+    *start = (uint8_t*) lo;
+    *len   = hi - lo;
+
+    return 0;
+}
+
+/*
+ * rom_protect()
+ * Make the ROM range of set read-only, so that a write into it faults.
+ * Only whole host pages can be protected, which for a ROM that starts
+ * and ends on a page boundary (as invaders does) is the whole range.
+ * rom_unprotect() must be called before the state is destroyed.
+ */
+int rom_protect(CPUState* state, const RomSet* set)
+{
+    uint8_t* start;
+    size_t   len;
+
+    if(rom_pages(state, set, &start, &len) < 0 || mprotect(start, len, PROT_READ) < 0)
+    {
+        fprintf(stderr, "[%s] failed to protect ROM range of %s\n", __func__, set->name);
+        return -1;
+    }
+
+    return 0;
+}
+
+/*
+ * rom_unprotect()
+ */
+int rom_unprotect(CPUState* state, const RomSet* set)
+{
+    uint8_t* start;
+    size_t   len;
+
+    if(rom_pages(state, set, &start, &len) < 0)
+        return -1;
+
+    return mprotect(start, len, PROT_READ | PROT_WRITE);
+}
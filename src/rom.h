@@ -0,0 +1,47 @@
+/*
+ * ROM
+ * Checked loading of ROM images. Files are mapped rather than read
+ * through stdio, every size is checked against the 64 KiB address
+ * space, and a known ROM set is also checked against its CRC32s. Once
+ * loaded the ROM range can be made read-only so that a stray write
+ * traps instead of quietly corrupting the program.
+ *
+ * Stefan Wong 2020
+ */
+
+#ifndef __ROM_H
+#define __ROM_H
+
+#include <stddef.h>
+#include <stdint.h>
+#include "cpu.h"
+
+typedef struct
+{
+    const char* name;           // file name within the ROM directory
+    uint16_t    offset;         // load address
+    uint16_t    size;           // expected size in bytes
+    uint32_t    crc32;
+} RomFile;
+
+typedef struct
+{
+    const char*    name;
+    const RomFile* files;
+    int            num_files;
+    uint16_t       rom_start;   // address range covered by the set
+    uint32_t       rom_end;     // one past the last ROM byte
+    uint16_t       ram_start;   // RAM, mirrored from ram_end to the top of memory
+    uint32_t       ram_end;
+} RomSet;
+
+extern const RomSet rom_set_invaders;
+
+uint32_t rom_crc32(const uint8_t* data, size_t len);
+long     rom_load_file(CPUState* state, const char* path, uint16_t offset);
+int      rom_load_set(CPUState* state, const RomSet* set, const char* dir);
+void     rom_map_init(const RomSet* set, CPUMemMap* map);
+int      rom_protect(CPUState* state, const RomSet* set);
+int      rom_unprotect(CPUState* state, const RomSet* set);
+
+#endif /*__ROM_H*/
@@ -0,0 +1,192 @@
+/*
+ * SCHEDULER
+ * Event scheduler driven by the CPU cycle count
+ *
+ * Stefan Wong 2020
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include "scheduler.h"
+
+static inline int event_before(const SchedEvent* a, const SchedEvent* b)
+{
+    return (a->when != b->when) ? (a->when < b->when) : (a->seq < b->seq);
+}
+
+static void heap_up(SchedEvent* heap, int idx)
+{
+    SchedEvent ev = heap[idx];
+
+    while(idx > 0)
+    {
+        int parent = (idx - 1) / 2;
+        if(!event_before(&ev, &heap[parent]))
+            break;
+        heap[idx] = heap[parent];
+        idx = parent;
+    }
+    heap[idx] = ev;
+}
+
+static void heap_down(SchedEvent* heap, int size, int idx)
+{
+    SchedEvent ev = heap[idx];
+
+    for(;;)
+    {
+        int child = 2 * idx + 1;
+        if(child >= size)
+            break;
+        if(child + 1 < size && event_before(&heap[child + 1], &heap[child]))
+            child++;
+        if(!event_before(&heap[child], &ev))
+            break;
+        heap[idx] = heap[child];
+        idx = child;
+    }
+    heap[idx] = ev;
+}
+
+/*
+ * sched_create()
+ */
+Scheduler* sched_create(void)
+{
+    Scheduler* s;
+
+    s = calloc(1, sizeof(*s));
+    if(!s)
+        return NULL;
+    s->heap = malloc(SCHED_INIT_EVENTS * sizeof(*s->heap));
+    if(!s->heap)
+    {
+        free(s);
+        return NULL;
+    }
+    s->capacity = SCHED_INIT_EVENTS;
+
+    return s;
+}
+
+/*
+ * sched_destroy()
+ */
+void sched_destroy(Scheduler* s)
+{
+    if(!s)
+        return;
+    free(s->heap);
+    free(s);
+}
+
+/*
+ * sched_add()
+ * Schedule func to be called once the cycle count reaches when. Returns
+ * 0 on success.
+ */
+int sched_add(Scheduler* s, uint64_t when, SchedFunc func, void* ctx)
+{
+    if(s->size == s->capacity)
+    {
+        SchedEvent* heap = realloc(s->heap, 2 * s->capacity * sizeof(*heap));
+        if(!heap)
+        {
+            fprintf(stderr, "[%s] failed to grow event heap\n", __func__);
+            return -1;
+        }
+        s->heap      = heap;
+        s->capacity *= 2;
+    }
+
+    s->heap[s->size].when = when;
+    s->heap[s->size].seq  = s->next_seq++;
+    s->heap[s->size].func = func;
+    s->heap[s->size].ctx  = ctx;
+    heap_up(s->heap, s->size);
+    s->size++;
+
+    return 0;
+}
+
+/*
+ * sched_cancel()
+ * Remove every pending event with this func and ctx. Returns the number
+ * removed.
+ */
+int sched_cancel(Scheduler* s, SchedFunc func, void* ctx)
+{
+    int removed = 0;
+
+    for(int i = 0; i < s->size; )
+    {
+        if(s->heap[i].func == func && s->heap[i].ctx == ctx)
+        {
+            s->heap[i] = s->heap[--s->size];
+            removed++;
+        }
+        else
+            i++;
+    }
+    // Cancelling is rare, so just rebuild the heap
+    for(int i = s->size / 2 - 1; i >= 0; --i)
+        heap_down(s->heap, s->size, i);
+
+    return removed;
+}
+
+/*
+ * sched_dispatch()
+ * Call every event due at or before now, earliest first. Events added by
+ * a callback that are already due run in the same pass. Returns the
+ * number of events dispatched.
+ */
+int sched_dispatch(Scheduler* s, uint64_t now)
+{
+    int count = 0;
+
+    while(s->size > 0 && s->heap[0].when <= now)
+    {
+        SchedEvent ev = s->heap[0];
+
+        s->heap[0] = s->heap[--s->size];
+        if(s->size > 0)
+            heap_down(s->heap, s->size, 0);
+        ev.func(s, ev.ctx, ev.when);
+        count++;
+    }
+    s->dispatched += count;
+
+    return count;
+}
+
+/*
+ * sched_run_until()
+ * Run the CPU until the cycle count reaches target, stopping at every
+ * event deadline on the way to dispatch it. Events due at target are
+ * dispatched before returning. Returns the cycles run, or the CPU's
+ * status if it stopped.
+ */
+long sched_run_until(Scheduler* s, CPUState* state, uint64_t target, SchedRunFunc run)
+{
+    uint64_t start = state->cycles;
+
+    for(;;)
+    {
+        uint64_t next = sched_next(s);
+
+        if(next > target)
+            next = target;
+        if(state->cycles < next)
+        {
+            long status = run(state, (long) (next - state->cycles));
+            if(status < 0)
+                return status;
+        }
+        sched_dispatch(s, state->cycles);
+        if(state->cycles >= target)
+            break;
+    }
+
+    return (long) (state->cycles - start);
+}
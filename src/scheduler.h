@@ -0,0 +1,62 @@
+/*
+ * SCHEDULER
+ * Event scheduler driven by the CPU cycle count. Events sit in a
+ * min-heap keyed on the absolute cycle they are due at. The CPU runs
+ * straight up to the earliest deadline (so the only per-instruction cost
+ * is the interpreter's budget check), then every event that is due is
+ * dispatched. Deadlines are absolute, so cycles a slice runs over are
+ * taken out of the next slice and periodic events never drift.
+ *
+ * Stefan Wong 2020
+ */
+
+#ifndef __SCHEDULER_H
+#define __SCHEDULER_H
+
+#include <stdint.h>
+#include "cpu.h"
+
+#define SCHED_INIT_EVENTS 16
+
+typedef struct Scheduler Scheduler;
+
+// Called when an event is due. when is the cycle it was due at, which
+// is the right base for rescheduling a periodic event.
+typedef void (*SchedFunc)(Scheduler* s, void* ctx, uint64_t when);
+// Runs the CPU for at least budget cycles (cpu_run_fast() and friends)
+typedef long (*SchedRunFunc)(CPUState* state, long budget);
+
+typedef struct
+{
+    uint64_t  when;
+    uint64_t  seq;          // events due together run in the order added
+    SchedFunc func;
+    void*     ctx;
+} SchedEvent;
+
+struct Scheduler
+{
+    SchedEvent* heap;
+    int         size;
+    int         capacity;
+    uint64_t    next_seq;
+    unsigned long dispatched;
+};
+
+Scheduler* sched_create(void);
+void       sched_destroy(Scheduler* s);
+int        sched_add(Scheduler* s, uint64_t when, SchedFunc func, void* ctx);
+int        sched_cancel(Scheduler* s, SchedFunc func, void* ctx);
+int        sched_dispatch(Scheduler* s, uint64_t now);
+long       sched_run_until(Scheduler* s, CPUState* state, uint64_t target, SchedRunFunc run);
+
+/*
+ * sched_next()
+ * Cycle the earliest event is due at, or UINT64_MAX if there are none
+ */
+static inline uint64_t sched_next(const Scheduler* s)
+{
+    return (s->size > 0) ? s->heap[0].when : UINT64_MAX;
+}
+
+#endif /*__SCHEDULER_H*/
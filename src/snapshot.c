@@ -0,0 +1,326 @@
+/*
+ * SNAPSHOT
+ * Incremental snapshots of a CPUState
+ *
+ * Stefan Wong 2020
+ */
+
+#include <stdatomic.h>
+#include <stdlib.h>
+#include <string.h>
+#include "snapshot.h"
+
+struct SnapPage
+{
+    atomic_int refs;
+    uint8_t    data[SNAP_PAGE_SIZE];
+};
+
+struct CPUSnapTracker
+{
+    CPUMemMap        map;                       // the machine's map, with clean pages protected
+    const CPUMemMap* machine;                   // the map it stands in for
+    SnapPage*        pages[SNAP_NUM_PAGES];     // memory as of the last take or restore
+    uint8_t          dirty[SNAP_NUM_PAGES];     // pages written since then
+    uint64_t         mem_gen;                   // generation of memory at that point
+};
+
+static SnapPage* page_ref(SnapPage* page)
+{
+    atomic_fetch_add(&page->refs, 1);
+    return page;
+}
+
+static void page_unref(SnapPage* page)
+{
+    if(page && atomic_fetch_sub(&page->refs, 1) == 1)
+        free(page);
+}
+
+static SnapPage* page_create(const uint8_t* data)
+{
+    SnapPage* page = malloc(sizeof(*page));
+
+    if(!page)
+        return NULL;
+    atomic_init(&page->refs, 1);
+    memcpy(page->data, data, SNAP_PAGE_SIZE);
+
+    return page;
+}
+
+static void regs_save(CPURegs* regs, const CPUState* state)
+{
+    regs->a          = state->a;
+    regs->b          = state->b;
+    regs->c          = state->c;
+    regs->d          = state->d;
+    regs->e          = state->e;
+    regs->h          = state->h;
+    regs->l          = state->l;
+    regs->sp         = state->sp;
+    regs->pc         = state->pc;
+    regs->cc         = state->cc;
+    regs->int_enable = state->int_enable;
+    regs->cycles     = state->cycles;
+}
+
+static void regs_load(CPUState* state, const CPURegs* regs)
+{
+    state->a          = regs->a;
+    state->b          = regs->b;
+    state->c          = regs->c;
+    state->d          = regs->d;
+    state->e          = regs->e;
+    state->h          = regs->h;
+    state->l          = regs->l;
+    state->sp         = regs->sp;
+    state->pc         = regs->pc;
+    state->cc         = regs->cc;
+    state->int_enable = regs->int_enable;
+    state->cycles     = regs->cycles;
+}
+
+// ======== WRITE TRACKING ======== //
+// The first store to a clean page. Mirrors of the page share its backing
+// and go back to it as well.
+static void track_write(CPUState* state, uint16_t addr, uint8_t val)
+{
+    CPUSnapTracker* t   = state->snap;
+    uint32_t        off = t->machine->write[addr >> 8];
+
+    t->dirty[off >> 8] = 1;
+    for(int p = 0; p < CPU_NUM_PAGES; ++p)
+    {
+        if(t->machine->write[p] == off)
+        {
+            t->map.write[p]         = off;
+            t->map.write_handler[p] = NULL;
+        }
+    }
+    state->memory[off | (addr & 0xFF)] = val;
+}
+
+// Memory changed from outside of the CPU could be anywhere
+static void track_check_gen(CPUSnapTracker* t, const CPUState* state)
+{
+    if(t->mem_gen != state->mem_gen)
+        memset(t->dirty, 1, sizeof(t->dirty));
+}
+
+// Memory now holds pages. Protect every RAM page again.
+static void track_reset(CPUSnapTracker* t, const CPUState* state, SnapPage* const* pages)
+{
+    for(int p = 0; p < SNAP_NUM_PAGES; ++p)
+    {
+        SnapPage* old = t->pages[p];
+
+        if(old == pages[p])
+            continue;
+        t->pages[p] = page_ref(pages[p]);
+        page_unref(old);
+    }
+    for(int p = 0; p < CPU_NUM_PAGES; ++p)
+    {
+        // Handler and sink pages don't write to snapshot memory
+        if(t->machine->write[p] >= CPU_MEM_SIZE || t->map.write[p] == CPU_PAGE_HANDLER)
+            continue;
+        t->map.write[p]         = CPU_PAGE_HANDLER;
+        t->map.write_handler[p] = track_write;
+    }
+    memset(t->dirty, 0, sizeof(t->dirty));
+    t->mem_gen = state->mem_gen;
+}
+
+/*
+ * cpu_snapshot_track()
+ * Track the pages state writes to from now on, so that taking and
+ * restoring snapshots of it only has to look at those. The map state
+ * has now is swapped for a tracking copy until cpu_snapshot_untrack(),
+ * which has to come before the machine changes its map or is destroyed.
+ * Tracking starts with the first take or restore.
+ */
+int cpu_snapshot_track(CPUState* state)
+{
+    CPUSnapTracker* t;
+
+    if(state->snap)
+        return 0;
+    t = calloc(1, sizeof(*t));
+    if(!t)
+        return -1;
+    t->map     = *state->map;
+    t->machine = state->map;
+    memset(t->dirty, 1, sizeof(t->dirty));
+    state->snap = t;
+    state->map  = &t->map;
+
+    return 0;
+}
+
+/*
+ * cpu_snapshot_untrack()
+ * Give state its own map back
+ */
+void cpu_snapshot_untrack(CPUState* state)
+{
+    CPUSnapTracker* t = state->snap;
+
+    if(!t)
+        return;
+    state->map  = t->machine;
+    state->snap = NULL;
+    for(int p = 0; p < SNAP_NUM_PAGES; ++p)
+        page_unref(t->pages[p]);
+    free(t);
+}
+
+
+// ======== SNAPSHOTS ======== //
+/*
+ * cpu_snapshot_take()
+ * Snapshot the registers and memory of state. Pages that are the same as
+ * in parent are shared with it. parent may be NULL, in which case every
+ * page is copied. If state is tracked, pages it hasn't written since the
+ * last take or restore are shared with that snapshot without looking at
+ * them.
+ */
+CPUSnapshot* cpu_snapshot_take(const CPUState* state, const CPUSnapshot* parent)
+{
+    CPUSnapTracker* t = state->snap;
+    CPUSnapshot*    snap;
+
+    snap = calloc(1, sizeof(*snap));
+    if(!snap)
+        return NULL;
+    regs_save(&snap->regs, state);
+    if(t)
+        track_check_gen(t, state);
+
+    for(int p = 0; p < SNAP_NUM_PAGES; ++p)
+    {
+        const uint8_t* src   = &state->memory[p * SNAP_PAGE_SIZE];
+        SnapPage*      clean = (t && !t->dirty[p]) ? t->pages[p] : NULL;
+
+        if(clean && (!parent || parent->pages[p] == clean))
+        {
+            snap->pages[p] = page_ref(clean);
+            if(!parent)
+                snap->new_pages++;
+            continue;
+        }
+        if(parent && memcmp(parent->pages[p]->data, src, SNAP_PAGE_SIZE) == 0)
+        {
+            snap->pages[p] = page_ref(parent->pages[p]);
+            continue;
+        }
+        snap->pages[p] = clean ? page_ref(clean) : page_create(src);
+        if(!snap->pages[p])
+            goto SNAP_TAKE_FAIL;
+        snap->new_pages++;
+    }
+    if(t)
+        track_reset(t, state, snap->pages);
+
+    return snap;
+
+SNAP_TAKE_FAIL:
+    cpu_snapshot_destroy(snap);
+    return NULL;
+}
+
+/*
+ * cpu_snapshot_clone()
+ * A second handle on the same snapshot, sharing every page
+ */
+CPUSnapshot* cpu_snapshot_clone(const CPUSnapshot* snap)
+{
+    CPUSnapshot* clone;
+
+    clone = malloc(sizeof(*clone));
+    if(!clone)
+        return NULL;
+    *clone = *snap;
+    clone->new_pages = 0;
+    for(int p = 0; p < SNAP_NUM_PAGES; ++p)
+        page_ref(clone->pages[p]);
+
+    return clone;
+}
+
+/*
+ * cpu_snapshot_destroy()
+ */
+void cpu_snapshot_destroy(CPUSnapshot* snap)
+{
+    if(!snap)
+        return;
+    for(int p = 0; p < SNAP_NUM_PAGES; ++p)
+        page_unref(snap->pages[p]);
+    free(snap);
+}
+
+/*
+ * cpu_snapshot_restore()
+ * Put state back the way it was when snap was taken. state keeps its own
+ * memory buffer and everything attached to it. Only pages that differ
+ * are copied, and the number of pages copied is returned. If it isn't
+ * zero any decode cache or JIT running on state starts over. If state is
+ * tracked, pages it hasn't written that snap shares with the last take
+ * or restore are skipped without looking at them.
+ */
+int cpu_snapshot_restore(const CPUSnapshot* snap, CPUState* state)
+{
+    CPUSnapTracker* t = state->snap;
+    int             copied = 0;
+
+    if(t)
+        track_check_gen(t, state);
+    for(int p = 0; p < SNAP_NUM_PAGES; ++p)
+    {
+        uint8_t* dst = &state->memory[p * SNAP_PAGE_SIZE];
+
+        if(t && !t->dirty[p] && t->pages[p] == snap->pages[p])
+            continue;
+        if(memcmp(dst, snap->pages[p]->data, SNAP_PAGE_SIZE) != 0)
+        {
+            memcpy(dst, snap->pages[p]->data, SNAP_PAGE_SIZE);
+            copied++;
+        }
+    }
+    regs_load(state, &snap->regs);
+    if(copied)
+        cpu_mem_changed(state);
+    if(t)
+        track_reset(t, state, snap->pages);
+
+    return copied;
+}
+
+/*
+ * cpu_snapshot_fork()
+ * Create a new machine in the state held by snap. It has its own copy of
+ * all of memory, a flat map and nothing attached, and isn't tracked.
+ */
+CPUState* cpu_snapshot_fork(const CPUSnapshot* snap)
+{
+    CPUState* state;
+
+    state = cpu_create();
+    if(!state)
+        return NULL;
+    for(int p = 0; p < SNAP_NUM_PAGES; ++p)
+        memcpy(&state->memory[p * SNAP_PAGE_SIZE], snap->pages[p]->data, SNAP_PAGE_SIZE);
+    regs_load(state, &snap->regs);
+
+    return state;
+}
+
+/*
+ * cpu_snapshot_page()
+ * Read-only view of one page of snapshot memory
+ */
+const uint8_t* cpu_snapshot_page(const CPUSnapshot* snap, int page)
+{
+    return snap->pages[page]->data;
+}
@@ -0,0 +1,74 @@
+/*
+ * SNAPSHOT
+ * Incremental snapshots of a CPUState. Memory is held as reference
+ * counted pages. A snapshot taken from a parent shares every page that
+ * hasn't changed since the parent was taken, so keeping a snapshot per
+ * frame only costs the pages that change.
+ *
+ * Without help that means comparing all of memory on every take and
+ * restore. cpu_snapshot_track() gives the machine a copy of its memory
+ * map with every RAM page write protected by a handler. The first store
+ * to a page since the last take or restore marks the page dirty and
+ * points it back at its backing, so the stores after it run at full
+ * speed. Taking a snapshot then only copies the dirty pages, and
+ * restoring only copies those and the pages the two snapshots don't
+ * share. A flat machine runs through the paged cores while tracked.
+ *
+ * Maps are offsets into a machine's own memory buffer, so a fork gets a
+ * copy of all of memory. To run many times from one state, track one
+ * machine and restore it between runs: each restore then costs the
+ * pages the run wrote.
+ *
+ * Only the architectural state is kept. The memory map, ports, tracer,
+ * profile and userdata belong to the machine, not to the snapshot.
+ *
+ * Stefan Wong 2020
+ */
+
+#ifndef __SNAPSHOT_H
+#define __SNAPSHOT_H
+
+#include <stddef.h>
+#include <stdint.h>
+#include "cpu.h"
+
+#define SNAP_PAGE_SIZE  CPU_PAGE_SIZE   // the pages of the memory map
+#define SNAP_NUM_PAGES  (CPU_MEM_SIZE / SNAP_PAGE_SIZE)
+
+typedef struct SnapPage SnapPage;
+typedef struct CPUSnapTracker CPUSnapTracker;
+
+// Registers, flags and the cycle count
+typedef struct
+{
+    uint8_t        a;
+    uint8_t        b;
+    uint8_t        c;
+    uint8_t        d;
+    uint8_t        e;
+    uint8_t        h;
+    uint8_t        l;
+    uint16_t       sp;
+    uint16_t       pc;
+    ConditionCodes cc;
+    uint8_t        int_enable;
+    uint64_t       cycles;
+} CPURegs;
+
+typedef struct
+{
+    CPURegs   regs;
+    SnapPage* pages[SNAP_NUM_PAGES];
+    int       new_pages;                // pages not shared with the parent
+} CPUSnapshot;
+
+CPUSnapshot* cpu_snapshot_take(const CPUState* state, const CPUSnapshot* parent);
+CPUSnapshot* cpu_snapshot_clone(const CPUSnapshot* snap);
+void         cpu_snapshot_destroy(CPUSnapshot* snap);
+int          cpu_snapshot_restore(const CPUSnapshot* snap, CPUState* state);
+CPUState*    cpu_snapshot_fork(const CPUSnapshot* snap);
+const uint8_t* cpu_snapshot_page(const CPUSnapshot* snap, int page);
+int          cpu_snapshot_track(CPUState* state);
+void         cpu_snapshot_untrack(CPUState* state);
+
+#endif /*__SNAPSHOT_H*/
@@ -0,0 +1,213 @@
+/*
+ * TRACE
+ * Binary instruction trace
+ *
+ * Stefan Wong 2020
+ */
+
+#define _DEFAULT_SOURCE
+#include <sched.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include "trace.h"
+
+#define TRACE_IDLE_NS  100000       // writer sleep when the ring is empty
+
+/*
+ * trace_drain()
+ * Write out everything the producer has published. Returns the number
+ * of records written.
+ */
+static size_t trace_drain(Tracer* tr)
+{
+    size_t head = atomic_load_explicit(&tr->head, memory_order_acquire);
+    size_t tail = atomic_load_explicit(&tr->tail, memory_order_relaxed);
+    size_t total = head - tail;
+
+    while(tail != head)
+    {
+        size_t start = tail & tr->mask;
+        size_t count = head - tail;
+
+        // Stop at the end of the ring, the rest goes out next time round
+        if(count > tr->mask + 1 - start)
+            count = tr->mask + 1 - start;
+        if(!tr->error && fwrite(&tr->ring[start], sizeof(TraceRecord), count, tr->fp) != count)
+            tr->error = 1;
+        tail += count;
+        atomic_store_explicit(&tr->tail, tail, memory_order_release);
+    }
+    tr->written += total;
+
+    return total;
+}
+
+static void* trace_writer(void* arg)
+{
+    Tracer* tr = arg;
+    struct timespec idle = { 0, TRACE_IDLE_NS };
+
+    for(;;)
+    {
+        // Check stop first so that a final drain picks up everything
+        // pushed before the producer asked us to stop
+        int stop = atomic_load_explicit(&tr->stop, memory_order_acquire);
+
+        if(trace_drain(tr) == 0)
+        {
+            if(stop)
+                break;
+            nanosleep(&idle, NULL);
+        }
+    }
+
+    return NULL;
+}
+
+/*
+ * tracer_create()
+ * Open a trace file and start the writer. ring_records is rounded up to
+ * a power of 2, 0 gives the default.
+ */
+Tracer* tracer_create(const char* path, size_t ring_records)
+{
+    Tracer*     tr;
+    TraceHeader hdr;
+    size_t      size = 1;
+
+    if(ring_records == 0)
+        ring_records = TRACE_RING_RECORDS;
+    while(size < ring_records)
+        size <<= 1;
+
+    tr = aligned_alloc(TRACE_CACHE_LINE, sizeof(*tr));
+    if(!tr)
+        return NULL;
+    memset(tr, 0, sizeof(*tr));
+    atomic_init(&tr->head, 0);
+    atomic_init(&tr->tail, 0);
+    atomic_init(&tr->stop, 0);
+    tr->mask = size - 1;
+
+    tr->ring = malloc(size * sizeof(TraceRecord));
+    if(!tr->ring)
+        goto TRACE_FAIL;
+    tr->fp = fopen(path, "wb");
+    if(!tr->fp)
+    {
+        fprintf(stderr, "[%s] couldn't open %s for writing\n", __func__, path);
+        goto TRACE_FAIL;
+    }
+
+    memcpy(hdr.magic, TRACE_MAGIC, sizeof(hdr.magic));
+    hdr.version     = TRACE_VERSION;
+    hdr.record_size = sizeof(TraceRecord);
+    if(fwrite(&hdr, sizeof(hdr), 1, tr->fp) != 1)
+        goto TRACE_FAIL;
+
+    if(pthread_create(&tr->writer, NULL, trace_writer, tr) != 0)
+    {
+        fprintf(stderr, "[%s] failed to start writer thread\n", __func__);
+        goto TRACE_FAIL;
+    }
+
+    return tr;
+
+TRACE_FAIL:
+    if(tr->fp)
+        fclose(tr->fp);
+    free(tr->ring);
+    free(tr);
+    return NULL;
+}
+
+/*
+ * tracer_destroy()
+ * Write out whatever is left in the ring and close the file. Returns 0
+ * if every record made it to the file.
+ */
+int tracer_destroy(Tracer* tr)
+{
+    int status;
+
+    if(!tr)
+        return 0;
+
+    atomic_store_explicit(&tr->stop, 1, memory_order_release);
+    pthread_join(tr->writer, NULL);
+    status = tr->error;
+    if(fclose(tr->fp) != 0)
+        status = 1;
+    free(tr->ring);
+    free(tr);
+
+    return status ? -1 : 0;
+}
+
+/*
+ * tracer_wait()
+ * Called by the producer when the ring looks full. Waits for the writer
+ * to make room.
+ */
+void tracer_wait(Tracer* tr)
+{
+    size_t head = atomic_load_explicit(&tr->head, memory_order_relaxed);
+
+    tr->tail_cache = atomic_load_explicit(&tr->tail, memory_order_acquire);
+    if(head - tr->tail_cache <= tr->mask)
+        return;
+    tr->stalls++;
+    do
+    {
+        sched_yield();
+        tr->tail_cache = atomic_load_explicit(&tr->tail, memory_order_acquire);
+    } while(head - tr->tail_cache > tr->mask);
+}
+
+/*
+ * tracer_records()
+ * Number of records pushed so far
+ */
+unsigned long tracer_records(const Tracer* tr)
+{
+    return atomic_load_explicit(&tr->head, memory_order_relaxed);
+}
+
+/*
+ * trace_open()
+ * Open a trace file for reading and check its header
+ */
+FILE* trace_open(const char* path)
+{
+    FILE*       fp;
+    TraceHeader hdr;
+
+    fp = fopen(path, "rb");
+    if(!fp)
+    {
+        fprintf(stderr, "[%s] couldn't open %s\n", __func__, path);
+        return NULL;
+    }
+    if(fread(&hdr, sizeof(hdr), 1, fp) != 1 ||
+       memcmp(hdr.magic, TRACE_MAGIC, sizeof(hdr.magic)) != 0 ||
+       hdr.version != TRACE_VERSION ||
+       hdr.record_size != sizeof(TraceRecord))
+    {
+        fprintf(stderr, "[%s] %s is not a version %d trace\n", __func__, path, TRACE_VERSION);
+        fclose(fp);
+        return NULL;
+    }
+
+    return fp;
+}
+
+/*
+ * trace_read()
+ * Read the next record. Returns 1 on success and 0 at the end of the
+ * trace.
+ */
+int trace_read(FILE* fp, TraceRecord* rec)
+{
+    return fread(rec, sizeof(*rec), 1, fp) == 1;
+}
@@ -0,0 +1,93 @@
+/*
+ * TRACE
+ * Binary instruction trace. The CPU fills in one fixed size record per
+ * instruction and pushes it onto a single-producer, single-consumer ring
+ * buffer. A writer thread drains the ring into the trace file, so the
+ * CPU never waits on the disk unless the ring fills up.
+ *
+ * Stefan Wong 2020
+ */
+
+#ifndef __TRACE_H
+#define __TRACE_H
+
+#include <stdatomic.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <pthread.h>
+
+#define TRACE_MAGIC          "S8TR"
+#define TRACE_VERSION        1
+#define TRACE_RING_RECORDS   (1 << 16)      // default ring size, a power of 2
+#define TRACE_CACHE_LINE     64
+
+// One instruction, as the CPU saw it just before running it
+typedef struct
+{
+    uint64_t cycles;
+    uint16_t pc;
+    uint16_t sp;
+    uint8_t  opcode;
+    uint8_t  operand[2];    // the two bytes after the opcode
+    uint8_t  a;
+    uint8_t  b;
+    uint8_t  c;
+    uint8_t  d;
+    uint8_t  e;
+    uint8_t  h;
+    uint8_t  l;
+    uint8_t  flags;
+    uint8_t  pad;
+} TraceRecord;
+
+// File header, followed by records until the end of the file
+typedef struct
+{
+    char     magic[4];
+    uint16_t version;
+    uint16_t record_size;
+} TraceHeader;
+
+typedef struct Tracer
+{
+    // Producer side
+    _Alignas(TRACE_CACHE_LINE) atomic_size_t head;
+    size_t        tail_cache;       // last tail the producer saw
+    unsigned long stalls;           // times the producer found the ring full
+    // Consumer side
+    _Alignas(TRACE_CACHE_LINE) atomic_size_t tail;
+    atomic_int    stop;
+    // Shared, read-only once running
+    _Alignas(TRACE_CACHE_LINE) TraceRecord* ring;
+    size_t        mask;
+    FILE*         fp;
+    pthread_t     writer;
+    unsigned long written;
+    int           error;
+} Tracer;
+
+Tracer*       tracer_create(const char* path, size_t ring_records);
+int           tracer_destroy(Tracer* tr);
+void          tracer_wait(Tracer* tr);
+unsigned long tracer_records(const Tracer* tr);
+
+// Reading traces back
+FILE*         trace_open(const char* path);
+int           trace_read(FILE* fp, TraceRecord* rec);
+
+/*
+ * tracer_push()
+ * Add a record. Only one thread may push to a tracer. If the writer has
+ * fallen a whole ring behind this waits for it rather than drop records.
+ */
+static inline void tracer_push(Tracer* tr, const TraceRecord* rec)
+{
+    size_t head = atomic_load_explicit(&tr->head, memory_order_relaxed);
+
+    if(__builtin_expect(head - tr->tail_cache > tr->mask, 0))
+        tracer_wait(tr);
+    tr->ring[head & tr->mask] = *rec;
+    atomic_store_explicit(&tr->head, head + 1, memory_order_release);
+}
+
+#endif /*__TRACE_H*/
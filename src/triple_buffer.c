@@ -0,0 +1,92 @@
+/*
+ * TRIPLE_BUFFER
+ * Lock-free triple buffer
+ *
+ * Stefan Wong 2020
+ */
+
+#include <stdlib.h>
+#include <string.h>
+#include "triple_buffer.h"
+
+/*
+ * triple_buffer_create()
+ */
+TripleBuffer* triple_buffer_create(size_t size)
+{
+    TripleBuffer* tb;
+
+    tb = calloc(1, sizeof(*tb));
+    if(!tb)
+        return NULL;
+    tb->data = calloc(3, size);
+    if(!tb->data)
+    {
+        free(tb);
+        return NULL;
+    }
+    tb->size  = size;
+    tb->back  = 0;
+    tb->front = 1;
+    atomic_init(&tb->middle, 2);
+
+    return tb;
+}
+
+/*
+ * triple_buffer_destroy()
+ */
+void triple_buffer_destroy(TripleBuffer* tb)
+{
+    if(!tb)
+        return;
+    free(tb->data);
+    free(tb);
+}
+
+/*
+ * triple_buffer_back()
+ * Slot the producer should fill in next
+ */
+uint8_t* triple_buffer_back(TripleBuffer* tb)
+{
+    return &tb->data[tb->back * tb->size];
+}
+
+/*
+ * triple_buffer_publish()
+ * Hand the back slot to the consumer as the newest frame, and take the
+ * old middle slot as the new back slot
+ */
+void triple_buffer_publish(TripleBuffer* tb, uint64_t seq)
+{
+    unsigned old;
+
+    tb->seq[tb->back] = seq;
+    old = atomic_exchange_explicit(&tb->middle, tb->back | TRIPLE_BUFFER_FRESH, memory_order_acq_rel);
+    tb->back = old & ~TRIPLE_BUFFER_FRESH;
+}
+
+/*
+ * triple_buffer_read()
+ * Get the newest frame. If a frame has been published since the last
+ * read it is swapped in and *fresh is set, otherwise the last frame is
+ * returned again. The frame stays valid until the next read.
+ */
+const uint8_t* triple_buffer_read(TripleBuffer* tb, uint64_t* seq, int* fresh)
+{
+    int is_fresh = 0;
+
+    if(atomic_load_explicit(&tb->middle, memory_order_relaxed) & TRIPLE_BUFFER_FRESH)
+    {
+        unsigned old = atomic_exchange_explicit(&tb->middle, tb->front, memory_order_acq_rel);
+        tb->front = old & ~TRIPLE_BUFFER_FRESH;
+        is_fresh  = 1;
+    }
+    if(seq)
+        *seq = tb->seq[tb->front];
+    if(fresh)
+        *fresh = is_fresh;
+
+    return &tb->data[tb->front * tb->size];
+}
@@ -0,0 +1,39 @@
+/*
+ * TRIPLE_BUFFER
+ * Lock-free triple buffer for handing frames from one producer thread
+ * to one consumer thread. The producer always has a slot to write into
+ * and the consumer always gets the newest complete frame, so neither
+ * ever waits on the other. Frames the consumer doesn't get to in time
+ * are dropped.
+ *
+ * Stefan Wong 2020
+ */
+
+#ifndef __TRIPLE_BUFFER_H
+#define __TRIPLE_BUFFER_H
+
+#include <stdatomic.h>
+#include <stddef.h>
+#include <stdint.h>
+
+#define TRIPLE_BUFFER_FRESH 0x4     // set in middle when it holds a new frame
+
+typedef struct
+{
+    uint8_t*      data;             // three slots of size bytes
+    size_t        size;
+    uint64_t      seq[3];           // frame number of each slot
+    atomic_uint   middle;           // slot index, plus TRIPLE_BUFFER_FRESH
+    unsigned      back;             // producer's slot
+    unsigned      front;            // consumer's slot
+} TripleBuffer;
+
+TripleBuffer*  triple_buffer_create(size_t size);
+void           triple_buffer_destroy(TripleBuffer* tb);
+// Producer
+uint8_t*       triple_buffer_back(TripleBuffer* tb);
+void           triple_buffer_publish(TripleBuffer* tb, uint64_t seq);
+// Consumer
+const uint8_t* triple_buffer_read(TripleBuffer* tb, uint64_t* seq, int* fresh);
+
+#endif /*__TRIPLE_BUFFER_H*/
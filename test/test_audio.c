@@ -0,0 +1,130 @@
+/*
+ * TEST_AUDIO
+ * Unit tests for the sound ports
+ *
+ * Stefan Wong 2020
+ */
+
+#include <stdio.h>
+#include <string.h>
+#include "audio.h"
+#include "invaders.h"
+// testing framework
+#include "bdd-for-c.h"
+
+// 2 MHz mixed at 48 kHz, so a sample is 125 / 3 cycles
+#define TEST_CLOCK_HZ 2000000
+#define TEST_RATE     48000
+#define TEST_SAMPLE(cycle) ((cycle) * TEST_RATE / TEST_CLOCK_HZ)
+
+static int16_t out[4096];
+
+// First sample that isn't silence, or -1
+static int first_sound(const int16_t* buf, size_t n)
+{
+    for(size_t i = 0; i < n; ++i)
+    {
+        if(buf[i] != 0)
+            return (int) i;
+    }
+    return -1;
+}
+
+spec("Audio")
+{
+    it("Should start an effect on the sample its port edge falls on")
+    {
+        Audio* a = audio_create(TEST_CLOCK_HZ, TEST_RATE, 10);
+
+        check(a != NULL);
+        // Amplifier on, then a shot 12345 cycles later
+        audio_port_write(a, 0, AUDIO_AMP_ENABLE, 1000);
+        audio_port_write(a, 0, AUDIO_AMP_ENABLE | 0x02, 13345);
+        check(audio_triggers(a) == 1);
+        audio_mix_until(a, 20000);
+        check(audio_queued(a) == TEST_SAMPLE(20000));
+        check(audio_read(a, out, TEST_SAMPLE(20000)) == TEST_SAMPLE(20000));
+        check(first_sound(out, TEST_SAMPLE(20000)) == TEST_SAMPLE(13345));
+        // Holding the bit doesn't start it again
+        audio_port_write(a, 0, AUDIO_AMP_ENABLE | 0x02, 30000);
+        check(audio_triggers(a) == 1);
+        check(audio_underruns(a) == 0);
+        audio_destroy(a);
+    }
+
+    it("Should keep quiet with the amplifier off")
+    {
+        Audio* a = audio_create(TEST_CLOCK_HZ, TEST_RATE, 10);
+
+        check(a != NULL);
+        audio_port_write(a, 1, 0x10, 0);
+        audio_mix_until(a, 10000);
+        check(audio_read(a, out, TEST_SAMPLE(10000)) == TEST_SAMPLE(10000));
+        check(first_sound(out, TEST_SAMPLE(10000)) == -1);
+        audio_destroy(a);
+    }
+
+    it("Should loop the UFO while its bit is set")
+    {
+        uint8_t ports[2] = { AUDIO_AMP_ENABLE, 0 };
+        Audio*  a = audio_create(TEST_CLOCK_HZ, TEST_RATE, 10);
+
+        check(a != NULL);
+        audio_start(a, 1000000, ports);
+        audio_port_write(a, 0, AUDIO_AMP_ENABLE | 0x01, 1000000);
+        // Read as we go, so that nothing is dropped over half a second
+        for(uint64_t c = 1000000; c < 2000000; c += 20000)
+        {
+            audio_mix_until(a, c + 20000);
+            check(audio_read(a, out, 480) == 480);
+        }
+        check(first_sound(out, 480) == 0);
+        audio_port_write(a, 0, AUDIO_AMP_ENABLE, 2000000);
+        audio_mix_until(a, 2020000);
+        check(audio_read(a, out, 480) == 480);
+        check(first_sound(out, 480) == -1);
+        check(audio_dropped(a) == 0);
+        audio_destroy(a);
+    }
+
+    it("Should drop samples instead of waiting for the output")
+    {
+        Audio* a = audio_create(TEST_CLOCK_HZ, TEST_RATE, 5);
+
+        check(a != NULL);
+        // A second with nothing reading, capped at twice the 5 ms target
+        audio_mix_until(a, TEST_CLOCK_HZ);
+        check(audio_queued(a) == 2 * 240);
+        check(audio_dropped(a) == TEST_RATE - 2 * 240);
+        // The output gets what there is and silence after it
+        memset(out, 0xFF, sizeof(out));
+        check(audio_read(a, out, 1000) == 2 * 240);
+        check(audio_underruns(a) == 1);
+        check(first_sound(&out[2 * 240], 1000 - 2 * 240) == -1);
+        check(audio_queued(a) == 0);
+        audio_destroy(a);
+    }
+
+    it("Should play the invaders sound ports in step with the machine")
+    {
+        Invaders* inv = invaders_create("ROM", DISP_BACKEND_NULL, 0);
+        Audio*    a = audio_create(INVADERS_CLOCK_HZ, TEST_RATE, 10);
+
+        check(inv != NULL);
+        check(a != NULL);
+        check(invaders_set_audio(inv, a) == 0);
+        // Mixed every ms by the scheduler, whether or not the ports move
+        for(int f = 0; f < 60; ++f)
+        {
+            check(invaders_run_frame(inv) > 0);
+            check(audio_queued(a) >= 800 - 48);
+            audio_read(a, out, audio_queued(a));
+        }
+        check(audio_dropped(a) == 0);
+        check(invaders_set_audio(inv, NULL) == 0);
+        check(invaders_run_frame(inv) > 0);
+        check(audio_queued(a) == 0);
+        invaders_destroy(inv);
+        audio_destroy(a);
+    }
+}
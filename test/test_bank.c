@@ -0,0 +1,114 @@
+/*
+ * TEST_BANK
+ * Unit tests for the structure-of-arrays CPU bank
+ *
+ * Stefan Wong 2020
+ */
+
+#include <stdio.h>
+#include <string.h>
+#include "cpu.h"
+#include "cpu_bank.h"
+// testing framework
+#include "bdd-for-c.h"
+
+#define TEST_LANES 70       // not a whole number of vectors
+
+// Register and flag work with branches that depend on the lane's data,
+// so the lanes drift apart and have to be peeled off
+static const uint8_t bank_prog[] = {
+    0x21, 0x00, 0x20,       // 0000 LXI H,2000
+    0x0E, 0x10,             // 0003 MVI C,10
+    0x80,                   // 0005 ADD B
+    0x07,                   // 0006 RLC
+    0xEE, 0x5A,             // 0007 XRI 5A
+    0xEA, 0x0E, 0x00,       // 0009 JPE 000E
+    0x14,                   // 000C INR D
+    0x1F,                   // 000D RAR
+    0x9A,                   // 000E SBB D
+    0x77,                   // 000F MOV M,A
+    0x2C,                   // 0010 INR L
+    0xDE, 0x03,             // 0011 SBI 03
+    0x3F,                   // 0013 CMC
+    0x0D,                   // 0014 DCR C
+    0xC2, 0x05, 0x00,       // 0015 JNZ 0005
+    0x76,                   // 0018 HLT
+};
+
+static void lane_init(CPUState* state, int lane)
+{
+    memcpy(state->memory, bank_prog, sizeof(bank_prog));
+    state->a      = lane * 7;
+    state->b      = lane * 13 + 1;
+    state->d      = lane >> 2;
+    state->cc.psw = (lane & 1) ? FLAG_ONE | FLAG_CY : FLAG_ONE;
+}
+
+// Compare every lane against its own interpreter run for the same number of steps
+static int bank_matches(int use_avx2, unsigned long* vector_ops)
+{
+    CPUBank*  bank = cpu_bank_create(TEST_LANES);
+    CPUState* ref[TEST_LANES];
+    CPUState  lane_state;
+    int       done[TEST_LANES] = {0};
+    int       ok = (bank != NULL);
+
+    for(int lane = 0; lane < TEST_LANES; ++lane)
+    {
+        ref[lane] = cpu_create();
+        lane_init(ref[lane], lane);
+        lane_state = *ref[lane];
+        lane_state.memory = cpu_bank_lane_memory(bank, lane);
+        lane_init(&lane_state, lane);
+        cpu_bank_set_lane(bank, lane, &lane_state);
+    }
+    bank->use_avx2 &= use_avx2;
+
+    while(ok && cpu_bank_active(bank) > 0)
+    {
+        cpu_bank_step(bank, 5);
+        for(int lane = 0; lane < TEST_LANES; ++lane)
+        {
+            for(int s = 0; s < 5 && !done[lane]; ++s)
+                done[lane] = (cpu_exec(ref[lane]) < 0);
+            cpu_bank_get_lane(bank, lane, &lane_state);
+            ok &= lane_state.a == ref[lane]->a && lane_state.b == ref[lane]->b &&
+                  lane_state.c == ref[lane]->c && lane_state.d == ref[lane]->d &&
+                  lane_state.h == ref[lane]->h && lane_state.l == ref[lane]->l &&
+                  lane_state.cc.psw == ref[lane]->cc.psw &&
+                  lane_state.pc == ref[lane]->pc &&
+                  lane_state.cycles == ref[lane]->cycles &&
+                  memcmp(lane_state.memory, ref[lane]->memory, CPU_MEM_SIZE) == 0;
+            ok &= (bank->halted[lane] != 0) == done[lane];
+        }
+    }
+    *vector_ops = bank->vector_ops;
+
+    for(int lane = 0; lane < TEST_LANES; ++lane)
+        cpu_destroy(ref[lane]);
+    cpu_bank_destroy(bank);
+
+    return ok;
+}
+
+spec("CPUBank")
+{
+    it("Should match the interpreter lane for lane on the vector path")
+    {
+        unsigned long vector_ops;
+
+        check(bank_matches(1, &vector_ops));
+#if defined(__x86_64__) || defined(__i386__)
+        if(__builtin_cpu_supports("avx2"))
+            check(vector_ops > 0);
+#endif
+    }
+
+    it("Should match the interpreter lane for lane with every lane peeled")
+    {
+        unsigned long vector_ops;
+
+        check(bank_matches(0, &vector_ops));
+        check(vector_ops == 0);
+    }
+}
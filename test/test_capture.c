@@ -0,0 +1,122 @@
+/*
+ * TEST_CAPTURE
+ * Unit tests for frame capture
+ *
+ * Stefan Wong 2020
+ */
+
+#define _DEFAULT_SOURCE
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include "capture.h"
+#include "display.h"
+// testing framework
+#include "bdd-for-c.h"
+
+static const char raw_path[] = "test_capture.tmp";
+static const char ppm_dir[]  = "test_capture_ppm.tmp";
+
+static void random_vram(uint8_t* vram)
+{
+    for(int b = 0; b < DISP_VRAM_SIZE; ++b)
+        vram[b] = rand() & 0xFF;
+}
+
+spec("Capture")
+{
+    it("Should stream every Nth frame as raw RGBA")
+    {
+        static uint32_t ref[5][DISP_NUM_PIXELS];
+        static uint8_t  frame[4 * DISP_NUM_PIXELS];
+        uint8_t  vram[DISP_VRAM_SIZE];
+        Display* disp = display_create(DISP_BACKEND_OFFSCREEN, 0);
+        // Two slots, so the ring wraps and the display may have to wait
+        Capture* cap = capture_create(CAPTURE_RAW, raw_path, 2, 2);
+        FILE*    fp;
+
+        check(disp != NULL);
+        check(cap != NULL);
+        display_set_capture(disp, cap);
+        srand(21);
+        for(int f = 0; f < 5; ++f)
+        {
+            random_vram(vram);
+            display_convert_ref(vram, ref[f]);
+            check(capture_due(cap, f) == (f % 2 == 0));
+            display_draw_vram(disp, vram);
+        }
+        check(capture_frames(cap) == 3);
+        display_destroy(disp);
+        check(capture_destroy(cap) == 0);
+
+        fp = fopen(raw_path, "rb");
+        check(fp != NULL);
+        for(int f = 0; f < 5; f += 2)
+        {
+            int same = 1;
+
+            check(fread(frame, 1, sizeof(frame), fp) == sizeof(frame));
+            for(int p = 0; p < DISP_NUM_PIXELS; ++p)
+            {
+                uint32_t rgb = (frame[4 * p] << 16) | (frame[4 * p + 1] << 8) | frame[4 * p + 2];
+                same &= (rgb == ref[f][p]) && (frame[4 * p + 3] == 0xFF);
+            }
+            check(same);
+        }
+        check(fgetc(fp) == EOF);
+        fclose(fp);
+        unlink(raw_path);
+    }
+
+    it("Should write PPM images even if the display keeps no pixels")
+    {
+        static uint32_t ref[DISP_NUM_PIXELS];
+        static uint8_t  rgb[3 * DISP_NUM_PIXELS];
+        uint8_t  vram[DISP_VRAM_SIZE];
+        char     header[16];
+        char     name[64];
+        Display* disp = display_create(DISP_BACKEND_NULL, 0);
+        Capture* cap = capture_create(CAPTURE_PPM, ppm_dir, 0, 0);
+        FILE*    fp;
+        int      same = 1;
+
+        check(disp != NULL);
+        check(cap != NULL);
+        display_set_capture(disp, cap);
+        random_vram(vram);
+        display_convert_ref(vram, ref);
+        display_draw_vram(disp, vram);
+        display_draw_vram(disp, vram);
+        display_destroy(disp);
+        check(capture_destroy(cap) == 0);
+
+        snprintf(name, sizeof(name), "%s/frame_000000.ppm", ppm_dir);
+        fp = fopen(name, "rb");
+        check(fp != NULL);
+        check(fread(header, 1, 15, fp) == 15);
+        check(memcmp(header, "P6\n224 256\n255\n", 15) == 0);
+        check(fread(rgb, 1, sizeof(rgb), fp) == sizeof(rgb));
+        for(int p = 0; p < DISP_NUM_PIXELS; ++p)
+            same &= ((uint32_t) ((rgb[3 * p] << 16) | (rgb[3 * p + 1] << 8) | rgb[3 * p + 2]) == ref[p]);
+        check(same);
+        fclose(fp);
+        unlink(name);
+        snprintf(name, sizeof(name), "%s/frame_000001.ppm", ppm_dir);
+        check(unlink(name) == 0);
+        rmdir(ppm_dir);
+    }
+
+    it("Should look up formats by name")
+    {
+        CaptureFormat fmt = CAPTURE_RAW;
+
+        check(capture_format_parse("png", &fmt) == 0);
+        check(fmt == CAPTURE_PNG);
+        check(capture_format_parse("ppm", &fmt) == 0);
+        check(fmt == CAPTURE_PPM);
+        check(capture_format_parse("gif", &fmt) < 0);
+        check(fmt == CAPTURE_PPM);
+    }
+}
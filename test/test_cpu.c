@@ -0,0 +1,517 @@
+/*
+ * TEST_CPU
+ * Unit tests for the 8080 interpreter
+ *
+ * Stefan Wong 2020
+ */
+
+#include <stdio.h>
+#include <string.h>
+#include "cpu.h"
+// testing framework
+#include "bdd-for-c.h"
+
+
+// Load a short program at address 0 and reset the PC
+static void load_program(CPUState* state, const uint8_t* prog, int len)
+{
+    memcpy(state->memory, prog, len);
+    state->pc = 0;
+    state->sp = 0x2400;
+}
+
+// Port handlers for the I/O test
+static uint8_t test_port_val;
+static uint8_t test_port_num;
+
+static CPUPorts test_ports;
+
+static uint8_t test_port_in(CPUState* state, void* dev, uint8_t port)
+{
+    test_port_num = port;
+    return *(uint8_t*) dev;
+}
+
+static void test_port_out(CPUState* state, void* dev, uint8_t port, uint8_t val)
+{
+    // registers must be visible in the state when a handler runs
+    test_port_num = port;
+    *(uint8_t*) dev = val + state->a;
+}
+
+// A device that holds the last byte written to it
+static uint8_t test_latch_in(CPUState* state, void* dev, uint8_t port)
+{
+    return *(uint8_t*) dev;
+}
+
+static void test_latch_out(CPUState* state, void* dev, uint8_t port, uint8_t val)
+{
+    *(uint8_t*) dev = val;
+}
+
+// A device that writes to memory at the address it was attached with
+static void test_dma_out(CPUState* state, void* dev, uint8_t port, uint8_t val)
+{
+    state->memory[*(uint16_t*) dev] = val;
+    cpu_mem_changed(state);
+}
+
+// Memory handler for the memory map test
+static uint8_t  test_mem_val;
+static uint16_t test_mem_addr;
+
+static uint8_t test_mem_read(CPUState* state, uint16_t addr)
+{
+    test_mem_addr = addr;
+    return test_mem_val;
+}
+
+static void test_mem_write(CPUState* state, uint16_t addr, uint8_t val)
+{
+    test_mem_addr = addr;
+    test_mem_val  = val;
+}
+
+spec("CPU")
+{
+    it("Should execute register loads and moves")
+    {
+        CPUState* state;
+        // MVI B,0x12 ; LXI D,0x3456 ; MOV A,D ; MOV L,B
+        uint8_t prog[] = {0x06, 0x12, 0x11, 0x56, 0x34, 0x7A, 0x68};
+
+        state = cpu_create();
+        check(state != NULL);
+        load_program(state, prog, sizeof(prog));
+
+        check(cpu_exec(state) == 7);
+        check(state->b == 0x12);
+        check(state->pc == 0x0002);
+        check(cpu_exec(state) == 10);
+        check(state->d == 0x34);
+        check(state->e == 0x56);
+        check(state->pc == 0x0005);
+        check(cpu_exec(state) == 5);
+        check(state->a == 0x34);
+        check(cpu_exec(state) == 5);
+        check(state->l == 0x12);
+        check(state->pc == 0x0007);
+
+        cpu_destroy(state);
+    }
+
+    it("Should set flags for arithmetic instructions")
+    {
+        CPUState* state;
+        // MVI A,0xFF ; ADI 0x01 ; SUI 0x01 ; MVI A,0x9B ; DAA
+        uint8_t prog[] = {0x3E, 0xFF, 0xC6, 0x01, 0xD6, 0x01, 0x3E, 0x9B, 0x27};
+
+        state = cpu_create();
+        check(state != NULL);
+        load_program(state, prog, sizeof(prog));
+
+        cpu_exec(state);
+        cpu_exec(state);        // 0xFF + 1 -> 0x00
+        check(state->a == 0x00);
+        check(state->cc.z == 1);
+        check(state->cc.cy == 1);
+        check(state->cc.p == 1);
+        check(state->cc.ac == 1);
+        check(state->cc.s == 0);
+
+        cpu_exec(state);        // 0x00 - 1 -> 0xFF with borrow
+        check(state->a == 0xFF);
+        check(state->cc.z == 0);
+        check(state->cc.cy == 1);
+        check(state->cc.s == 1);
+        check(state->cc.p == 1);
+
+        cpu_exec(state);
+        cpu_exec(state);        // DAA on 0x9B -> 0x01 with carry
+        check(state->a == 0x01);
+        check(state->cc.cy == 1);
+        check(state->cc.ac == 1);
+
+        cpu_destroy(state);
+    }
+
+    it("Should build the flag tables correctly")
+    {
+        for(int v = 0; v < 512; ++v)
+        {
+            uint8_t res  = v & 0xFF;
+            int     bits = 0;
+            uint8_t exp;
+
+            for(int b = 0; b < 8; ++b)
+                bits += (res >> b) & 0x1;
+            exp = (res & 0x80) | ((res == 0) ? 0x40 : 0) | ((bits & 0x1) ? 0 : 0x04);
+            check(cpu_flag_szpc[v] == (exp | (v >> 8)));
+            if(v < 256)
+                check(cpu_flag_szp[v] == exp);
+        }
+    }
+
+    it("Should set flags for logic and compare instructions")
+    {
+        CPUState* state;
+        // MVI A,0x0F ; MVI B,0xF0 ; ANA B ; ORA B ; CPI 0xF1 ; XRA A
+        uint8_t prog[] = {0x3E, 0x0F, 0x06, 0xF0, 0xA0, 0xB0, 0xFE, 0xF1, 0xAF};
+
+        state = cpu_create();
+        check(state != NULL);
+        load_program(state, prog, sizeof(prog));
+
+        cpu_exec(state);
+        cpu_exec(state);
+        cpu_exec(state);        // ANA B
+        check(state->a == 0x00);
+        check(state->cc.z == 1);
+        check(state->cc.cy == 0);
+        cpu_exec(state);        // ORA B
+        check(state->a == 0xF0);
+        check(state->cc.s == 1);
+        check(state->cc.z == 0);
+        cpu_exec(state);        // CPI 0xF1 (A is less than the operand)
+        check(state->a == 0xF0);
+        check(state->cc.cy == 1);
+        check(state->cc.z == 0);
+        cpu_exec(state);        // XRA A
+        check(state->a == 0x00);
+        check(state->cc.z == 1);
+        check(state->cc.p == 1);
+
+        cpu_destroy(state);
+    }
+
+    it("Should take branches and calls with the correct timing")
+    {
+        CPUState* state;
+        uint8_t prog[] = {
+            0xCD, 0x08, 0x00,       // 0000 CALL 0008
+            0xAF,                   // 0003 XRA A
+            0xC2, 0x00, 0x00,       // 0004 JNZ 0000 (not taken)
+            0x76,                   // 0007 HLT
+            0xC0,                   // 0008 RNZ (not taken, Z is set below)
+            0xC9,                   // 0009 RET
+        };
+
+        state = cpu_create();
+        check(state != NULL);
+        load_program(state, prog, sizeof(prog));
+        state->cc.z = 1;
+
+        check(cpu_exec(state) == 17);
+        check(state->pc == 0x0008);
+        check(state->sp == 0x23FE);
+        check(state->memory[0x23FE] == 0x03);
+        check(state->memory[0x23FF] == 0x00);
+        check(cpu_exec(state) == 5);        // RNZ falls through
+        check(cpu_exec(state) == 10);       // RET
+        check(state->pc == 0x0003);
+        check(state->sp == 0x2400);
+        check(cpu_exec(state) == 4);
+        check(cpu_exec(state) == 10);
+        check(state->pc == 0x0007);
+        check(cpu_exec(state) == -2);       // HLT
+
+        cpu_destroy(state);
+    }
+
+    it("Should round trip the PSW through the stack")
+    {
+        CPUState* state;
+        // PUSH PSW ; POP B ; PUSH B ; POP PSW
+        uint8_t prog[] = {0xF5, 0xC1, 0xC5, 0xF1};
+
+        state = cpu_create();
+        check(state != NULL);
+        load_program(state, prog, sizeof(prog));
+        state->a     = 0x42;
+        state->cc.s  = 1;
+        state->cc.cy = 1;
+
+        cpu_exec(state);
+        cpu_exec(state);
+        check(state->b == 0x42);
+        check(state->c == 0x83);        // S, the fixed bit and CY
+
+        state->a     = 0;
+        state->cc.s  = 0;
+        state->cc.cy = 0;
+        cpu_exec(state);
+        cpu_exec(state);
+        check(state->a == 0x42);
+        check(state->cc.s == 1);
+        check(state->cc.cy == 1);
+        check(state->cc.z == 0);
+
+        cpu_destroy(state);
+    }
+
+    it("Should run a cycle budget in one call")
+    {
+        CPUState* state;
+        int cycles;
+        // 0000 MVI B,0x10 ; 0002 DCR B ; 0003 JNZ 0002 ; 0006 HLT
+        uint8_t prog[] = {0x06, 0x10, 0x05, 0xC2, 0x02, 0x00, 0x76};
+
+        state = cpu_create();
+        check(state != NULL);
+        load_program(state, prog, sizeof(prog));
+
+        // Stops once the budget is reached, on an instruction boundary
+        cycles = cpu_run(state, 20, 0);
+        check(cycles == 22);
+        check(state->b == 0x0F);
+        check(state->pc == 0x0002);
+
+        // Runs into the HLT
+        cycles = cpu_run(state, 10000, 0);
+        check(cycles == -2);
+        check(state->b == 0x00);
+        check(state->cycles == 7 + 16 * (5 + 10) + 7);
+
+        cpu_destroy(state);
+    }
+
+    it("Should sync registers around port handlers")
+    {
+        CPUState* state;
+        long cycles;
+        // MVI A,0x21 ; OUT 0x04 ; IN 0x03 ; HLT
+        uint8_t prog[] = {0x3E, 0x21, 0xD3, 0x04, 0xDB, 0x03, 0x76};
+
+        state = cpu_create();
+        check(state != NULL);
+        load_program(state, prog, sizeof(prog));
+        cpu_ports_init(&test_ports);
+        cpu_ports_out(&test_ports, 0x04, 0x04, test_port_out, &test_port_val);
+        cpu_ports_in(&test_ports, 0x03, 0x03, test_port_in, &test_port_val);
+        state->ports = &test_ports;
+
+        cycles = cpu_run_fast(state, 17);
+        check(cycles == 17);
+        check(test_port_num == 0x04);
+        check(test_port_val == 0x42);
+        check(state->pc == 0x0004);
+
+        cycles = cpu_run_fast(state, 10);
+        check(cycles == 10);
+        check(test_port_num == 0x03);
+        check(state->a == 0x42);
+        check(state->pc == 0x0006);
+
+        cpu_destroy(state);
+    }
+
+    it("Should send each port to its own device")
+    {
+        CPUState* state;
+        uint8_t   dev_a = 0;
+        uint8_t   dev_b = 0;
+        uint8_t prog[] = {
+            0x3E, 0x11,             // MVI A,11
+            0xD3, 0x10,             // OUT 10
+            0x3E, 0x22,             // MVI A,22
+            0xD3, 0x20,             // OUT 20
+            0xD3, 0x30,             // OUT 30     (unconnected)
+            0xDB, 0x10,             // IN 10
+            0x47,                   // MOV B,A
+            0xDB, 0x99,             // IN 99      (unconnected)
+            0xD3, 0x20,             // OUT 20     (disconnected below)
+            0x76,                   // HLT
+        };
+
+        state = cpu_create();
+        check(state != NULL);
+        load_program(state, prog, sizeof(prog));
+        cpu_ports_init(&test_ports);
+        cpu_ports_out(&test_ports, 0x10, 0x1F, test_latch_out, &dev_a);
+        cpu_ports_out(&test_ports, 0x20, 0x20, test_latch_out, &dev_b);
+        cpu_ports_in(&test_ports, 0x10, 0x10, test_latch_in, &dev_a);
+        state->ports = &test_ports;
+
+        check(cpu_run_fast(state, 44) == 44);
+        check(dev_a == 0x11);
+        check(dev_b == 0x22);
+        check(state->a == 0x22);
+        check(cpu_run_fast(state, 15) == 15);
+        check(state->b == 0x11);
+        check(cpu_run_fast(state, 10) == 10);
+        check(state->a == 0x11);
+        check(state->pc == 0x000F);
+
+        cpu_ports_out(&test_ports, 0x20, 0x20, NULL, NULL);
+        check(test_ports.out_dev[0x20] == NULL);
+        check(cpu_run_fast(state, 10) == 10);
+        check(dev_b == 0x22);
+        check(cpu_run_fast(state, 10) == -2);
+
+        cpu_destroy(state);
+    }
+
+    it("Should run from the decoded cache and drop entries that are written over")
+    {
+        CPUState*       state;
+        CPUDecodeCache* dc;
+        const CPUDecodedOp* dec;
+        uint8_t prog[] = {
+            0x21, 0x0E, 0x00,       // 0000 LXI H,000E
+            0x36, 0x3C,             // 0003 MVI M,3C      (INR A over the NOP)
+            0x3E, 0x10,             // 0005 MVI A,10
+            0x32, 0x10, 0x00,       // 0007 STA 0010      (operand of the MVI B)
+            0x22, 0x12, 0x00,       // 000A SHLD 0012     (operand of the JMP)
+            0x76,                   // 000D HLT
+            0x00,                   // 000E NOP
+            0x06, 0x00,             // 000F MVI B,00
+            0xC3, 0x00, 0x00,       // 0011 JMP 0000
+        };
+
+        state = cpu_create();
+        dc    = cpu_dcache_create();
+        check(state != NULL);
+        check(dc != NULL);
+        load_program(state, prog, sizeof(prog));
+
+        // Decode the tail of the program before it gets patched
+        state->pc = 0x000E;
+        check(cpu_run_decoded(state, dc, 21) == 21);
+        dec = cpu_dcache_lookup(dc, 0x000F);
+        check(dec != NULL);
+        check(dec->opcode == 0x06);
+        check(dec->length == 2);
+        check(dec->cycles == 7);
+        check(dec->operand == 0xC300);
+        check(cpu_dcache_lookup(dc, 0x0011) != NULL);
+        check(cpu_dcache_lookup(dc, 0x0014) == NULL);
+
+        // MVI M, STA and SHLD all write over decoded code
+        state->pc = 0x0000;
+        check(cpu_run_decoded(state, dc, 1000) == -2);
+        check(cpu_dcache_invalidations(dc) > 0);
+        state->pc = 0x000E;
+        cpu_run_decoded(state, dc, 21);
+        check(state->a == 0x11);        // INR A
+        check(state->b == 0x10);        // patched MVI B
+        check(state->pc == 0x000E);     // JMP to the new target in HL
+
+        cpu_dcache_destroy(dc);
+        cpu_destroy(state);
+    }
+
+    it("Should start the decoded cache over when memory changes outside the CPU")
+    {
+        CPUState*       state;
+        CPUDecodeCache* dc;
+        uint16_t        dma_addr = 0x0004;
+        uint8_t prog[] = {
+            0x3C,                   // 0000 INR A
+            0xD3, 0x30,             // 0001 OUT 30        (A into 0004)
+            0x06, 0x00,             // 0003 MVI B,00
+            0xFE, 0x03,             // 0005 CPI 03
+            0xC2, 0x00, 0x00,       // 0007 JNZ 0000
+            0x76,                   // 000A HLT
+        };
+        uint8_t patch[] = {
+            0x06, 0x55,             // 0000 MVI B,55
+            0x76,                   // 0002 HLT
+        };
+
+        state = cpu_create();
+        dc    = cpu_dcache_create();
+        check(state != NULL);
+        check(dc != NULL);
+        load_program(state, prog, sizeof(prog));
+        cpu_ports_init(&test_ports);
+        cpu_ports_out(&test_ports, 0x30, 0x30, test_dma_out, &dma_addr);
+        state->ports = &test_ports;
+
+        // The MVI B is decoded on the first pass and patched on each one
+        check(cpu_run_decoded(state, dc, 1000) == -2);
+        check(state->b == 0x03);
+
+        // A new program loaded between runs
+        memcpy(state->memory, patch, sizeof(patch));
+        cpu_mem_changed(state);
+        state->pc = 0;
+        check(cpu_run_decoded(state, dc, 1000) == -2);
+        check(state->b == 0x55);
+
+        cpu_dcache_destroy(dc);
+        cpu_destroy(state);
+    }
+
+    it("Should see the PC an interrupt pushes over decoded code")
+    {
+        CPUState*       state;
+        CPUDecodeCache* dc;
+        uint8_t prog[] = {
+            0x06, 0x00,             // 0000 MVI B,00
+            0x76,                   // 0002 HLT
+        };
+
+        state = cpu_create();
+        dc    = cpu_dcache_create();
+        check(state != NULL);
+        check(dc != NULL);
+        load_program(state, prog, sizeof(prog));
+        check(cpu_run_decoded(state, dc, 1000) == -2);
+        check(state->b == 0x00);
+
+        // The return address lands on the MVI, making it MVI B,42
+        state->pc = 0x4206;
+        state->sp = 0x0002;
+        state->int_enable = 1;
+        check(cpu_interrupt(state, 0) == 1);
+        check(cpu_run_decoded(state, dc, 1000) == -2);
+        check(state->b == 0x42);
+
+        cpu_dcache_destroy(dc);
+        cpu_destroy(state);
+    }
+
+    it("Should go through the memory map for mirrors, protected pages and handlers")
+    {
+        CPUState* state;
+        CPUMemMap map;
+        uint8_t prog[] = {
+            0x3E, 0x5A,             // 0000 MVI A,5A
+            0x32, 0x00, 0x00,       // 0002 STA 0000      (ignored)
+            0x32, 0x10, 0x60,       // 0005 STA 6010      (mirror of 2010)
+            0x3A, 0x10, 0x20,       // 0008 LDA 2010
+            0x47,                   // 000B MOV B,A
+            0x32, 0x34, 0xF0,       // 000C STA F034      (handler)
+            0x3A, 0x00, 0xF1,       // 000F LDA F100      (handler)
+            0x76,                   // 0012 HLT
+        };
+
+        check(cpu_map_flat.read[0x20] == 0x2000);
+        cpu_map_init(&map);
+        cpu_map_protect(&map, 0x0000, 0x2000);
+        cpu_map_mirror(&map, 0x4000, 0xF000, 0x2000, 0x4000);
+        cpu_map_handler(&map, 0xF000, 0x10000, test_mem_read, test_mem_write);
+        check(map.read[0x60] == 0x2000);
+        check(map.write[0x00] == CPU_PAGE_SINK);
+
+        state = cpu_create();
+        check(state != NULL);
+        check(state->map == &cpu_map_flat);
+        load_program(state, prog, sizeof(prog));
+        state->map = &map;
+
+        check(cpu_run_fast(state, 1000) == -2);
+        check(state->memory[0x0000] == 0x3E);
+        check(state->memory[0x2010] == 0x5A);
+        check(state->b == 0x5A);
+        check(test_mem_addr == 0xF100);
+        check(test_mem_val == 0x5A);
+        check(state->a == 0x5A);
+        check(cpu_mem_read(state, 0xA010) == 0x5A);
+        cpu_mem_write(state, 0x0001, 0xFF);
+        check(cpu_mem_read(state, 0x0001) == 0x5A);
+
+        cpu_destroy(state);
+    }
+}
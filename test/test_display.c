@@ -0,0 +1,166 @@
+/*
+ * TEST_DISPLAY
+ * Unit tests for the display and the headless invaders machine
+ *
+ * Stefan Wong 2020
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "cpu.h"
+#include "display.h"
+#include "invaders.h"
+// testing framework
+#include "bdd-for-c.h"
+
+static const char rom_dir[] = "ROM";
+
+spec("Display")
+{
+    it("Should draw nothing but still count frames on the null backend")
+    {
+        Display* disp = display_create(DISP_BACKEND_NULL, 0);
+        uint8_t  mem[CPU_MEM_SIZE];
+
+        memset(mem, 0xFF, sizeof(mem));
+        check(disp != NULL);
+        check(display_pixels(disp) == NULL);
+        display_draw(disp, mem);
+        display_draw(disp, mem);
+        check(display_frames(disp) == 2);
+        check(strcmp(display_backend_name(disp), "null") == 0);
+        display_destroy(disp);
+    }
+
+    it("Should rotate video RAM into the offscreen pixel buffer")
+    {
+        Display* disp = display_create(DISP_BACKEND_OFFSCREEN, 0);
+        const uint32_t* pixels;
+        uint8_t  mem[CPU_MEM_SIZE];
+
+        memset(mem, 0, sizeof(mem));
+        // First byte of video RAM is the bottom 8 pixels of the left
+        // column, with bit 0 on the bottom line
+        mem[DISP_VRAM_ADDR] = 0x01;
+        // Last byte is the top 8 pixels of the right column
+        mem[DISP_VRAM_ADDR + DISP_VRAM_SIZE - 1] = 0x80;
+
+        check(disp != NULL);
+        display_draw(disp, mem);
+        pixels = display_pixels(disp);
+        check(pixels != NULL);
+        check(pixels[(DISP_HEIGHT - 1) * DISP_WIDTH] == 0xFFFFFF);
+        check(pixels[(DISP_HEIGHT - 2) * DISP_WIDTH] == 0x000000);
+        check(pixels[DISP_WIDTH - 1] == 0xFFFFFF);
+
+        int lit = 0;
+        for(int p = 0; p < DISP_NUM_PIXELS; ++p)
+            lit += (pixels[p] != 0);
+        check(lit == 2);
+        display_destroy(disp);
+    }
+
+    it("Should convert video RAM the same way as the reference")
+    {
+        static uint32_t ref[DISP_NUM_PIXELS];
+        static uint32_t fast[DISP_NUM_PIXELS];
+        uint8_t vram[DISP_VRAM_SIZE];
+
+        // Random screens, plus one with a single bit in each byte
+        srand(8080);
+        for(int pass = 0; pass < 9; ++pass)
+        {
+            for(int b = 0; b < DISP_VRAM_SIZE; ++b)
+                vram[b] = (pass < 8) ? rand() & 0xFF : 1 << (b & 7);
+            memset(ref, 0x55, sizeof(ref));
+            memset(fast, 0xAA, sizeof(fast));
+            display_convert_ref(vram, ref);
+            display_convert(vram, fast);
+            check(memcmp(ref, fast, sizeof(ref)) == 0);
+        }
+    }
+
+    it("Should only redraw the dirty columns")
+    {
+        Display* disp = display_create(DISP_BACKEND_OFFSCREEN, 0);
+        static uint32_t ref[DISP_NUM_PIXELS];
+        uint8_t  vram[DISP_VRAM_SIZE];
+        uint32_t dirty[DISP_DIRTY_WORDS];
+
+        check(disp != NULL);
+        srand(2400);
+        for(int b = 0; b < DISP_VRAM_SIZE; ++b)
+            vram[b] = rand() & 0xFF;
+        // The first frame is always drawn in full
+        memset(dirty, 0, sizeof(dirty));
+        display_draw_dirty(disp, vram, dirty);
+        check(display_cols_drawn(disp) == DISP_WIDTH);
+
+        // Change columns 37 and 200, but only mark column 37
+        vram[37 * DISP_COL_BYTES + 5] ^= 0xFF;
+        vram[200 * DISP_COL_BYTES]    ^= 0x01;
+        display_mark_dirty(dirty, 37 * DISP_COL_BYTES + 5);
+        check(dirty[1] == 1u << 5);
+        display_draw_dirty(disp, vram, dirty);
+        // Columns are drawn in groups of 8
+        check(display_cols_drawn(disp) == DISP_WIDTH + 8);
+        display_convert_ref(vram, ref);
+        check(memcmp(ref, display_pixels(disp), sizeof(ref)) != 0);
+
+        display_mark_dirty(dirty, 200 * DISP_COL_BYTES);
+        display_draw_dirty(disp, vram, dirty);
+        check(display_cols_drawn(disp) == DISP_WIDTH + 24);
+        check(memcmp(ref, display_pixels(disp), sizeof(ref)) == 0);
+        check(display_frames(disp) == 3);
+        display_destroy(disp);
+    }
+
+    it("Should look up backends by name")
+    {
+        DispBackend backend = DISP_BACKEND_SDL;
+
+        check(display_backend_parse("offscreen", &backend) == 0);
+        check(backend == DISP_BACKEND_OFFSCREEN);
+        check(display_backend_parse("null", &backend) == 0);
+        check(backend == DISP_BACKEND_NULL);
+        check(display_backend_parse("vga", &backend) < 0);
+        check(backend == DISP_BACKEND_NULL);
+    }
+
+    it("Should run invaders headless with frame interrupts")
+    {
+        Invaders* inv = invaders_create(rom_dir, DISP_BACKEND_OFFSCREEN, 0);
+        const uint32_t* pixels;
+        long cycles = 0;
+        int  lit = 0;
+
+        check(inv != NULL);
+        // Two seconds is enough for the attract screen to draw
+        for(int f = 0; f < 2 * INVADERS_FPS; ++f)
+        {
+            long frame_cycles = invaders_run_frame(inv);
+            check(frame_cycles > 0);
+            cycles += frame_cycles;
+        }
+        check(inv->frames == 2 * INVADERS_FPS);
+        check(display_frames(inv->disp) == 2 * INVADERS_FPS);
+        // Frames are laid out on the cycle count, so only the last
+        // instruction and the vblank interrupt can run over
+        check(cycles >= 2 * INVADERS_FPS * INVADERS_CYCLES_PER_FRAME);
+        check(cycles <  2 * INVADERS_FPS * INVADERS_CYCLES_PER_FRAME + 18 + 11);
+
+        pixels = display_pixels(inv->disp);
+        for(int p = 0; p < DISP_NUM_PIXELS; ++p)
+            lit += (pixels[p] != 0);
+        check(lit > 0);
+
+        // Redrawing only what was written still gives the whole screen
+        static uint32_t ref[DISP_NUM_PIXELS];
+        display_convert_ref(&inv->cpu->memory[DISP_VRAM_ADDR], ref);
+        check(memcmp(ref, pixels, sizeof(ref)) == 0);
+        check(display_cols_drawn(inv->disp) < display_frames(inv->disp) * DISP_WIDTH);
+
+        invaders_destroy(inv);
+    }
+}
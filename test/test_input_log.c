@@ -0,0 +1,206 @@
+/*
+ * TEST_INPUT_LOG
+ * Unit tests for input record and replay
+ *
+ * Stefan Wong 2020
+ */
+
+#include <stdio.h>
+#include <string.h>
+#include "cpu.h"
+#include "input_log.h"
+#include "invaders.h"
+#include "jit.h"
+// testing framework
+#include "bdd-for-c.h"
+
+static const char log_filename[] = "test_input_log.tmp";
+
+// Reads port 1 in a loop and folds the value into memory, so a replay
+// that gets any value or timing wrong ends up in a different state
+static const uint8_t input_prog[] = {
+    0x21, 0x00, 0x20,       // 0000 LXI H,2000
+    0xDB, 0x01,             // 0003 IN 01
+    0x80,                   // 0005 ADD B
+    0x47,                   // 0006 MOV B,A
+    0x77,                   // 0007 MOV M,A
+    0x2C,                   // 0008 INR L
+    0xC2, 0x03, 0x00,       // 0009 JNZ 0003
+    0x76,                   // 000C HLT
+};
+
+static InputLog*   test_log;
+static InputReplay test_replay;
+static CPUPorts    rec_ports;
+static CPUPorts    rep_ports;
+
+// Changes every 64 cycles, like a button held for a while
+static uint8_t record_in(CPUState* state, void* dev, uint8_t port)
+{
+    uint8_t val = (state->cycles >> 6) & 0x0F;
+
+    input_log_port(test_log, state->cycles, port, val);
+    return val;
+}
+
+static uint8_t replay_in(CPUState* state, void* dev, uint8_t port)
+{
+    return input_replay_port(&test_replay, state->cycles, port);
+}
+
+// Put a coin in, start a one player game and move about shooting
+#define TEST_FRAMES 600
+
+static uint8_t script_in1(int frame)
+{
+    uint8_t val = 0x08;
+
+    if(frame >= 60 && frame < 66)
+        val |= INVADERS_IN1_COIN;
+    if(frame >= 180 && frame < 186)
+        val |= INVADERS_IN1_P1_START;
+    if(frame >= 300)
+    {
+        val |= (frame / 40 % 2) ? INVADERS_IN1_P1_LEFT : INVADERS_IN1_P1_RIGHT;
+        if(frame % 20 < 2)
+            val |= INVADERS_IN1_P1_SHOT;
+    }
+    return val;
+}
+
+spec("InputLog")
+{
+    it("Should round trip events through the varint encoding")
+    {
+        InputLog*   log = input_log_create();
+        InputCursor cursor;
+        InputEvent  ev;
+        uint64_t    times[] = { 0, 127, 128, 16383, 1ULL << 40 };
+
+        check(log != NULL);
+        for(int i = 0; i < 5; ++i)
+            input_log_port(log, times[i], 0x02, i);
+        // Unchanged values aren't logged
+        input_log_port(log, times[4] + 1, 0x02, 4);
+        input_log_interrupt(log, times[4] + 2, 0x10);
+        input_log_hash(log, times[4] + 2, 0xFEEDFACECAFEBEEFULL);
+        check(log->num_events == 7);
+
+        input_cursor_init(&cursor);
+        for(int i = 0; i < 5; ++i)
+        {
+            check(input_log_read(log, &cursor, &ev) == 1);
+            check(ev.kind == INPUT_EV_PORT);
+            check(ev.cycles == times[i]);
+            check(ev.port == 0x02 && ev.value == i);
+        }
+        check(input_log_read(log, &cursor, &ev) == 1);
+        check(ev.kind == INPUT_EV_INTERRUPT && ev.port == 0x10);
+        check(ev.cycles == times[4] + 2);
+        check(input_log_read(log, &cursor, &ev) == 1);
+        check(ev.kind == INPUT_EV_HASH && ev.hash == 0xFEEDFACECAFEBEEFULL);
+        check(input_log_read(log, &cursor, &ev) == 0);
+
+        input_log_destroy(log);
+    }
+
+    it("Should replay a recording from a file to the same state")
+    {
+        CPUState* rec = cpu_create();
+        CPUState* rep = cpu_create();
+        InputLog* loaded;
+        uint64_t  hash;
+
+        memcpy(rec->memory, input_prog, sizeof(input_prog));
+        memcpy(rep->memory, input_prog, sizeof(input_prog));
+        test_log     = input_log_create();
+        cpu_ports_init(&rec_ports);
+        cpu_ports_in(&rec_ports, 0, CPU_NUM_PORTS - 1, record_in, NULL);
+        rec->ports = &rec_ports;
+        check(cpu_run_fast(rec, 100000) == -2);
+        hash = cpu_state_hash(rec);
+        input_log_hash(test_log, rec->cycles, hash);
+        // Far fewer events than IN instructions
+        check(test_log->num_events > 10 && test_log->num_events < 256);
+
+        check(input_log_save(test_log, log_filename) == 0);
+        loaded = input_log_load(log_filename);
+        remove(log_filename);
+        check(loaded != NULL);
+        check(loaded->num_events == test_log->num_events);
+        check(loaded->data->size == test_log->data->size);
+        check(memcmp(loaded->data->data, test_log->data->data, loaded->data->size) == 0);
+
+        input_replay_init(&test_replay, loaded);
+        cpu_ports_init(&rep_ports);
+        cpu_ports_in(&rep_ports, 0, CPU_NUM_PORTS - 1, replay_in, NULL);
+        rep->ports = &rep_ports;
+        check(cpu_run_fast(rep, 100000) == -2);
+        check(rep->cycles == rec->cycles);
+        check(cpu_state_hash(rep) == hash);
+        check(memcmp(rep->memory, rec->memory, CPU_MEM_SIZE) == 0);
+
+        input_log_destroy(loaded);
+        input_log_destroy(test_log);
+        cpu_destroy(rec);
+        cpu_destroy(rep);
+    }
+
+    it("Should replay an invaders session with its inputs and interrupts")
+    {
+        static uint64_t hashes[TEST_FRAMES];
+        Invaders*   rec = invaders_create("ROM", DISP_BACKEND_NULL, 0);
+        Invaders*   rep = invaders_create("ROM", DISP_BACKEND_NULL, 0);
+        Invaders*   idle = invaders_create("ROM", DISP_BACKEND_NULL, 0);
+        JIT*        jit = jit_create();
+        InputLog*   loaded;
+        InputReplay rp;
+        InputCursor cursor;
+        InputEvent  ev;
+        int         interrupts = 0;
+
+        check(rec != NULL && rep != NULL && idle != NULL);
+        test_log = input_log_create();
+        invaders_record(rec, test_log);
+        for(int f = 0; f < TEST_FRAMES; ++f)
+        {
+            rec->in_port[1] = script_in1(f);
+            check(invaders_run_frame(rec) > 0);
+            hashes[f] = cpu_state_hash(rec->cpu);
+        }
+        invaders_record(rec, NULL);
+        input_cursor_init(&cursor);
+        while(input_log_next_of(test_log, &cursor, 1u << INPUT_EV_INTERRUPT, &ev))
+            interrupts++;
+        check(interrupts == 2 * TEST_FRAMES);
+
+        check(input_log_save(test_log, log_filename) == 0);
+        loaded = input_log_load(log_filename);
+        remove(log_filename);
+        check(loaded != NULL);
+
+        // Played back on the recompiler where there is one, with nothing
+        // set on the inputs
+        input_replay_init(&rp, loaded);
+        check(invaders_replay(rep, &rp) == 0);
+        invaders_set_jit(rep, jit);
+        for(int f = 0; f < TEST_FRAMES; ++f)
+        {
+            check(invaders_run_frame(rep) > 0);
+            check(cpu_state_hash(rep->cpu) == hashes[f]);
+        }
+        check(rep->frames == rec->frames);
+
+        // The same frames without the inputs end up somewhere else
+        for(int f = 0; f < TEST_FRAMES; ++f)
+            check(invaders_run_frame(idle) > 0);
+        check(cpu_state_hash(idle->cpu) != hashes[TEST_FRAMES - 1]);
+
+        input_log_destroy(loaded);
+        input_log_destroy(test_log);
+        jit_destroy(jit);
+        invaders_destroy(rec);
+        invaders_destroy(rep);
+        invaders_destroy(idle);
+    }
+}
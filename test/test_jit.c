@@ -0,0 +1,577 @@
+/*
+ * TEST_JIT
+ * Unit tests for the basic block recompiler
+ *
+ * Stefan Wong 2020
+ */
+
+#include <stdio.h>
+#include <string.h>
+#include "cpu.h"
+#include "jit.h"
+// testing framework
+#include "bdd-for-c.h"
+
+
+// Load the same program into two states
+static void load_pair(CPUState* a, CPUState* b, const uint8_t* prog, int len)
+{
+    memcpy(a->memory, prog, len);
+    memcpy(b->memory, prog, len);
+    a->pc = b->pc = 0;
+    a->sp = b->sp = 0x2400;
+}
+
+static int same_state(CPUState* a, CPUState* b)
+{
+    return a->a == b->a && a->b == b->b && a->c == b->c &&
+           a->d == b->d && a->e == b->e && a->h == b->h &&
+           a->l == b->l && a->sp == b->sp && a->pc == b->pc &&
+           a->cc.psw == b->cc.psw && a->cycles == b->cycles &&
+           memcmp(a->memory, b->memory, CPU_MEM_SIZE) == 0;
+}
+
+// Exercises the ALU, the stack, memory writes and both kinds of branch
+static const uint8_t loop_prog[] = {
+    0x31, 0x00, 0x24,       // 0000 LXI SP,2400
+    0x21, 0x00, 0x20,       // 0003 LXI H,2000
+    0x06, 0x40,             // 0006 MVI B,40
+    0x80,                   // 0008 ADD B
+    0x9E,                   // 0009 SBB M
+    0x77,                   // 000A MOV M,A
+    0x23,                   // 000B INX H
+    0xCD, 0x20, 0x00,       // 000C CALL 0020
+    0x05,                   // 000F DCR B
+    0xC2, 0x08, 0x00,       // 0010 JNZ 0008
+    0x76,                   // 0013 HLT
+    0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0,
+    0xF5,                   // 0020 PUSH PSW
+    0x19,                   // 0021 DAD D
+    0x1F,                   // 0022 RAR
+    0xE3,                   // 0023 XTHL
+    0xE3,                   // 0024 XTHL
+    0xF1,                   // 0025 POP PSW
+    0xC9,                   // 0026 RET
+};
+
+// Fixed seed, so that a failure can be run again
+static uint32_t rand_state = 0x8080;
+
+static uint32_t test_rand(void)
+{
+    rand_state ^= rand_state << 13;
+    rand_state ^= rand_state >> 17;
+    rand_state ^= rand_state << 5;
+    return rand_state;
+}
+
+// Random bytes over all of memory and random registers in both states
+static void load_random(CPUState* a, CPUState* b)
+{
+    for(int i = 0; i < CPU_MEM_SIZE; ++i)
+        a->memory[i] = test_rand() & 0xFF;
+    memcpy(b->memory, a->memory, CPU_MEM_SIZE);
+    a->a  = test_rand(); a->b = test_rand(); a->c = test_rand();
+    a->d  = test_rand(); a->e = test_rand(); a->h = test_rand();
+    a->l  = test_rand();
+    a->sp = test_rand();
+    a->pc = test_rand();
+    a->cc.psw     = (test_rand() & FLAG_MASK) | FLAG_ONE;
+    a->int_enable = 0;
+    a->cycles     = 0;
+    b->a  = a->a; b->b = a->b; b->c = a->c;
+    b->d  = a->d; b->e = a->e; b->h = a->h;
+    b->l  = a->l;
+    b->sp = a->sp;
+    b->pc = a->pc;
+    b->cc = a->cc;
+    b->int_enable = 0;
+    b->cycles     = 0;
+}
+
+// A machine laid out like invaders: ROM, RAM mirrored over the top half,
+// and a page each with a write and a read handler
+static void test_write_inv(CPUState* state, uint16_t addr, uint8_t val)
+{
+    state->memory[addr & 0x3FFF] = val ^ 0xFF;
+    cpu_mem_changed(state);
+}
+
+static uint8_t test_read_inv(CPUState* state, uint16_t addr)
+{
+    return state->memory[addr & 0x3FFF] ^ 0xFF;
+}
+
+static void test_map_init(CPUMemMap* map)
+{
+    cpu_map_init(map);
+    cpu_map_protect(map, 0x0000, 0x2000);
+    cpu_map_handler(map, 0x2400, 0x2500, NULL, test_write_inv);
+    cpu_map_handler(map, 0x2500, 0x2600, test_read_inv, NULL);
+    cpu_map_mirror(map, 0x4000, CPU_MEM_SIZE, 0x2000, 0x4000);
+}
+
+// Write protects a page until the first store to it, as snapshot
+// tracking does
+static CPUMemMap unprotect_map;
+
+static void test_write_unprotect(CPUState* state, uint16_t addr, uint8_t val)
+{
+    unprotect_map.write[addr >> 8]         = addr & 0xFF00;
+    unprotect_map.write_handler[addr >> 8] = NULL;
+    state->memory[addr] = val;
+}
+
+// What the port handlers saw, one entry per OUT
+typedef struct
+{
+    uint64_t cycles[64];
+    uint16_t pc[64];
+    uint16_t sp[64];
+    uint8_t  a[64];
+    int      n;
+} TestPortLog;
+
+// OUT 0 logs, OUT 1 writes A over the subroutine at 0040 and OUT 2
+// raises RST 1
+static void test_port_out(CPUState* state, void* dev, uint8_t port, uint8_t val)
+{
+    TestPortLog* log = dev;
+
+    if(log->n < 64)
+    {
+        log->cycles[log->n] = state->cycles;
+        log->pc[log->n]     = state->pc;
+        log->sp[log->n]     = state->sp;
+        log->a[log->n]      = val;
+        log->n++;
+    }
+    if(port == 1)
+    {
+        state->memory[0x0040] = val;
+        cpu_mem_changed(state);
+    }
+    if(port == 2)
+        cpu_interrupt(state, 1);
+}
+
+static uint8_t test_port_in(CPUState* state, void* dev, uint8_t port)
+{
+    return state->cycles & 0xFF;
+}
+
+spec("JIT")
+{
+    it("Should match the interpreter over a whole program")
+    {
+        CPUState* ref = cpu_create();
+        CPUState* dut = cpu_create();
+        JIT*      jit = jit_create();
+        long      c_ref, c_dut;
+
+        check(ref != NULL);
+        check(dut != NULL);
+#ifdef JIT_AVAILABLE
+        check(jit != NULL);
+#endif /*JIT_AVAILABLE*/
+        load_pair(ref, dut, loop_prog, sizeof(loop_prog));
+
+        do
+        {
+            c_ref = cpu_run_fast(ref, 100);
+            c_dut = jit_run(jit, dut, 100);
+            check(c_ref == c_dut);
+            check(same_state(ref, dut));
+        } while(c_ref > 0);
+        check(c_ref == -2);
+
+        jit_destroy(jit);
+        cpu_destroy(ref);
+        cpu_destroy(dut);
+    }
+
+    it("Should match the interpreter on random programs")
+    {
+        CPUState* ref = cpu_create();
+        CPUState* dut = cpu_create();
+        JIT*      jit = jit_create();
+        long      c_ref, c_dut;
+
+        // Random code writes all over itself. Half of the programs are
+        // loaded into a new machine, which is often given the memory the
+        // last one had, and half into the same machine.
+        for(int prog = 0; prog < 200; ++prog)
+        {
+            if(prog % 2 == 1)
+            {
+                cpu_destroy(dut);
+                dut = cpu_create();
+                check(dut != NULL);
+            }
+            load_random(ref, dut);
+            cpu_mem_changed(dut);
+            for(int slice = 0; slice < 100; ++slice)
+            {
+                long budget = 1 + test_rand() % 400;
+
+                c_ref = cpu_run_fast(ref, budget);
+                c_dut = jit_run(jit, dut, budget);
+                check(c_ref == c_dut);
+                check(same_state(ref, dut));
+                if(c_ref < 0)
+                    break;
+            }
+        }
+
+        jit_destroy(jit);
+        cpu_destroy(ref);
+        cpu_destroy(dut);
+    }
+
+    it("Should stop on the same instruction as the interpreter")
+    {
+        CPUState* ref = cpu_create();
+        CPUState* dut = cpu_create();
+        JIT*      jit = jit_create();
+
+        // Every budget from 1 up lands on an instruction boundary in the
+        // middle of a block at some point
+        for(long budget = 1; budget < 80; ++budget)
+        {
+            load_pair(ref, dut, loop_prog, sizeof(loop_prog));
+            jit_flush(jit);
+            check(cpu_run_fast(ref, budget) == jit_run(jit, dut, budget));
+            check(same_state(ref, dut));
+        }
+
+        jit_destroy(jit);
+        cpu_destroy(ref);
+        cpu_destroy(dut);
+    }
+
+    it("Should notice code that writes over itself")
+    {
+        CPUState* state = cpu_create();
+        JIT*      jit   = jit_create();
+        uint8_t prog[] = {
+            0x3E, 0x05,             // 0000 MVI A,05
+            0x32, 0x09, 0x00,       // 0002 STA 0009  (patch the MVI below)
+            0xC3, 0x08, 0x00,       // 0005 JMP 0008
+            0x06, 0x00,             // 0008 MVI B,00
+            0x76,                   // 000A HLT
+        };
+
+        memcpy(state->memory, prog, sizeof(prog));
+        // Translate the target once before it gets patched
+        state->pc = 0x0008;
+        jit_run(jit, state, 7);
+        check(state->b == 0x00);
+
+        state->pc = 0x0000;
+        check(jit_run(jit, state, 1000) == -2);
+        check(state->b == 0x05);
+
+        jit_destroy(jit);
+        cpu_destroy(state);
+    }
+
+    it("Should only throw away the blocks that are written over")
+    {
+        CPUState* ref = cpu_create();
+        CPUState* dut = cpu_create();
+        JIT*      jit = jit_create();
+        JITStats  stats;
+        uint8_t prog[0x36] = {
+            0x21, 0x40, 0x00,       // 0000 LXI H,0040
+            0x0E, 0x04,             // 0003 MVI C,04
+            0xCD, 0x30, 0x00,       // 0005 CALL 0030
+            0x71,                   // 0008 MOV M,C   (data next to the code)
+            0x23,                   // 0009 INX H
+            0x79,                   // 000A MOV A,C
+            0x32, 0x31, 0x00,       // 000B STA 0031  (patch the MVI B below)
+            0x0D,                   // 000E DCR C
+            0xC2, 0x05, 0x00,       // 000F JNZ 0005
+            0x76,                   // 0012 HLT
+        };
+        static const uint8_t sub[] = {
+            0x06, 0x00,             // 0030 MVI B,00
+            0x7B,                   // 0032 MOV A,E
+            0x80,                   // 0033 ADD B
+            0x5F,                   // 0034 MOV E,A
+            0xC9,                   // 0035 RET
+        };
+
+        memcpy(&prog[0x30], sub, sizeof(sub));
+        load_pair(ref, dut, prog, sizeof(prog));
+        check(cpu_run_fast(ref, 10000) == -2);
+        check(jit_run(jit, dut, 10000) == -2);
+        check(same_state(ref, dut));
+        check(dut->e == 0 + 4 + 3 + 2);
+#ifdef JIT_AVAILABLE
+        // Only the subroutine is translated again, once per patch, and the
+        // CALL that was chained to it finds the new copy
+        jit_get_stats(jit, &stats);
+        check(stats.invalidations == 4);
+        check(stats.flushes <= 1);
+#endif /*JIT_AVAILABLE*/
+
+        jit_destroy(jit);
+        cpu_destroy(ref);
+        cpu_destroy(dut);
+    }
+
+    it("Should run DAA translated")
+    {
+        CPUState* ref = cpu_create();
+        CPUState* dut = cpu_create();
+        JIT*      jit = jit_create();
+        JITStats  stats;
+        static const uint8_t prog[] = {
+            0xAF,                   // 0000 XRA A
+            0x0E, 0x63,             // 0001 MVI C,99
+            0xC6, 0x01,             // 0003 ADI 01
+            0x27,                   // 0005 DAA
+            0x0D,                   // 0006 DCR C
+            0xC2, 0x03, 0x00,       // 0007 JNZ 0003
+            0x76,                   // 000A HLT
+        };
+
+        load_pair(ref, dut, prog, sizeof(prog));
+        check(cpu_run_fast(ref, 10000) == -2);
+        check(jit_run(jit, dut, 10000) == -2);
+        check(same_state(ref, dut));
+        check(dut->a == 0x99);
+#ifdef JIT_AVAILABLE
+        // Only the HLT goes to the interpreter
+        jit_get_stats(jit, &stats);
+        check(stats.interp_ops == 1);
+#endif /*JIT_AVAILABLE*/
+
+        jit_destroy(jit);
+        cpu_destroy(ref);
+        cpu_destroy(dut);
+    }
+
+    it("Should call port handlers with the same state as the interpreter")
+    {
+        CPUState*   ref = cpu_create();
+        CPUState*   dut = cpu_create();
+        JIT*        jit = jit_create();
+        CPUPorts    ports[2];
+        TestPortLog log[2];
+        JITStats    stats;
+        uint8_t     prog[0x48] = {
+            0xC3, 0x10, 0x00,       // 0000 JMP 0010
+            0, 0, 0, 0, 0,
+            0xFB,                   // 0008 EI
+            0xC9,                   // 0009 RET
+        };
+        static const uint8_t main[] = {
+            0xFB,                   // 0010 EI
+            0x0E, 0x0A,             // 0011 MVI C,0A
+            0xDB, 0x00,             // 0013 IN 0
+            0xD3, 0x00,             // 0015 OUT 0
+            0x79,                   // 0017 MOV A,C
+            0xE6, 0x01,             // 0018 ANI 01
+            0x07, 0x07, 0x07, 0x07, // 001A RLC x4
+            0xC6, 0x04,             // 001E ADI 04   (INR B or INR D)
+            0xCD, 0x40, 0x00,       // 0020 CALL 0040
+            0xD3, 0x01,             // 0023 OUT 1    (over the INR at 0040)
+            0xCD, 0x40, 0x00,       // 0025 CALL 0040
+            0xD3, 0x02,             // 0028 OUT 2    (RST 1)
+            0x0D,                   // 002A DCR C
+            0xC2, 0x13, 0x00,       // 002B JNZ 0013
+            0x76,                   // 002E HLT
+        };
+        static const uint8_t sub[] = {
+            0x00,                   // 0040 NOP      (patched)
+            0xC9,                   // 0041 RET
+        };
+
+        memcpy(&prog[0x10], main, sizeof(main));
+        memcpy(&prog[0x40], sub, sizeof(sub));
+        load_pair(ref, dut, prog, sizeof(prog));
+        memset(log, 0, sizeof(log));
+        for(int n = 0; n < 2; ++n)
+        {
+            cpu_ports_init(&ports[n]);
+            cpu_ports_in(&ports[n], 0x00, 0x00, test_port_in, &log[n]);
+            cpu_ports_out(&ports[n], 0x00, 0x02, test_port_out, &log[n]);
+        }
+        ref->ports = &ports[0];
+        dut->ports = &ports[1];
+
+        check(cpu_run_fast(ref, 100000) == -2);
+        check(jit_run(jit, dut, 100000) == -2);
+        check(same_state(ref, dut));
+        check(dut->b == 10 && dut->d == 9);
+        check(log[1].n == 30);
+        check(memcmp(&log[0], &log[1], sizeof(log[0])) == 0);
+#ifdef JIT_AVAILABLE
+        jit_get_stats(jit, &stats);
+        check(stats.interp_ops == 1);
+#endif /*JIT_AVAILABLE*/
+
+        jit_destroy(jit);
+        cpu_destroy(ref);
+        cpu_destroy(dut);
+    }
+
+    it("Should match the interpreter through a memory map")
+    {
+        static CPUMemMap map;
+        CPUState* ref = cpu_create();
+        CPUState* dut = cpu_create();
+        JIT*      jit = jit_create();
+        JITStats  stats;
+        long      c_ref, c_dut;
+
+        test_map_init(&map);
+        ref->map = &map;
+        dut->map = &map;
+        for(int prog = 0; prog < 200; ++prog)
+        {
+            load_random(ref, dut);
+            cpu_mem_changed(dut);
+            for(int slice = 0; slice < 100; ++slice)
+            {
+                long budget = 1 + test_rand() % 400;
+
+                c_ref = cpu_run_fast(ref, budget);
+                c_dut = jit_run(jit, dut, budget);
+                check(c_ref == c_dut);
+                check(same_state(ref, dut));
+                if(c_ref < 0)
+                    break;
+            }
+        }
+#ifdef JIT_AVAILABLE
+        jit_get_stats(jit, &stats);
+        check(stats.blocks > 0);
+#endif /*JIT_AVAILABLE*/
+
+        jit_destroy(jit);
+        cpu_destroy(ref);
+        cpu_destroy(dut);
+    }
+
+    it("Should see writes to code through a mirror")
+    {
+        static CPUMemMap map;
+        CPUState* state = cpu_create();
+        JIT*      jit   = jit_create();
+        static const uint8_t prog[] = {
+            0xCD, 0x10, 0x20,       // 2000 CALL 2010
+            0x3E, 0x3C,             // 2003 MVI A,3C  (INR A)
+            0x32, 0x10, 0x60,       // 2005 STA 6010  (the INR B below)
+            0xCD, 0x10, 0x20,       // 2008 CALL 2010
+            0x76,                   // 200B HLT
+            0, 0, 0, 0,
+            0x04,                   // 2010 INR B
+            0xC9,                   // 2011 RET
+        };
+
+        test_map_init(&map);
+        state->map = &map;
+        memcpy(&state->memory[0x2000], prog, sizeof(prog));
+        state->pc = 0x2000;
+        state->sp = 0x3000;
+        check(jit_run(jit, state, 1000) == -2);
+        check(state->b == 1);
+        check(state->a == 0x3D);
+
+        jit_destroy(jit);
+        cpu_destroy(state);
+    }
+
+    it("Should see a write handler store over translated code")
+    {
+        CPUState* state = cpu_create();
+        JIT*      jit   = jit_create();
+        static const uint8_t prog[] = {
+            0xCD, 0x10, 0x20,       // 2000 CALL 2010
+            0x3E, 0x3C,             // 2003 MVI A,3C  (INR A)
+            0x32, 0x10, 0x20,       // 2005 STA 2010  (the INR B below)
+            0xCD, 0x10, 0x20,       // 2008 CALL 2010
+            0x76,                   // 200B HLT
+            0, 0, 0, 0,
+            0x04,                   // 2010 INR B
+            0xC9,                   // 2011 RET
+        };
+
+        // The handler stores the byte itself and lets the rest of the
+        // page's stores through
+        cpu_map_init(&unprotect_map);
+        cpu_map_handler(&unprotect_map, 0x2000, 0x2100, NULL, test_write_unprotect);
+        state->map = &unprotect_map;
+        memcpy(&state->memory[0x2000], prog, sizeof(prog));
+        state->pc = 0x2000;
+        state->sp = 0x3000;
+        check(jit_run(jit, state, 1000) == -2);
+        check(state->b == 1);
+        check(state->a == 0x3D);
+        check(unprotect_map.write[0x20] == 0x2000);
+
+        jit_destroy(jit);
+        cpu_destroy(state);
+    }
+
+    it("Should see the PC an interrupt pushes over translated code")
+    {
+        CPUState* state = cpu_create();
+        JIT*      jit   = jit_create();
+        static const uint8_t prog[] = {
+            0x06, 0x00,             // 0000 MVI B,00
+            0x76,                   // 0002 HLT
+        };
+
+        memcpy(state->memory, prog, sizeof(prog));
+        check(jit_run(jit, state, 1000) == -2);
+        check(state->b == 0x00);
+
+        // The return address lands on the MVI, making it MVI B,42
+        state->pc = 0x4206;
+        state->sp = 0x0002;
+        state->int_enable = 1;
+        check(cpu_interrupt(state, 0) == 1);
+        check(jit_run(jit, state, 1000) == -2);
+        check(state->b == 0x42);
+
+        jit_destroy(jit);
+        cpu_destroy(state);
+    }
+
+#if defined(JIT_AVAILABLE) && defined(__linux__)
+    it("Should never map code writable and executable at once")
+    {
+        CPUState* state = cpu_create();
+        JIT*      jit   = jit_create();
+        FILE*     fp;
+        char      line[512];
+        char      perms[8];
+        int       rwx = 0;
+        JITStats  stats;
+
+        // Translating and chaining both write to the buffer
+        memcpy(state->memory, loop_prog, sizeof(loop_prog));
+        state->sp = 0x2400;
+        while(jit_run(jit, state, 1000) > 0)
+            ;
+        jit_get_stats(jit, &stats);
+        check(stats.chains > 0);
+
+        fp = fopen("/proc/self/maps", "r");
+        check(fp != NULL);
+        while(fgets(line, sizeof(line), fp))
+        {
+            if(sscanf(line, "%*s %7s", perms) == 1 && strncmp(perms, "rwx", 3) == 0)
+                rwx = 1;
+        }
+        fclose(fp);
+        check(rwx == 0);
+
+        jit_destroy(jit);
+        cpu_destroy(state);
+    }
+#endif /*JIT_AVAILABLE && __linux__*/
+}
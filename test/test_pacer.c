@@ -0,0 +1,129 @@
+/*
+ * TEST_PACER
+ * Unit tests for real time pacing
+ *
+ * Stefan Wong 2020
+ */
+
+#define _POSIX_C_SOURCE 200809L
+#include <stdio.h>
+#include <time.h>
+#include "pacer.h"
+// testing framework
+#include "bdd-for-c.h"
+
+// 1 kHz, so that a cycle is a millisecond
+#define TEST_CLOCK_HZ 1000.0
+
+static double elapsed_ms(const struct timespec* start)
+{
+    struct timespec now;
+
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    return (now.tv_sec - start->tv_sec) * 1e3 + (now.tv_nsec - start->tv_nsec) / 1e6;
+}
+
+static void sleep_ms(long ms)
+{
+    struct timespec ts = { ms / 1000, (ms % 1000) * 1000000 };
+
+    nanosleep(&ts, NULL);
+}
+
+spec("Pacer")
+{
+    it("Should pace cycles to the clock without drifting")
+    {
+        struct timespec start;
+        Pacer* p = pacer_create(TEST_CLOCK_HZ, 1.0);
+
+        check(p != NULL);
+        clock_gettime(CLOCK_MONOTONIC, &start);
+        pacer_start(p, 0);
+        // Frames that take some of their own time to emulate
+        for(int f = 1; f <= 20; ++f)
+        {
+            if(f % 4 == 0)
+                sleep_ms(3);
+            check(pacer_wait(p, f * 5) == 0);
+        }
+        // 100 cycles at 1 kHz. Each wait oversleeps a little, but the
+        // deadlines don't move so only the last one shows.
+        check(elapsed_ms(&start) >= 100.0);
+        check(elapsed_ms(&start) < 100.0 + PACER_RESYNC_NS / 1e6);
+        check(p->waits == 20);
+        check(p->sleeps >= 15);
+        check(p->resyncs == 0);
+        check(p->intervals == 20);
+        check(pacer_jitter_rms_ns(p) >= pacer_jitter_mean_ns(p));
+        pacer_destroy(p);
+    }
+
+    it("Should run at a multiple of the clock")
+    {
+        struct timespec start;
+        Pacer* p = pacer_create(TEST_CLOCK_HZ, 4.0);
+
+        check(p != NULL);
+        clock_gettime(CLOCK_MONOTONIC, &start);
+        pacer_start(p, 1000);
+        for(int f = 1; f <= 10; ++f)
+            pacer_wait(p, 1000 + f * 20);
+        // 200 cycles at 4 kHz
+        check(elapsed_ms(&start) >= 50.0);
+        check(elapsed_ms(&start) < 150.0);
+
+        // A new speed doesn't count against the frames already run
+        pacer_set_multiplier(p, 1.0);
+        check(pacer_wait(p, 1200) == 1);
+        clock_gettime(CLOCK_MONOTONIC, &start);
+        pacer_wait(p, 1240);
+        check(elapsed_ms(&start) >= 40.0);
+        pacer_destroy(p);
+    }
+
+    it("Should not sleep in turbo")
+    {
+        struct timespec start;
+        Pacer* p = pacer_create(TEST_CLOCK_HZ, 1.0);
+
+        check(p != NULL);
+        pacer_start(p, 0);
+        pacer_set_turbo(p, 1);
+        clock_gettime(CLOCK_MONOTONIC, &start);
+        for(int f = 1; f <= 100; ++f)
+            check(pacer_wait(p, f * 1000) == 1);
+        check(elapsed_ms(&start) < 50.0);
+        check(p->sleeps == 0);
+
+        // Back to the clock from where turbo left off
+        pacer_set_turbo(p, 0);
+        check(pacer_wait(p, 100000) == 1);
+        clock_gettime(CLOCK_MONOTONIC, &start);
+        check(pacer_wait(p, 100020) == 0);
+        check(elapsed_ms(&start) >= 20.0);
+        check(p->sleeps == 1);
+        pacer_destroy(p);
+    }
+
+    it("Should start again after falling too far behind")
+    {
+        Pacer* p = pacer_create(TEST_CLOCK_HZ, 1.0);
+
+        check(p != NULL);
+        pacer_start(p, 0);
+        sleep_ms(PACER_RESYNC_NS / 1000000 + 20);
+        check(pacer_wait(p, 1) == 1);
+        check(p->resyncs == 1);
+        // Not running flat out to make up the lost time
+        check(pacer_wait(p, 11) == 0);
+        check(p->sleeps == 1);
+        pacer_destroy(p);
+    }
+
+    it("Should refuse a clock that doesn't run")
+    {
+        check(pacer_create(TEST_CLOCK_HZ, 0.0) == NULL);
+        check(pacer_create(0.0, 1.0) == NULL);
+    }
+}
@@ -0,0 +1,160 @@
+/*
+ * TEST_PROFILE
+ * Unit tests for the execution profiler
+ *
+ * Stefan Wong 2020
+ */
+
+#define _DEFAULT_SOURCE
+#include <stdio.h>
+#include <string.h>
+#include "cpu.h"
+#include "disassem.h"
+#include "jit.h"
+#include "profile.h"
+// testing framework
+#include "bdd-for-c.h"
+
+// Count B down from 10 and halt
+static const uint8_t loop_program[] = {
+    0x06, 0x0A,             // 0000  MVI B, 0A
+    0x05,                   // 0002  DCR B
+    0xC2, 0x02, 0x00,       // 0003  JNZ 0002
+    0x76                    // 0006  HLT
+};
+
+static CPUState* load_loop(void)
+{
+    CPUState* state = cpu_create();
+
+    memcpy(state->memory, loop_program, sizeof(loop_program));
+    state->cc.psw = FLAG_ONE;
+
+    return state;
+}
+
+spec("Profile")
+{
+    it("Should count executions and cycles by opcode and by address")
+    {
+        CPUState*   state = load_loop();
+        CPUProfile* prof  = cpu_profile_create();
+
+        state->profile = prof;
+        check(cpu_run_fast(state, 1000) == -2);
+
+        check(prof->op_count[0x06] == 1);
+        check(prof->op_count[0x05] == 10);
+        check(prof->op_count[0xC2] == 10);
+        check(prof->op_count[0x76] == 1);
+        check(prof->op_cycles[0x05] == 10 * 5);
+        check(prof->op_cycles[0xC2] == 10 * 10);
+        check(prof->pc_count[0x0002] == 10);
+        check(prof->pc_count[0x0003] == 10);
+        check(prof->pc_cycles[0x0000] == 7);
+        check(prof->pc_count[0x0001] == 0);
+        check(cpu_profile_total_cycles(prof) == state->cycles);
+
+        cpu_profile_clear(prof);
+        check(cpu_profile_total_cycles(prof) == 0);
+        cpu_profile_destroy(prof);
+        cpu_destroy(state);
+    }
+
+    it("Should end in the same state with and without a profile")
+    {
+        CPUState*   ref   = load_loop();
+        CPUState*   state = load_loop();
+        CPUProfile* prof  = cpu_profile_create();
+
+        state->profile = prof;
+        // Stop partway through, every instruction is still counted once
+        check(cpu_run_fast(ref, 40) > 0);
+        check(cpu_run_fast(state, 40) > 0);
+        check(state->pc == ref->pc);
+        check(state->b == ref->b);
+        check(state->cycles == ref->cycles);
+        check(cpu_profile_total_cycles(prof) == state->cycles);
+        cpu_run_fast(ref, 1000);
+        cpu_run_fast(state, 1000);
+        check(state->cycles == ref->cycles);
+        check(cpu_profile_total_cycles(prof) == state->cycles);
+
+        cpu_profile_destroy(prof);
+        cpu_destroy(ref);
+        cpu_destroy(state);
+    }
+
+    it("Should profile on the interpreter when another core is asked for")
+    {
+        CPUState*       state = load_loop();
+        CPUProfile*     prof  = cpu_profile_create();
+        CPUDecodeCache* dc    = cpu_dcache_create();
+
+        state->profile = prof;
+        check(cpu_run_decoded(state, dc, 1000) == -2);
+        check(prof->op_count[0x05] == 10);
+        check(cpu_dcache_lookup(dc, 0x0002) == NULL);
+#ifdef JIT_AVAILABLE
+        JIT* jit = jit_create();
+
+        cpu_profile_clear(prof);
+        state->pc     = 0;
+        state->cycles = 0;
+        check(jit_run(jit, state, 1000) == -2);
+        check(prof->op_count[0x05] == 10);
+        jit_destroy(jit);
+#endif /*JIT_AVAILABLE*/
+
+        cpu_dcache_destroy(dc);
+        cpu_profile_destroy(prof);
+        cpu_destroy(state);
+    }
+
+    it("Should report the busiest opcodes and addresses first")
+    {
+        CPUState*   state = load_loop();
+        CPUProfile* prof  = cpu_profile_create();
+        char        buf[4096];
+        FILE*       fp;
+
+        state->profile = prof;
+        cpu_run_fast(state, 1000);
+
+        memset(buf, 0, sizeof(buf));
+        fp = fmemopen(buf, sizeof(buf) - 1, "w");
+        check(fp != NULL);
+        cpu_profile_report(prof, state->memory, fp, 2);
+        fclose(fp);
+        // JNZ at 0003 takes the most cycles, then DCR at 0002
+        check(strstr(buf, "C2  JNZ") != NULL);
+        check(strstr(buf, "0003  JNZ") != NULL);
+        check(strstr(buf, "0002  DCR") != NULL);
+        check(strstr(buf, "0000  MVI") == NULL);
+        check(strstr(buf, "C2  JNZ") < strstr(buf, "05  DCR"));
+
+        cpu_profile_destroy(prof);
+        cpu_destroy(state);
+    }
+
+    it("Should name opcodes in the report with the length the CPU runs them at")
+    {
+        uint8_t code[3] = { 0x00, 0x34, 0x12 };
+        char    line[64];
+
+        for(int op = 0; op < 256; ++op)
+        {
+            code[0] = (uint8_t) op;
+            check(disassemble_8080_op_str(line, sizeof(line), code, 0) == cpu_op_len[op]);
+        }
+        code[0] = 0x17;
+        disassemble_8080_op_str(line, sizeof(line), code, 0);
+        check(strstr(line, "RAL") != NULL);
+        code[0] = 0x1B;
+        disassemble_8080_op_str(line, sizeof(line), code, 0);
+        check(strstr(line, "DCX   D") != NULL);
+        code[0] = 0x1C;
+        disassemble_8080_op_str(line, sizeof(line), code, 0);
+        check(strstr(line, "INR   E") != NULL);
+    }
+}
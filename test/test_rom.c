@@ -0,0 +1,60 @@
+/*
+ * TEST_ROM
+ * Unit tests for the ROM loader
+ *
+ * Stefan Wong 2020
+ */
+
+#include <stdio.h>
+#include <string.h>
+#include "cpu.h"
+#include "rom.h"
+// testing framework
+#include "bdd-for-c.h"
+
+static const char rom_dir[]      = "ROM";
+static const char rom_combined[] = "ROM/invaders.rom";
+
+spec("ROM")
+{
+    it("Should compute the standard CRC32")
+    {
+        check(rom_crc32((const uint8_t*) "123456789", 9) == 0xCBF43926);
+        check(rom_crc32(NULL, 0) == 0);
+    }
+
+    it("Should load the invaders ROM set at the right offsets")
+    {
+        CPUState* state = cpu_create();
+        CPUState* ref   = cpu_create();
+
+        check(rom_load_set(state, &rom_set_invaders, rom_dir) == 0);
+        check(rom_load_file(ref, rom_combined, 0) == 0x2000);
+        check(memcmp(state->memory, ref->memory, CPU_MEM_SIZE) == 0);
+
+        check(rom_protect(state, &rom_set_invaders) == 0);
+        check(state->memory[0x0000] == ref->memory[0x0000]);
+        check(rom_unprotect(state, &rom_set_invaders) == 0);
+
+        cpu_destroy(state);
+        cpu_destroy(ref);
+    }
+
+    it("Should reject files that are missing, the wrong size or don't fit")
+    {
+        CPUState* state = cpu_create();
+        RomFile   bad_file = { "invaders.rom", 0x0000, 0x0800, 0x734F5AD8 };
+        RomSet    bad_set  = { "bad", &bad_file, 1, 0x0000, 0x0800 };
+
+        check(rom_load_set(state, &rom_set_invaders, "no_such_dir") < 0);
+        check(rom_load_set(state, &bad_set, rom_dir) < 0);
+        // Same size, wrong contents
+        bad_file.name = "invaders.g";
+        check(rom_load_set(state, &bad_set, rom_dir) < 0);
+        // 8 KiB won't fit in the last 4 KiB of memory
+        check(rom_load_file(state, rom_combined, 0xF000) < 0);
+        check(rom_load_file(state, rom_combined, 0xE000) == 0x2000);
+
+        cpu_destroy(state);
+    }
+}
@@ -0,0 +1,132 @@
+/*
+ * TEST_SCHEDULER
+ * Unit tests for the cycle event scheduler
+ *
+ * Stefan Wong 2020
+ */
+
+#include <stdio.h>
+#include <string.h>
+#include "cpu.h"
+#include "scheduler.h"
+// testing framework
+#include "bdd-for-c.h"
+
+#define LOG_SIZE 64
+
+typedef struct
+{
+    int      id[LOG_SIZE];
+    uint64_t when[LOG_SIZE];
+    uint64_t now[LOG_SIZE];
+    int      count;
+    CPUState* state;
+} EventLog;
+
+static EventLog event_log;
+
+static void log_event(Scheduler* s, void* ctx, uint64_t when)
+{
+    int n = event_log.count++;
+
+    event_log.id[n]   = (int) (intptr_t) ctx;
+    event_log.when[n] = when;
+    event_log.now[n]  = event_log.state ? event_log.state->cycles : 0;
+}
+
+static void periodic_event(Scheduler* s, void* ctx, uint64_t when)
+{
+    log_event(s, ctx, when);
+    sched_add(s, when + 100, periodic_event, ctx);
+}
+
+spec("Scheduler")
+{
+    it("Should dispatch events in deadline order, and in the order added on ties")
+    {
+        Scheduler* s = sched_create();
+
+        memset(&event_log, 0, sizeof(event_log));
+        check(sched_next(s) == UINT64_MAX);
+        // More events than the initial heap so that it has to grow
+        for(int i = 0; i < 40; ++i)
+            check(sched_add(s, (uint64_t) ((i * 37) % 40) * 10, log_event, (void*) (intptr_t) i) == 0);
+        check(sched_add(s, 50, log_event, (void*) (intptr_t) 100) == 0);
+        check(sched_next(s) == 0);
+
+        check(sched_dispatch(s, 45) == 5);
+        check(sched_dispatch(s, 1000) == 36);
+        check(event_log.count == 41);
+        for(int n = 1; n < event_log.count; ++n)
+            check(event_log.when[n - 1] <= event_log.when[n]);
+        // Both are due at 50, and event 100 was added last
+        check(event_log.when[5] == 50 && event_log.when[6] == 50);
+        check(event_log.id[6] == 100);
+        check(sched_next(s) == UINT64_MAX);
+
+        sched_destroy(s);
+    }
+
+    it("Should cancel pending events")
+    {
+        Scheduler* s = sched_create();
+
+        memset(&event_log, 0, sizeof(event_log));
+        sched_add(s, 10, log_event, (void*) (intptr_t) 1);
+        sched_add(s, 20, log_event, (void*) (intptr_t) 2);
+        sched_add(s, 30, log_event, (void*) (intptr_t) 1);
+        sched_add(s, 40, periodic_event, (void*) (intptr_t) 1);
+        check(sched_cancel(s, log_event, (void*) (intptr_t) 1) == 2);
+        check(sched_next(s) == 20);
+        check(sched_dispatch(s, 40) == 2);
+        check(event_log.id[0] == 2);
+        check(event_log.when[1] == 40);
+
+        sched_destroy(s);
+    }
+
+    it("Should run the CPU up to each deadline without drifting")
+    {
+        Scheduler* s     = sched_create();
+        CPUState*  state = cpu_create();
+        long       cycles;
+
+        // JMP 0000, 10 cycles per instruction, so deadlines that aren't
+        // multiples of 10 are overshot
+        state->memory[0] = 0xC3;
+        memset(&event_log, 0, sizeof(event_log));
+        event_log.state = state;
+        sched_add(s, 95, periodic_event, (void*) (intptr_t) 7);
+
+        cycles = sched_run_until(s, state, 1000, cpu_run_fast);
+        check(cycles == 1000);
+        check(state->cycles == 1000);
+        check(event_log.count == 10);
+        for(int n = 0; n < event_log.count; ++n)
+        {
+            // Due every 100 cycles from 95, seen at the next instruction
+            // boundary, with the overshoot never carried forward
+            check(event_log.when[n] == 95 + 100 * (uint64_t) n);
+            check(event_log.now[n] == 100 + 100 * (uint64_t) n);
+        }
+        check(sched_next(s) == 1095);
+
+        sched_destroy(s);
+        cpu_destroy(state);
+    }
+
+    it("Should stop when the CPU halts")
+    {
+        Scheduler* s     = sched_create();
+        CPUState*  state = cpu_create();
+
+        state->memory[0] = 0x76;
+        memset(&event_log, 0, sizeof(event_log));
+        sched_add(s, 1000, log_event, NULL);
+        check(sched_run_until(s, state, 2000, cpu_run_fast) == -2);
+        check(event_log.count == 0);
+
+        sched_destroy(s);
+        cpu_destroy(state);
+    }
+}
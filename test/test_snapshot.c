@@ -0,0 +1,231 @@
+/*
+ * TEST_SNAPSHOT
+ * Unit tests for incremental CPU snapshots
+ *
+ * Stefan Wong 2020
+ */
+
+#include <stdio.h>
+#include <string.h>
+#include "cpu.h"
+#include "jit.h"
+#include "profile.h"
+#include "snapshot.h"
+// testing framework
+#include "bdd-for-c.h"
+
+// Fills 0x2000-0x20FF with a count, one page of writes per pass
+static const uint8_t fill_prog[] = {
+    0x21, 0x00, 0x20,       // 0000 LXI H,2000
+    0x77,                   // 0003 MOV M,A
+    0x3C,                   // 0004 INR A
+    0x2C,                   // 0005 INR L
+    0xC2, 0x03, 0x00,       // 0006 JNZ 0003
+    0x76,                   // 0009 HLT
+};
+
+spec("CPUSnapshot")
+{
+    it("Should share pages that haven't been written since the parent")
+    {
+        CPUState*    state = cpu_create();
+        CPUSnapshot* base;
+        CPUSnapshot* next;
+        CPUSnapshot* clone;
+
+        memcpy(state->memory, fill_prog, sizeof(fill_prog));
+        base = cpu_snapshot_take(state, NULL);
+        check(base != NULL);
+        check(base->new_pages == SNAP_NUM_PAGES);
+
+        while(cpu_run_fast(state, 1000) >= 0)
+            ;
+        next = cpu_snapshot_take(state, base);
+        check(next != NULL);
+        check(next->new_pages == 1);
+        check(cpu_snapshot_page(next, 0) == cpu_snapshot_page(base, 0));
+        check(cpu_snapshot_page(next, 0x20) != cpu_snapshot_page(base, 0x20));
+        check(cpu_snapshot_page(next, 0x20)[0x10] == 0x10);
+
+        // Pages must outlive the snapshot that made them
+        clone = cpu_snapshot_clone(next);
+        cpu_snapshot_destroy(next);
+        check(clone->new_pages == 0);
+        check(cpu_snapshot_page(clone, 0x20)[0xFF] == 0xFF);
+
+        cpu_snapshot_destroy(clone);
+        cpu_snapshot_destroy(base);
+        cpu_destroy(state);
+    }
+
+    it("Should restore and fork machines that run the same way")
+    {
+        CPUState*    state = cpu_create();
+        CPUState*    fork;
+        CPUSnapshot* snap;
+        uint8_t*     memory = state->memory;
+
+        memcpy(state->memory, fill_prog, sizeof(fill_prog));
+        cpu_run_fast(state, 100);
+        snap = cpu_snapshot_take(state, NULL);
+        check(snap != NULL);
+
+        while(cpu_run_fast(state, 1000) >= 0)
+            ;
+        check(cpu_snapshot_restore(snap, state) == 1);
+        check(state->memory == memory);
+        check(state->pc == snap->regs.pc);
+        check(state->cycles == snap->regs.cycles);
+        check(cpu_snapshot_restore(snap, state) == 0);
+
+        fork = cpu_snapshot_fork(snap);
+        check(fork != NULL);
+        check(fork->memory != state->memory);
+        while(cpu_run_fast(state, 1000) >= 0)
+            ;
+        while(cpu_run_fast(fork, 1000) >= 0)
+            ;
+        check(fork->a == state->a && fork->h == state->h && fork->l == state->l);
+        check(fork->pc == state->pc && fork->cycles == state->cycles);
+        check(memcmp(fork->memory, state->memory, CPU_MEM_SIZE) == 0);
+
+        cpu_destroy(fork);
+        cpu_snapshot_destroy(snap);
+        cpu_destroy(state);
+    }
+
+    it("Should only look at the pages a tracked machine wrote")
+    {
+        CPUState*    state = cpu_create();
+        CPUSnapshot* base;
+        CPUSnapshot* next;
+
+        memcpy(state->memory, fill_prog, sizeof(fill_prog));
+        check(cpu_snapshot_track(state) == 0);
+        check(state->map != &cpu_map_flat);
+        base = cpu_snapshot_take(state, NULL);
+        check(base != NULL);
+        check(base->new_pages == SNAP_NUM_PAGES);
+        check(state->map->write[0x20] == CPU_PAGE_HANDLER);
+
+        // Only the first store to a page goes through the handler
+        while(cpu_run_fast(state, 1000) >= 0)
+            ;
+        check(state->map->write[0x20] == 0x2000);
+        check(state->map->write[0x21] == CPU_PAGE_HANDLER);
+        next = cpu_snapshot_take(state, base);
+        check(next != NULL);
+        check(next->new_pages == 1);
+        check(cpu_snapshot_page(next, 0x20)[0xFF] == 0xFF);
+        check(state->map->write[0x20] == CPU_PAGE_HANDLER);
+
+        // Pages the map didn't see written aren't looked at, unless the
+        // machine says that memory changed
+        state->memory[0x3000] = 0xAA;
+        check(cpu_snapshot_restore(base, state) == 1);
+        check(state->memory[0x3000] == 0xAA);
+        check(cpu_snapshot_restore(next, state) == 1);
+        cpu_mem_changed(state);
+        check(cpu_snapshot_restore(next, state) == 1);
+        check(state->memory[0x3000] == 0x00);
+        check(memcmp(&state->memory[0x2000], cpu_snapshot_page(next, 0x20), SNAP_PAGE_SIZE) == 0);
+
+        cpu_snapshot_untrack(state);
+        check(state->map == &cpu_map_flat);
+        check(state->snap == NULL);
+
+        cpu_snapshot_destroy(next);
+        cpu_snapshot_destroy(base);
+        cpu_destroy(state);
+    }
+
+    it("Should track the writes of a machine on the JIT")
+    {
+        CPUState*    ref = cpu_create();
+        CPUState*    dut = cpu_create();
+        JIT*         jit = jit_create();
+        CPUSnapshot* base;
+        CPUSnapshot* snap;
+
+        memcpy(ref->memory, fill_prog, sizeof(fill_prog));
+        memcpy(dut->memory, fill_prog, sizeof(fill_prog));
+        check(cpu_snapshot_track(dut) == 0);
+        base = cpu_snapshot_take(dut, NULL);
+        check(base != NULL);
+
+        for(int pass = 0; pass < 3; ++pass)
+        {
+            while(cpu_run_fast(ref, 1000) >= 0)
+                ;
+            while(jit_run(jit, dut, 1000) >= 0)
+                ;
+            check(dut->pc == ref->pc && dut->cycles == ref->cycles);
+            check(memcmp(dut->memory, ref->memory, CPU_MEM_SIZE) == 0);
+            snap = cpu_snapshot_take(dut, base);
+            check(snap != NULL);
+            check(snap->new_pages == 1);
+            cpu_snapshot_destroy(snap);
+
+            // Go again from the top with a new count
+            ref->pc = dut->pc = 0x0003;
+            ref->h  = dut->h  = 0x20;
+        }
+
+        cpu_snapshot_untrack(dut);
+        cpu_snapshot_destroy(base);
+        jit_destroy(jit);
+        cpu_destroy(ref);
+        cpu_destroy(dut);
+    }
+
+    it("Should leave what is attached to a machine out of its snapshots")
+    {
+        CPUState*    state      = cpu_create();
+        CPUState*    other      = cpu_create();
+        CPUState*    fork;
+        CPUSnapshot* snap;
+        CPUProfile*  prof       = cpu_profile_create();
+        CPUProfile*  other_prof = cpu_profile_create();
+        CPUPorts     ports;
+        CPUMemMap    map;
+
+        memcpy(state->memory, fill_prog, sizeof(fill_prog));
+        cpu_ports_init(&ports);
+        cpu_map_init(&map);
+        state->profile  = prof;
+        state->ports    = &ports;
+        state->userdata = state;
+        cpu_run_fast(state, 100);
+        snap = cpu_snapshot_take(state, NULL);
+        check(snap != NULL);
+
+        // The machine restored into keeps its own attachments
+        other->profile = other_prof;
+        other->map     = &map;
+        check(cpu_snapshot_restore(snap, other) == 2);
+        check(other->pc == state->pc && other->cycles == state->cycles);
+        check(other->profile == other_prof);
+        check(other->map == &map);
+        check(other->ports == NULL);
+        check(other->userdata == NULL);
+
+        // A fork starts with nothing attached
+        fork = cpu_snapshot_fork(snap);
+        check(fork != NULL);
+        check(fork->profile == NULL);
+        check(fork->tracer == NULL);
+        check(fork->ports == NULL);
+        check(fork->userdata == NULL);
+        check(fork->map == &cpu_map_flat);
+        while(cpu_run_fast(fork, 1000) >= 0)
+            ;
+        check(cpu_profile_total_cycles(prof) == state->cycles);
+
+        cpu_destroy(fork);
+        cpu_snapshot_destroy(snap);
+        cpu_profile_destroy(other_prof);
+        cpu_profile_destroy(prof);
+        cpu_destroy(other);
+        cpu_destroy(state);
+    }
+}
@@ -0,0 +1,136 @@
+/*
+ * TEST_TRACE
+ * Unit tests for the binary tracer
+ *
+ * Stefan Wong 2020
+ */
+
+#include <stdio.h>
+#include <string.h>
+#include "cpu.h"
+#include "trace.h"
+// testing framework
+#include "bdd-for-c.h"
+
+static const char trace_path[] = "test_trace.tmp";
+
+// Fill 0100-0163 with 64 down to 01 and halt
+static const uint8_t fill_program[] = {
+    0x21, 0x00, 0x01,       // 0000  LXI H, 0100
+    0x0E, 0x64,             // 0003  MVI C, 64
+    0x71,                   // 0005  MOV M, C
+    0x23,                   // 0006  INX H
+    0x0D,                   // 0007  DCR C
+    0xC2, 0x05, 0x00,       // 0008  JNZ 0005
+    0x76                    // 000B  HLT
+};
+
+#define FILL_RECORDS (2 + 4 * 100 + 1)
+
+static CPUState* load_fill(void)
+{
+    CPUState* state = cpu_create();
+
+    memcpy(state->memory, fill_program, sizeof(fill_program));
+    state->cc.psw = FLAG_ONE;
+
+    return state;
+}
+
+spec("Trace")
+{
+    it("Should write one record per instruction with the state before it ran")
+    {
+        CPUState*   state = load_fill();
+        Tracer*     tr;
+        FILE*       fp;
+        TraceRecord rec;
+        int         n = 0;
+
+        // A tiny ring makes the producer wrap and wait on the writer
+        tr = tracer_create(trace_path, 4);
+        check(tr != NULL);
+        state->tracer = tr;
+        check(cpu_run_fast(state, 100000) == -2);
+        check(tracer_records(tr) == FILL_RECORDS);
+        state->tracer = NULL;
+        check(tracer_destroy(tr) == 0);
+
+        fp = trace_open(trace_path);
+        check(fp != NULL);
+        check(trace_read(fp, &rec));
+        check(rec.pc == 0x0000);
+        check(rec.opcode == 0x21);
+        check(rec.operand[0] == 0x00 && rec.operand[1] == 0x01);
+        check(rec.cycles == 0);
+        check(trace_read(fp, &rec));
+        check(rec.pc == 0x0003);
+        check(rec.operand[0] == 0x64);
+        check(rec.h == 0x01 && rec.l == 0x00);
+        check(rec.cycles == 10);
+        n += 2;
+        for(int i = 0; i < 100; ++i)
+        {
+            check(trace_read(fp, &rec));
+            check(rec.pc == 0x0005);
+            check(rec.opcode == 0x71);
+            check(rec.c == 100 - i);
+            check(rec.h == 0x01 && rec.l == i);
+            check(rec.cycles == 17 + 27 * i);
+            check(trace_read(fp, &rec));
+            check(rec.pc == 0x0006);
+            check(trace_read(fp, &rec));
+            check(rec.pc == 0x0007);
+            check(rec.l == i + 1);
+            check(trace_read(fp, &rec));
+            check(rec.pc == 0x0008);
+            check(rec.operand[0] == 0x05 && rec.operand[1] == 0x00);
+            check(rec.c == 99 - i);
+            n += 4;
+        }
+        check(trace_read(fp, &rec));
+        check(rec.opcode == 0x76);
+        check(rec.flags & FLAG_Z);
+        check(!trace_read(fp, &rec));
+        check(++n == FILL_RECORDS);
+        fclose(fp);
+        remove(trace_path);
+
+        cpu_destroy(state);
+    }
+
+    it("Should trace on the interpreter without changing the result")
+    {
+        CPUState*       ref   = load_fill();
+        CPUState*       state = load_fill();
+        CPUDecodeCache* dc    = cpu_dcache_create();
+        Tracer*         tr    = tracer_create(trace_path, 0);
+
+        check(tr != NULL);
+        state->tracer = tr;
+        check(cpu_run_decoded(state, dc, 100000) == -2);
+        check(cpu_run_fast(ref, 100000) == -2);
+        check(state->cycles == ref->cycles);
+        check(state->pc == ref->pc);
+        check(tracer_records(tr) == FILL_RECORDS);
+        check(memcmp(&state->memory[0x0100], &ref->memory[0x0100], 100) == 0);
+        check(cpu_dcache_lookup(dc, 0x0002) == NULL);
+        check(tracer_destroy(tr) == 0);
+        remove(trace_path);
+
+        cpu_dcache_destroy(dc);
+        cpu_destroy(ref);
+        cpu_destroy(state);
+    }
+
+    it("Should refuse files that aren't traces")
+    {
+        FILE* fp = fopen(trace_path, "wb");
+
+        fputs("not a trace", fp);
+        fclose(fp);
+        check(trace_open(trace_path) == NULL);
+        check(trace_open("no_such_trace.tmp") == NULL);
+        remove(trace_path);
+    }
+}
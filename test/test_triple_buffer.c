@@ -0,0 +1,109 @@
+/*
+ * TEST_TRIPLE_BUFFER
+ * Unit tests for the lock-free triple buffer
+ *
+ * Stefan Wong 2020
+ */
+
+#include <stdio.h>
+#include <string.h>
+#include <pthread.h>
+#include "triple_buffer.h"
+// testing framework
+#include "bdd-for-c.h"
+
+#define FRAME_SIZE   4096
+#define NUM_FRAMES   20000
+
+static void* producer(void* arg)
+{
+    TripleBuffer* tb = arg;
+
+    for(uint64_t n = 1; n <= NUM_FRAMES; ++n)
+    {
+        memset(triple_buffer_back(tb), (int) (n & 0xFF), FRAME_SIZE);
+        triple_buffer_publish(tb, n);
+    }
+
+    return NULL;
+}
+
+static int frame_is(const uint8_t* frame, uint8_t val)
+{
+    for(int i = 0; i < FRAME_SIZE; ++i)
+    {
+        if(frame[i] != val)
+            return 0;
+    }
+    return 1;
+}
+
+spec("TripleBuffer")
+{
+    it("Should hand over the newest frame and drop the ones in between")
+    {
+        TripleBuffer*  tb = triple_buffer_create(16);
+        const uint8_t* frame;
+        uint64_t       seq;
+        int            fresh;
+
+        check(tb != NULL);
+        frame = triple_buffer_read(tb, &seq, &fresh);
+        check(!fresh);
+
+        for(int n = 1; n <= 3; ++n)
+        {
+            memset(triple_buffer_back(tb), n, 16);
+            triple_buffer_publish(tb, n);
+        }
+        frame = triple_buffer_read(tb, &seq, &fresh);
+        check(fresh);
+        check(seq == 3);
+        check(frame[0] == 3 && frame[15] == 3);
+
+        // Nothing new, so the same frame comes back
+        frame = triple_buffer_read(tb, &seq, &fresh);
+        check(!fresh);
+        check(seq == 3);
+        check(frame[0] == 3);
+
+        // The producer never writes into the frame being read
+        memset(triple_buffer_back(tb), 4, 16);
+        check(frame[0] == 3);
+        triple_buffer_publish(tb, 4);
+        memset(triple_buffer_back(tb), 5, 16);
+        check(frame[0] == 3);
+        frame = triple_buffer_read(tb, &seq, &fresh);
+        check(fresh && seq == 4 && frame[0] == 4);
+
+        triple_buffer_destroy(tb);
+    }
+
+    it("Should never tear a frame with the producer on another thread")
+    {
+        TripleBuffer* tb = triple_buffer_create(FRAME_SIZE);
+        pthread_t     thread;
+        uint64_t      last = 0, seq;
+        int           fresh, torn = 0, backwards = 0;
+
+        check(tb != NULL);
+        check(pthread_create(&thread, NULL, producer, tb) == 0);
+        while(last < NUM_FRAMES)
+        {
+            const uint8_t* frame = triple_buffer_read(tb, &seq, &fresh);
+            if(!fresh)
+                continue;
+            if(seq <= last)
+                backwards++;
+            if(!frame_is(frame, (uint8_t) (seq & 0xFF)))
+                torn++;
+            last = seq;
+        }
+        pthread_join(thread, NULL);
+        check(torn == 0);
+        check(backwards == 0);
+        check(last == NUM_FRAMES);
+
+        triple_buffer_destroy(tb);
+    }
+}
@@ -4,19 +4,89 @@
  *
  */
 
+#define _DEFAULT_SOURCE
 #include <stdio.h>
 #include <stdlib.h>
+#include <unistd.h>
+#include "cpu.h"
 #include "disassem.h"
+#include "trace.h"
 
 
+static void usage(const char* prog)
+{
+    fprintf(stderr, "Usage: %s <file>\n", prog);
+    fprintf(stderr, "       %s -t <trace>\n", prog);
+    fprintf(stderr, "  -t   decode a binary trace written by emu8080 -T\n");
+}
+
+/*
+ * decode_trace()
+ * Print every record in a trace file, one instruction per line
+ */
+static int decode_trace(const char* path)
+{
+    FILE*         fp;
+    TraceRecord   rec;
+    unsigned long num_records = 0;
+    char          instr[32];
+
+    fp = trace_open(path);
+    if(fp == NULL)
+        return -1;
+
+    fprintf(stdout, "%14s  PC    %-20s A  B  C  D  E  H  L  SP   FLAGS\n", "CYCLES", "INSTR");
+    while(trace_read(fp, &rec))
+    {
+        uint8_t code[3] = { rec.opcode, rec.operand[0], rec.operand[1] };
+
+        disassemble_8080_op_str(instr, sizeof(instr), code, 0);
+        fprintf(stdout, "%14lu  %04X  %-20s %02X %02X %02X %02X %02X %02X %02X %04X %c%c%c%c%c\n",
+                (unsigned long) rec.cycles, rec.pc, instr,
+                rec.a, rec.b, rec.c, rec.d, rec.e, rec.h, rec.l, rec.sp,
+                (rec.flags & FLAG_S) ? 'S' : '-',
+                (rec.flags & FLAG_Z) ? 'Z' : '-',
+                (rec.flags & FLAG_AC) ? 'A' : '-',
+                (rec.flags & FLAG_P) ? 'P' : '-',
+                (rec.flags & FLAG_CY) ? 'C' : '-');
+        num_records++;
+    }
+    fclose(fp);
+    fprintf(stdout, "%lu records\n", num_records);
+
+    return 0;
+}
+
 int main(int argc, char *argv[])
 {
     FILE *fp;
+    int opt;
+    const char* trace_path = NULL;
+
+    while((opt = getopt(argc, argv, "t:")) != -1)
+    {
+        switch(opt)
+        {
+            case 't':
+                trace_path = optarg;
+                break;
+            default:
+                usage(argv[0]);
+                exit(1);
+        }
+    }
+    if(trace_path != NULL)
+        return (decode_trace(trace_path) < 0) ? 1 : 0;
+    if(optind >= argc)
+    {
+        usage(argv[0]);
+        exit(1);
+    }
 
-    fp = fopen(argv[1], "rb");
+    fp = fopen(argv[optind], "rb");
     if(fp == NULL)
     {
-        fprintf(stderr, "Couldn't open file %s\n", argv[1]);
+        fprintf(stderr, "Couldn't open file %s\n", argv[optind]);
         exit(1);
     }
 
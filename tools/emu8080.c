@@ -4,31 +4,1289 @@
  *
  */
 
+#define _DEFAULT_SOURCE
 #include <stdio.h>
 #include <stdlib.h>
+#include <string.h>
+#include <strings.h>
+#include <unistd.h>
+#include <time.h>
+#include <dirent.h>
+#include <pthread.h>
+#include <stdatomic.h>
+#include <sys/stat.h>
+#include "audio.h"
+#include "capture.h"
 #include "cpu.h"
+#include "cpu_bank.h"
 #include "emu_utils.h"
+#include "input_log.h"
+#include "invaders.h"
+#include "jit.h"
+#include "pacer.h"
+#include "profile.h"
+#include "rom.h"
+#include "trace.h"
+#include "triple_buffer.h"
 
-#define TEST_CYCLE_LIMIT 200000
+#define TEST_CYCLE_LIMIT  200000
+#define BATCH_CYCLES      10000
+#define BATCH_CYCLE_LIMIT 100000000L
+#define BATCH_OUTPUT_SIZE 4096
+#define LANE_STEPS        1000
+#define SESSION_HASH_CYCLES 2000000L     // one emulated second at 2 MHz
+#define RENDER_IDLE_NS    1000000         // render thread sleep with no new frame
+#define HEADLESS_AUDIO_SLICES 8           // pacer waits per frame with sound on
+
+// CP/M images are loaded at the start of the TPA. Address 0 (warm boot)
+// halts the CPU and the BDOS entry point at 5 jumps to a stub that hands
+// the call to a port handler.
+#define CPM_LOAD_ADDR     0x0100
+#define CPM_BDOS_ADDR     0xFF00
+#define CPM_BDOS_PORT     0x00
+
+typedef enum
+{
+    CORE_INTERP,
+    CORE_DECODED,
+    CORE_JIT
+} EmuCore;
+
+static const char* core_names[] = { "interp", "decoded", "jit" };
+
+// Profile and trace requested on the command line
+typedef struct
+{
+    CPUProfile* prof;
+    int         prof_lines;
+    Tracer*     tracer;
+    const char* trace_path;
+} Instruments;
+
+// Display and sound options for headless runs
+typedef struct
+{
+    DispBackend backend;
+    unsigned    flags;
+    Capture*    capture;
+    int         sound;
+} DisplayOpts;
+
+// One image in a batch run
+typedef struct
+{
+    char*       path;
+    int         cpm;            // load as a CP/M .COM file
+    const char* status;
+    double      wall_ms;
+    CPUState    regs;           // final registers (memory is not kept)
+    char        output[BATCH_OUTPUT_SIZE];
+    size_t      out_len;
+} BatchJob;
+
+typedef struct
+{
+    BatchJob*   jobs;
+    int         num_jobs;
+    atomic_int  next;
+    EmuCore     core;
+    long        limit;
+} BatchQueue;
+
+// Job being run on this thread, for the BDOS port handler
+static _Thread_local BatchJob* cur_job;
+
+static void usage(const char* prog)
+{
+    fprintf(stderr, "Usage: %s [-d|-j] <file>\n", prog);
+    fprintf(stderr, "       %s [-d|-j] -R <rom dir>\n", prog);
+    fprintf(stderr, "       %s [-d|-j] [-n cycles] -w <log> <file>|-R <rom dir>\n", prog);
+    fprintf(stderr, "       %s [-d|-j] -p <log> <file>|-R <rom dir>\n", prog);
+    fprintf(stderr, "       %s -b [-d|-j] [-n cycles] [-t threads] [-v] <file|dir>...\n", prog);
+    fprintf(stderr, "       %s -L lanes [-n cycles] <file>\n", prog);
+    fprintf(stderr, "       %s -H frames [-j] [-S] [-M speed] [-A] [-D null|offscreen|sdl] [-V] [-C ppm|png|raw:<path>[:n]] -R <rom dir>\n", prog);
+    fprintf(stderr, "       %s -T <trace> [-n cycles] <file>|-R <rom dir>\n", prog);
+    fprintf(stderr, "  -d   run from the decoded instruction cache instead of tracing each instruction\n");
+    fprintf(stderr, "  -j   run on the recompiler instead of tracing each instruction\n");
+    fprintf(stderr, "  -b   batch mode, run every image and print a summary\n");
+    fprintf(stderr, "  -n   cycle limit per image in batch mode (default %ld)\n", BATCH_CYCLE_LIMIT);
+    fprintf(stderr, "  -t   number of worker threads (default is one per core)\n");
+    fprintf(stderr, "  -v   print console output from CP/M images\n");
+    fprintf(stderr, "  -R   load the invaders ROM set from a directory, checked and write protected\n");
+    fprintf(stderr, "  -w   record port input and state hashes to a log, running for -n cycles. With -R\n");
+    fprintf(stderr, "       the invaders machine runs, and its inputs and interrupts are logged\n");
+    fprintf(stderr, "  -p   replay a log as fast as possible and check the state hashes\n");
+    fprintf(stderr, "  -L   run the image on a bank of lockstep machines and report throughput\n");
+    fprintf(stderr, "  -H   run the ROM set for a number of frames as fast as possible and report speed\n");
+    fprintf(stderr, "  -D   display backend for -H (default null)\n");
+    fprintf(stderr, "  -S   with -H, emulate on one thread and draw on another\n");
+    fprintf(stderr, "  -M   with -H, run in real time at speed times the authentic clock (1 for 2 MHz).\n");
+    fprintf(stderr, "       Hold Tab in the window to run uncapped, Escape quits\n");
+    fprintf(stderr, "  -A   with -H, play the sound effects (needs SDL, use with -M)\n");
+    fprintf(stderr, "  -V   with -D sdl, wait for vsync when presenting a frame\n");
+    fprintf(stderr, "  -C   with -H, capture every nth drawn frame (default 1) as images in a directory,\n");
+    fprintf(stderr, "       or as raw RGBA frames to a file or - for stdout\n");
+    fprintf(stderr, "  -T   write a binary trace of every instruction, decode it with dis8080 -t\n");
+    fprintf(stderr, "  -P   profile opcodes and addresses and print the top N of each at exit (0 for all)\n");
+}
+
+static double now_ms(void)
+{
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec * 1e3 + ts.tv_nsec / 1e6;
+}
+
+/*
+ * load_image()
+ * Load a file into memory at offset. Returns 0 on success, -1 if the file
+ * can't be read or doesn't fit.
+ */
+static int load_image(CPUState* state, const char* path, uint16_t offset)
+{
+    return (rom_load_file(state, path, offset) < 0) ? -1 : 0;
+}
+
+static void job_putc(BatchJob* job, char c)
+{
+    if(job->out_len < BATCH_OUTPUT_SIZE - 1)
+        job->output[job->out_len++] = c;
+}
+
+// BDOS console output (function 2) and print string (function 9)
+static void bdos_port_out(CPUState* state, void* dev, uint8_t port, uint8_t val)
+{
+    if(cur_job == NULL)
+        return;
+
+    if(state->c == 2)
+        job_putc(cur_job, state->e);
+    else if(state->c == 9)
+    {
+        uint16_t addr = (state->d << 8) | state->e;
+        for(int n = 0; state->memory[addr] != '$' && n < BATCH_OUTPUT_SIZE; ++n)
+            job_putc(cur_job, state->memory[addr++]);
+    }
+}
+
+// Shared by every batch worker, so filled in once
+static CPUPorts       cpm_ports;
+static pthread_once_t cpm_ports_once = PTHREAD_ONCE_INIT;
+
+static void cpm_ports_init(void)
+{
+    cpu_ports_init(&cpm_ports);
+    cpu_ports_out(&cpm_ports, CPM_BDOS_PORT, CPM_BDOS_PORT, bdos_port_out, NULL);
+}
+
+static void setup_cpm(CPUState* state)
+{
+    uint8_t* mem = state->memory;
+
+    pthread_once(&cpm_ports_once, cpm_ports_init);
+
+    mem[0x0000] = 0x76;                         // HLT
+    mem[0x0005] = 0xC3;                         // JMP BDOS
+    mem[0x0006] = CPM_BDOS_ADDR & 0xFF;
+    mem[0x0007] = CPM_BDOS_ADDR >> 8;
+    mem[CPM_BDOS_ADDR]     = 0xD3;              // OUT port
+    mem[CPM_BDOS_ADDR + 1] = CPM_BDOS_PORT;
+    mem[CPM_BDOS_ADDR + 2] = 0xC9;              // RET
+    state->pc       = CPM_LOAD_ADDR;
+    state->sp       = CPM_BDOS_ADDR;
+    state->ports    = &cpm_ports;
+}
+
+/*
+ * run_core()
+ * Run one batch of cycles on the selected core
+ */
+static long run_core(CPUState* state, EmuCore core, JIT* jit, CPUDecodeCache* dc, long budget)
+{
+    switch(core)
+    {
+        case CORE_JIT:
+            return jit_run(jit, state, budget);
+        case CORE_DECODED:
+            return cpu_run_decoded(state, dc, budget);
+        default:
+            return cpu_run_fast(state, budget);
+    }
+}
+
+/*
+ * run_image()
+ * Run one job to completion on the selected core
+ */
+static void run_image(BatchJob* job, EmuCore core, long limit, JIT* jit, CPUDecodeCache* dc)
+{
+    CPUState* state;
+    long      status = 0;
+    double    start;
+
+    state = cpu_create();
+    if(state == NULL)
+    {
+        job->status = "error";
+        return;
+    }
+    if(load_image(state, job->path, job->cpm ? CPM_LOAD_ADDR : 0) < 0)
+    {
+        job->status = "badfile";
+        goto RUN_END;
+    }
+    if(job->cpm)
+        setup_cpm(state);
+
+    cur_job = job;
+    if(jit)
+        jit_flush(jit);
+    if(dc)
+        cpu_dcache_flush(dc);
+
+    start = now_ms();
+    while(state->cycles < (uint64_t) limit)
+    {
+        status = run_core(state, core, jit, dc, BATCH_CYCLES);
+        if(status < 0)
+            break;
+    }
+    job->wall_ms = now_ms() - start;
+    job->status  = (status < 0) ? "halt" : "limit";
+    cur_job = NULL;
+
+RUN_END:
+    job->regs        = *state;
+    job->regs.memory = NULL;
+    cpu_destroy(state);
+}
+
+static void* batch_worker(void* arg)
+{
+    BatchQueue*     queue = arg;
+    JIT*            jit   = NULL;
+    CPUDecodeCache* dc    = NULL;
+    EmuCore         core  = queue->core;
+    int             idx;
+
+    if(core == CORE_JIT)
+    {
+        jit = jit_create();
+        if(jit == NULL)
+            core = CORE_INTERP;
+    }
+    else if(core == CORE_DECODED)
+    {
+        dc = cpu_dcache_create();
+        if(dc == NULL)
+            core = CORE_INTERP;
+    }
+
+    while((idx = atomic_fetch_add(&queue->next, 1)) < queue->num_jobs)
+        run_image(&queue->jobs[idx], core, queue->limit, jit, dc);
+
+    jit_destroy(jit);
+    if(dc)
+        cpu_dcache_destroy(dc);
+
+    return NULL;
+}
+
+static int is_cpm_image(const char* path)
+{
+    const char* ext = strrchr(path, '.');
+
+    return ext != NULL && strcasecmp(ext, ".com") == 0;
+}
+
+static int add_job(BatchQueue* queue, int* cap, const char* path)
+{
+    if(queue->num_jobs == *cap)
+    {
+        int       new_cap = (*cap) ? 2 * (*cap) : 16;
+        BatchJob* jobs    = realloc(queue->jobs, new_cap * sizeof(*jobs));
+        if(jobs == NULL)
+            return -1;
+        queue->jobs = jobs;
+        *cap        = new_cap;
+    }
+    memset(&queue->jobs[queue->num_jobs], 0, sizeof(BatchJob));
+    queue->jobs[queue->num_jobs].path = strdup(path);
+    if(queue->jobs[queue->num_jobs].path == NULL)
+        return -1;
+    queue->jobs[queue->num_jobs].cpm = is_cpm_image(path);
+    queue->num_jobs++;
+
+    return 0;
+}
+
+static int cmp_names(const void* a, const void* b)
+{
+    return strcmp(*(char* const*) a, *(char* const*) b);
+}
+
+/*
+ * add_dir()
+ * Add every regular file in a directory, sorted by name
+ */
+static int add_dir(BatchQueue* queue, int* cap, const char* dir_path)
+{
+    DIR*           dir;
+    struct dirent* ent;
+    struct stat    st;
+    char**         names   = NULL;
+    int            n_names = 0;
+    int            status  = 0;
+
+    dir = opendir(dir_path);
+    if(dir == NULL)
+        return -1;
+
+    while((ent = readdir(dir)) != NULL)
+    {
+        char   path[4096];
+        char** tmp;
+
+        snprintf(path, sizeof(path), "%s/%s", dir_path, ent->d_name);
+        if(stat(path, &st) != 0 || !S_ISREG(st.st_mode))
+            continue;
+        tmp = realloc(names, (n_names + 1) * sizeof(*names));
+        if(tmp == NULL)
+        {
+            status = -1;
+            break;
+        }
+        names = tmp;
+        names[n_names] = strdup(path);
+        if(names[n_names] == NULL)
+        {
+            status = -1;
+            break;
+        }
+        n_names++;
+    }
+    closedir(dir);
+
+    qsort(names, n_names, sizeof(*names), cmp_names);
+    for(int i = 0; i < n_names; ++i)
+    {
+        if(status == 0)
+            status = add_job(queue, cap, names[i]);
+        free(names[i]);
+    }
+    free(names);
+
+    return status;
+}
+
+static void print_job(const BatchJob* job, int verbose)
+{
+    const CPUState* r = &job->regs;
+
+    fprintf(stdout, "%-32s %-7s %12lu %10.3f  PC:%04X SP:%04X A:%02X B:%02X C:%02X D:%02X E:%02X H:%02X L:%02X F:%02X\n",
+            job->path, job->status, (unsigned long) r->cycles, job->wall_ms,
+            r->pc, r->sp, r->a, r->b, r->c, r->d, r->e, r->h, r->l, r->cc.psw);
+    if(verbose && job->out_len > 0)
+        fprintf(stdout, "%.*s\n", (int) job->out_len, job->output);
+}
+
+/*
+ * run_batch()
+ * Run every image named on the command line (directories are expanded)
+ * on a pool of worker threads and print one summary line per image
+ */
+static int run_batch(char** paths, int num_paths, EmuCore core, long limit, int num_threads, int verbose)
+{
+    BatchQueue queue;
+    pthread_t* threads;
+    struct stat st;
+    int    cap = 0;
+    int    num_failed = 0;
+    double start;
+
+    memset(&queue, 0, sizeof(queue));
+    atomic_init(&queue.next, 0);
+    queue.core  = core;
+    queue.limit = limit;
+
+    for(int i = 0; i < num_paths; ++i)
+    {
+        int status;
+
+        if(stat(paths[i], &st) == 0 && S_ISDIR(st.st_mode))
+            status = add_dir(&queue, &cap, paths[i]);
+        else
+            status = add_job(&queue, &cap, paths[i]);
+        if(status < 0)
+        {
+            fprintf(stderr, "Failed to add %s\n", paths[i]);
+            goto BATCH_END;
+        }
+    }
+    if(queue.num_jobs == 0)
+    {
+        fprintf(stderr, "No images to run\n");
+        goto BATCH_END;
+    }
+
+    if(num_threads <= 0)
+        num_threads = (int) sysconf(_SC_NPROCESSORS_ONLN);
+    if(num_threads <= 0)
+        num_threads = 1;
+    if(num_threads > queue.num_jobs)
+        num_threads = queue.num_jobs;
+
+    threads = malloc(num_threads * sizeof(*threads));
+    if(threads == NULL)
+        goto BATCH_END;
+
+    start = now_ms();
+    for(int t = 0; t < num_threads; ++t)
+    {
+        if(pthread_create(&threads[t], NULL, batch_worker, &queue) != 0)
+        {
+            num_threads = t;
+            break;
+        }
+    }
+    // Anything left over still gets run if no worker could be started
+    if(num_threads == 0)
+        batch_worker(&queue);
+    for(int t = 0; t < num_threads; ++t)
+        pthread_join(threads[t], NULL);
+    free(threads);
+
+    fprintf(stdout, "%-32s %-7s %12s %10s  REGISTERS\n", "IMAGE", "STATUS", "CYCLES", "WALL(ms)");
+    for(int i = 0; i < queue.num_jobs; ++i)
+    {
+        print_job(&queue.jobs[i], verbose);
+        if(strcmp(queue.jobs[i].status, "halt") != 0)
+            num_failed++;
+    }
+    fprintf(stdout, "%d images, %d did not halt, %d threads (%s), %.3f ms\n",
+            queue.num_jobs, num_failed, (num_threads > 0) ? num_threads : 1,
+            core_names[core], now_ms() - start);
+
+BATCH_END:
+    for(int i = 0; i < queue.num_jobs; ++i)
+        free(queue.jobs[i].path);
+    free(queue.jobs);
+
+    return (queue.num_jobs > 0 && num_failed == 0) ? 0 : 1;
+}
+
+/*
+ * run_lanes()
+ * Load one image into every lane of a CPU bank and run them in lockstep
+ * until they all halt or pass the cycle limit
+ */
+static int run_lanes(const char* path, int num_lanes, long limit)
+{
+    CPUBank*  bank;
+    CPUState  lane;
+    int       cpm = is_cpm_image(path);
+    long      executed = 0;
+    double    start, wall_ms;
+    int       status = -1;
+
+    bank = cpu_bank_create(num_lanes);
+    if(bank == NULL)
+    {
+        fprintf(stderr, "Failed to create a bank of %d lanes\n", num_lanes);
+        return -1;
+    }
+    for(int n = 0; n < num_lanes; ++n)
+    {
+        memset(&lane, 0, sizeof(lane));
+        lane.memory = cpu_bank_lane_memory(bank, n);
+        lane.cc.psw = FLAG_ONE;
+        if(load_image(&lane, path, cpm ? CPM_LOAD_ADDR : 0) < 0)
+        {
+            fprintf(stderr, "Failed to load %s\n", path);
+            goto LANES_END;
+        }
+        if(cpm)
+            setup_cpm(&lane);
+        cpu_bank_set_lane(bank, n, &lane);
+    }
+
+    start = now_ms();
+    while(cpu_bank_active(bank) > 0)
+    {
+        uint64_t min_cycles = UINT64_MAX;
+
+        executed += cpu_bank_step(bank, LANE_STEPS);
+        for(int n = 0; n < num_lanes; ++n)
+        {
+            if(!bank->halted[n] && bank->cycles[n] < min_cycles)
+                min_cycles = bank->cycles[n];
+        }
+        if(min_cycles != UINT64_MAX && min_cycles >= (uint64_t) limit)
+            break;
+    }
+    wall_ms = now_ms() - start;
+
+    fprintf(stdout, "%d lanes (%s), %d halted, %ld instructions in %.3f ms, %.2f M instructions/s\n",
+            num_lanes, bank->use_avx2 ? "avx2" : "scalar", num_lanes - cpu_bank_active(bank),
+            executed, wall_ms, (wall_ms > 0.0) ? executed / (wall_ms * 1e3) : 0.0);
+    fprintf(stdout, "%lu vector lane-instructions, %lu peeled\n", bank->vector_ops, bank->scalar_ops);
+    status = 0;
+
+LANES_END:
+    cpu_bank_destroy(bank);
+    return status;
+}
+
+/*
+ * instruments_attach()
+ */
+static void instruments_attach(Instruments* ins, CPUState* state)
+{
+    state->profile = ins->prof;
+    state->tracer  = ins->tracer;
+}
+
+/*
+ * instruments_finish()
+ * Print the profile, flush the trace and free both. state is the
+ * machine they were attached to, for disassembly.
+ */
+static int instruments_finish(Instruments* ins, CPUState* state)
+{
+    int status = 0;
+
+    if(ins->prof != NULL)
+        cpu_profile_report(ins->prof, state->memory, stdout, ins->prof_lines);
+    cpu_profile_destroy(ins->prof);
+    ins->prof = NULL;
+    if(ins->tracer != NULL)
+    {
+        unsigned long records = tracer_records(ins->tracer);
+        unsigned long stalls  = ins->tracer->stalls;
+
+        state->tracer = NULL;
+        status = tracer_destroy(ins->tracer);
+        if(status < 0)
+            fprintf(stderr, "Failed to write trace %s\n", ins->trace_path);
+        else
+            fprintf(stdout, "Traced %lu instructions to %s (%lu stalls)\n", records, ins->trace_path, stalls);
+        ins->tracer = NULL;
+    }
+
+    return status;
+}
+
+/*
+ * run_traced()
+ * Run at full speed until the CPU halts or passes the cycle limit
+ */
+static int run_traced(CPUState* state, long limit)
+{
+    long status = 0;
+
+    while(status >= 0 && state->cycles < (uint64_t) limit)
+        status = cpu_run_fast(state, BATCH_CYCLES);
+
+    return (int) status;
+}
+
+// Emulation side of a headless run
+typedef struct
+{
+    Invaders*   inv;
+    Pacer*      pacer;          // NULL to run as fast as possible
+    Audio*      audio;          // NULL unless sound is on
+    JIT*        jit;            // NULL unless running on the recompiler
+    int         slices;         // times the pacer waits per frame
+    long        num_frames;
+    uint64_t    cycles;
+    int         status;
+    atomic_int  done;
+} HeadlessJob;
+
+/*
+ * run_slices()
+ * Run one frame in job->slices steps, pacing after each of them. Sound
+ * only reaches the output as fast as the pacer lets the machine run, so
+ * with sound on the frame is sliced finer than the output buffer.
+ */
+static int run_slices(HeadlessJob* job)
+{
+    uint64_t frame_end = (job->inv->frames + 1) * (uint64_t) INVADERS_CYCLES_PER_FRAME;
+
+    for(int s = job->slices - 1; s >= 0; --s)
+    {
+        long cycles = invaders_run_until(job->inv, frame_end - s * (uint64_t) (INVADERS_CYCLES_PER_FRAME / job->slices));
+
+        if(cycles < 0)
+            return -1;
+        job->cycles += cycles;
+        if(job->pacer != NULL)
+            pacer_wait(job->pacer, job->cycles);
+    }
+
+    return 0;
+}
+
+static void run_frames(HeadlessJob* job)
+{
+    if(job->pacer != NULL)
+        pacer_start(job->pacer, job->cycles);
+    for(long f = 0; f < job->num_frames; ++f)
+    {
+        unsigned keys;
+
+        if(run_slices(job) < 0)
+        {
+            fprintf(stderr, "CPU stopped in frame %ld at PC %04X\n", f, job->inv->cpu->pc);
+            job->status = -1;
+            break;
+        }
+
+        keys = display_keys(job->inv->disp);
+        if(keys & DISP_KEY_QUIT)
+            break;
+        if(job->pacer != NULL)
+            pacer_set_turbo(job->pacer, (keys & DISP_KEY_TURBO) != 0);
+    }
+    atomic_store_explicit(&job->done, 1, memory_order_release);
+}
+
+static void* emu_thread(void* arg)
+{
+    run_frames(arg);
+    return NULL;
+}
+
+/*
+ * render_frames()
+ * Draw the newest frame the emulation thread has published until it is
+ * done. Returns the number of frames drawn.
+ */
+static unsigned long render_frames(HeadlessJob* job, TripleBuffer* tb)
+{
+    struct timespec idle = { 0, RENDER_IDLE_NS };
+    unsigned long   drawn = 0;
+    uint64_t        seq, next = 0;
+    const uint8_t*  vram;
+    int             done, fresh;
+
+    do
+    {
+        // Read done first, so the last frame is picked up on the way out
+        done = atomic_load_explicit(&job->done, memory_order_acquire);
+        vram = triple_buffer_read(tb, &seq, &fresh);
+        if(fresh)
+        {
+            // The dirty columns only cover the changes since the frame
+            // before, so redraw everything after a dropped frame
+            if(seq == next)
+                display_draw_dirty(job->inv->disp, vram, (const uint32_t*) (vram + DISP_VRAM_SIZE));
+            else
+                display_draw_vram(job->inv->disp, vram);
+            next = seq + 1;
+            drawn++;
+        }
+        else if(!done)
+            nanosleep(&idle, NULL);
+    } while(!done);
+
+    return drawn;
+}
+
+/*
+ * open_capture()
+ * Start a capture from a spec of the form format:path[:n]
+ */
+static Capture* open_capture(const char* spec)
+{
+    CaptureFormat fmt;
+    Capture*      cap;
+    char*         buf;
+    char*         path;
+    char*         every;
+    char*         end;
+    unsigned long n = 1;
+
+    buf  = strdup(spec);
+    path = strchr(buf, ':');
+    if(path == NULL)
+    {
+        fprintf(stderr, "Capture spec %s should be format:path[:n]\n", spec);
+        free(buf);
+        return NULL;
+    }
+    *path++ = '\0';
+    if(capture_format_parse(buf, &fmt) < 0)
+    {
+        fprintf(stderr, "Unknown capture format %s\n", buf);
+        free(buf);
+        return NULL;
+    }
+    // A trailing :n is the frame interval, anything else is part of the path
+    every = strrchr(path, ':');
+    if(every != NULL)
+    {
+        n = strtoul(every + 1, &end, 10);
+        if(every[1] != '\0' && *end == '\0' && n > 0)
+            *every = '\0';
+        else
+            n = 1;
+    }
+    cap = capture_create(fmt, path, (unsigned) n, 0);
+    if(cap == NULL)
+        fprintf(stderr, "Failed to start capture to %s\n", path);
+    else if(strcmp(path, "-") == 0)
+    {
+        // Keep the reports out of the frame stream
+        fflush(stdout);
+        dup2(STDERR_FILENO, STDOUT_FILENO);
+    }
+    free(buf);
+
+    return cap;
+}
+
+/*
+ * run_headless()
+ * Run the invaders machine for a number of frames, with interrupts, as
+ * fast as the host allows and report the emulated clock rate. A speed
+ * above zero paces the machine to that multiple of its authentic clock
+ * instead. With split set the machine runs on its own thread and this
+ * one draws. The CPU runs on the recompiler for CORE_JIT and on the
+ * interpreter otherwise.
+ */
+static int run_headless(const char* rom_dir, long num_frames, const DisplayOpts* dopts, double speed, int split,
+                        EmuCore core, Instruments* ins)
+{
+    HeadlessJob   job;
+    TripleBuffer* tb = NULL;
+    pthread_t     thread;
+    unsigned long drawn = 0;
+    double        start, wall_ms, mhz;
+    int           status = 0;
+
+    memset(&job, 0, sizeof(job));
+    atomic_init(&job.done, 0);
+    job.num_frames = num_frames;
+    job.slices     = 1;
+    if(core == CORE_JIT && (job.jit = jit_create()) == NULL)
+    {
+        fprintf(stderr, "Recompiler not available on this host\n");
+        return -1;
+    }
+    if(speed > 0.0 && (job.pacer = pacer_create(INVADERS_CLOCK_HZ, speed)) == NULL)
+    {
+        jit_destroy(job.jit);
+        return -1;
+    }
+    job.inv = invaders_create(rom_dir, dopts->backend, dopts->flags);
+    if(job.inv == NULL)
+    {
+        pacer_destroy(job.pacer);
+        jit_destroy(job.jit);
+        return -1;
+    }
+    invaders_set_jit(job.inv, job.jit);
+    if(dopts->sound)
+    {
+        job.audio = audio_create(INVADERS_CLOCK_HZ, AUDIO_RATE, AUDIO_TARGET_MS);
+        if(job.audio == NULL || audio_open_device(job.audio) < 0 ||
+           invaders_set_audio(job.inv, job.audio) < 0)
+        {
+            fprintf(stderr, "Failed to start sound\n");
+            audio_destroy(job.audio);
+            invaders_destroy(job.inv);
+            pacer_destroy(job.pacer);
+            jit_destroy(job.jit);
+            return -1;
+        }
+        job.slices = HEADLESS_AUDIO_SLICES;
+    }
+    instruments_attach(ins, job.inv->cpu);
+    display_set_capture(job.inv->disp, dopts->capture);
+    if(split)
+    {
+        tb = triple_buffer_create(INVADERS_FRAME_SIZE);
+        if(tb == NULL)
+        {
+            audio_destroy(job.audio);
+            invaders_destroy(job.inv);
+            pacer_destroy(job.pacer);
+            jit_destroy(job.jit);
+            return -1;
+        }
+        job.inv->frames_out = tb;
+    }
+
+    start = now_ms();
+    if(split && pthread_create(&thread, NULL, emu_thread, &job) == 0)
+    {
+        drawn = render_frames(&job, tb);
+        pthread_join(thread, NULL);
+    }
+    else
+    {
+        job.inv->frames_out = NULL;
+        run_frames(&job);
+        drawn = display_frames(job.inv->disp);
+    }
+    wall_ms = now_ms() - start;
+    mhz = (wall_ms > 0.0) ? job.cycles / (wall_ms * 1e3) : 0.0;
+
+    fprintf(stdout, "%lu frames, %lu cycles in %.3f ms (%s display, %lu frames drawn%s)\n",
+            job.inv->frames, (unsigned long) job.cycles, wall_ms, display_backend_name(job.inv->disp),
+            drawn, (job.inv->frames_out != NULL) ? " on the render thread" : "");
+    fprintf(stdout, "%.2f MHz emulated, %.1fx real time\n", mhz, mhz * 1e6 / INVADERS_CLOCK_HZ);
+    if(display_cols_drawn(job.inv->disp) > 0)
+    {
+        fprintf(stdout, "%.1f%% of video RAM redrawn per frame\n",
+                100.0 * display_cols_drawn(job.inv->disp) / (display_frames(job.inv->disp) * (double) DISP_WIDTH));
+    }
+    if(job.pacer != NULL)
+    {
+        Pacer* p = job.pacer;
+
+        fprintf(stdout, "Paced at %gx: %lu of %lu waits late, %lu resyncs, woke %.3f ms late on average (%.3f ms max)\n",
+                p->multiplier, p->late, p->waits, p->resyncs, (p->waits > 0) ? p->late_sum_ns / (p->waits * 1e6) : 0.0,
+                p->late_max_ns / 1e6);
+        fprintf(stdout, "Frame time jitter %.3f ms mean, %.3f ms rms, %.3f ms max\n",
+                pacer_jitter_mean_ns(p) / 1e6, pacer_jitter_rms_ns(p) / 1e6, p->jitter_max_ns / 1e6);
+    }
+    if(job.jit != NULL)
+    {
+        JITStats stats;
+
+        jit_get_stats(job.jit, &stats);
+        fprintf(stdout, "JIT: %lu blocks, %lu chained exits, %lu flushes, %lu invalidated, %lu interpreted ops\n",
+                stats.blocks, stats.chains, stats.flushes, stats.invalidations, stats.interp_ops);
+    }
+    if(job.audio != NULL)
+    {
+        fprintf(stdout, "Sound: %lu effects, %lu samples dropped, %lu output underruns\n",
+                audio_triggers(job.audio), audio_dropped(job.audio), audio_underruns(job.audio));
+    }
+    if(job.status < 0)
+        status = -1;
+    if(instruments_finish(ins, job.inv->cpu) < 0)
+        status = -1;
+    // The output device goes first, it may still be pulling samples
+    audio_destroy(job.audio);
+    pacer_destroy(job.pacer);
+    invaders_destroy(job.inv);
+    jit_destroy(job.jit);
+    triple_buffer_destroy(tb);
+    if(dopts->capture != NULL)
+    {
+        unsigned long captured = capture_frames(dopts->capture);
+        unsigned long stalls   = capture_stalls(dopts->capture);
+
+        if(capture_destroy(dopts->capture) < 0)
+        {
+            fprintf(stderr, "Failed to write captured frames\n");
+            status = -1;
+        }
+        else
+            fprintf(stderr, "Captured %lu frames (%lu stalls)\n", captured, stalls);
+    }
+
+    return status;
+}
+
+// ======== RECORD / REPLAY ======== //
+static InputLog*   session_log;
+static InputReplay session_replay;
+static CPUPorts    session_ports;
+
+static uint8_t record_port_in(CPUState* state, void* dev, uint8_t port)
+{
+    // Nothing is attached to the ports, so IN leaves A as it is
+    uint8_t val = state->a;
+
+    input_log_port(session_log, state->cycles, port, val);
+    return val;
+}
+
+static uint8_t replay_port_in(CPUState* state, void* dev, uint8_t port)
+{
+    return input_replay_port(&session_replay, state->cycles, port);
+}
+
+/*
+ * run_until()
+ * Run until the cycle count reaches target. Stopping on an instruction
+ * boundary that was reached while recording lands on it exactly.
+ */
+static long run_until(CPUState* state, EmuCore core, JIT* jit, CPUDecodeCache* dc, uint64_t target)
+{
+    long status = 0;
+
+    while(state->cycles < target)
+    {
+        uint64_t left = target - state->cycles;
+
+        status = run_core(state, core, jit, dc, (left < BATCH_CYCLES) ? (long) left : BATCH_CYCLES);
+        if(status < 0)
+            break;
+    }
+
+    return status;
+}
+
+// Run a session machine up to target, on the invaders machine if there is one
+static long session_run_until(CPUState* state, Invaders* inv, EmuCore core, JIT* jit, CPUDecodeCache* dc, uint64_t target)
+{
+    if(inv)
+        return invaders_run_until(inv, target);
+    return run_until(state, core, jit, dc, target);
+}
+
+/*
+ * run_session()
+ * Record a session to log_path, or replay one from it. A recording logs
+ * every change in an IN port value, and a state hash every
+ * SESSION_HASH_CYCLES. A replay feeds the ports from the log and checks
+ * every hash. With inv set the session runs on the invaders machine, which
+ * logs its inputs and display interrupts and takes them from the log on
+ * replay. Otherwise state runs on its own, where nothing is connected to
+ * the ports and IN leaves A as it is.
+ */
+static int run_session(CPUState* state, Invaders* inv, EmuCore core, long limit, const char* log_path, int replay)
+{
+    JIT*            jit = NULL;
+    CPUDecodeCache* dc  = NULL;
+    InputEvent      ev;
+    InputCursor     cursor;
+    long            status = 0;
+    int             result = 0;
+    int             num_hashes = 0;
+    int             mismatches = 0;
+    double          start;
+
+    if(core == CORE_JIT && (jit = jit_create()) == NULL)
+        core = CORE_INTERP;
+    // The decoded cache would just fall back for the invaders memory map
+    if(core == CORE_DECODED && (inv || (dc = cpu_dcache_create()) == NULL))
+        core = CORE_INTERP;
+    if(inv)
+        invaders_set_jit(inv, jit);
+
+    session_log = replay ? input_log_load(log_path) : input_log_create();
+    if(session_log == NULL)
+    {
+        fprintf(stderr, "Failed to %s input log %s\n", replay ? "load" : "create", log_path);
+        result = -1;
+        goto SESSION_END;
+    }
+
+    start = now_ms();
+    if(replay)
+    {
+        input_replay_init(&session_replay, session_log);
+        if(inv)
+        {
+            if(invaders_replay(inv, &session_replay) < 0)
+            {
+                result = -1;
+                goto SESSION_END;
+            }
+        }
+        else
+        {
+            cpu_ports_init(&session_ports);
+            cpu_ports_in(&session_ports, 0, CPU_NUM_PORTS - 1, replay_port_in, NULL);
+            state->ports = &session_ports;
+        }
+        input_cursor_init(&cursor);
+        while(input_log_next_of(session_log, &cursor, 1u << INPUT_EV_HASH, &ev))
+        {
+            status = session_run_until(state, inv, core, jit, dc, ev.cycles);
+            num_hashes++;
+            if(state->cycles != ev.cycles || cpu_state_hash(state) != ev.hash)
+            {
+                fprintf(stdout, "State hash mismatch at cycle %lu (now at %lu)\n",
+                        (unsigned long) ev.cycles, (unsigned long) state->cycles);
+                mismatches++;
+                break;
+            }
+            if(status < 0)
+                break;
+        }
+    }
+    else
+    {
+        if(inv)
+            invaders_record(inv, session_log);
+        else
+        {
+            cpu_ports_init(&session_ports);
+            cpu_ports_in(&session_ports, 0, CPU_NUM_PORTS - 1, record_port_in, NULL);
+            state->ports = &session_ports;
+        }
+        while(state->cycles < (uint64_t) limit)
+        {
+            status = session_run_until(state, inv, core, jit, dc, state->cycles + SESSION_HASH_CYCLES);
+            input_log_hash(session_log, state->cycles, cpu_state_hash(state));
+            num_hashes++;
+            if(status < 0)
+                break;
+        }
+        if(input_log_save(session_log, log_path) < 0)
+            result = -1;
+    }
+
+    fprintf(stdout, "%s %lu cycles in %.3f ms (%s), %d events, %d bytes, %d hashes checked\n",
+            replay ? "Replayed" : "Recorded", (unsigned long) state->cycles, now_ms() - start,
+            core_names[core], session_log->num_events, session_log->data->size,
+            replay ? num_hashes : 0);
+    if(mismatches > 0)
+        result = -1;
+    else if(replay)
+        fprintf(stdout, "Replay matches the recording\n");
+
+SESSION_END:
+    if(inv)
+    {
+        invaders_record(inv, NULL);
+        invaders_replay(inv, NULL);
+        invaders_set_jit(inv, NULL);
+    }
+    input_log_destroy(session_log);
+    session_log = NULL;
+    jit_destroy(jit);
+    if(dc)
+        cpu_dcache_destroy(dc);
+
+    return result;
+}
+
+/*
+ * run_jit()
+ * Run until the CPU stops or TEST_CYCLE_LIMIT cycles have elapsed
+ */
+static int run_jit(CPUState* state)
+{
+    JIT*          jit;
+    JITStats      stats;
+    long          status = 0;
+    unsigned long total  = 0;
+
+    jit = jit_create();
+    if(jit == NULL)
+    {
+        fprintf(stderr, "Recompiler not available on this host\n");
+        return -1;
+    }
+
+    while(total < TEST_CYCLE_LIMIT)
+    {
+        status = jit_run(jit, state, BATCH_CYCLES);
+        if(status < 0)
+            break;
+        total += status;
+    }
+    if(total >= TEST_CYCLE_LIMIT)
+    {
+        fprintf(stdout, "Hit max cycles (%d)\n", TEST_CYCLE_LIMIT);
+        status = 0;
+    }
+
+    jit_get_stats(jit, &stats);
+    fprintf(stdout, "JIT: %lu blocks, %lu chained exits, %lu flushes, %lu invalidated, %lu interpreted ops\n",
+            stats.blocks, stats.chains, stats.flushes, stats.invalidations, stats.interp_ops);
+    jit_destroy(jit);
+
+    return status;
+}
+
+/*
+ * run_decoded()
+ * Run until the CPU stops or TEST_CYCLE_LIMIT cycles have elapsed
+ */
+static int run_decoded(CPUState* state)
+{
+    CPUDecodeCache* dc;
+    long            status = 0;
+    unsigned long   total  = 0;
+
+    dc = cpu_dcache_create();
+    if(dc == NULL)
+    {
+        fprintf(stderr, "Failed to create decode cache\n");
+        return -1;
+    }
+
+    while(total < TEST_CYCLE_LIMIT)
+    {
+        status = cpu_run_decoded(state, dc, BATCH_CYCLES);
+        if(status < 0)
+            break;
+        total += status;
+    }
+    if(total >= TEST_CYCLE_LIMIT)
+    {
+        fprintf(stdout, "Hit max cycles (%d)\n", TEST_CYCLE_LIMIT);
+        status = 0;
+    }
+    fprintf(stdout, "Decode cache: %lu pages invalidated\n", cpu_dcache_invalidations(dc));
+    cpu_dcache_destroy(dc);
+
+    return status;
+}
 
 int main(int argc, char *argv[])
 {
-    FILE *fp;
+    int opt;
+    int batch = 0;
+    int verbose = 0;
+    int num_threads = 0;
+    int num_lanes = 0;
+    long num_frames = 0;
+    int split = 0;
+    double speed = 0.0;
+    int prof_lines = -1;
+    int status = 0;
+    Instruments ins = { NULL, 0, NULL, NULL };
+    DisplayOpts dopts = { DISP_BACKEND_NULL, 0, NULL, 0 };
+    const char* capture_spec = NULL;
+    const char* rom_dir = NULL;
+    const char* log_path = NULL;
+    int replay = 0;
+    long limit = BATCH_CYCLE_LIMIT;
+    EmuCore core = CORE_INTERP;
 
-    fp = fopen(argv[1], "rb");
-    if(fp == NULL)
+    while((opt = getopt(argc, argv, "bdjn:p:t:vw:AC:D:H:L:M:P:R:ST:V")) != -1)
     {
-        fprintf(stderr, "Couldn't open file %s\n", argv[1]);
+        switch(opt)
+        {
+            case 'b':
+                batch = 1;
+                break;
+            case 'd':
+                core = CORE_DECODED;
+                break;
+            case 'j':
+                core = CORE_JIT;
+                break;
+            case 'n':
+                limit = strtol(optarg, NULL, 0);
+                break;
+            case 't':
+                num_threads = atoi(optarg);
+                break;
+            case 'v':
+                verbose = 1;
+                break;
+            case 'A':
+                dopts.sound = 1;
+                break;
+            case 'C':
+                capture_spec = optarg;
+                break;
+            case 'D':
+                if(display_backend_parse(optarg, &dopts.backend) < 0)
+                {
+                    fprintf(stderr, "Unknown display backend %s\n", optarg);
+                    exit(1);
+                }
+                break;
+            case 'H':
+                num_frames = strtol(optarg, NULL, 0);
+                break;
+            case 'M':
+                speed = strtod(optarg, NULL);
+                if(speed <= 0.0)
+                {
+                    fprintf(stderr, "Speed %s should be above zero\n", optarg);
+                    exit(1);
+                }
+                break;
+            case 'P':
+                prof_lines = atoi(optarg);
+                break;
+            case 'S':
+                split = 1;
+                break;
+            case 'T':
+                ins.trace_path = optarg;
+                break;
+            case 'V':
+                dopts.flags |= DISP_VSYNC;
+                break;
+            case 'L':
+                num_lanes = atoi(optarg);
+                break;
+            case 'R':
+                rom_dir = optarg;
+                break;
+            case 'w':
+                log_path = optarg;
+                replay   = 0;
+                break;
+            case 'p':
+                log_path = optarg;
+                replay   = 1;
+                break;
+            default:
+                usage(argv[0]);
+                exit(1);
+        }
+    }
+    if(optind >= argc && rom_dir == NULL)
+    {
+        usage(argv[0]);
         exit(1);
     }
 
-    // Get the file size and read file into a buffer
-    fseek(fp, 0L, SEEK_END);
-    int fsize = ftell(fp);
-    fseek(fp, 0L, SEEK_SET);
+    if(num_lanes > 0)
+        return (run_lanes(argv[optind], num_lanes, limit) < 0) ? 1 : 0;
+    if(batch)
+        return run_batch(&argv[optind], argc - optind, core, limit, num_threads, verbose);
+    if(num_frames > 0 && rom_dir == NULL)
+    {
+        fprintf(stderr, "Headless mode needs a ROM set (-R)\n");
+        exit(1);
+    }
+
+    if(prof_lines >= 0)
+    {
+        ins.prof_lines = prof_lines;
+        if((ins.prof = cpu_profile_create()) == NULL)
+        {
+            fprintf(stderr, "Failed to create profile\n");
+            exit(1);
+        }
+    }
+    if(ins.trace_path != NULL && (ins.tracer = tracer_create(ins.trace_path, 0)) == NULL)
+    {
+        fprintf(stderr, "Failed to create trace %s\n", ins.trace_path);
+        exit(1);
+    }
+    if(num_frames > 0)
+    {
+        if(capture_spec != NULL && (dopts.capture = open_capture(capture_spec)) == NULL)
+            exit(1);
+        return (run_headless(rom_dir, num_frames, &dopts, speed, split, core, &ins) < 0) ? 1 : 0;
+    }
+
+    if(rom_dir != NULL && log_path != NULL)
+    {
+        Invaders* inv = invaders_create(rom_dir, DISP_BACKEND_NULL, 0);
+
+        if(inv == NULL)
+            exit(1);
+        instruments_attach(&ins, inv->cpu);
+        status = run_session(inv->cpu, inv, core, limit, log_path, replay);
+        if(instruments_finish(&ins, inv->cpu) < 0)
+            status = -1;
+        invaders_destroy(inv);
+        return (status < 0) ? 1 : 0;
+    }
 
     CPUState *emu_state;
-    
+    CPUMemMap rom_map;
+
     emu_state = cpu_create();
     if(emu_state == NULL)
     {
@@ -36,28 +1294,64 @@ int main(int argc, char *argv[])
         exit(-1);
     }
 
-    fread(emu_state->memory, fsize, 1, fp);
-    fclose(fp);
+    if(rom_dir != NULL)
+    {
+        if(rom_load_set(emu_state, &rom_set_invaders, rom_dir) < 0 ||
+           rom_protect(emu_state, &rom_set_invaders) < 0)
+        {
+            fprintf(stderr, "Couldn't load ROM set %s from %s\n", rom_set_invaders.name, rom_dir);
+            cpu_destroy(emu_state);
+            exit(1);
+        }
+        rom_map_init(&rom_set_invaders, &rom_map);
+        emu_state->map = &rom_map;
+    }
+    else if(load_image(emu_state, argv[optind], 0) < 0)
+    {
+        fprintf(stderr, "Couldn't load file %s\n", argv[optind]);
+        cpu_destroy(emu_state);
+        exit(1);
+    }
 
-    int status = 0;
-    unsigned long int num_cycles = 0;
-    while(status == 0)
-    { 
-        status = cpu_exec(emu_state);
-        if(status < 0)          // trap an unimplmented instruction
-            break;
-        num_cycles++;
-        if(num_cycles > TEST_CYCLE_LIMIT)
+    instruments_attach(&ins, emu_state);
+    if(log_path != NULL)
+    {
+        status = run_session(emu_state, NULL, core, limit, log_path, replay);
+        if(instruments_finish(&ins, emu_state) < 0)
+            status = -1;
+        cpu_destroy(emu_state);
+        return (status < 0) ? 1 : 0;
+    }
+    if(ins.tracer != NULL)
+        status = run_traced(emu_state, limit);
+    else if(core == CORE_JIT)
+        status = run_jit(emu_state);
+    else if(core == CORE_DECODED)
+        status = run_decoded(emu_state);
+    else
+    {
+        unsigned long int num_cycles = 0;
+        while(status >= 0)
         {
-            fprintf(stdout, "Hit max cycles (%d)\n", TEST_CYCLE_LIMIT);
-            break;
+            status = cpu_exec(emu_state);
+            if(status < 0)          // trap an unimplmented instruction
+                break;
+            num_cycles++;
+            if(num_cycles > TEST_CYCLE_LIMIT)
+            {
+                fprintf(stdout, "Hit max cycles (%d)\n", TEST_CYCLE_LIMIT);
+                break;
+            }
+            fprintf(stdout, "[I %04X]  ", emu_state->memory[emu_state->pc]);
+            PrintState(emu_state);
         }
-        fprintf(stdout, "[I %04X]  ", emu_state->memory[emu_state->pc]);
-        PrintState(emu_state);
     }
     fprintf(stdout, "Emulator finishd with exit code %d\n", status);
-    PrintState(emu_state); 
+    PrintState(emu_state);
+    instruments_finish(&ins, emu_state);
 
+    if(rom_dir != NULL)
+        rom_unprotect(emu_state, &rom_set_invaders);
     cpu_destroy(emu_state);
 
     return 0;